@@ -6,6 +6,12 @@
 #define STATS 1
 #include "shared/stats.glsl"
 
+// indexed leaves store only the triangle ids, vertices are fetched from the scene geometry
+#ifdef TRIANGLES_INDEXED
+#include "shared/data_scene.h"
+#include "shared/intersection_triangle.glsl"
+#endif
+
 layout(push_constant, scalar) uniform uPushConstant
 {
     PC_Trace data;
@@ -13,6 +19,19 @@ layout(push_constant, scalar) uniform uPushConstant
 
 layout(local_size_x = 32, local_size_y_id = 0) in;
 
+// quantized layouts decode the child bounds on the fly
+#ifndef CHILD_BV
+#define CHILD_BV(node, i) (node).bv[i]
+#endif
+
+// mixed layouts pick the intersection test by the tag of the child index, the tag is stripped before the index is used
+#ifndef INTERSECT_CHILD
+#define INTERSECT_CHILD(node, i, rd, tmax) intersect(CHILD_BV(node, i), rd, tmax)
+#endif
+#ifndef CHILD_ID
+#define CHILD_ID(c) (c)
+#endif
+
 #define STACK_SIZE 64
 #define DYNAMIC_FETCH_THRESHOLD 20
 #define BOTTOM_OF_STACK 0x76543210
@@ -31,6 +50,10 @@ void trace()
     i32 leafId;
     u32 rayId;
     RayDetail rayDetail;
+#ifdef TRIANGLES_INDEXED
+    RayWatertight rayWatertight;
+    GeometryDescriptor gDesc = GeometryDescriptor(pc.data.geometryDescriptorAddress);
+#endif
 
     BVH_TYPE bvh = BVH_TYPE(pc.data.bvhAddress);
     BvhTriangles triangles = BvhTriangles(pc.data.bvhTrianglesAddress);
@@ -42,6 +65,9 @@ void trace()
     RayTraceResult result;
 
     const u32 rayCount = rayBufMeta.data.rayCount;
+    // secondary rays sorted by ptrace_SortRays.comp are fetched in the sorted order
+    const bool reordered = (pc.data.rayOrderAddress != 0) && (u32_buf(pc.data.rayOrderCountAddress).val[0] != 0);
+    u64_buf rayOrder = u64_buf(pc.data.rayOrderAddress);
 
     while (true) {
         const bool isTerminated = (nodeId == BOTTOM_OF_STACK);
@@ -59,10 +85,15 @@ void trace()
             rayId = nextRay[gl_SubgroupID] + terminatedId;
             if (rayId >= rayCount)
                 break;
+            if (reordered)
+                rayId = u32(rayOrder.val[rayId]);
 
             const Ray ray = rayBuffer.ray[rayId];
 
             rayDetail = initRayDetail(ray);
+#ifdef TRIANGLES_INDEXED
+            rayWatertight = initRayWatertight(ray.d.xyz);
+#endif
             result.t = ray.d.w;
 
             stackId = 0;
@@ -80,12 +111,12 @@ void trace()
             {
                 STATS_NODE_PP;
 
-                const vec2 c0minmax = intersect(bvh.node[nodeId].bv[0], rayDetail, result.t);
+                const vec2 c0minmax = INTERSECT_CHILD(bvh.node[nodeId], 0, rayDetail, result.t);
                 STATS_BV_PP;
-                const vec2 c1minmax = intersect(bvh.node[nodeId].bv[1], rayDetail, result.t);
+                const vec2 c1minmax = INTERSECT_CHILD(bvh.node[nodeId], 1, rayDetail, result.t);
                 STATS_BV_PP;
 
-                ivec2 cnodes = ivec2(bvh.node[nodeId].c[0], bvh.node[nodeId].c[1]);
+                ivec2 cnodes = ivec2(CHILD_ID(bvh.node[nodeId].c[0]), CHILD_ID(bvh.node[nodeId].c[1]));
                 const bool swp = (c1minmax[0] < c0minmax[0]);
                 const bool traverseC0 = (c0minmax[1] >= c0minmax[0]);
                 const bool traverseC1 = (c1minmax[1] >= c1minmax[0]);
@@ -126,6 +157,20 @@ void trace()
                 for (i32 triId = triStartId; triId < triStartId + triCount; ++triId) {
                     STATS_TRI_PP;
 
+#ifdef TRIANGLES_INDEXED
+                    const BvhTriangleIndex ids = triangleIndices.val[triId];
+                    const Geometry g = gDesc.g[ids.nodeId];
+                    const uvec3 idx = uvec3_buf(g.idxAddress).val[ids.triangleId];
+                    vec3_buf vertices = vec3_buf(g.vtxAddress);
+
+                    vec3 tuv;
+                    if (intersectWatertight(rayWatertight, rayDetail.origin, rayDetail.tmin, result.t, vertices.val[idx.x], vertices.val[idx.y], vertices.val[idx.z], tuv)) {
+                        result.tId = triId;
+                        result.t = tuv.x;
+                        result.u = tuv.y;
+                        result.v = tuv.z;
+                    }
+#else
                     const vec4 v00 = triangles.t[triId].v0;
                     const vec4 v11 = triangles.t[triId].v1;
                     const vec4 v22 = triangles.t[triId].v2;
@@ -143,6 +188,7 @@ void trace()
                             }
                         }
                     }
+#endif
                 }
                 leafId = nodeId;
 
@@ -165,6 +211,16 @@ void trace()
     }
 }
 
+#include "ptrace_bvh2_instanced.glsl"
+// variants of the single level traversal, two-level trees keep the closest hit full stack one. Short stack kernels
+// define SHORT_STACK_SIZE, occlusion kernels of the shadow rays define TRACE_OCCLUSION.
+#ifdef SHORT_STACK_SIZE
+#include "ptrace_bvh2_short_stack.glsl"
+#endif
+#ifdef TRACE_OCCLUSION
+#include "ptrace_bvh2_occlusion.glsl"
+#endif
+
 void traceTimed()
 {
     TraceTime_ref times = TraceTime_ref(pc.data.traceTimeAddress);
@@ -177,7 +233,16 @@ void traceTimed()
     }
     barrier();
 
-    trace();
+    if (pc.data.blasDescriptorsAddress != 0)
+        traceInstanced();
+    else
+#if defined(TRACE_OCCLUSION)
+        traceOcclusion();
+#elif defined(SHORT_STACK_SIZE)
+        traceShortStack();
+#else
+        trace();
+#endif
 
     barrier();
     if (gl_LocalInvocationIndex == 0) {
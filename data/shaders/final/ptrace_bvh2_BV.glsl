@@ -12,6 +12,11 @@ layout(push_constant, scalar) uniform uPushConstant
 
 layout(local_size_x = 32, local_size_y_id = 0) in;
 
+// mixed layouts tag the child index, the tag is stripped before the index is used
+#ifndef CHILD_ID
+#define CHILD_ID(c) (c)
+#endif
+
 #define STACK_SIZE 64
 #define DYNAMIC_FETCH_THRESHOLD 20
 #define BOTTOM_OF_STACK 0x76543210
@@ -85,7 +90,7 @@ void trace()
                 vec3 c1normal;
                 const vec2 c1minmax = intersect(bvh.node[nodeId].bv[1], rayDetail, result.t, c1normal);
 
-                ivec2 cnodes = ivec2(bvh.node[nodeId].c[0], bvh.node[nodeId].c[1]);
+                ivec2 cnodes = ivec2(CHILD_ID(bvh.node[nodeId].c[0]), CHILD_ID(bvh.node[nodeId].c[1]));
                 const bool swp = (c1minmax[0] < c0minmax[0]);
                 const bool traverseC0 = (c0minmax[1] >= c0minmax[0]);
                 const bool traverseC1 = (c1minmax[1] >= c1minmax[0]);
@@ -0,0 +1,204 @@
+#ifndef PTRACE_BVH2_INSTANCED_GLSL
+#define PTRACE_BVH2_INSTANCED_GLSL
+
+#include "shared/data_scene.h"
+
+// Two-level traversal. The top level is an AABB tree over instances, its leaves index instances through
+// bvhTriangleIndices. An instance moves the ray to the object space of its geometry and traverses that
+// geometry's bottom level tree. The direction is not normalized, so hit distances are shared by both levels.
+
+#define INSTANCE_STACK_SIZE 32
+
+vec2 intersectInstanceBounds(in AABB bv, in vec3 origin, in vec3 idir, in f32 tmin, in f32 tmax)
+{
+    const vec3 t0 = (bv.min - origin) * idir;
+    const vec3 t1 = (bv.max - origin) * idir;
+    const vec3 tNear = min(t0, t1);
+    const vec3 tFar = max(t0, t1);
+    return vec2(
+        max(max(tNear.x, tNear.y), max(tNear.z, tmin)),
+        min(min(tFar.x, tFar.y), min(tFar.z, tmax)));
+}
+
+vec3 safeInverse(in vec3 d)
+{
+    return vec3(
+        1.f / (abs(d.x) > EPS_BV_INTERSECT ? d.x : EPS_BV_INTERSECT * sign(d.x)),
+        1.f / (abs(d.y) > EPS_BV_INTERSECT ? d.y : EPS_BV_INTERSECT * sign(d.y)),
+        1.f / (abs(d.z) > EPS_BV_INTERSECT ? d.z : EPS_BV_INTERSECT * sign(d.z)));
+}
+
+// returns true if a closer hit was found, result.tId is then local to the bottom level tree
+bool traceBlas(in Instance instance, in BlasDescriptor blas, in Ray worldRay, inout RayTraceResult result, inout u32 testedNodes, inout u32 testedTris, inout u32 testedBVs)
+{
+    const vec4 o = vec4(worldRay.o.xyz, 1.f);
+    const vec4 d = vec4(worldRay.d.xyz, 0.f);
+    Ray ray;
+    ray.o = vec4(dot(instance.worldToObject[0], o), dot(instance.worldToObject[1], o), dot(instance.worldToObject[2], o), worldRay.o.w);
+    ray.d = vec4(dot(instance.worldToObject[0], d), dot(instance.worldToObject[1], d), dot(instance.worldToObject[2], d), result.t);
+    const RayDetail rayDetail = initRayDetail(ray);
+
+    BVH_TYPE bvh = BVH_TYPE(blas.bvhAddress);
+    BvhTriangles triangles = BvhTriangles(blas.bvhTrianglesAddress);
+
+    bool hit = false;
+    u32 stackId = 0;
+    i32 traversalStack[STACK_SIZE];
+    traversalStack[0] = BOTTOM_OF_STACK;
+    i32 nodeId = 0;
+
+    while (nodeId != BOTTOM_OF_STACK) {
+        if (nodeId >= 0) {
+            STATS_NODE_PP;
+
+            const vec2 c0minmax = INTERSECT_CHILD(bvh.node[nodeId], 0, rayDetail, result.t);
+            STATS_BV_PP;
+            const vec2 c1minmax = INTERSECT_CHILD(bvh.node[nodeId], 1, rayDetail, result.t);
+            STATS_BV_PP;
+
+            ivec2 cnodes = ivec2(CHILD_ID(bvh.node[nodeId].c[0]), CHILD_ID(bvh.node[nodeId].c[1]));
+            const bool traverseC0 = (c0minmax[1] >= c0minmax[0]);
+            const bool traverseC1 = (c1minmax[1] >= c1minmax[0]);
+
+            if (!traverseC0 && !traverseC1) {
+                nodeId = traversalStack[stackId];
+                --stackId;
+            } else if (traverseC0 && traverseC1) {
+                const bool swp = (c1minmax[0] < c0minmax[0]);
+                nodeId = swp ? cnodes.y : cnodes.x;
+                ++stackId;
+                traversalStack[stackId] = swp ? cnodes.x : cnodes.y;
+            } else
+                nodeId = traverseC0 ? cnodes.x : cnodes.y;
+            continue;
+        }
+
+        const i32 triStartId = nodeId & 0x07FFFFFF;
+        const i32 triCount = ((nodeId >> 27) & 0xF) + 1;
+        for (i32 triId = triStartId; triId < triStartId + triCount; ++triId) {
+            STATS_TRI_PP;
+
+            const vec4 v00 = triangles.t[triId].v0;
+            const vec4 v11 = triangles.t[triId].v1;
+            const vec4 v22 = triangles.t[triId].v2;
+
+            const f32 t = (v00.w - dot(rayDetail.origin, v00.xyz)) / dot(rayDetail.dir, v00.xyz);
+            if (t > rayDetail.tmin && t < result.t) {
+                const f32 u = v11.w + dot(rayDetail.origin, v11.xyz) + t * dot(rayDetail.dir, v11.xyz);
+                if (u >= 0.f) {
+                    const f32 v = v22.w + dot(rayDetail.origin, v22.xyz) + t * dot(rayDetail.dir, v22.xyz);
+                    if (v >= 0.f && u + v <= 1.f) {
+                        result.tId = triId;
+                        result.t = t;
+                        result.u = u;
+                        result.v = v;
+                        hit = true;
+                    }
+                }
+            }
+        }
+        nodeId = traversalStack[stackId];
+        --stackId;
+    }
+    return hit;
+}
+
+void traceInstanced()
+{
+    STATS_LOCAL_DEF;
+
+    BVH2_AABB_c tlas = BVH2_AABB_c(pc.data.bvhAddress);
+    BvhTriangleIndices instanceIndices = BvhTriangleIndices(pc.data.bvhTriangleIndicesAddress);
+    Instances instances = Instances(pc.data.instancesAddress);
+    BlasDescriptors blases = BlasDescriptors(pc.data.blasDescriptorsAddress);
+
+    RayBufferMetadata_ref rayBufMeta = RayBufferMetadata_ref(pc.data.rayBufferMetadataAddress);
+    RayBuffer_ref rayBuffer = RayBuffer_ref(pc.data.rayBufferAddress);
+    RayTraceResults_ref results = RayTraceResults_ref(pc.data.rayTraceResultAddress);
+    u32_buf instanceHits = u32_buf(pc.data.instanceHitAddress);
+
+    const u32 rayCount = rayBufMeta.data.rayCount;
+    // secondary rays sorted by ptrace_SortRays.comp are fetched in the sorted order
+    const bool reordered = (pc.data.rayOrderAddress != 0) && (u32_buf(pc.data.rayOrderCountAddress).val[0] != 0);
+    u64_buf rayOrder = u64_buf(pc.data.rayOrderAddress);
+
+    while (true) {
+        const uvec4 ballot = subgroupBallot(true);
+        u32 rayIdBase;
+        if (subgroupElect())
+            rayIdBase = atomicAdd(rayBufMeta.data.rayTracedCount, subgroupBallotBitCount(ballot));
+        const u32 fetchId = subgroupBroadcastFirst(rayIdBase) + subgroupBallotExclusiveBitCount(ballot);
+        if (fetchId >= rayCount)
+            break;
+        const u32 rayId = reordered ? u32(rayOrder.val[fetchId]) : fetchId;
+
+        STATS_LOCAL_RESET;
+
+        const Ray ray = rayBuffer.ray[rayId];
+        const vec3 idir = safeInverse(ray.d.xyz);
+        const f32 tmin = ray.o.w;
+
+        RayTraceResult result;
+        result.tId = INVALID_ID;
+        result.t = ray.d.w;
+        result.u = -1.f;
+        result.v = -1.f;
+        u32 hitInstanceId = INVALID_ID;
+        u32 hitPrimitiveId = INVALID_ID;
+
+        u32 stackId = 0;
+        i32 traversalStack[INSTANCE_STACK_SIZE];
+        traversalStack[0] = BOTTOM_OF_STACK;
+        i32 nodeId = 0;
+
+        while (nodeId != BOTTOM_OF_STACK) {
+            if (nodeId >= 0) {
+                STATS_NODE_PP;
+
+                const vec2 c0minmax = intersectInstanceBounds(tlas.node[nodeId].bv[0], ray.o.xyz, idir, tmin, result.t);
+                STATS_BV_PP;
+                const vec2 c1minmax = intersectInstanceBounds(tlas.node[nodeId].bv[1], ray.o.xyz, idir, tmin, result.t);
+                STATS_BV_PP;
+
+                ivec2 cnodes = ivec2(tlas.node[nodeId].c[0], tlas.node[nodeId].c[1]);
+                const bool traverseC0 = (c0minmax[1] >= c0minmax[0]);
+                const bool traverseC1 = (c1minmax[1] >= c1minmax[0]);
+
+                if (!traverseC0 && !traverseC1) {
+                    nodeId = traversalStack[stackId];
+                    --stackId;
+                } else if (traverseC0 && traverseC1) {
+                    const bool swp = (c1minmax[0] < c0minmax[0]);
+                    nodeId = swp ? cnodes.y : cnodes.x;
+                    ++stackId;
+                    traversalStack[stackId] = swp ? cnodes.x : cnodes.y;
+                } else
+                    nodeId = traverseC0 ? cnodes.x : cnodes.y;
+                continue;
+            }
+
+            const i32 leafStartId = nodeId & 0x07FFFFFF;
+            const i32 leafCount = ((nodeId >> 27) & 0xF) + 1;
+            for (i32 leafId = leafStartId; leafId < leafStartId + leafCount; ++leafId) {
+                const u32 instanceId = instanceIndices.val[leafId].nodeId;
+                const Instance instance = instances.i[instanceId];
+                const BlasDescriptor blas = blases.b[instance.blasId];
+                if (traceBlas(instance, blas, ray, result, testedNodes, testedTris, testedBVs)) {
+                    hitInstanceId = instanceId;
+                    hitPrimitiveId = BvhTriangleIndices(blas.bvhTriangleIndicesAddress).val[result.tId].triangleId;
+                }
+            }
+            nodeId = traversalStack[stackId];
+            --stackId;
+        }
+
+        // shading reads the primitive of the instanced geometry directly
+        result.tId = hitPrimitiveId;
+        results.result[rayId] = result;
+        instanceHits.val[rayId] = hitInstanceId;
+
+        STATS_SHARED_STORE;
+    }
+}
+
+#endif
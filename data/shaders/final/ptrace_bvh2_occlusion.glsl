@@ -0,0 +1,111 @@
+#ifndef PTRACE_BVH2_OCCLUSION_GLSL
+#define PTRACE_BVH2_OCCLUSION_GLSL
+
+// Any hit traversal of the shadow rays. Only the visibility up to the ray extent matters, so the children are not
+// ordered and the ray terminates at the first intersected triangle. The result holds the id and the distance of that
+// triangle, or INVALID_ID for an unoccluded ray.
+
+#ifdef TRIANGLES_INDEXED
+#error "occlusion traversal intersects Woop triangles only"
+#endif
+
+void traceOcclusion()
+{
+    i32 traversalStack[STACK_SIZE];
+
+    STATS_LOCAL_DEF;
+
+    BVH_TYPE bvh = BVH_TYPE(pc.data.bvhAddress);
+    BvhTriangles triangles = BvhTriangles(pc.data.bvhTrianglesAddress);
+
+    RayBufferMetadata_ref rayBufMeta = RayBufferMetadata_ref(pc.data.rayBufferMetadataAddress);
+    RayBuffer_ref rayBuffer = RayBuffer_ref(pc.data.rayBufferAddress);
+    RayTraceResults_ref results = RayTraceResults_ref(pc.data.rayTraceResultAddress);
+
+    const u32 rayCount = rayBufMeta.data.rayCount;
+
+    while (true) {
+        const uvec4 ballot = subgroupBallot(true);
+        if (subgroupElect())
+            nextRay[gl_SubgroupID] = atomicAdd(rayBufMeta.data.rayTracedCount, subgroupBallotBitCount(ballot));
+        memoryBarrier(gl_ScopeSubgroup, gl_StorageSemanticsShared, gl_SemanticsAcquireRelease);
+
+        const u32 rayId = nextRay[gl_SubgroupID] + subgroupBallotExclusiveBitCount(ballot);
+        if (rayId >= rayCount)
+            break;
+
+        STATS_LOCAL_RESET;
+
+        const Ray ray = rayBuffer.ray[rayId];
+        const RayDetail rayDetail = initRayDetail(ray);
+        const f32 tmax = ray.d.w;
+
+        RayTraceResult result;
+        result.tId = INVALID_ID;
+        result.t = tmax;
+        result.u = -1.f;
+        result.v = -1.f;
+
+        u32 stackId = 0;
+        i32 nodeId = 0;
+        while (true) {
+            if (nodeId >= 0) {
+                STATS_NODE_PP;
+
+                const vec2 c0minmax = INTERSECT_CHILD(bvh.node[nodeId], 0, rayDetail, tmax);
+                STATS_BV_PP;
+                const vec2 c1minmax = INTERSECT_CHILD(bvh.node[nodeId], 1, rayDetail, tmax);
+                STATS_BV_PP;
+
+                const bool traverseC0 = (c0minmax[1] >= c0minmax[0]);
+                const bool traverseC1 = (c1minmax[1] >= c1minmax[0]);
+
+                if (traverseC0 || traverseC1) {
+                    if (traverseC0 && traverseC1)
+                        traversalStack[stackId++] = CHILD_ID(bvh.node[nodeId].c[1]);
+                    nodeId = CHILD_ID(bvh.node[nodeId].c[traverseC0 ? 0 : 1]);
+                    continue;
+                }
+            }
+            else {
+                const i32 triStartId = nodeId & 0x07FFFFFF;
+                const i32 triCount = ((nodeId >> 27) & 0xF) + 1;
+
+                for (i32 triId = triStartId; triId < triStartId + triCount; ++triId) {
+                    STATS_TRI_PP;
+
+                    const vec4 v00 = triangles.t[triId].v0;
+                    const vec4 v11 = triangles.t[triId].v1;
+                    const vec4 v22 = triangles.t[triId].v2;
+
+                    const f32 t = (v00.w - dot(rayDetail.origin, v00.xyz)) / dot(rayDetail.dir, v00.xyz);
+                    if (t > rayDetail.tmin && t < tmax) {
+                        const f32 u = v11.w + dot(rayDetail.origin, v11.xyz) + t * dot(rayDetail.dir, v11.xyz);
+                        if (u >= 0.f) {
+                            const f32 v = v22.w + dot(rayDetail.origin, v22.xyz) + t * dot(rayDetail.dir, v22.xyz);
+                            if (v >= 0.f && u + v <= 1.f) {
+                                result.tId = triId;
+                                result.t = t;
+                                result.u = u;
+                                result.v = v;
+                                break;
+                            }
+                        }
+                    }
+                }
+                if (result.tId != INVALID_ID)
+                    break;
+            }
+
+            if (stackId == 0)
+                break;
+            nodeId = traversalStack[--stackId];
+        }
+
+        results.result[rayId] = result;
+
+        STATS_SHARED_STORE;
+    }
+}
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef PTRACE_BVH2_SHORT_STACK_GLSL
+#define PTRACE_BVH2_SHORT_STACK_GLSL
+
+// Short stack traversal with a restart trail (Laine, HPG 2010). The trail keeps one bit per tree level, a set bit marks
+// that the child taken at that level is the last one left there. Only the SHORT_STACK_SIZE most recently postponed
+// children are kept, once the stack runs empty the traversal restarts at the root and follows the trail down to the
+// next postponed child. SHORT_STACK_SIZE 0 is the stackless variant, it restarts on every pop.
+//
+// Children are ordered by their entry distance, which does not depend on the shrinking hit distance, so a restart
+// takes the same path down. Compact nodes keep no parent pointers, hence the restart instead of a walk up the tree.
+// TraversalReference.cpp mirrors this loop on the host. Trees deeper than TRAIL_DEPTH_MAX levels are not traced,
+// see tracer.short_stack, the level == 0 guard only keeps such a tree from hanging the kernel.
+
+#ifdef TRIANGLES_INDEXED
+#error "short stack traversal intersects Woop triangles only"
+#endif
+
+#define TRAIL_DEPTH_MAX 62
+#define TRAIL_ROOT (u64(1) << TRAIL_DEPTH_MAX)
+
+void traceShortStack()
+{
+#if SHORT_STACK_SIZE > 0
+    i32 shortStack[SHORT_STACK_SIZE];
+#endif
+
+    STATS_LOCAL_DEF;
+
+    BVH_TYPE bvh = BVH_TYPE(pc.data.bvhAddress);
+    BvhTriangles triangles = BvhTriangles(pc.data.bvhTrianglesAddress);
+
+    RayBufferMetadata_ref rayBufMeta = RayBufferMetadata_ref(pc.data.rayBufferMetadataAddress);
+    RayBuffer_ref rayBuffer = RayBuffer_ref(pc.data.rayBufferAddress);
+    RayTraceResults_ref results = RayTraceResults_ref(pc.data.rayTraceResultAddress);
+
+    const u32 rayCount = rayBufMeta.data.rayCount;
+    // secondary rays sorted by ptrace_SortRays.comp are fetched in the sorted order
+    const bool reordered = (pc.data.rayOrderAddress != 0) && (u32_buf(pc.data.rayOrderCountAddress).val[0] != 0);
+    u64_buf rayOrder = u64_buf(pc.data.rayOrderAddress);
+
+    while (true) {
+        const uvec4 ballot = subgroupBallot(true);
+        if (subgroupElect())
+            nextRay[gl_SubgroupID] = atomicAdd(rayBufMeta.data.rayTracedCount, subgroupBallotBitCount(ballot));
+        memoryBarrier(gl_ScopeSubgroup, gl_StorageSemanticsShared, gl_SemanticsAcquireRelease);
+
+        u32 rayId = nextRay[gl_SubgroupID] + subgroupBallotExclusiveBitCount(ballot);
+        if (rayId >= rayCount)
+            break;
+        if (reordered)
+            rayId = u32(rayOrder.val[rayId]);
+
+        STATS_LOCAL_RESET;
+
+        const Ray ray = rayBuffer.ray[rayId];
+        const RayDetail rayDetail = initRayDetail(ray);
+
+        RayTraceResult result;
+        result.tId = INVALID_ID;
+        result.t = ray.d.w;
+        result.u = -1.f;
+        result.v = -1.f;
+
+        u64 trail = u64(0);
+        u64 level = TRAIL_ROOT;
+        u32 stackTop = 0;
+        u32 stackCount = 0;
+        i32 nodeId = 0;
+
+        while (true) {
+            if (nodeId >= 0) {
+                STATS_NODE_PP;
+
+                const vec2 c0minmax = INTERSECT_CHILD(bvh.node[nodeId], 0, rayDetail, result.t);
+                STATS_BV_PP;
+                const vec2 c1minmax = INTERSECT_CHILD(bvh.node[nodeId], 1, rayDetail, result.t);
+                STATS_BV_PP;
+
+                const bool swp = (c1minmax[0] < c0minmax[0]);
+                const i32 nearId = CHILD_ID(bvh.node[nodeId].c[swp ? 1 : 0]);
+                const i32 farId = CHILD_ID(bvh.node[nodeId].c[swp ? 0 : 1]);
+                const bool traverseC0 = (c0minmax[1] >= c0minmax[0]);
+                const bool traverseC1 = (c1minmax[1] >= c1minmax[0]);
+                const bool traverseNear = swp ? traverseC1 : traverseC0;
+                const bool traverseFar = swp ? traverseC0 : traverseC1;
+
+                if (traverseNear || traverseFar) {
+                    level >>= 1;
+                    if (level == u64(0))
+                        break;
+                    if ((trail & level) == u64(0)) {
+                        if (traverseNear && traverseFar) {
+#if SHORT_STACK_SIZE > 0
+                            // a full stack drops its oldest entry, the trail leads back to it
+                            shortStack[stackTop] = farId;
+                            stackTop = (stackTop + 1) % u32(SHORT_STACK_SIZE);
+                            stackCount = min(stackCount + 1, u32(SHORT_STACK_SIZE));
+#endif
+                            nodeId = nearId;
+                            continue;
+                        }
+                        // the only child left at this level, a culled near child ends the trail leading through it
+                        if (!traverseNear)
+                            trail &= ~(level - u64(1));
+                        trail |= level;
+                        nodeId = traverseNear ? nearId : farId;
+                        continue;
+                    }
+                    // restarted traversal, the lowest trail bit is the level of the postponed far child
+                    const bool postponedFar = (trail & (level - u64(1))) == u64(0);
+                    if (traverseFar || !postponedFar) {
+                        nodeId = traverseFar ? farId : nearId;
+                        continue;
+                    }
+                    // the postponed far child is culled by now, pop past it
+                }
+            }
+            else {
+                const i32 triStartId = nodeId & 0x07FFFFFF;
+                const i32 triCount = ((nodeId >> 27) & 0xF) + 1;
+
+                for (i32 triId = triStartId; triId < triStartId + triCount; ++triId) {
+                    STATS_TRI_PP;
+
+                    const vec4 v00 = triangles.t[triId].v0;
+                    const vec4 v11 = triangles.t[triId].v1;
+                    const vec4 v22 = triangles.t[triId].v2;
+
+                    const f32 t = (v00.w - dot(rayDetail.origin, v00.xyz)) / dot(rayDetail.dir, v00.xyz);
+                    if (t > rayDetail.tmin && t < result.t) {
+                        const f32 u = v11.w + dot(rayDetail.origin, v11.xyz) + t * dot(rayDetail.dir, v11.xyz);
+                        if (u >= 0.f) {
+                            const f32 v = v22.w + dot(rayDetail.origin, v22.xyz) + t * dot(rayDetail.dir, v22.xyz);
+                            if (v >= 0.f && u + v <= 1.f) {
+                                result.tId = triId;
+                                result.t = t;
+                                result.u = u;
+                                result.v = v;
+                            }
+                        }
+                    }
+                }
+            }
+
+            // pop: drop the trail below this level and advance it to the next postponed child
+            trail &= ~(level - u64(1));
+            trail += level;
+            if ((trail & TRAIL_ROOT) != u64(0))
+                break;
+            level = trail & (~trail + u64(1));
+
+#if SHORT_STACK_SIZE > 0
+            if (stackCount > 0) {
+                stackTop = (stackTop + u32(SHORT_STACK_SIZE) - 1) % u32(SHORT_STACK_SIZE);
+                --stackCount;
+                nodeId = shortStack[stackTop];
+                continue;
+            }
+#endif
+            nodeId = 0;
+            level = TRAIL_ROOT;
+        }
+
+        results.result[rayId] = result;
+
+        STATS_SHARED_STORE;
+    }
+}
+
+#endif
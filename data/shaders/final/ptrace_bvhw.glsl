@@ -0,0 +1,190 @@
+#ifndef PTRACE_BVHW_GLSL
+#define PTRACE_BVHW_GLSL
+
+// Traversal of WIDTH-wide compact trees. All children of a node are tested, the hit ones are ordered by their
+// entry distance, the nearest one is visited next and the others are pushed so that the closer are popped first.
+
+#define INCLUDE_FROM_SHADER
+#include "shared/data_bvh.h"
+#define STATS 1
+#include "shared/stats.glsl"
+
+#extension GL_EXT_control_flow_attributes: require
+#define UNROLL_NEXT_LOOP [[unroll]]
+
+layout(push_constant, scalar) uniform uPushConstant
+{
+    PC_Trace data;
+} pc;
+
+layout(local_size_x = 32, local_size_y_id = 0) in;
+
+#define STACK_SIZE 64
+#define DYNAMIC_FETCH_THRESHOLD 20
+#define BOTTOM_OF_STACK 0x76543210
+
+shared u32 nextRay[gl_WorkGroupSize.y];
+
+void trace()
+{
+    u32 stackId;
+    i32 traversalStack[STACK_SIZE];
+    traversalStack[0] = BOTTOM_OF_STACK;
+
+    STATS_LOCAL_DEF;
+
+    i32 nodeId = BOTTOM_OF_STACK;
+    u32 rayId;
+    RayDetail rayDetail;
+
+    BVH_TYPE bvh = BVH_TYPE(pc.data.bvhAddress);
+    BvhTriangles triangles = BvhTriangles(pc.data.bvhTrianglesAddress);
+
+    RayBufferMetadata_ref rayBufMeta = RayBufferMetadata_ref(pc.data.rayBufferMetadataAddress);
+    RayBuffer_ref rayBuffer = RayBuffer_ref(pc.data.rayBufferAddress);
+    RayTraceResults_ref results = RayTraceResults_ref(pc.data.rayTraceResultAddress);
+    RayTraceResult result;
+
+    const u32 rayCount = rayBufMeta.data.rayCount;
+    // secondary rays sorted by ptrace_SortRays.comp are fetched in the sorted order
+    const bool reordered = (pc.data.rayOrderAddress != 0) && (u32_buf(pc.data.rayOrderCountAddress).val[0] != 0);
+    u64_buf rayOrder = u64_buf(pc.data.rayOrderAddress);
+
+    while (true) {
+        const bool isTerminated = (nodeId == BOTTOM_OF_STACK);
+        const uvec4 ballot = subgroupBallot(isTerminated);
+        const u32 terminatedCount = subgroupBallotBitCount(ballot);
+        const u32 terminatedId = subgroupBallotExclusiveBitCount(ballot);
+
+        if (isTerminated) {
+            STATS_LOCAL_RESET;
+
+            if (terminatedId == 0)
+                nextRay[gl_SubgroupID] = atomicAdd(rayBufMeta.data.rayTracedCount, terminatedCount);
+            memoryBarrier(gl_ScopeSubgroup, gl_StorageSemanticsShared, gl_SemanticsAcquireRelease);
+
+            rayId = nextRay[gl_SubgroupID] + terminatedId;
+            if (rayId >= rayCount)
+                break;
+            if (reordered)
+                rayId = u32(rayOrder.val[rayId]);
+
+            const Ray ray = rayBuffer.ray[rayId];
+
+            rayDetail = initRayDetail(ray);
+            result.t = ray.d.w;
+
+            stackId = 0;
+            nodeId = 0;
+
+            result.tId = INVALID_ID;
+            result.u = -1.f;
+            result.v = -1.f;
+        }
+
+        while (nodeId != BOTTOM_OF_STACK)
+        {
+            if (nodeId >= 0) {
+                STATS_NODE_PP;
+
+                f32 hitT[WIDTH];
+                i32 hitC[WIDTH];
+                i32 hitCount = 0;
+
+                UNROLL_NEXT_LOOP
+                for (i32 i = 0; i < WIDTH; i++) {
+                    const i32 c = bvh.node[nodeId].c[i];
+                    if (c == INVALID_VALUE_I32)
+                        continue;
+
+                    const vec2 cminmax = intersect(bvh.node[nodeId].bv[i], rayDetail, result.t);
+                    STATS_BV_PP;
+                    if (cminmax[1] < cminmax[0])
+                        continue;
+
+                    i32 j = hitCount++;
+                    for (; j > 0 && hitT[j - 1] > cminmax[0]; --j) {
+                        hitT[j] = hitT[j - 1];
+                        hitC[j] = hitC[j - 1];
+                    }
+                    hitT[j] = cminmax[0];
+                    hitC[j] = c;
+                }
+
+                if (hitCount == 0) {
+                    nodeId = traversalStack[stackId];
+                    --stackId;
+                }
+                else {
+                    for (i32 i = hitCount - 1; i > 0; --i) {
+                        ++stackId;
+                        traversalStack[stackId] = hitC[i];
+                    }
+                    nodeId = hitC[0];
+                }
+                continue;
+            }
+
+            const i32 triStartId = nodeId & 0x07FFFFFF;
+            const i32 triCount = ((nodeId >> 27) & 0xF) + 1;
+
+            for (i32 triId = triStartId; triId < triStartId + triCount; ++triId) {
+                STATS_TRI_PP;
+
+                const vec4 v00 = triangles.t[triId].v0;
+                const vec4 v11 = triangles.t[triId].v1;
+                const vec4 v22 = triangles.t[triId].v2;
+
+                const f32 t = (v00.w - dot(rayDetail.origin, v00.xyz)) / dot(rayDetail.dir, v00.xyz);
+                if (t > rayDetail.tmin && t < result.t) {
+                    const f32 u = v11.w + dot(rayDetail.origin, v11.xyz) + t * dot(rayDetail.dir, v11.xyz);
+                    if (u >= 0.f) {
+                        const f32 v = v22.w + dot(rayDetail.origin, v22.xyz) + t * dot(rayDetail.dir, v22.xyz);
+                        if (v >= 0.f && u + v <= 1.f) {
+                            result.tId = triId;
+                            result.t = t;
+                            result.u = u;
+                            result.v = v;
+                        }
+                    }
+                }
+            }
+            nodeId = traversalStack[stackId];
+            --stackId;
+
+            // dynamic fetch
+            if (subgroupBallotBitCount(subgroupBallot(true)) < DYNAMIC_FETCH_THRESHOLD)
+                break;
+        }
+
+        if (nodeId == BOTTOM_OF_STACK) {
+            results.result[rayId] = result;
+
+            STATS_SHARED_STORE;
+        }
+    }
+}
+
+void traceTimed()
+{
+    TraceTime_ref times = TraceTime_ref(pc.data.traceTimeAddress);
+    if (gl_LocalInvocationIndex == 0) {
+        atomicMin(times.val.tStart, clockRealtimeEXT());
+        RayBufferMetadata_ref rayBufMeta = RayBufferMetadata_ref(pc.data.rayBufferMetadataAddress);
+        times.val.rayCount = rayBufMeta.data.rayCount;
+
+        STATS_SHARED_RESET;
+    }
+    barrier();
+
+    trace();
+
+    barrier();
+    if (gl_LocalInvocationIndex == 0) {
+        atomicMax(times.val.timer, u32(clockRealtimeEXT() - times.val.tStart));
+
+        STATS_GLOBAL_STORE;
+    }
+}
+
+#endif
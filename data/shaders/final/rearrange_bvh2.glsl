@@ -3,9 +3,22 @@
 
 #define CONCAT(a, b) a##b
 #define EXPAND_AND_CONCAT(a, b) CONCAT(a, b)
+#ifndef DST_BVH_TYPE
 #define DST_BVH_TYPE EXPAND_AND_CONCAT(SRC_BVH_TYPE, _c)
+#endif
 #define DST_BVH_NODE EXPAND_AND_CONCAT(Node, DST_BVH_TYPE)
 
+// quantized layouts store the compact node through bvQuantize()
+#ifndef STORE_BVH_TYPE
+#define STORE_BVH_TYPE DST_BVH_TYPE
+#define bvStore(node) (node)
+#endif
+
+// mixed layouts tag the child index by the kind of its bounding volume
+#ifndef CHILD_TAG
+#define CHILD_TAG(bv) 0
+#endif
+
 #extension GL_EXT_buffer_reference2: require
 #extension GL_EXT_scalar_block_layout: require
 
@@ -52,12 +65,16 @@ void rearrange()
     const u32 wgId = partitionId;
     const u32 globalThreadId = partitionId * gl_WorkGroupSize.x + gl_LocalInvocationIndex;
 
-    if (globalThreadId >= pc.data.leafNodeCount)
+    if (globalThreadId >= BVH_COUNTS.nodeCountLeaf)
         return;
 
     SRC_BVH_TYPE bvh = SRC_BVH_TYPE(pc.data.bvhAddress);
-    DST_BVH_TYPE bvhWide = DST_BVH_TYPE(pc.data.bvhWideAddress);
+    STORE_BVH_TYPE bvhWide = STORE_BVH_TYPE(pc.data.bvhWideAddress);
     u64_buf workItems = u64_buf(pc.data.workBufferAddress);
+    // the first work item is the root of the input tree, its id is known only on the device
+    if (globalThreadId == 0)
+        atomicStore(workItems.val[0], u64(u32(BVH_COUNTS.rootId)),
+                gl_ScopeQueueFamily, gl_StorageSemanticsBuffer, gl_SemanticsRelease | gl_SemanticsMakeAvailable);
 
     WorkItem wi;
     u64 wiPacked;
@@ -134,6 +151,7 @@ void rearrange()
                     node.c[i] = wideId;
                     wiPacked = (u64(wideId) << 32) | u32(c[i]);
                 }
+                node.c[i] |= CHILD_TAG(node.bv[i]);
 
                 u32 workItemId = globalThreadId;
                 if (i > 0)
@@ -142,7 +160,7 @@ void rearrange()
                 atomicStore(workItems.val[workItemId], wiPacked,
                     gl_ScopeQueueFamily, gl_StorageSemanticsBuffer, gl_SemanticsRelease | gl_SemanticsMakeAvailable);
             }
-            bvhWide.node[wi.bvhWideId] = node;
+            bvhWide.node[wi.bvhWideId] = bvStore(node);
         }
     }
 }
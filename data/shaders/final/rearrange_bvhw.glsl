@@ -0,0 +1,231 @@
+#ifndef REARRANGE_BVHW_GLSL
+#define REARRANGE_BVHW_GLSL
+
+// Collapses the binary tree into WIDTH-wide compact nodes. The includer defines WIDTH, SRC_BVH_TYPE and DST_BVH_TYPE.
+// The collapse minimizes the SAH cost of the wide tree. Leaves keep their binary form, so the cost that depends on the
+// collapse is the sum of the wide node surface areas. A bottom-up pass first computes cost(n, k), the lowest cost the
+// subtree of n adds when it may use up to k child slots of its wide parent. The top-down pass then opens a child
+// whenever spending its slots on its own children is cheaper than giving it a wide node.
+
+#define CONCAT(a, b) a##b
+#define EXPAND_AND_CONCAT(a, b) CONCAT(a, b)
+#define DST_BVH_NODE EXPAND_AND_CONCAT(Node, DST_BVH_TYPE)
+
+#extension GL_EXT_buffer_reference2: require
+#extension GL_EXT_scalar_block_layout: require
+
+#extension GL_KHR_memory_scope_semantics : require
+#extension GL_KHR_shader_subgroup_ballot : require
+#extension GL_KHR_shader_subgroup_arithmetic : require
+#extension GL_EXT_control_flow_attributes: require
+
+#define INCLUDE_FROM_SHADER
+#include "shared/data_bvh.h"
+#include "shared/data_plocpp.h"
+
+layout(local_size_x_id = 0) in;
+
+layout(push_constant) uniform uPushConstant {
+    PC_Rearrange data;
+} pc;
+
+struct WorkItem {
+    i32 bvhId;
+    i32 bvhWideId;
+};
+
+struct RuntimeData {
+    u32 workgroupId;
+    u32 workItemId;
+    i32 wideId;
+};
+layout(buffer_reference, scalar) buffer RuntimeData_ref {
+    RuntimeData data;
+};
+
+#define UNROLL_NEXT_LOOP [[unroll]]
+
+shared u32 partitionId;
+
+// the aux buffer holds one arrival counter per binary node followed by the WIDTH collapse costs of each node
+f32 collapseCost(in f32_buf costs, in u32 costOffset, in i32 id, in i32 slots)
+{
+    // leaves are never opened and add nothing, whatever the slot count
+    if (id < 0)
+        return 0.f;
+    return costs.val[costOffset + u32(id) * WIDTH + u32(slots - 1)];
+}
+
+// the cheapest split of the slots between the two children, returns the slot count of the first one
+i32 splitSlots(in f32_buf costs, in u32 costOffset, in i32 c0, in i32 c1, in i32 slots, out f32 cost)
+{
+    i32 best = 1;
+    cost = BIG_FLOAT;
+    for (i32 i = 1; i < slots; i++) {
+        const f32 c = collapseCost(costs, costOffset, c0, i) + collapseCost(costs, costOffset, c1, slots - i);
+        if (c < cost) {
+            cost = c;
+            best = i;
+        }
+    }
+    return best;
+}
+
+// walks up from the leaf, the last child to arrive computes the costs of its parent. Returns true in the thread that
+// finished the root.
+bool computeCollapseCosts(in i32 leafId)
+{
+    SRC_BVH_TYPE bvh = SRC_BVH_TYPE(pc.data.bvhAddress);
+    u32_buf counter = u32_buf(pc.data.auxBufferAddress);
+    f32_buf costs = f32_buf(pc.data.auxBufferAddress);
+    const u32 costOffset = BVH_COUNTS.nodeCountTotal;
+
+    i32 nodeId = bvh.node[leafId].parent;
+    if (nodeId == INVALID_ID)
+        return true;
+
+    while (atomicAdd(counter.val[nodeId], 1) > 0) {
+        const i32 c0 = bvh.node[nodeId].c0;
+        const i32 c1 = bvh.node[nodeId].c1;
+
+        f32 costAsNode;
+        splitSlots(costs, costOffset, c0, c1, WIDTH, costAsNode);
+        costAsNode += bvArea(bvh.node[nodeId].bv);
+
+        costs.val[costOffset + u32(nodeId) * WIDTH] = costAsNode;
+        for (i32 slots = 2; slots <= WIDTH; slots++) {
+            f32 costOpened;
+            splitSlots(costs, costOffset, c0, c1, slots, costOpened);
+            costs.val[costOffset + u32(nodeId) * WIDTH + u32(slots - 1)] = min(costAsNode, costOpened);
+        }
+        memoryBarrier(gl_ScopeQueueFamily, gl_StorageSemanticsBuffer, gl_SemanticsAcquireRelease | gl_SemanticsMakeAvailable | gl_SemanticsMakeVisible);
+
+        nodeId = bvh.node[nodeId].parent;
+        if (nodeId == INVALID_ID)
+            return true;
+    }
+    return false;
+}
+
+void rearrange()
+{
+    RuntimeData_ref runtime = RuntimeData_ref(pc.data.runtimeDataAddress);
+    if (gl_LocalInvocationIndex == 0)
+        partitionId = atomicAdd(runtime.data.workgroupId, 1);
+    barrier();
+    const u32 globalThreadId = partitionId * gl_WorkGroupSize.x + gl_LocalInvocationIndex;
+
+    if (globalThreadId >= BVH_COUNTS.nodeCountLeaf)
+        return;
+
+    SRC_BVH_TYPE bvh = SRC_BVH_TYPE(pc.data.bvhAddress);
+    DST_BVH_TYPE bvhWide = DST_BVH_TYPE(pc.data.bvhWideAddress);
+    u64_buf workItems = u64_buf(pc.data.workBufferAddress);
+    f32_buf costs = f32_buf(pc.data.auxBufferAddress);
+    const u32 costOffset = BVH_COUNTS.nodeCountTotal;
+
+    // leaves are the first nodes of the input tree. The first work item is its root, seeded once all costs are known.
+    if (computeCollapseCosts(i32(globalThreadId)))
+        atomicStore(workItems.val[0], u64(u32(BVH_COUNTS.rootId)),
+                gl_ScopeQueueFamily, gl_StorageSemanticsBuffer, gl_SemanticsRelease | gl_SemanticsMakeAvailable);
+
+    WorkItem wi;
+    u64 wiPacked;
+
+    while (true) {
+        wiPacked = atomicLoad(workItems.val[globalThreadId],
+                gl_ScopeQueueFamily, gl_StorageSemanticsBuffer, gl_SemanticsAcquire | gl_SemanticsMakeVisible);
+        wi.bvhId = i32(wiPacked);
+        wi.bvhWideId = i32(wiPacked >> 32);
+
+        if (wi.bvhId < 0)
+            break;
+
+        if (wi.bvhId >= 0 && wi.bvhId < INVALID_VALUE_I32) {
+            i32 c[WIDTH];
+            i32 slots[WIDTH];
+            i32 childCount = 2;
+            c[0] = bvh.node[wi.bvhId].c0;
+            c[1] = bvh.node[wi.bvhId].c1;
+
+            f32 cost;
+            slots[0] = splitSlots(costs, costOffset, c[0], c[1], WIDTH, cost);
+            slots[1] = WIDTH - slots[0];
+
+            // the slot counts always sum up to WIDTH, so the opened children never overflow the node
+            for (i32 i = 0; i < childCount;) {
+                if (c[i] < 0 || slots[i] < 2) {
+                    i++;
+                    continue;
+                }
+                const i32 c0 = bvh.node[c[i]].c0;
+                const i32 c1 = bvh.node[c[i]].c1;
+                const i32 slots0 = splitSlots(costs, costOffset, c0, c1, slots[i], cost);
+                if (!(cost < collapseCost(costs, costOffset, c[i], 1))) {
+                    i++;
+                    continue;
+                }
+
+                c[childCount] = c1;
+                slots[childCount] = slots[i] - slots0;
+                childCount++;
+                c[i] = c0;
+                slots[i] = slots0;
+            }
+
+            i32 nonLeafCount = 0;
+            for (i32 i = 0; i < childCount; i++)
+                if (c[i] >= 0)
+                    nonLeafCount++;
+
+            DST_BVH_NODE node;
+
+            i32 wideIdOffset;
+            i32 interiorCount = subgroupAdd(nonLeafCount);
+            if (subgroupElect())
+                wideIdOffset = atomicAdd(runtime.data.wideId, interiorCount);
+            wideIdOffset = subgroupBroadcastFirst(wideIdOffset) + subgroupExclusiveAdd(nonLeafCount);
+            i32 wideIdLocalOffset = 0;
+
+            // the first child continues in this thread's slot, the others get new ones
+            u32 wiOffset;
+            const u32 wiCount = u32(childCount - 1);
+            const u32 wiCountTotal = subgroupAdd(wiCount);
+            if (subgroupElect())
+                wiOffset = atomicAdd(runtime.data.workItemId, wiCountTotal);
+            wiOffset = subgroupBroadcastFirst(wiOffset) + subgroupExclusiveAdd(wiCount);
+
+            UNROLL_NEXT_LOOP
+            for (i32 i = 0; i < WIDTH; i++) {
+                if (i >= childCount) {
+                    node.c[i] = INVALID_VALUE_I32;
+                    continue;
+                }
+
+                const i32 cId = c[i] < 0 ? ~c[i] : c[i];
+                node.bv[i] = bvh.node[cId].bv;
+
+                if (c[i] < 0) {
+                    i32 size = abs(bvh.node[cId].size) - 1;
+                    i32 c0 = bvh.node[cId].c0;
+                    node.c[i] = (1 << 31) | (size << 27) | c0;
+                    wiPacked = (u64(wi.bvhWideId) << 32) | u32(c[i]);
+                }
+                else {
+                    i32 wideId = wideIdOffset + (wideIdLocalOffset++);
+                    node.c[i] = wideId;
+                    wiPacked = (u64(wideId) << 32) | u32(c[i]);
+                }
+
+                u32 workItemId = globalThreadId;
+                if (i > 0)
+                    workItemId = wiOffset + i - 1;
+
+                atomicStore(workItems.val[workItemId], wiPacked,
+                    gl_ScopeQueueFamily, gl_StorageSemanticsBuffer, gl_SemanticsRelease | gl_SemanticsMakeAvailable);
+            }
+            bvhWide.node[wi.bvhWideId] = node;
+        }
+    }
+}
+#endif
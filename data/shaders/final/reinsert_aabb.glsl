@@ -0,0 +1,356 @@
+#ifndef REINSERT_AABB_GLSL
+#define REINSERT_AABB_GLSL
+
+// Parallel reinsertion optimizer of the binary AABB tree, after Meister and Bittner. Every node looks for the position
+// where removing it from its parent and inserting it as a sibling of another node lowers the total internal node area
+// the most. The insertion point is found by a branch and bound search from the root. Candidates lock the nodes on both
+// paths up to their common ancestor with their gain, a move is applied only if it owns all of its locks, so the moves
+// of one iteration never touch the same nodes. Bounds and sizes are refitted bottom-up after every iteration.
+// An iteration with fewer than minReinsertionRatio * nodeCount applied moves ends the optimization, the remaining dispatches exit early.
+// The moved parent keeps its id, the root is never moved, so the root id stays the last one.
+// Scored by the same bounds as the treelet restructuring, see restructure_score.glsl. When the score is a proxy of the
+// traversed volume (SCORE_SOBB), a found move is re-evaluated by the exact area of the nodes it changes and dropped
+// unless that area shrinks.
+
+#extension GL_EXT_buffer_reference2: require
+#extension GL_EXT_scalar_block_layout: require
+#extension GL_EXT_shader_atomic_int64 : require
+#extension GL_KHR_memory_scope_semantics : require
+#extension GL_GOOGLE_include_directive : enable
+
+#define INCLUDE_FROM_SHADER
+#include "shared/types.glsl"
+#include "shared/compute.glsl"
+#include "shared/bv_aabb.glsl"
+#ifdef SCORE_DOP14
+#    define DOP_14
+#    include "shared/bv_dop.glsl"
+#endif
+#ifdef SCORE_SOBB
+#    include "shared/bv_dop.glsl"
+#    include "shared/bv_sobb.glsl"
+#endif
+#include "shared/data_bvh.h"
+#include "shared/data_plocpp.h"
+#include "shared/data_scene.h"
+
+layout(local_size_x_id = 0) in;
+
+layout(push_constant) uniform uPushConstant {
+    PC_Reinsert data;
+} pc;
+
+// limits the search stack and the locked paths, nodes deeper than this are not moved
+#define MAX_DEPTH 64
+
+#include "restructure_score.glsl"
+
+ReinsertionCandidate_buf candidates;
+u64_buf locks;
+u32_buf applied;
+
+i32 childRef(in i32 nodeId)
+{
+    return nodeId < i32(BVH_COUNTS.nodeCountLeaf) ? ~nodeId : nodeId;
+}
+
+// the previous iteration has not moved enough nodes, so does not any later one
+bool isStopped()
+{
+    const u32 minReinsertions = max(1u, u32(pc.data.minReinsertionRatio * f32(BVH_COUNTS.nodeCountTotal)));
+    return pc.data.iteration > 0 && applied.val[pc.data.iteration - 1] < minReinsertions;
+}
+
+// gain in the high bits, the highest gain wins the lock, ties are broken by the node id
+u64 lockKey(in i32 nodeId, in f32 gain)
+{
+    return (u64(floatBitsToUint(gain)) << 32) | u64(nodeId);
+}
+
+void replaceChild(in i32 nodeId, in i32 oldRef, in i32 newRef)
+{
+    if (bvh.node[nodeId].c0 == oldRef)
+        bvh.node[nodeId].c0 = newRef;
+    else
+        bvh.node[nodeId].c1 = newRef;
+}
+
+// change of the exact area the move causes, only the nodes below the common ancestor change their bounds
+f32 exactAreaDelta(in i32 nodeId, in i32 targetId, in i32 lcaId)
+{
+    const i32 parentId = bvh.node[nodeId].parent;
+    const NodeBVH2_AABB parent = bvh.node[parentId];
+    const i32 siblingId = nodeIndex(parent.c0 == childRef(nodeId) ? parent.c1 : parent.c0);
+    const SCORE_BV bvNode = scoreLoad(nodeId);
+
+    f32 delta = -scoreAreaExact(scoreLoad(parentId));
+
+    // the ancestors of the parent lose the node, so does the target when it is the common ancestor
+    SCORE_BV bv = scoreLoad(siblingId);
+    if (lcaId != parentId) {
+        i32 id = parentId;
+        i32 ancestorId = parent.parent;
+        while (ancestorId != lcaId || ancestorId == targetId) {
+            const NodeBVH2_AABB ancestor = bvh.node[ancestorId];
+            bvFit(bv, scoreLoad(nodeIndex(ancestor.c0 == id ? ancestor.c1 : ancestor.c0)));
+            delta += scoreAreaExact(bv) - scoreAreaExact(scoreLoad(ancestorId));
+            if (ancestorId == lcaId)
+                break;
+            id = ancestorId;
+            ancestorId = ancestor.parent;
+        }
+    }
+
+    // the parent comes back between the target and its parent, the target's ancestors gain the node
+    SCORE_BV bvInserted = targetId == lcaId ? bv : scoreLoad(targetId);
+    bvFit(bvInserted, bvNode);
+    delta += scoreAreaExact(bvInserted);
+    if (targetId != lcaId) {
+        for (i32 ancestorId = bvh.node[targetId].parent; ancestorId != lcaId; ancestorId = bvh.node[ancestorId].parent) {
+            SCORE_BV bvAncestor = scoreLoad(ancestorId);
+            bvFit(bvAncestor, bvNode);
+            delta += scoreAreaExact(bvAncestor) - scoreAreaExact(scoreLoad(ancestorId));
+        }
+    }
+    return delta;
+}
+
+void search(in i32 nodeId)
+{
+    candidates.val[nodeId] = ReinsertionCandidate(INVALID_ID, INVALID_ID, 0.f);
+
+    const i32 rootId = i32(BVH_COUNTS.rootId);
+    const i32 parentId = bvh.node[nodeId].parent;
+    if (parentId == INVALID_ID || parentId == rootId)
+        return;
+
+    const NodeBVH2_AABB parent = bvh.node[parentId];
+    const i32 siblingId = nodeIndex(parent.c0 == childRef(nodeId) ? parent.c1 : parent.c0);
+    const SCORE_BV bvNode = scoreLoad(nodeId);
+    const f32 areaNode = bvArea(bvNode);
+
+    // the parent disappears with the node, the ancestors shrink to the bounds of the rest of their subtrees
+    f32 gainRemove = bvArea(scoreLoad(parentId));
+    {
+        SCORE_BV bv = scoreLoad(siblingId);
+        i32 id = parentId;
+        i32 ancestorId = parent.parent;
+        while (ancestorId != INVALID_ID) {
+            const NodeBVH2_AABB ancestor = bvh.node[ancestorId];
+            bvFit(bv, scoreLoad(nodeIndex(ancestor.c0 == id ? ancestor.c1 : ancestor.c0)));
+            const f32 shrink = bvArea(scoreLoad(ancestorId)) - bvArea(bv);
+            // bounds that do not shrink keep the ones above unchanged as well
+            if (shrink <= 0.f)
+                break;
+            gainRemove += shrink;
+            id = ancestorId;
+            ancestorId = ancestor.parent;
+        }
+    }
+
+    // the cost of an insertion is the area of the new node plus the growth of the target's ancestors,
+    // a subtree is pruned once its induced cost plus the smallest possible new node cannot beat the best one
+    i32 stackNode[MAX_DEPTH];
+    f32 stackInduced[MAX_DEPTH];
+    i32 stackSize = 0;
+    stackNode[stackSize] = rootId;
+    stackInduced[stackSize++] = 0.f;
+
+    f32 bestCost = gainRemove;
+    i32 bestId = INVALID_ID;
+    while (stackSize > 0) {
+        --stackSize;
+        const i32 id = stackNode[stackSize];
+        const f32 induced = stackInduced[stackSize];
+        if (induced + areaNode >= bestCost)
+            continue;
+
+        const SCORE_BV bvOld = scoreLoad(id);
+        SCORE_BV bv = bvOld;
+        bvFit(bv, bvNode);
+        const f32 area = bvArea(bv);
+
+        // inserting next to the sibling or the parent gives back the current tree
+        if (id != rootId && id != parentId && id != siblingId && induced + area < bestCost) {
+            bestCost = induced + area;
+            bestId = id;
+        }
+
+        if (id < i32(BVH_COUNTS.nodeCountLeaf))
+            continue;
+        const f32 childInduced = induced + area - bvArea(bvOld);
+        if (childInduced + areaNode >= bestCost || stackSize + 2 > MAX_DEPTH)
+            continue;
+
+        // the subtree of the node itself is not a valid target
+        const NodeBVH2_AABB node = bvh.node[id];
+        if (nodeIndex(node.c0) != nodeId) {
+            stackNode[stackSize] = nodeIndex(node.c0);
+            stackInduced[stackSize++] = childInduced;
+        }
+        if (nodeIndex(node.c1) != nodeId) {
+            stackNode[stackSize] = nodeIndex(node.c1);
+            stackInduced[stackSize++] = childInduced;
+        }
+    }
+    if (bestId == INVALID_ID)
+        return;
+
+    // the common ancestor is the first node of the target's path that is on the path of the node, the root is on both
+    i32 path[MAX_DEPTH];
+    i32 pathLength = 0;
+    for (i32 id = nodeId; id != INVALID_ID; id = bvh.node[id].parent) {
+        if (pathLength == MAX_DEPTH)
+            return;
+        path[pathLength++] = id;
+    }
+    i32 lcaId = bestId;
+    i32 lcaIndex = -1;
+    while (true) {
+        for (i32 i = 0; i < pathLength && lcaIndex < 0; i++)
+            if (path[i] == lcaId)
+                lcaIndex = i;
+        if (lcaIndex >= 0)
+            break;
+        lcaId = bvh.node[lcaId].parent;
+    }
+
+    // the locked paths keep concurrent moves from forming cycles, the rest are the nodes whose links are rewritten
+    f32 gain = gainRemove - bestCost;
+#ifdef SCORE_SOBB
+    gain = -exactAreaDelta(nodeId, bestId, lcaId);
+    if (gain <= 0.f)
+        return;
+#endif
+    const u64 key = lockKey(nodeId, gain);
+    for (i32 i = 0; i <= lcaIndex; i++)
+        atomicMax(locks.val[path[i]], key);
+    for (i32 id = bestId; id != lcaId; id = bvh.node[id].parent)
+        atomicMax(locks.val[id], key);
+    atomicMax(locks.val[siblingId], key);
+    atomicMax(locks.val[parent.parent], key);
+    atomicMax(locks.val[bvh.node[bestId].parent], key);
+
+    candidates.val[nodeId] = ReinsertionCandidate(bestId, lcaId, gain);
+}
+
+// nodes owned by the move are not rewritten by any other one, so their parent links are safe to follow
+bool ownsPath(in i32 fromId, in i32 lcaId, in u64 key)
+{
+    for (i32 id = fromId;; id = bvh.node[id].parent) {
+        if (locks.val[id] != key)
+            return false;
+        if (id == lcaId)
+            return true;
+    }
+    return false;
+}
+
+void apply(in i32 nodeId)
+{
+    const ReinsertionCandidate candidate = candidates.val[nodeId];
+    if (candidate.target == INVALID_ID)
+        return;
+
+    const u64 key = lockKey(nodeId, candidate.gain);
+    if (!ownsPath(nodeId, candidate.lca, key) || !ownsPath(candidate.target, candidate.lca, key))
+        return;
+
+    const i32 ref = childRef(nodeId);
+    const i32 parentId = bvh.node[nodeId].parent;
+    const NodeBVH2_AABB parent = bvh.node[parentId];
+    const i32 siblingRef = parent.c0 == ref ? parent.c1 : parent.c0;
+    const i32 targetParentId = bvh.node[candidate.target].parent;
+    if (locks.val[nodeIndex(siblingRef)] != key || locks.val[parent.parent] != key || locks.val[targetParentId] != key)
+        return;
+
+    // the sibling takes the place of the parent
+    replaceChild(parent.parent, parentId, siblingRef);
+    bvh.node[nodeIndex(siblingRef)].parent = parent.parent;
+
+    // the parent is reused as the new node between the target and its parent
+    const i32 targetRef = childRef(candidate.target);
+    replaceChild(targetParentId, targetRef, parentId);
+    bvh.node[parentId].c0 = ref;
+    bvh.node[parentId].c1 = targetRef;
+    bvh.node[parentId].parent = targetParentId;
+    bvh.node[candidate.target].parent = parentId;
+
+    atomicAdd(applied.val[pc.data.iteration], 1);
+}
+
+void refit(in i32 nodeId)
+{
+    u32_buf counter = u32_buf(pc.data.countersAddress);
+
+    NodeBVH2_AABB node = bvh.node[nodeId];
+    if (pc.data.phase == REINSERT_PHASE_INIT) {
+        scoreStore(nodeId, scoreFitLeaf(node));
+        memoryBarrier(gl_ScopeQueueFamily, gl_StorageSemanticsBuffer, gl_SemanticsAcquireRelease | gl_SemanticsMakeAvailable | gl_SemanticsMakeVisible);
+    }
+
+    nodeId = node.parent;
+    if (nodeId == INVALID_ID)
+        return;
+    while (atomicAdd(counter.val[nodeId], 1) > 0)
+    {
+        node = bvh.node[nodeId];
+        const i32 c0 = nodeIndex(node.c0);
+        const i32 c1 = nodeIndex(node.c1);
+
+        AABB aabb = bvh.node[c0].bv;
+        bvFit(aabb, bvh.node[c1].bv);
+        bvh.node[nodeId].bv = aabb;
+        bvh.node[nodeId].size = abs(bvh.node[c0].size) + abs(bvh.node[c1].size);
+
+#ifdef SCORE_SIDE_BUFFER
+        SCORE_BV bv = scoreLoad(c0);
+        bvFit(bv, scoreLoad(c1));
+        scoreStore(nodeId, bv);
+#endif
+        memoryBarrier(gl_ScopeQueueFamily, gl_StorageSemanticsBuffer, gl_SemanticsAcquireRelease | gl_SemanticsMakeAvailable | gl_SemanticsMakeVisible);
+
+        nodeId = node.parent;
+        if (nodeId == INVALID_ID)
+            return;
+    }
+}
+
+void reinsert(in u32 taskId)
+{
+    const u32 threadId = taskId * gl_WorkGroupSize.x + gl_LocalInvocationID.x;
+    if (threadId >= BVH_COUNTS.nodeCountTotal)
+        return;
+
+    bvh = BVH2_AABB(pc.data.bvhAddress);
+#ifdef SCORE_DOP14
+    bvhScore = BVH2_DOP14(pc.data.bvhScoreAddress);
+#endif
+#ifdef SCORE_SOBB
+    bvhScore = DOP_ref(pc.data.bvhScoreAddress);
+#endif
+    candidates = ReinsertionCandidate_buf(pc.data.candidatesAddress);
+    locks = u64_buf(pc.data.locksAddress);
+    applied = u32_buf(pc.data.runtimeDataAddress);
+
+    switch (pc.data.phase) {
+    case REINSERT_PHASE_SEARCH:
+        if (!isStopped())
+            search(i32(threadId));
+        break;
+    case REINSERT_PHASE_APPLY:
+        if (!isStopped())
+            apply(i32(threadId));
+        break;
+    case REINSERT_PHASE_REFIT:
+        // no move applied, the bounds are still valid, otherwise falls through to the refit
+        if (applied.val[pc.data.iteration] == 0)
+            break;
+    case REINSERT_PHASE_INIT:
+        if (threadId < BVH_COUNTS.nodeCountLeaf)
+            refit(i32(threadId));
+        break;
+    }
+}
+
+#endif
@@ -0,0 +1,235 @@
+#ifndef RESTRUCTURE_AABB_GLSL
+#define RESTRUCTURE_AABB_GLSL
+
+// Treelet restructuring of the binary AABB tree, one pass per dispatch. Nodes are visited bottom-up, the second child
+// to arrive at a node continues to its parent. A treelet is formed under each visited node with enough triangles by
+// repeatedly opening its largest treelet leaf, its optimal topology is found by dynamic programming over all subsets
+// of the treelet leaves and written back if it lowers the SAH cost. Internal node ids are reused, the treelet root
+// keeps its id.
+// With SCORE_DOP14 defined, the cost is evaluated over DOP14 bounds kept in a side buffer, a tighter proxy of the
+// surface area of the oriented volumes fitted to the tree by the later stages.
+
+#extension GL_EXT_buffer_reference2: require
+#extension GL_EXT_scalar_block_layout: require
+#extension GL_KHR_memory_scope_semantics : require
+#extension GL_GOOGLE_include_directive : enable
+
+#define INCLUDE_FROM_SHADER
+#include "shared/types.glsl"
+#include "shared/compute.glsl"
+#include "shared/bv_aabb.glsl"
+#ifdef SCORE_DOP14
+#    define DOP_14
+#    include "shared/bv_dop.glsl"
+#endif
+#include "shared/data_bvh.h"
+#include "shared/data_plocpp.h"
+#include "shared/data_scene.h"
+
+layout(local_size_x_id = 0) in;
+layout(constant_id = 1) const u32 sc_TreeletSize = 7;
+
+const u32 sc_SubsetCount = 1u << sc_TreeletSize;
+
+layout(push_constant) uniform uPushConstant {
+    PC_Restructure data;
+} pc;
+
+// accepted topologies have to be cheaper by at least this fraction, keeps equal cost treelets from being rewritten
+#define MIN_RELATIVE_GAIN 1e-4f
+
+f32_buf nodeCost;
+
+#include "restructure_score.glsl"
+
+void optimizeTreelet(in i32 rootId, in NodeBVH2_AABB root)
+{
+    i32 treeletLeaves[sc_TreeletSize];
+    f32 treeletLeafArea[sc_TreeletSize];
+    i32 treeletInternals[sc_TreeletSize - 1];
+
+    treeletInternals[0] = rootId;
+    treeletLeaves[0] = root.c0;
+    treeletLeaves[1] = root.c1;
+    i32 leafCount = 2;
+    i32 internalCount = 1;
+
+    // tree leaves are never opened, mark them by negative area
+    for (i32 i = 0; i < 2; i++)
+        treeletLeafArea[i] = treeletLeaves[i] < 0 ? -1.f : bvArea(scoreLoad(treeletLeaves[i]));
+
+    while (leafCount < i32(sc_TreeletSize)) {
+        i32 best = -1;
+        f32 bestArea = -1.f;
+        for (i32 i = 0; i < leafCount; i++) {
+            if (treeletLeafArea[i] > bestArea) {
+                bestArea = treeletLeafArea[i];
+                best = i;
+            }
+        }
+        if (best < 0)
+            break;
+
+        const i32 openId = treeletLeaves[best];
+        treeletInternals[internalCount++] = openId;
+        treeletLeaves[best] = bvh.node[openId].c0;
+        treeletLeaves[leafCount] = bvh.node[openId].c1;
+        treeletLeafArea[best] = treeletLeaves[best] < 0 ? -1.f : bvArea(scoreLoad(treeletLeaves[best]));
+        treeletLeafArea[leafCount] = treeletLeaves[leafCount] < 0 ? -1.f : bvArea(scoreLoad(treeletLeaves[leafCount]));
+        leafCount++;
+    }
+
+    // two or three leaves have no topology with a different cost
+    if (leafCount < 4)
+        return;
+
+    SCORE_BV leafBv[sc_TreeletSize];
+    f32 leafCost[sc_TreeletSize];
+    for (i32 i = 0; i < leafCount; i++) {
+        const i32 id = nodeIndex(treeletLeaves[i]);
+        leafBv[i] = scoreLoad(id);
+        leafCost[i] = nodeCost.val[id];
+    }
+
+    // subsets are visited in increasing order, so both parts of any split are already solved,
+    // the part holding the lowest leaf of the subset enumerates every split exactly once
+    f32 subsetCost[sc_SubsetCount];
+    u32 subsetSplit[sc_SubsetCount];
+    const u32 fullSet = (1u << leafCount) - 1;
+    for (u32 s = 1; s <= fullSet; s++) {
+        if (bitCount(s) == 1) {
+            subsetCost[s] = leafCost[findLSB(s)];
+            continue;
+        }
+
+        SCORE_BV bv = scoreInit();
+        for (i32 i = 0; i < leafCount; i++)
+            if (((s >> i) & 1u) != 0)
+                bvFit(bv, leafBv[i]);
+
+        const u32 lowest = s & (~s + 1u);
+        const u32 rest = s ^ lowest;
+        f32 bestCost = BIG_FLOAT;
+        u32 bestSplit = 0;
+        for (u32 p = (rest - 1u) & rest;; p = (p - 1u) & rest) {
+            const u32 part = p | lowest;
+            const f32 cost = subsetCost[part] + subsetCost[s ^ part];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestSplit = part;
+            }
+            if (p == 0)
+                break;
+        }
+        subsetCost[s] = pc.data.c_t * bvArea(bv) + bestCost;
+        subsetSplit[s] = bestSplit;
+    }
+
+    if (subsetCost[fullSet] >= nodeCost.val[rootId] * (1.f - MIN_RELATIVE_GAIN))
+        return;
+
+    // rebuild top-down, internal nodes are handed out in the order they are reached
+    u32 stackSubset[sc_TreeletSize];
+    i32 stackNode[sc_TreeletSize];
+    i32 stackSize = 0;
+    stackSubset[stackSize] = fullSet;
+    stackNode[stackSize++] = rootId;
+
+    u32 orderSubset[sc_TreeletSize - 1];
+    i32 orderNode[sc_TreeletSize - 1];
+    i32 orderCount = 0;
+    i32 nextInternal = 1;
+
+    while (stackSize > 0) {
+        --stackSize;
+        const u32 s = stackSubset[stackSize];
+        const i32 id = stackNode[stackSize];
+        orderSubset[orderCount] = s;
+        orderNode[orderCount++] = id;
+
+        const u32 parts[2] = { subsetSplit[s], s ^ subsetSplit[s] };
+        i32 c[2];
+        for (i32 j = 0; j < 2; j++) {
+            if (bitCount(parts[j]) == 1)
+                c[j] = treeletLeaves[findLSB(parts[j])];
+            else {
+                c[j] = treeletInternals[nextInternal++];
+                stackSubset[stackSize] = parts[j];
+                stackNode[stackSize++] = c[j];
+            }
+            bvh.node[nodeIndex(c[j])].parent = id;
+        }
+        bvh.node[id].c0 = c[0];
+        bvh.node[id].c1 = c[1];
+    }
+
+    // children are reached after their parents, refit in reverse
+    for (i32 i = orderCount - 1; i >= 0; i--) {
+        const i32 id = orderNode[i];
+        const i32 c0 = nodeIndex(bvh.node[id].c0);
+        const i32 c1 = nodeIndex(bvh.node[id].c1);
+
+        AABB aabb = bvh.node[c0].bv;
+        bvFit(aabb, bvh.node[c1].bv);
+        bvh.node[id].bv = aabb;
+        bvh.node[id].size = abs(bvh.node[c0].size) + abs(bvh.node[c1].size);
+        nodeCost.val[id] = subsetCost[orderSubset[i]];
+
+#ifdef SCORE_DOP14
+        SCORE_BV bv = scoreInit();
+        for (i32 j = 0; j < leafCount; j++)
+            if (((orderSubset[i] >> j) & 1u) != 0)
+                bvFit(bv, leafBv[j]);
+        scoreStore(id, bv);
+#endif
+    }
+}
+
+void restructure(in u32 taskId)
+{
+    u32 nodeId = taskId * gl_WorkGroupSize.x + gl_LocalInvocationID.x;
+    if (nodeId >= BVH_COUNTS.nodeCountLeaf)
+        return;
+
+    bvh = BVH2_AABB(pc.data.bvhAddress);
+    nodeCost = f32_buf(pc.data.costAddress);
+#ifdef SCORE_DOP14
+    bvhScore = BVH2_DOP14(pc.data.bvhScoreAddress);
+#endif
+    u32_buf counter = u32_buf(pc.data.countersAddress);
+
+    NodeBVH2_AABB node = bvh.node[nodeId];
+    {
+        const SCORE_BV bv = scoreFitLeaf(node);
+        scoreStore(i32(nodeId), bv);
+        nodeCost.val[nodeId] = pc.data.c_i * bvArea(bv) * f32(abs(node.size));
+    }
+    memoryBarrier(gl_ScopeQueueFamily, gl_StorageSemanticsBuffer, gl_SemanticsAcquireRelease | gl_SemanticsMakeAvailable | gl_SemanticsMakeVisible);
+
+    nodeId = node.parent;
+    if (nodeId == INVALID_ID)
+        return;
+    while (atomicAdd(counter.val[nodeId], 1) > 0)
+    {
+        // both subtrees are final, their union and so the bounds of this node are not changed by restructuring them
+        node = bvh.node[nodeId];
+        const i32 c0 = nodeIndex(node.c0);
+        const i32 c1 = nodeIndex(node.c1);
+
+        SCORE_BV bv = scoreLoad(c0);
+        bvFit(bv, scoreLoad(c1));
+        scoreStore(i32(nodeId), bv);
+        nodeCost.val[nodeId] = pc.data.c_t * bvArea(bv) + nodeCost.val[c0] + nodeCost.val[c1];
+
+        if (abs(node.size) >= i32(sc_TreeletSize))
+            optimizeTreelet(i32(nodeId), node);
+
+        memoryBarrier(gl_ScopeQueueFamily, gl_StorageSemanticsBuffer, gl_SemanticsAcquireRelease | gl_SemanticsMakeAvailable | gl_SemanticsMakeVisible);
+
+        nodeId = node.parent;
+        if (nodeId == INVALID_ID)
+            return;
+    }
+}
+
+#endif
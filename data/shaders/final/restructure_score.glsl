@@ -0,0 +1,113 @@
+#ifndef RESTRUCTURE_SCORE_GLSL
+#define RESTRUCTURE_SCORE_GLSL
+
+// Bounds the topology optimizers score the binary AABB tree by. AABBs of the tree itself by default, with SCORE_DOP14
+// defined DOP14 bounds kept in a side buffer, leaves fitted to their triangles. With SCORE_SOBB defined the side buffer
+// keeps the k-DOP of the includer's DOP_32, DOP_48 or DOP_64, the one the transformation stage fits the SOBBs to.
+// Expects the push constant block `pc` to carry the triangle index, geometry descriptor and score buffer addresses.
+
+BVH2_AABB bvh;
+
+#if defined(SCORE_DOP14) || defined(SCORE_SOBB)
+#    define SCORE_BV DOP
+#    define SCORE_SIDE_BUFFER
+
+#    ifdef SCORE_DOP14
+BVH2_DOP14 bvhScore;
+
+SCORE_BV scoreLoad(in i32 nodeId)
+{
+    return bvhScore.node[nodeId].bv;
+}
+
+void scoreStore(in i32 nodeId, in SCORE_BV bv)
+{
+    bvhScore.node[nodeId].bv = bv;
+}
+#    else
+DOP_ref bvhScore;
+
+SCORE_BV scoreLoad(in i32 nodeId)
+{
+    return bvhScore.val[nodeId];
+}
+
+void scoreStore(in i32 nodeId, in SCORE_BV bv)
+{
+    bvhScore.val[nodeId] = bv;
+}
+
+// fitting a SOBB is too slow for the search, it ranks by the axis aligned slabs of the k-DOP instead
+f32 bvArea(in DOP dop)
+{
+    const f32 d0 = dop_slab_d(dop, 0);
+    const f32 d1 = dop_slab_d(dop, 1);
+    const f32 d2 = dop_slab_d(dop, 2);
+    return 2.f * (d0 * d1 + d0 * d2 + d1 * d2);
+}
+#    endif
+
+SCORE_BV scoreInit()
+{
+    return dopInit();
+}
+
+SCORE_BV scoreFitLeaf(in NodeBVH2_AABB node)
+{
+    BvhTriangleIndices triangleIndices = BvhTriangleIndices(pc.data.bvhTriangleIndicesAddress);
+    GeometryDescriptor gDesc = GeometryDescriptor(pc.data.geometryDescriptorAddress);
+
+    DOP dop = dopInit();
+    const i32 triStartId = node.c0;
+    const i32 triCount = abs(node.size);
+    for (i32 triId = triStartId; triId < triStartId + triCount; triId++) {
+        BvhTriangleIndex ids = triangleIndices.val[triId];
+        Geometry g = gDesc.g[ids.nodeId];
+        uvec3_buf indices = uvec3_buf(g.idxAddress);
+        vec3_buf vertices = vec3_buf(g.vtxAddress);
+
+        const uvec3 idx = indices.val[ids.triangleId];
+        bvFit(dop, vertices.val[idx.x], vertices.val[idx.y], vertices.val[idx.z]);
+    }
+    return dop;
+}
+#else
+#    define SCORE_BV AABB
+
+SCORE_BV scoreInit()
+{
+    return AABB(vec3(BIG_FLOAT), vec3(-BIG_FLOAT));
+}
+
+SCORE_BV scoreLoad(in i32 nodeId)
+{
+    return bvh.node[nodeId].bv;
+}
+
+void scoreStore(in i32 nodeId, in SCORE_BV bv)
+{
+}
+
+SCORE_BV scoreFitLeaf(in NodeBVH2_AABB node)
+{
+    return node.bv;
+}
+#endif
+
+// area of the volume that is traversed in the end, the SOBB as the transformation stage fits it by default
+f32 scoreAreaExact(in SCORE_BV bv)
+{
+#ifdef SCORE_SOBB
+    i32 i, j, k;
+    return FitSOBB(bv, i, j, k);
+#else
+    return bvArea(bv);
+#endif
+}
+
+i32 nodeIndex(in i32 c)
+{
+    return c < 0 ? ~c : c;
+}
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef BV_QUANTIZED_GLSL
+#define BV_QUANTIZED_GLSL
+
+// Child bounds of the quantized layouts are stored in 8 bits relative to a per-node frame with a power of two grid step.
+// Encoding rounds outwards and checks every value against the exact decoding expression used by traversal, so the
+// decoded volume always contains the original one. Decoding is marked precise to keep both sides bit identical.
+
+#extension GL_EXT_control_flow_attributes: require
+#define UNROLL_NEXT_LOOP [[unroll]]
+
+#define INCLUDE_FROM_SHADER
+#include "data_bvh.h"
+
+#define Q_EXPONENT_BIAS 127
+#define Q_EXPONENT_MIN -126
+#define Q_EXPONENT_MAX 127
+
+f32 qDecode(in f32 origin, in f32 q, in f32 scale)
+{
+    precise f32 result = origin + q * scale;
+    return result;
+}
+
+vec2 qDecode(in f32 origin, in vec2 q, in f32 scale)
+{
+    precise vec2 result = vec2(origin) + q * scale;
+    return result;
+}
+
+vec3 qDecode(in vec3 origin, in vec3 q, in vec3 scale)
+{
+    precise vec3 result = origin + q * scale;
+    return result;
+}
+
+f32 qDot(in vec3 a, in vec3 b)
+{
+    precise f32 result = a.x * b.x + a.y * b.y + a.z * b.z;
+    return result;
+}
+
+i32 qExponent(in f32 range, in f32 gridSize)
+{
+    return clamp(i32(ceil(log2(max(range, 1e-30f) / gridSize))), Q_EXPONENT_MIN, Q_EXPONENT_MAX);
+}
+
+i32 qEncodeMin(in f32 v, in f32 origin, in f32 scale, in i32 qLo, in i32 qHi)
+{
+    i32 q = clamp(i32(floor((v - origin) / scale)), qLo, qHi);
+    while (q > qLo && qDecode(origin, f32(q), scale) > v)
+        q--;
+    return q;
+}
+
+i32 qEncodeMax(in f32 v, in f32 origin, in f32 scale, in i32 qLo, in i32 qHi)
+{
+    i32 q = clamp(i32(ceil((v - origin) / scale)), qLo, qHi);
+    while (q < qHi && qDecode(origin, f32(q), scale) < v)
+        q++;
+    return q;
+}
+
+// AABB: the frame is the node bounds, children are unsigned offsets from its min corner with a per-axis step
+NodeBVH2_AABB_q bvQuantize(in NodeBVH2_AABB_c node)
+{
+    AABB frame = node.bv[0];
+    bvFit(frame, node.bv[1]);
+
+    NodeBVH2_AABB_q result;
+    result.origin = frame.min;
+    result.exponents = 0;
+
+    vec3 scale;
+    UNROLL_NEXT_LOOP
+    for (i32 a = 0; a < 3; a++) {
+        i32 e = qExponent(frame.max[a] - frame.min[a], 255.f);
+        while (e < Q_EXPONENT_MAX && qDecode(frame.min[a], 255.f, exp2(f32(e))) < frame.max[a])
+            e++;
+        scale[a] = exp2(f32(e));
+        result.exponents |= u32(e + Q_EXPONENT_BIAS) << (8 * a);
+    }
+
+    UNROLL_NEXT_LOOP
+    for (i32 i = 0; i < 2; i++) {
+        result.qMin[i] = 0;
+        result.qMax[i] = 0;
+        UNROLL_NEXT_LOOP
+        for (i32 a = 0; a < 3; a++) {
+            result.qMin[i] |= u32(qEncodeMin(node.bv[i].min[a], frame.min[a], scale[a], 0, 255)) << (8 * a);
+            result.qMax[i] |= u32(qEncodeMax(node.bv[i].max[a], frame.min[a], scale[a], 0, 255)) << (8 * a);
+        }
+        result.c[i] = node.c[i];
+    }
+    return result;
+}
+
+AABB bvDequantize(in NodeBVH2_AABB_q node, in i32 i)
+{
+    const vec3 scale = exp2(vec3(ivec3(
+        bitfieldExtract(node.exponents, 0, 8),
+        bitfieldExtract(node.exponents, 8, 8),
+        bitfieldExtract(node.exponents, 16, 8)) - Q_EXPONENT_BIAS));
+
+    AABB result;
+    result.min = qDecode(node.origin, vec3(bitfieldExtract(node.qMin[i], 0, 8), bitfieldExtract(node.qMin[i], 8, 8), bitfieldExtract(node.qMin[i], 16, 8)), scale);
+    result.max = qDecode(node.origin, vec3(bitfieldExtract(node.qMax[i], 0, 8), bitfieldExtract(node.qMax[i], 8, 8), bitfieldExtract(node.qMax[i], 16, 8)), scale);
+    return result;
+}
+
+#ifdef HAVE_DOP
+
+vec3 bvCenter(in SOBBi sobb)
+{
+    const mat3 n = transpose(mat3(
+        DOP_NORMALS[(sobb.normalIds >> 20) & 0x3FF],
+        DOP_NORMALS[(sobb.normalIds >> 10) & 0x3FF],
+        DOP_NORMALS[(sobb.normalIds) & 0x3FF]));
+    return inverse(n) * (.5f * vec3(sobb.b0.x + sobb.b0.y, sobb.b1.x + sobb.b1.y, sobb.b2.x + sobb.b2.y));
+}
+
+// SOBBi: slabs keep their DOP normals, both slab planes are signed offsets from the projection of a point shared by
+// the children, with a single step for the whole node
+NodeBVH2_SOBBi_q bvQuantize(in NodeBVH2_SOBBi_c node)
+{
+    NodeBVH2_SOBBi_q result;
+    result.origin = .5f * (bvCenter(node.bv[0]) + bvCenter(node.bv[1]));
+
+    vec2 slab[2][3];
+    f32 d0[2][3];
+    f32 range = 0.f;
+    UNROLL_NEXT_LOOP
+    for (i32 i = 0; i < 2; i++) {
+        slab[i][0] = node.bv[i].b0;
+        slab[i][1] = node.bv[i].b1;
+        slab[i][2] = node.bv[i].b2;
+        d0[i][0] = qDot(DOP_NORMALS[(node.bv[i].normalIds >> 20) & 0x3FF], result.origin);
+        d0[i][1] = qDot(DOP_NORMALS[(node.bv[i].normalIds >> 10) & 0x3FF], result.origin);
+        d0[i][2] = qDot(DOP_NORMALS[(node.bv[i].normalIds) & 0x3FF], result.origin);
+        UNROLL_NEXT_LOOP
+        for (i32 s = 0; s < 3; s++)
+            range = max(range, max(abs(slab[i][s].x - d0[i][s]), abs(slab[i][s].y - d0[i][s])));
+    }
+
+    i32 e = qExponent(range, 127.f);
+    while (e < Q_EXPONENT_MAX) {
+        bool fits = true;
+        for (i32 i = 0; i < 2; i++)
+            for (i32 s = 0; s < 3; s++)
+                fits = fits && qDecode(d0[i][s], -128.f, exp2(f32(e))) <= slab[i][s].x && qDecode(d0[i][s], 127.f, exp2(f32(e))) >= slab[i][s].y;
+        if (fits)
+            break;
+        e++;
+    }
+    result.scale = exp2(f32(e));
+
+    UNROLL_NEXT_LOOP
+    for (i32 i = 0; i < 2; i++) {
+        i32 q[3][2];
+        UNROLL_NEXT_LOOP
+        for (i32 s = 0; s < 3; s++) {
+            q[s][0] = qEncodeMin(slab[i][s].x, d0[i][s], result.scale, -128, 127);
+            q[s][1] = qEncodeMax(slab[i][s].y, d0[i][s], result.scale, -128, 127);
+        }
+        result.normalIds[i] = node.bv[i].normalIds;
+        result.q01[i] = u32(q[0][0] & 0xFF) | (u32(q[0][1] & 0xFF) << 8) | (u32(q[1][0] & 0xFF) << 16) | (u32(q[1][1] & 0xFF) << 24);
+        result.q2[i] = u32(q[2][0] & 0xFF) | (u32(q[2][1] & 0xFF) << 8);
+        result.c[i] = node.c[i];
+    }
+    return result;
+}
+
+SOBBi bvDequantize(in NodeBVH2_SOBBi_q node, in i32 i)
+{
+    const i32 ids = node.normalIds[i];
+    const i32 q01 = i32(node.q01[i]);
+    const i32 q2 = i32(node.q2[i]);
+
+    SOBBi result;
+    result.normalIds = ids;
+    result.b0 = qDecode(qDot(DOP_NORMALS[(ids >> 20) & 0x3FF], node.origin), vec2(bitfieldExtract(q01, 0, 8), bitfieldExtract(q01, 8, 8)), node.scale);
+    result.b1 = qDecode(qDot(DOP_NORMALS[(ids >> 10) & 0x3FF], node.origin), vec2(bitfieldExtract(q01, 16, 8), bitfieldExtract(q01, 24, 8)), node.scale);
+    result.b2 = qDecode(qDot(DOP_NORMALS[(ids) & 0x3FF], node.origin), vec2(bitfieldExtract(q2, 0, 8), bitfieldExtract(q2, 8, 8)), node.scale);
+    return result;
+}
+
+#endif
+
+#endif
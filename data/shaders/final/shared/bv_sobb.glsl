@@ -91,6 +91,8 @@ f32 bvArea(in SOBBi sobb)
 #define FitSOBB FitSOBB_k2
 // #define FitSOBB FitSOBB_k1
 
+#define EPS_SOBB_DET 1e-4f
+
 f32 FitSOBB_k1(in DOP dop, out i32 besti, out i32 bestj, out i32 bestk)
 {
     f32 d[DOP_SLABS];
@@ -214,6 +216,64 @@ f32 FitSOBB_k3(in DOP dop, out i32 besti, out i32 bestj, out i32 bestk)
     return bestArea;
 }
 
+// exhaustive search over the few narrowest slabs only, the AABB slabs are the fallback for degenerate triplets
+#define SOBB_CANDIDATES_MAX 8
+f32 FitSOBB_pruned(in DOP dop, in u32 candidateCount, out i32 besti, out i32 bestj, out i32 bestk)
+{
+    const i32 count = clamp(i32(candidateCount), 3, SOBB_CANDIDATES_MAX);
+    i32 ids[SOBB_CANDIDATES_MAX];
+    f32 d[SOBB_CANDIDATES_MAX];
+    i32 kept = 0;
+
+    // insertion of every slab into the sorted list of the narrowest ones
+    for (i32 i = 0; i < DOP_SLABS; i++) {
+        const f32 di = dop_slab_d(dop, i);
+        if (kept == count && di >= d[count - 1])
+            continue;
+        i32 pos = min(kept, count - 1);
+        while (pos > 0 && d[pos - 1] > di) {
+            d[pos] = d[pos - 1];
+            ids[pos] = ids[pos - 1];
+            pos--;
+        }
+        d[pos] = di;
+        ids[pos] = i;
+        kept = min(kept + 1, count);
+    }
+
+    besti = 0;
+    bestj = 1;
+    bestk = 2;
+
+    const f32 d0 = dop_slab_d(dop, 0);
+    const f32 d1 = dop_slab_d(dop, 1);
+    const f32 d2 = dop_slab_d(dop, 2);
+    f32 bestArea = 2.f * (d0 * d1 + d0 * d2 + d1 * d2);
+
+    for (i32 a = 0; a < count; a++) {
+        const vec3 n1 = DOP_NORMALS[ids[a]];
+        for (i32 b = a + 1; b < count; b++) {
+            const vec3 n2 = DOP_NORMALS[ids[b]];
+            const vec3 n12 = cross(n1, n2);
+            const f32 a1 = d[a] * d[b];
+            const f32 a2 = d[a] + d[b];
+            for (i32 c = b + 1; c < count; c++) {
+                const f32 det = abs(dot(n12, DOP_NORMALS[ids[c]]));
+                if (det < EPS_SOBB_DET)
+                    continue;
+                const f32 area = 2.f * (a1 + d[c] * a2) / det;
+                if (area < bestArea) {
+                    bestArea = area;
+                    besti = ids[a];
+                    bestj = ids[b];
+                    bestk = ids[c];
+                }
+            }
+        }
+    }
+    return bestArea;
+}
+
 #endif
 
 #endif
@@ -26,11 +26,44 @@ namespace data_bvh {
 #    define DOP14_SPLIT f32[8]
 #endif
 
+// node counts of a tree, written on the device by the stage that built it. Stages that read the tree take the counts
+// from here instead of push constants and dispatch over it indirectly, so no count is read back in between.
+#define BVH_COUNTS_FROM_CLUSTERS 0
+#define BVH_COUNTS_FROM_COLLAPSED 1
+#define BVH_COUNTS_FROM_REARRANGED 2
+#define BVH_COUNTS_DISPATCH 3
+
+// mixed compact layout, a child is bounded either by a SOBB or by an AABB stored as a SOBB over the x, y, z slabs.
+// AABB children are tagged in their child index and take the cheaper test, the tag limits node ids and leaf
+// triangle offsets to 26 bits.
+#define MIXED_CHILD_AABB 0x04000000
+#define MIXED_AABB_NORMAL_IDS 0x00000402
+
+struct BvhCounts {
+    u32 nodeCountLeaf;
+    u32 nodeCountTotal;
+    u32 rootId;
+};
+
+// indirect dispatches over the leaves and over all nodes of a tree
+struct BvhDispatch {
+    uvec3 leaves;
+    uvec3 nodes;
+};
+
+struct PC_BvhCounts {
+    u64 countsAddress;
+    u64 dataAddress;
+    u64 inputCountsAddress;
+    u32 mode;
+    u32 workgroupSize;
+};
+
 struct PC_BvhStats {
     u64 bvhAddress;
     u64 bvhAuxAddress;
     u64 resultBufferAddress;
-    u32 nodeCount;
+    u64 countsAddress;
     f32 c_t;
     f32 c_i;
     f32 sceneAABBSurfaceArea;
@@ -103,6 +136,14 @@ struct BvhTriangle {
     vec4 v2;
 };
 
+// bottom level tree of one geometry, referenced from instance leaves of the top level tree
+struct BlasDescriptor {
+    u64 bvhAddress;
+    u64 bvhTrianglesAddress;
+    u64 bvhTriangleIndicesAddress;
+    u64 bvhAuxAddress;
+};
+
 struct NodeBVH2_SOBB {
     SOBB bv;
     i32 size;
@@ -132,8 +173,65 @@ struct NodeBVH2_SOBBi_c {
     i32 c[2];
 };
 
+struct NodeBVH2_MIXED_c {
+    SOBBi bv[2];
+    i32 c[2];
+};
+
+// quantized compact layouts, child bounds are stored in 8 bits relative to a per-node frame (see bv_quantized.glsl)
+struct NodeBVH2_AABB_q {
+    vec3 origin;
+    u32 exponents;
+    u32 qMin[2];
+    u32 qMax[2];
+    i32 c[2];
+};
+
+struct NodeBVH2_SOBBi_q {
+    vec3 origin;
+    f32 scale;
+    i32 normalIds[2];
+    u32 q01[2];
+    u32 q2[2];
+    i32 c[2];
+};
+
+// wide compact layouts, unused child slots are marked by INVALID_VALUE_I32
+struct NodeBVH4_AABB_c {
+    AABB bv[4];
+    i32 c[4];
+};
+
+struct NodeBVH8_AABB_c {
+    AABB bv[8];
+    i32 c[8];
+};
+
+struct NodeBVH4_SOBB_c {
+    SOBB bv[4];
+    i32 c[4];
+};
+
+struct NodeBVH8_SOBB_c {
+    SOBB bv[8];
+    i32 c[8];
+};
+
+struct NodeBVH4_SOBBi_c {
+    SOBBi bv[4];
+    i32 c[4];
+};
+
+struct NodeBVH8_SOBBi_c {
+    SOBBi bv[8];
+    i32 c[8];
+};
+
 #ifndef INCLUDE_FROM_SHADER
-static_assert(sizeof(PC_BvhStats) == 40);
+static_assert(sizeof(BvhCounts) == 12);
+static_assert(sizeof(BvhDispatch) == 24);
+static_assert(sizeof(PC_BvhCounts) == 32);
+static_assert(sizeof(PC_BvhStats) == 44);
 static_assert(sizeof(NodeBVH2_AABB) == 40);
 static_assert(sizeof(NodeBVH2_AABB_c) == 56);
 static_assert(sizeof(NodeBVH2_OBB) == 64);
@@ -147,6 +245,16 @@ static_assert(sizeof(NodeBVH2_SOBB) == 64);
 static_assert(sizeof(NodeBVH2_SOBB_c) == 112);
 static_assert(sizeof(NodeBVH2_SOBBi) == 44);
 static_assert(sizeof(NodeBVH2_SOBBi_c) == 64);
+static_assert(sizeof(NodeBVH2_MIXED_c) == 64);
+static_assert(sizeof(NodeBVH2_AABB_q) == 40);
+static_assert(sizeof(NodeBVH2_SOBBi_q) == 48);
+static_assert(sizeof(NodeBVH4_AABB_c) == 112);
+static_assert(sizeof(NodeBVH8_AABB_c) == 224);
+static_assert(sizeof(NodeBVH4_SOBB_c) == 208);
+static_assert(sizeof(NodeBVH8_SOBB_c) == 416);
+static_assert(sizeof(NodeBVH4_SOBBi_c) == 128);
+static_assert(sizeof(NodeBVH8_SOBBi_c) == 256);
+static_assert(sizeof(BlasDescriptor) == 32);
 }
 #    pragma pack(pop)
 #else
@@ -166,6 +274,17 @@ layout(buffer_reference, scalar) buffer BVH2_SOBB_c { NodeBVH2_SOBB_c node[]; };
 
 layout(buffer_reference, scalar) buffer BVH2_SOBBi { NodeBVH2_SOBBi node[]; };
 layout(buffer_reference, scalar) buffer BVH2_SOBBi_c { NodeBVH2_SOBBi_c node[]; };
+layout(buffer_reference, scalar) buffer BVH2_MIXED_c { NodeBVH2_MIXED_c node[]; };
+
+layout(buffer_reference, scalar) buffer BVH2_AABB_q { NodeBVH2_AABB_q node[]; };
+layout(buffer_reference, scalar) buffer BVH2_SOBBi_q { NodeBVH2_SOBBi_q node[]; };
+
+layout(buffer_reference, scalar) buffer BVH4_AABB_c { NodeBVH4_AABB_c node[]; };
+layout(buffer_reference, scalar) buffer BVH8_AABB_c { NodeBVH8_AABB_c node[]; };
+layout(buffer_reference, scalar) buffer BVH4_SOBB_c { NodeBVH4_SOBB_c node[]; };
+layout(buffer_reference, scalar) buffer BVH8_SOBB_c { NodeBVH8_SOBB_c node[]; };
+layout(buffer_reference, scalar) buffer BVH4_SOBBi_c { NodeBVH4_SOBBi_c node[]; };
+layout(buffer_reference, scalar) buffer BVH8_SOBBi_c { NodeBVH8_SOBBi_c node[]; };
 
 layout(buffer_reference, scalar) buffer BvhStats
 {
@@ -176,9 +295,15 @@ layout(buffer_reference, scalar) buffer BvhStats
     uint leafSizeSum;
     uint leafSizeMin;
     uint leafSizeMax;
+    uint aabbChildCount;
 };
+layout(buffer_reference, scalar) buffer BvhCounts_ref { BvhCounts c; };
+layout(buffer_reference, scalar) buffer BvhDispatch_ref { BvhDispatch d; };
+// counts of the tree a stage reads, the push constants of the stage carry its countsAddress
+#define BVH_COUNTS BvhCounts_ref(pc.data.countsAddress).c
 layout(buffer_reference, scalar) buffer BvhTriangles { BvhTriangle t[]; };
 layout(buffer_reference, scalar) buffer BvhTriangleIndices { BvhTriangleIndex val[]; };
+layout(buffer_reference, scalar) buffer BlasDescriptors { BlasDescriptor b[]; };
 #endif
 
 #endif
@@ -9,6 +9,22 @@ namespace data_plocpp {
 #else
 #endif
 
+// space filling curves ordering the initial clusters
+#define SFC_MORTON32 0
+#define SFC_MORTON64 1
+#define SFC_HILBERT64 2
+
+// search radius schedules of the PLOC++ iterations, see iterationRadius() in plocpp_aabb_PLOCpp.comp
+#define PLOC_RADIUS_FIXED 0
+#define PLOC_RADIUS_LINEAR 1
+#define PLOC_RADIUS_CLUSTER_COUNT 2
+
+// search of the slab triplet a SOBB is fitted to, see FitSOBB_* in bv_sobb.glsl
+#define SOBB_FIT_GREEDY 0
+#define SOBB_FIT_ANCHORED 1
+#define SOBB_FIT_PRUNED 2
+#define SOBB_FIT_EXHAUSTIVE 3
+
 struct PC_MortonGlobal {
     vec3 sceneAabbCubedMin;
     f32 sceneAabbNormalizationScale;
@@ -17,6 +33,8 @@ struct PC_MortonGlobal {
     u64 bvhTrianglesAddress;
     u64 bvhTriangleIndicesAddress;
     u64 auxBufferAddress;
+    u32 spaceFilling;
+    u32 clusterIdBits;
 };
 
 struct PC_MortonPerGeometry {
@@ -27,10 +45,37 @@ struct PC_MortonPerGeometry {
     u32 triangleCount;
 };
 
+struct PC_MortonInstances {
+    u64 instancesAddress;
+    u32 instanceCount;
+};
+
+// the priority pass sums the split priorities of all triangles, the split pass distributes the budget by them
+#define SPLIT_PHASE_PRIORITIES 0
+#define SPLIT_PHASE_SPLIT 1
+
+struct PC_SplitClusters {
+    vec3 sceneAabbCubedMin;
+    f32 sceneAabbNormalizationScale;
+    u64 mortonAddress;
+    u64 bvhAddress;
+    u64 bvhTriangleIndicesAddress;
+    u64 geometryDescriptorAddress;
+    u64 prioritiesAddress;
+    u64 prioritySumAddress;
+    u64 idbAddress;
+    u32 spaceFilling;
+    u32 clusterIdBits;
+    u32 triangleCount;
+    u32 splitBudget;
+    u32 phase;
+};
+
 struct PC_CopySortedNodeIds {
     u64 mortonAddress;
     u64 nodeIdAddress;
     u32 clusterCount;
+    u32 clusterIdMask;
 };
 
 struct PC_PlocppIterationIndirect {
@@ -41,6 +86,10 @@ struct PC_PlocppIterationIndirect {
     u64 runtimeDataAddress;
     u64 auxBufferAddress;
     u64 idbAddress;
+
+    u32 radiusSchedule;
+    u32 radiusMin;
+    u32 radiusStep;
 };
 
 struct PC_DiscoverPairs {
@@ -80,8 +129,8 @@ struct PC_Collapse {
     u64 indirectDispatchBufferAddress;
 
     u64 debugAddress;
+    u64 countsAddress;
 
-    u32 leafNodeCount;
     u32 maxLeafSize;
 
     f32 c_t;
@@ -96,8 +145,7 @@ struct PC_TransformToDOP {
     u64 bvhNodeCountsAddress;
     u64 geometryDescriptorAddress;
     u64 countersAddress;
-
-    u32 leafNodeCount;
+    u64 countsAddress;
 };
 
 struct PC_TransformToOBB {
@@ -112,8 +160,7 @@ struct PC_TransformToOBB {
     u64 traversalCounterAddress;
     u64 schedulerDataAddress;
     u64 timesAddress_TMP;
-
-    u32 leafNodeCount;
+    u64 countsAddress;
 };
 
 struct PC_TransformToSOBB {
@@ -128,8 +175,13 @@ struct PC_TransformToSOBB {
     u64 dopRefAddress;
 
     u64 statsAddress;
+    u64 countsAddress;
 
-    u32 leafNodeCount;
+    // intersection cost of a SOBB relative to an AABB, for the hybrid transformation
+    f32 sobbCostRatio;
+    // one of SOBB_FIT_*, the pruned search tries triplets of the sobbCandidates narrowest slabs only
+    u32 sobbFit;
+    u32 sobbCandidates;
 };
 
 struct PC_Rearrange {
@@ -138,7 +190,65 @@ struct PC_Rearrange {
     u64 workBufferAddress;
     u64 runtimeDataAddress;
     u64 auxBufferAddress;
-    u32 leafNodeCount;
+    u64 countsAddress;
+};
+
+struct PC_Refit {
+    u64 bvhAddress;
+    u64 bvhTrianglesAddress;
+    u64 bvhTriangleIndicesAddress;
+
+    u64 geometryDescriptorAddress;
+    u64 countersAddress;
+    u64 countsAddress;
+};
+
+struct PC_Restructure {
+    u64 bvhAddress;
+    u64 bvhTriangleIndicesAddress;
+    u64 bvhScoreAddress;
+
+    u64 geometryDescriptorAddress;
+    u64 countersAddress;
+    u64 costAddress;
+    u64 countsAddress;
+
+    f32 c_t;
+    f32 c_i;
+};
+
+// phases of one reinsertion iteration, the initial refit only fills the score bounds
+#define REINSERT_PHASE_INIT 0
+#define REINSERT_PHASE_SEARCH 1
+#define REINSERT_PHASE_APPLY 2
+#define REINSERT_PHASE_REFIT 3
+
+struct PC_Reinsert {
+    u64 bvhAddress;
+    u64 bvhTriangleIndicesAddress;
+    u64 bvhScoreAddress;
+
+    u64 geometryDescriptorAddress;
+    u64 countersAddress;
+    u64 candidatesAddress;
+    u64 locksAddress;
+    u64 runtimeDataAddress;
+    u64 countsAddress;
+
+    u32 phase;
+    u32 iteration;
+    f32 minReinsertionRatio;
+};
+
+struct ReinsertionCandidate {
+    i32 target;
+    i32 lca;
+    f32 gain;
+};
+
+struct SC_Restructure {
+    u32 sizeWorkgroup;
+    u32 treeletSize;
 };
 
 struct SC {
@@ -154,11 +264,6 @@ struct SC {
 #endif
 };
 
-struct Morton32KeyVal {
-    u32 key;
-    u32 mortonCode;
-};
-
 struct DLPartitionData {
     u32 aggregate;
     u32 prefix;
@@ -170,6 +275,8 @@ struct PLOCData {
     u32 iterationTaskCount;
     u32 fill;
     u32 iterationCounter;
+    u32 iterationRadius;
+    u32 leafClusterCount;
 };
 
 struct IndirectClusters {
@@ -184,23 +291,28 @@ struct IndirectClusters {
 };
 
 #ifndef INCLUDE_FROM_SHADER
-static_assert(sizeof(PC_MortonGlobal) == 56);
+static_assert(sizeof(PC_MortonGlobal) == 64);
 static_assert(sizeof(PC_MortonPerGeometry) == 28);
-static_assert(sizeof(PC_PlocppIterationIndirect) == 56);
+static_assert(sizeof(PC_MortonInstances) == 12);
+static_assert(sizeof(PC_PlocppIterationIndirect) == 68);
 static_assert(sizeof(PC_DiscoverPairs) == 96);
-static_assert(sizeof(PC_CopySortedNodeIds) == 20);
-static_assert(sizeof(PC_Collapse) == 144);
-static_assert(sizeof(PC_TransformToDOP) == 52);
-static_assert(sizeof(PC_TransformToOBB) == 76);
-static_assert(sizeof(PC_TransformToSOBB) == 68);
-static_assert(sizeof(PC_Rearrange) == 44);
+static_assert(sizeof(PC_SplitClusters) == 92);
+static_assert(sizeof(PC_CopySortedNodeIds) == 24);
+static_assert(sizeof(PC_Collapse) == 148);
+static_assert(sizeof(PC_TransformToDOP) == 56);
+static_assert(sizeof(PC_TransformToOBB) == 80);
+static_assert(sizeof(PC_TransformToSOBB) == 84);
+static_assert(sizeof(PC_Rearrange) == 48);
+static_assert(sizeof(PC_Refit) == 48);
+static_assert(sizeof(PC_Restructure) == 64);
+static_assert(sizeof(PC_Reinsert) == 84);
 static_assert(sizeof(IndirectClusters) == 28);
 }
 #    pragma pack(pop)
 #else
-layout(buffer_reference, scalar) buffer Morton32KeyVals { Morton32KeyVal keyval[]; };
 layout(buffer_reference, scalar) buffer DLWork_buf { DLPartitionData val[]; };
 layout(buffer_reference, scalar) buffer IndirectClusters_ref { IndirectClusters ic; };
+layout(buffer_reference, scalar) buffer ReinsertionCandidate_buf { ReinsertionCandidate val[]; };
 
 #endif
 
@@ -65,6 +65,8 @@ struct TraceTime {
 
 struct TraceTimes {
     TraceTime times[8];
+    // occlusion traversal of the shadow rays cast at each depth
+    TraceTime shadowTimes[8];
 };
 
 struct TraceStats {
@@ -94,6 +96,29 @@ struct PC_Trace {
 
     u64 traceTimeAddress;
     u64 traceStatsAddress;
+
+    // two-level tree only: bvh* addresses describe the top level over instances
+    u64 instancesAddress;
+    u64 blasDescriptorsAddress;
+    u64 instanceHitAddress;
+
+    // indexed leaves fetch their vertices through the triangle ids, bvhTrianglesAddress is 0 then
+    u64 geometryDescriptorAddress;
+
+    // sorted keyvals of ptrace_SortRays.comp, rays are fetched through their low 32 bits when the count is not 0
+    u64 rayOrderAddress;
+    u64 rayOrderCountAddress;
+};
+
+struct PC_SortRays {
+    u64 rayBufferMetadataAddress;
+    u64 rayBufferAddress;
+    u64 keyvalsAddress;
+    u64 sortCountAddress;
+
+    vec3 sceneAabbCubedMin;
+    f32 sceneAabbNormalizationScale;
+    u32 minRayCount;
 };
 
 struct PC_ShadeCast {
@@ -110,12 +135,30 @@ struct PC_ShadeCast {
     u64 rayTraceResultAddress;
     u64 geometryDescriptorAddress;
     u64 bvhTriangleIndicesAddress;
+    u64 instancesAddress;
+    u64 instanceHitAddress;
+
+    // shadow rays toward the directional light, cast from each hit when the addresses are not 0. Their contribution
+    // is gathered per pixel in pathRadiance and added to the image once the path terminates.
+    u64 shadow_rayBufferMetadataAddress;
+    u64 shadow_rayBufferAddress;
+    u64 shadow_rayPayloadAddress;
+    u64 pathRadianceAddress;
 
     u32 depth;
     u32 depthMax;
     u32 samplesComputed;
 };
 
+// adds the payload throughput of the unoccluded shadow rays to the radiance of their paths
+struct PC_ResolveShadows {
+    u64 rayBufferMetadataAddress;
+    u64 rayPayloadAddress;
+    u64 rayTraceResultAddress;
+    u64 pathRadianceAddress;
+    u32 imageWidth;
+};
+
 #ifndef INCLUDE_FROM_SHADER
 static_assert(sizeof(Ray) == 32);
 static_assert(sizeof(RayBufferMetadata) == 8);
@@ -124,11 +167,13 @@ static_assert(sizeof(RayTraceResult_BV) == 24);
 static_assert(sizeof(RayTraceResult_Intersections) == 24);
 static_assert(sizeof(RayPayload) == 20);
 static_assert(sizeof(TraceTime) == 16);
-static_assert(sizeof(TraceTimes) == 128);
+static_assert(sizeof(TraceTimes) == 256);
 static_assert(sizeof(TraceStats) == 16);
 static_assert(sizeof(PC_GenPrimary) == 32);
-static_assert(sizeof(PC_Trace) == 72);
-static_assert(sizeof(PC_ShadeCast) == 100);
+static_assert(sizeof(PC_Trace) == 120);
+static_assert(sizeof(PC_SortRays) == 52);
+static_assert(sizeof(PC_ShadeCast) == 148);
+static_assert(sizeof(PC_ResolveShadows) == 36);
 }
 #    pragma pack(pop)
 #else
@@ -3,6 +3,8 @@
 
 #ifndef INCLUDE_FROM_SHADER
 #    include <berries/util/types.h>
+using vec3 = f32[3];
+using vec4 = f32[4];
 #    pragma pack(push, 1)
 namespace data_scene {
 #else
@@ -15,12 +17,24 @@ struct Geometry {
     u64 uvAddress;
 };
 
+// geometry placed by a scene node, transforms are stored as the top three rows of a 4x4 matrix
+struct Instance {
+    vec4 objectToWorld[3];
+    vec4 worldToObject[3];
+    vec3 aabbMin;
+    u32 geometryId;
+    vec3 aabbMax;
+    u32 blasId;
+};
+
 #ifndef INCLUDE_FROM_SHADER
 static_assert(sizeof(Geometry) == 32);
+static_assert(sizeof(Instance) == 128);
 }
 #    pragma pack(pop)
 #else
 layout(buffer_reference, scalar) buffer GeometryDescriptor { Geometry g[]; };
+layout(buffer_reference, scalar) buffer Instances { Instance i[]; };
 #endif
 
 #endif
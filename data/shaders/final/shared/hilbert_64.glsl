@@ -0,0 +1,48 @@
+#ifndef HILBERT_64_GLSL
+#define HILBERT_64_GLSL
+
+#include "type_64.glsl"
+#include "morton_64.glsl"
+
+// Skilling's transform of the axes to the transposed Hilbert index, interleaved the same way as the Morton code,
+// same 20 bits per axis as the 64-bit Morton code
+const u32 HILBERT_BITS = 20;
+const u32 HILBERT_SCALE_TO_U64 = (1u << HILBERT_BITS) - 1;
+
+u64 hilbertCode64(in uvec3 p)
+{
+    u32 x[3] = u32[3](p.x, p.y, p.z);
+
+    for (u32 q = 1u << (HILBERT_BITS - 1); q > 1; q >>= 1) {
+        const u32 mask = q - 1;
+        for (i32 i = 0; i < 3; i++) {
+            if ((x[i] & q) != 0)
+                x[0] ^= mask;
+            else {
+                const u32 t = (x[0] ^ x[i]) & mask;
+                x[0] ^= t;
+                x[i] ^= t;
+            }
+        }
+    }
+
+    x[1] ^= x[0];
+    x[2] ^= x[1];
+    u32 t = 0;
+    for (u32 q = 1u << (HILBERT_BITS - 1); q > 1; q >>= 1)
+        if ((x[2] & q) != 0)
+            t ^= q - 1;
+    x[0] ^= t;
+    x[1] ^= t;
+    x[2] ^= t;
+
+    // the first axis holds the most significant bit of every level
+    return mortonCode64_part(x[2]) | (mortonCode64_part(x[1]) << 1) | (mortonCode64_part(x[0]) << 2);
+}
+
+u64 hilbertCode64(in vec3 p)
+{
+    return hilbertCode64(uvec3(p * HILBERT_SCALE_TO_U64));
+}
+
+#endif
@@ -276,7 +276,9 @@ vec2 intersect(in SOBB bv, in RayDetail rd, in f32 tmax, out vec3 normal)
 #endif
 
 #ifdef INTERSECTION_SOBBi
+#ifndef BVH_TYPE
 #define BVH_TYPE BVH2_SOBBi_c
+#endif
 vec2 testSlab(in vec3 normal, in vec2 slab, in vec3 dir, in vec3 origin)
 {
     float dotResult = dot(normal, dir);
@@ -318,4 +320,16 @@ vec2 intersect(in SOBBi bv, in RayDetail rd, in f32 tmax, out vec3 normal)
 }
 #endif
 
+#ifdef INTERSECTION_MIXED
+#include "data_bvh.h"
+
+// tagged children hold an AABB in the x, y, z slabs of the SOBB and take the cheaper slab test
+vec2 intersectMixed(in SOBBi bv, in i32 c, in RayDetail rd, in f32 tmax)
+{
+    if ((c & MIXED_CHILD_AABB) != 0)
+        return intersect(AABB(vec3(bv.b0.x, bv.b1.x, bv.b2.x), vec3(bv.b0.y, bv.b1.y, bv.b2.y)), rd, tmax);
+    return intersect(bv, rd, tmax);
+}
+#endif
+
 #endif
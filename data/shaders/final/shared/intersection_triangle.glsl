@@ -0,0 +1,64 @@
+#ifndef INTERSECTION_TRIANGLE_GLSL
+#define INTERSECTION_TRIANGLE_GLSL
+
+#include "types.glsl"
+
+// watertight ray/triangle test of Woop, Benthin and Wald (JCGT 2013), used by leaves that store triangle ids
+// instead of precomputed Woop triangles. The per ray shear is computed once, when the ray is fetched.
+struct RayWatertight {
+    ivec3 k;
+    vec3 s;
+};
+
+RayWatertight initRayWatertight(in vec3 dir)
+{
+    RayWatertight wr;
+    const vec3 absDir = abs(dir);
+    wr.k.z = (absDir.x > absDir.y) ? ((absDir.x > absDir.z) ? 0 : 2) : ((absDir.y > absDir.z) ? 1 : 2);
+    wr.k.x = (wr.k.z + 1) % 3;
+    wr.k.y = (wr.k.x + 1) % 3;
+    // keep the winding of the triangles
+    if (dir[wr.k.z] < 0.f) {
+        const i32 tmp = wr.k.x;
+        wr.k.x = wr.k.y;
+        wr.k.y = tmp;
+    }
+    wr.s = vec3(dir[wr.k.x] / dir[wr.k.z], dir[wr.k.y] / dir[wr.k.z], 1.f / dir[wr.k.z]);
+    return wr;
+}
+
+// on hit, tuv holds the distance and the barycentric coordinates of v0 and v1, as expected by the shading
+bool intersectWatertight(in RayWatertight wr, in vec3 origin, in f32 tmin, in f32 tmax, in vec3 v0, in vec3 v1, in vec3 v2, out vec3 tuv)
+{
+    const vec3 a = v0 - origin;
+    const vec3 b = v1 - origin;
+    const vec3 c = v2 - origin;
+
+    const f32 ax = a[wr.k.x] - wr.s.x * a[wr.k.z];
+    const f32 ay = a[wr.k.y] - wr.s.y * a[wr.k.z];
+    const f32 bx = b[wr.k.x] - wr.s.x * b[wr.k.z];
+    const f32 by = b[wr.k.y] - wr.s.y * b[wr.k.z];
+    const f32 cx = c[wr.k.x] - wr.s.x * c[wr.k.z];
+    const f32 cy = c[wr.k.y] - wr.s.y * c[wr.k.z];
+
+    const f32 u = cx * by - cy * bx;
+    const f32 v = ax * cy - ay * cx;
+    const f32 w = bx * ay - by * ax;
+
+    if ((u < 0.f || v < 0.f || w < 0.f) && (u > 0.f || v > 0.f || w > 0.f))
+        return false;
+
+    const f32 det = u + v + w;
+    if (det == 0.f)
+        return false;
+
+    const f32 invDet = 1.f / det;
+    const f32 t = (u * a[wr.k.z] + v * b[wr.k.z] + w * c[wr.k.z]) * wr.s.z * invDet;
+    if (t <= tmin || t >= tmax)
+        return false;
+
+    tuv = vec3(t, u * invDet, v * invDet);
+    return true;
+}
+
+#endif
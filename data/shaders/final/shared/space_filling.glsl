@@ -0,0 +1,24 @@
+#ifndef SPACE_FILLING_GLSL
+#define SPACE_FILLING_GLSL
+
+#include "type_64.glsl"
+#include "morton_32.glsl"
+#include "morton_64.glsl"
+#include "hilbert_64.glsl"
+
+// expects the SFC_ curve ids from data_plocpp.h
+
+// Sort keyval of a cluster with its centroid normalized to the unit cube. The radix sort orders keyvals by their high
+// bits, the lowest clusterIdBits bits keep the cluster id. 64-bit codes are aligned to the top and lose as many
+// of their lowest bits as the id needs.
+u64 sortKeyval(in u32 clusterId, in vec3 p, in u32 spaceFilling, in u32 clusterIdBits)
+{
+    if (spaceFilling == SFC_MORTON32)
+        return (u64(mortonCode32(p)) << 32) | u64(clusterId);
+
+    const u64 code = (spaceFilling == SFC_HILBERT64 ? hilbertCode64(p) : mortonCode64(p)) << 4;
+    const u64 idMask = (u64(1) << clusterIdBits) - 1;
+    return (code & ~idMask) | u64(clusterId);
+}
+
+#endif
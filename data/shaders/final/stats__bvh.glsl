@@ -24,7 +24,7 @@ shared uint leafSizeMin;
 shared uint leafSizeMax;
 
 void stats() {
-    if (gl_GlobalInvocationID.x >= (pc.data.nodeCount - 1))
+    if (gl_GlobalInvocationID.x >= (BVH_COUNTS.nodeCountTotal - 1))
         return;
     if (gl_LocalInvocationID.x == 0) {
         satAggregate = 0.f;
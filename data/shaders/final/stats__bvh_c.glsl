@@ -5,6 +5,10 @@
 #define EXPAND_AND_CONCAT(a, b) CONCAT(a, b)
 #define BVH_NODE EXPAND_AND_CONCAT(Node, BVH_TYPE)
 
+#ifndef CHILD_BV
+#define CHILD_BV(node, i) (node).bv[i]
+#endif
+
 #define INCLUDE_FROM_SHADER
 #include "shared/data_bvh.h"
 
@@ -21,9 +25,12 @@ shared f32 ciAggregate;
 shared u32 leafSizeSum;
 shared u32 leafSizeMin;
 shared u32 leafSizeMax;
+#ifdef MIXED_CHILDREN
+shared u32 aabbChildCount;
+#endif
 
 void stats() {
-    if (gl_GlobalInvocationID.x >= (pc.data.nodeCount - 1))
+    if (gl_GlobalInvocationID.x >= (BVH_COUNTS.nodeCountTotal - 1))
         return;
     if (gl_LocalInvocationID.x == 0) {
         satAggregate = 0.f;
@@ -33,6 +40,9 @@ void stats() {
         leafSizeSum = 0;
         leafSizeMin = 0xFFFFFFFF;
         leafSizeMax = 0;
+#ifdef MIXED_CHILDREN
+        aabbChildCount = 0;
+#endif
     }
     barrier();
 
@@ -41,7 +51,11 @@ void stats() {
 
     for (i32 i = 0; i < WIDTH; i++) {
         if (node.c[i] != INVALID_VALUE_I32) {
-            float sa = bvArea(node.bv[i]);
+            float sa = bvArea(CHILD_BV(node, i));
+#ifdef MIXED_CHILDREN
+            if ((node.c[i] & MIXED_CHILD_AABB) != 0)
+                atomicAdd(aabbChildCount, 1);
+#endif
 
             if (node.c[i] < 0) {
                 int32_t size = ((node.c[i] >> 27) & 0xF) + 1;
@@ -69,6 +83,9 @@ void stats() {
         atomicAdd(stats.leafSizeSum, leafSizeSum);
         atomicMin(stats.leafSizeMin, leafSizeMin);
         atomicMax(stats.leafSizeMax, leafSizeMax);
+#ifdef MIXED_CHILDREN
+        atomicAdd(stats.aabbChildCount, aabbChildCount);
+#endif
     }
 }
 #endif
@@ -46,10 +46,41 @@ SOBBi bvEncode(in DOP dop, in int i, in int j, in int k)
 }
 #endif
 
+f32 FitConfigured(in DOP dop, out i32 i, out i32 j, out i32 k)
+{
+    switch (pc.data.sobbFit) {
+    case SOBB_FIT_GREEDY:
+        return FitSOBB_k1(dop, i, j, k);
+    case SOBB_FIT_PRUNED:
+        return FitSOBB_pruned(dop, pc.data.sobbCandidates, i, j, k);
+    case SOBB_FIT_EXHAUSTIVE:
+        return FitSOBB_k3(dop, i, j, k);
+    default:
+        return FitSOBB_k2(dop, i, j, k);
+    }
+}
+
+// hybrid trees keep the axis aligned slabs 0, 1, 2 when the SOBB does not pay off its more expensive intersection
+void FitBV(in DOP dop, out i32 i, out i32 j, out i32 k)
+{
+    const f32 sobbArea = FitConfigured(dop, i, j, k);
+#ifdef TRANSFORM_HYBRID
+    const f32 d0 = dop_slab_d(dop, 0);
+    const f32 d1 = dop_slab_d(dop, 1);
+    const f32 d2 = dop_slab_d(dop, 2);
+    const f32 aabbArea = 2.f * (d0 * d1 + d0 * d2 + d1 * d2);
+    if (aabbArea <= sobbArea * pc.data.sobbCostRatio) {
+        i = 0;
+        j = 1;
+        k = 2;
+    }
+#endif
+}
+
 void transform(in u32 taskId)
 {
     u32 nodeId = taskId * gl_WorkGroupSize.x + gl_LocalInvocationID.x;
-    if (nodeId >= pc.data.leafNodeCount)
+    if (nodeId >= BVH_COUNTS.nodeCountLeaf)
         return;
 
     BvhTriangleIndices triangleIndices = BvhTriangleIndices(pc.data.bvhTriangleIndicesAddress);
@@ -97,7 +128,7 @@ void transform(in u32 taskId)
     dops.val[nodeId] = dop;
 
     i32 i, j, k;
-    FitSOBB(dop, i, j, k);
+    FitBV(dop, i, j, k);
     bvhSOBB.node[nodeId].bv = bvEncode(dop, i, j, k);
 
     // '~' encoded leafId
@@ -122,7 +153,7 @@ void transform(in u32 taskId)
         dopIds.val[nodeId] = dopIds.val[cId];
         dops.val[dopIds.val[nodeId]] = dop;
 
-        FitSOBB(dop, i, j, k);
+        FitBV(dop, i, j, k);
         bvhSOBB.node[nodeId].bv = bvEncode(dop, i, j, k);
 
         memoryBarrier(gl_ScopeQueueFamily, gl_StorageSemanticsBuffer, gl_SemanticsAcquireRelease | gl_SemanticsMakeAvailable | gl_SemanticsMakeVisible);
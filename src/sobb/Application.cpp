@@ -115,6 +115,12 @@ int Application::Run()
         benchmark.Run();
         animation.Run();
 
+        if (!scenes.empty() && scenes.back()->changed.transformation) {
+            scenes.back()->RecomputeWorldMatrices();
+            backend.UpdateTransformationMatrices(*scenes.back());
+            scenes.back()->changed.transformation = false;
+        }
+
         glfwPollEvents();
         asyncProcessing.Check();
         gui();
@@ -160,7 +166,7 @@ void Application::AsyncProcessing::Check()
 
     if (fHotReload.valid() && isReady(fHotReload))
         fHotReload.get();
-    if (!fHotReload.valid() && app.state.shaderHotReload && app.backend.state.oncePer250ms)
+    if (!fHotReload.valid() && app.state.shaderHotReload && (app.shaderManager.IsEventDriven() || app.backend.state.oncePer250ms))
         fHotReload = app.mainExecutor.async([this]() {
             app.shaderManager.CheckForHotReload();
         });
@@ -199,6 +205,7 @@ void Application::loadSceneBinary(std::string_view path)
     berry::log::timer("Scene load started (binary)", glfwGetTime());
     asyncProcessing.scenes.push_back(mainExecutor.async([this, path = std::filesystem::path(path)]() {
         HostScene result { scene::deserialize(path) };
+        result.contentHash = scene::contentHash(path);
         berry::log::timer("  deserialized", glfwGetTime());
 
         result.RecomputeWorldMatrices();
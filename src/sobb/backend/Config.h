@@ -21,19 +21,51 @@ enum class BV {
     eSOBB_i32,
     eSOBB_i48,
     eSOBB_i64,
+
+    eHybrid_i32,
 };
 
 enum class SpaceFilling {
     eMorton32,
+    eMorton64,
+    eHilbert64,
 };
 
 enum class NodeLayout {
     eDefault,
     eBVH2,
+    eBVH2q,
+    eBVH4,
+    eBVH8,
 };
 
 enum class InitialClusters {
     eTriangles,
+    eTriangleSplits,
+};
+
+enum class RadiusSchedule {
+    eFixed,
+    eLinear,
+    eClusterCount,
+};
+
+// Woop triangles, or scene triangle ids only
+enum class TriangleLayout {
+    eWoop,
+    eIndexed,
+};
+
+enum class SOBBFit {
+    eGreedy,
+    eAnchored,
+    ePruned,
+    eExhaustive,
+};
+
+enum class RestructuringMethod {
+    eTreelet,
+    eReinsertion,
 };
 
 struct PLOC {
@@ -47,11 +79,33 @@ struct PLOC {
     } shader;
     SpaceFilling sfc { SpaceFilling::eMorton32 };
     InitialClusters ic { InitialClusters::eTriangles };
-    u32 radius { 16 };
+    u32 radius { 16 }; // largest one of a schedule
+    RadiusSchedule radiusSchedule { RadiusSchedule::eFixed };
+    u32 radiusMin { 4 };
+    u32 radiusStep { 2 };
+    float splitBudget { .3f }; // extra leaves per triangle, AABB only
+    u32 workgroupSize { 0 }; // multiple of 32, 0 for the device maximum
 
     bool operator==(PLOC const& rhs) const = default;
 };
 
+struct Restructuring {
+    BV bv { BV::eNone }; // scoring volume, the tree keeps AABBs
+    struct Shaders {
+        std::string restructure;
+
+        bool operator==(Shaders const& rhs) const = default;
+    } shader;
+    RestructuringMethod method { RestructuringMethod::eTreelet };
+    u32 treeletSize { 7 };
+    u32 iterations { 3 };
+    float c_t { 3.f };
+    float c_i { 2.f };
+    float minReinsertionRatio { 1e-3f }; // of the nodes moved per iteration, fewer stop the reinsertion
+
+    bool operator==(Restructuring const& rhs) const = default;
+};
+
 struct Collapsing {
     BV bv { BV::eNone };
     struct Shaders {
@@ -59,6 +113,7 @@ struct Collapsing {
 
         bool operator==(Shaders const& rhs) const = default;
     } shader;
+    TriangleLayout triangles { TriangleLayout::eWoop }; // collapsed trees only
     u32 maxLeafSize { 15 };
     float c_t { 3.f };
     float c_i { 2.f };
@@ -73,6 +128,9 @@ struct Transformation {
 
         bool operator==(Shaders const& rhs) const = default;
     } shader;
+    float sobbCostRatio { 1.3f }; // hybrid trees only
+    SOBBFit sobbFit { SOBBFit::eAnchored };
+    u32 sobbCandidates { 6 }; // pruned fit only, 3 to 8
 
     bool operator==(Transformation const& rhs) const = default;
 };
@@ -108,11 +166,27 @@ struct Tracer {
         std::string traceRays_int;
         std::string shadeAndCast_int;
 
+        std::string sortRays;
+        std::string traceShadow;
+        std::string resolveShadows;
+
         bool operator==(Shaders const& rhs) const = default;
     } shader;
     PersistentThreads rPrimary;
     PersistentThreads rSecondary;
 
+    struct RayReordering {
+        bool enabled { false };
+        u32 minRayCount { 1u << 18 };
+
+        bool operator==(RayReordering const& rhs) const = default;
+    } reordering;
+
+    bool shadowRays { false };
+
+    u32 validateShortStack { 0 }; // short stack size checked on the host, 0 disables
+    bool shortStack { false }; // traceRays follows a restart trail
+
     u32 bvDepth { 1 };
     bool bvRenderTriangles { false };
 
@@ -131,12 +205,15 @@ struct BVHPipeline {
     std::string name;
 
     PLOC plocpp;
+    Restructuring restructuring;
     Collapsing collapsing;
     Transformation transformation;
     Rearrangement rearrangement;
     Tracer tracer;
 
     Stats stats;
+
+    bool singleSubmission { false };
 };
 
 }
@@ -12,6 +12,7 @@ struct PLOC {
     f32 timeTotal { 0.f };
 
     u32 iterationCount { 0 };
+    u32 splitCount { 0 };
     f32 saIntersect { 0.f };
     f32 saTraverse { 0.f };
     f32 costTotal { 0.f };
@@ -30,6 +31,8 @@ struct PLOC {
         berry::log::info("{:>14.2f} ms  - copy clusters", times[2]);
         berry::log::info("{:>14.2f} ms  - PLOC iterations", times[3]);
         berry::log::info("    Iteration count: {}", iterationCount);
+        if (splitCount > 0)
+            berry::log::info("    #Triangle splits: {}", splitCount);
         berry::log::info("    Cost total: {:.2f}", costTotal);
         berry::log::info("{:>17.2f}  - area intersect", saIntersect);
         berry::log::info("{:>17.2f}  - area traverse", saTraverse);
@@ -40,6 +43,31 @@ struct PLOC {
     }
 };
 
+struct Restructuring {
+    f32 timeTotal { 0.f };
+
+    u32 iterationCount { 0 };
+    u32 reinsertionCount { 0 };
+    f32 saIntersect { 0.f };
+    f32 saTraverse { 0.f };
+    f32 costTotal { 0.f };
+
+    u32 nodeCountTotal { 0 };
+
+    void print() const
+    {
+        berry::log::info("  Restructuring:");
+        berry::log::info("    Time total: {:.2f} ms", timeTotal);
+        berry::log::info("    Iteration count: {}", iterationCount);
+        if (reinsertionCount > 0)
+            berry::log::info("    #Reinsertions: {}", reinsertionCount);
+        berry::log::info("    Cost total: {:.2f}", costTotal);
+        berry::log::info("{:>17.2f}  - area intersect", saIntersect);
+        berry::log::info("{:>17.2f}  - area traverse", saTraverse);
+        berry::log::info("    #Nodes total: {}", nodeCountTotal);
+    }
+};
+
 struct Transformation {
     f32 timeTotal { 0.f };
 
@@ -103,6 +131,8 @@ struct Rearrangement {
     u32 leafSizeMin { 0 };
     u32 leafSizeMax { 0 };
     f32 leafSizeAvg { 0.f };
+    // children bounded by an AABB in the mixed layout
+    u32 childCountAABB { 0 };
 
     void print() const
     {
@@ -115,29 +145,83 @@ struct Rearrangement {
         berry::log::info("    Leaf size min: {}", leafSizeMin);
         berry::log::info("    Leaf size max: {}", leafSizeMax);
         berry::log::info("    Leaf size avg: {:.2f}", leafSizeAvg);
+        if (childCountAABB > 0)
+            berry::log::info("    #AABB children: {}", childCountAABB);
+    }
+};
+
+struct Refit {
+    f32 timeTotal { 0.f };
+
+    f32 costTotal { 0.f };
+    f32 costReference { 0.f };
+    f32 sahDegradation { 1.f };
+    bool rebuildScheduled { false };
+
+    void print() const
+    {
+        berry::log::info("  Refit:");
+        berry::log::info("    Time total: {:.2f} ms", timeTotal);
+        berry::log::info("    Cost total: {:.2f}", costTotal);
+        berry::log::info("    Cost of the built tree: {:.2f}", costReference);
+        berry::log::info("    SAH degradation: {:.3f}{}", sahDegradation, rebuildScheduled ? " (rebuild scheduled)" : "");
+    }
+};
+
+// two-level tree over instanced scene nodes, stage stats above then describe the last bottom level built
+struct Instancing {
+    u32 blasCount { 0 };
+    u32 instanceCount { 0 };
+    u32 triangleCountUnique { 0 };
+    u32 triangleCountInstanced { 0 };
+    u64 memoryBlas { 0 };
+
+    f32 timeBlas { 0.f };
+    f32 timeTlas { 0.f };
+
+    void print() const
+    {
+        berry::log::info("  Instancing:");
+        berry::log::info("    Bottom level trees: {}, instances: {}", blasCount, instanceCount);
+        berry::log::info("    Triangles unique: {}, instanced: {}", triangleCountUnique, triangleCountInstanced);
+        berry::log::info("    Bottom level memory: {:.2f} MB", 1e-6f * static_cast<f32>(memoryBlas));
+        berry::log::info("    Time bottom levels: {:.2f} ms", timeBlas);
+        berry::log::info("    Time top level: {:.2f} ms", timeTlas);
     }
 };
 
 struct BVHPipeline {
     PLOC plocpp;
+    Restructuring restructuring;
     Collapsing collapsing;
     Transformation transformation;
     Rearrangement rearrangement;
+    Refit refit;
+    Instancing instancing;
 
     void print() const
     {
         plocpp.print();
+        if (restructuring.timeTotal > 0.f)
+            restructuring.print();
         collapsing.print();
+        if (refit.timeTotal > 0.f)
+            refit.print();
         transformation.print();
         rearrangement.print();
+        if (instancing.instanceCount > 0)
+            instancing.print();
     }
 
     void clear()
     {
         plocpp = {};
+        restructuring = {};
         collapsing = {};
         transformation = {};
         rearrangement = {};
+        refit = {};
+        instancing = {};
     }
 };
 
@@ -147,6 +231,8 @@ struct Trace {
         f32 traceTimeMs { 0.f };
     };
     std::array<PerDepth, 8> data;
+    // shadow rays cast at each depth, not counted in data
+    std::array<PerDepth, 8> shadow;
     u32 testedNodes { 0 };
     u32 testedTriangles { 0 };
     u32 testedBVolumes { 0 };
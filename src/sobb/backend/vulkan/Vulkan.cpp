@@ -56,6 +56,8 @@ struct Vulkan::Impl {
 
     std::unique_ptr<data::Scene> sceneOnDevice;
     data::DeviceData deviceData;
+    vk::DeviceSize geometryCompactionBudget { 16 * lime::MB };
+    std::filesystem::path bvhCacheDir;
 
     Impl(State& state, berry::Window const& window, module::ShaderManager& shaman)
         : state(state)
@@ -74,6 +76,8 @@ struct Vulkan::Impl {
         , deviceData(ctx())
     {
         lime::PrintAllPhysicalDevices(i);
+        sCache.EnablePersistentCache(pd, shaman.CacheDirectory());
+        bvhCacheDir = shaman.CacheDirectory() / "bvh";
         FuchsiaRadixSort::RadixSortCreate(d, sCache.getPipelineCache());
 
         RecreateRenderer();
@@ -106,6 +110,10 @@ struct Vulkan::Impl {
         bool const haveImageToRenderTo { backBufferDetail.image };
         u32 const imgId { swapChain.imageIndexToPresentNext };
 
+        if (std::unique_lock lock { deviceData.geometries.mutex, std::try_to_lock }; lock.owns_lock())
+            if (deviceData.geometries.Compact(geometryCompactionBudget))
+                deviceData.SetSceneDescription_TMP();
+
         if (haveImageToRenderTo) {
             lime::rg::id::Resource renderedImg;
             if (sceneOnDevice && renderer) {
@@ -131,6 +139,7 @@ struct Vulkan::Impl {
 
         swapChain.Present(device.queues.graphics.q, signalSemaphores);
         frame.Wait();
+        deviceData.geometries.ReleaseRetiredBlocks();
 
         if (sceneOnDevice)
             sceneOnDevice->changed.reset();
@@ -150,6 +159,7 @@ struct Vulkan::Impl {
 
     data::Geometry::ID AddGeometry(input::Geometry const& g)
     {
+        std::scoped_lock lock { deviceData.geometries.mutex };
         return deviceData.geometries.add(g);
     }
 
@@ -192,6 +202,7 @@ struct Vulkan::Impl {
             if (!capabilities.isAvailable<RayTracing_compute>())
                 return;
             renderer = std::make_unique<PathTracerCompute>(ctx(), device.queues.graphics);
+            static_cast<PathTracerCompute*>(renderer.get())->EnableBvhDiskCache(bvhCacheDir);
             static_cast<PathTracerCompute*>(renderer.get())->SetPipelineConfiguration(state.ptComputeConfig);
             break;
         }
@@ -219,6 +230,7 @@ struct Vulkan::Impl {
 
     void UploadScene(HostScene const& sceneOnHost)
     {
+        std::unique_lock lock { deviceData.geometries.mutex };
         auto scene = std::make_unique<data::Scene>(&deviceData, sceneOnHost);
         scene->changed.loadedOnFrame = frame.CurrentFrameId();
         sceneOnDevice = std::move(scene);
@@ -265,6 +277,23 @@ struct Vulkan::Impl {
         }
     }
 
+    std::vector<std::function<void()>> PipelineWarmUpJobs(std::vector<config::BVHPipeline> const& pipelines)
+    {
+        std::vector<bvh::PipelineKey> keys;
+        for (auto const& p : pipelines)
+            PathTracerCompute::CollectPipelineKeys(pd, p, keys);
+
+        std::vector<std::function<void()>> jobs;
+        for (auto it { keys.begin() }; it != keys.end(); ++it) {
+            if (it->shader.empty() || std::find(keys.begin(), it, *it) != it)
+                continue;
+            jobs.emplace_back([this, key = *it] {
+                [[maybe_unused]] lime::PipelineCompute const pipeline { d, sCache, key.shader, key.GetSpecializationInfo() };
+            });
+        }
+        return jobs;
+    }
+
     inline void SetCamera(input::Camera const& c)
     {
         deviceData.SetCamera_TMP(c);
@@ -413,6 +442,13 @@ void Vulkan::UpdateTransformationMatrices(HostScene const& scene)
 {
     assert(impl->sceneOnDevice);
     impl->sceneOnDevice->UpdateTransformationMatrices(scene);
+    if (impl->sceneOnDevice->changed.transformationMatrices)
+        impl->ResetAccumulation();
+}
+
+std::string Vulkan::GetDeviceName() const
+{
+    return impl->pd.getProperties().deviceName;
 }
 
 config::BVHPipeline Vulkan::GetConfig()
@@ -441,6 +477,11 @@ void Vulkan::SetPipelineConfiguration(config::BVHPipeline config)
     impl->SetPipelineConfiguration(std::move(config));
 }
 
+std::vector<std::function<void()>> Vulkan::PipelineWarmUpJobs(std::vector<config::BVHPipeline> const& pipelines) const
+{
+    return impl->PipelineWarmUpJobs(pipelines);
+}
+
 void Vulkan::SetCamera(input::Camera const& c)
 {
     impl->SetCamera(c);
@@ -8,6 +8,9 @@
 #include <berries/util/types.h>
 #include <glm/ext/vector_float4.hpp>
 
+#include <functional>
+#include <vector>
+
 struct HostScene;
 
 namespace module {
@@ -35,6 +38,7 @@ struct Vulkan {
 
     void InitGUIRenderer(char const* pathFont);
 
+    [[nodiscard]] std::string GetDeviceName() const;
     config::BVHPipeline GetConfig();
     stats::BVHPipeline GetStatsBuild() const;
     stats::Trace GetStatsTrace() const;
@@ -45,6 +49,8 @@ struct Vulkan {
     void UnloadScene();
     void UpdateTransformationMatrices(HostScene const& scene);
     void SetPipelineConfiguration(config::BVHPipeline config);
+    // independent jobs compiling every compute pipeline the given configurations use into the pipeline cache
+    [[nodiscard]] std::vector<std::function<void()>> PipelineWarmUpJobs(std::vector<config::BVHPipeline> const& pipelines) const;
     void SetCamera(input::Camera const& c);
 
     void SetVSync(bool enable, u32 x, u32 y);
@@ -23,11 +23,6 @@ struct State {
         ePLOCpp,
     };
 
-    enum class MortonCode {
-        eMorton30,
-        eMorton60,
-    };
-
     enum class Centroid {
         eTriangle,
         eAABB,
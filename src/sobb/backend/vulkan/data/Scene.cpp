@@ -1,12 +1,48 @@
 #include "Scene.h"
 
 #include "../../../scene/Scene.h"
+#include <algorithm>
+#include <cstring>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/matrix.hpp>
 
 namespace backend::vulkan::data {
 
+// device geometry is not instanced, the first node referencing a geometry places it
+static std::vector<std::pair<u32, glm::mat4>> geometryWorldTransforms(::HostScene const& sceneOnHost)
+{
+    std::vector<std::pair<u32, glm::mat4>> result;
+    std::vector<bool> placed(sceneOnHost.geometries.size(), false);
+    for (auto const& node : sceneOnHost.nodes)
+        for (auto const gId : node.geometry)
+            if (gId < placed.size() && !placed[gId]) {
+                placed[gId] = true;
+                result.emplace_back(gId, node.transformWorld);
+            }
+    return result;
+}
+
+static bool hasInstancedGeometry(::HostScene const& sceneOnHost)
+{
+    std::vector<u32> referenceCount(sceneOnHost.geometries.size(), 0);
+    for (auto const& node : sceneOnHost.nodes)
+        for (auto const gId : node.geometry)
+            if (gId < referenceCount.size() && ++referenceCount[gId] > 1)
+                return true;
+    return false;
+}
+
+// glm matrices are column major, instances store the top three rows
+static void storeRows(glm::mat4 const& m, vec4 (&rows)[3])
+{
+    for (u32 r = 0; r < 3; ++r)
+        for (u32 c = 0; c < 4; ++c)
+            rows[r][c] = m[c][r];
+}
+
 Scene::Scene(DeviceData* data, ::HostScene const& sceneOnHost)
     : data(data)
+    , contentHash(sceneOnHost.contentHash)
 {
     for (auto const& geometry : sceneOnHost.geometries) {
         backend::input::Geometry g {
@@ -25,11 +61,127 @@ Scene::Scene(DeviceData* data, ::HostScene const& sceneOnHost)
 
     aabb = sceneOnHost.aabb;
     data->SetSceneDescription_TMP();
+
+    placements.resize(geometries.size());
+    for (auto const& [gId, world] : geometryWorldTransforms(sceneOnHost))
+        placements[gId] = { .uploaded = world, .current = world };
+
+    geometryAabbs.reserve(sceneOnHost.geometries.size());
+    for (auto const& geometry : sceneOnHost.geometries)
+        geometryAabbs.emplace_back(geometry.aabb);
+
+    if (hasInstancedGeometry(sceneOnHost))
+        updateInstances(sceneOnHost);
+}
+
+Scene::Scene(DeviceData* data, Geometry::ID geometry, scene::AABB const& aabb)
+    : data(data)
+    , aabb(aabb)
+    , totalTriangleCount(data->geometries[geometry].indexCount / 3)
+    , geometries({ geometry })
+{
+}
+
+bool Scene::updateInstances(::HostScene const& sceneOnHost)
+{
+    std::vector<data_scene::Instance> result;
+    u32 triangleCount { 0 };
+    scene::AABB worldAabb;
+    for (auto const& node : sceneOnHost.nodes) {
+        for (auto const gId : node.geometry) {
+            if (gId >= geometries.size())
+                continue;
+            // uploaded geometry sits where its first node placed it, that is its object space
+            auto const objectToWorld { node.transformWorld * glm::inverse(placements[gId].uploaded) };
+            auto const& local { geometryAabbs[gId] };
+
+            data_scene::Instance instance {
+                .aabbMin = { local.min.x, local.min.y, local.min.z },
+                .geometryId = geometries[gId].get(),
+                .aabbMax = { local.max.x, local.max.y, local.max.z },
+                .blasId = gId,
+            };
+            storeRows(objectToWorld, instance.objectToWorld);
+            storeRows(glm::inverse(objectToWorld), instance.worldToObject);
+            result.emplace_back(instance);
+
+            for (u32 corner = 0; corner < 8; ++corner) {
+                glm::vec3 const p { corner & 1 ? local.max.x : local.min.x, corner & 2 ? local.max.y : local.min.y, corner & 4 ? local.max.z : local.min.z };
+                worldAabb.Fit(glm::vec3(objectToWorld * glm::vec4(p, 1.f)));
+            }
+            triangleCount += data->geometries[geometries[gId]].indexCount / 3;
+        }
+    }
+
+    auto const unchanged { result.size() == instances.size() && std::memcmp(result.data(), instances.data(), result.size() * sizeof(data_scene::Instance)) == 0 };
+    if (unchanged)
+        return false;
+
+    instances = std::move(result);
+    instancedTriangleCount = triangleCount;
+    aabb = worldAabb;
+
+    if (auto const size { instances.size() * sizeof(data_scene::Instance) }; instanceBuffer.getSizeInBytes() < size) {
+        instanceBuffer.reset();
+        instanceBuffer = data->ctx.memory.alloc({ .memoryUsage = lime::DeviceMemoryUsage::eDeviceOptimal },
+            {
+                .size = size,
+                .usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eTransferDst,
+            },
+            "scene_instances");
+    }
+    data->ctx.transfer.ToDeviceSync(instances, instanceBuffer);
+    return true;
 }
 
 void Scene::UpdateTransformationMatrices(::HostScene const& sceneOnHost)
 {
-    static_cast<void>(sceneOnHost);
+    // instanced geometry stays in object space, only the instance transforms move
+    if (IsInstanced()) {
+        if (updateInstances(sceneOnHost))
+            changed.transformationMatrices = true;
+        return;
+    }
+
+    auto const transforms { geometryWorldTransforms(sceneOnHost) };
+
+    // transformed copies are kept until the single batched upload below
+    std::vector<std::vector<glm::vec3>> transformed;
+    std::vector<GeometryHandler::VertexUpdate> updates;
+    transformed.reserve(2 * transforms.size());
+    for (auto const& [gId, world] : transforms) {
+        auto& placement { placements[gId] };
+        if (placement.current == world)
+            continue;
+
+        // vertices are uploaded as authored, motion is applied relative to the placement at upload
+        auto const& g { sceneOnHost.geometries[gId] };
+        auto const delta { world * glm::inverse(placement.uploaded) };
+        auto const deltaNormal { glm::transpose(glm::inverse(glm::mat3(delta))) };
+
+        auto& vertices { transformed.emplace_back(g.vertices.size()) };
+        std::ranges::transform(g.vertices, vertices.begin(), [&](glm::vec3 const& v) { return glm::vec3(delta * glm::vec4(v, 1.f)); });
+        auto& normals { transformed.emplace_back(g.normals.size()) };
+        std::ranges::transform(g.normals, normals.begin(), [&](glm::vec3 const& n) { return glm::normalize(deltaNormal * n); });
+
+        updates.push_back({ .id = geometries[gId], .vertexData = vertices.data(), .normalData = normals.empty() ? nullptr : normals.data() });
+        placement.current = world;
+    }
+
+    if (updates.empty())
+        return;
+    data->geometries.UpdateVertices(updates);
+
+    aabb = {};
+    for (u32 gId = 0; gId < placements.size(); ++gId) {
+        auto const& local { sceneOnHost.geometries[gId].aabb };
+        auto const delta { placements[gId].current * glm::inverse(placements[gId].uploaded) };
+        for (u32 corner = 0; corner < 8; ++corner) {
+            glm::vec3 const p { corner & 1 ? local.max.x : local.min.x, corner & 2 ? local.max.y : local.min.y, corner & 4 ? local.max.z : local.min.z };
+            aabb.Fit(glm::vec3(delta * glm::vec4(p, 1.f)));
+        }
+    }
+    changed.transformationMatrices = true;
 }
 
 }
@@ -5,6 +5,7 @@
 #include "handler/Geometry.h"
 #include <atomic>
 #include <berries/util/UidUtil.h>
+#include <glm/mat4x4.hpp>
 #include <vector>
 
 struct HostScene;
@@ -35,11 +36,35 @@ struct Scene {
 
     scene::AABB aabb;
     u32 totalTriangleCount { 0 };
+    u64 contentHash { 0 };
     std::vector<Geometry::ID> geometries;
 
+    // world transform of each geometry when uploaded and as currently placed on the device
+    struct Placement {
+        glm::mat4 uploaded { 1.f };
+        glm::mat4 current { 1.f };
+    };
+    std::vector<Placement> placements;
+
+    // one per node and referenced geometry, filled only once some geometry is placed by more than one node
+    std::vector<data_scene::Instance> instances;
+    std::vector<scene::AABB> geometryAabbs;
+    lime::Buffer instanceBuffer;
+    u32 instancedTriangleCount { 0 };
+
     Scene() = default;
     Scene(DeviceData* data, ::HostScene const& sceneOnHost);
+    // view over a single uploaded geometry, the bottom level tree of its instances is built from it
+    Scene(DeviceData* data, Geometry::ID geometry, scene::AABB const& aabb);
     void UpdateTransformationMatrices(::HostScene const& sceneOnHost);
+
+    [[nodiscard]] bool IsInstanced() const
+    {
+        return !instances.empty();
+    }
+
+private:
+    bool updateInstances(::HostScene const& sceneOnHost);
 };
 
 }
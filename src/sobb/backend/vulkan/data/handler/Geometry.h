@@ -6,6 +6,11 @@
 #include "../../../data/Input.h"
 #include <berries/util/UidUtil.h>
 
+#include <algorithm>
+#include <mutex>
+#include <span>
+#include <vector>
+
 namespace backend::vulkan::data {
 
 struct Geometry {
@@ -33,8 +38,21 @@ public:
     uidVector<Geometry> geometries;
     std::vector<lime::Buffer> buffer;
     std::vector<lime::LinearAllocator> linearAllocator;
+    std::vector<vk::DeviceSize> liveBytes;
     vk::DeviceSize alignment { 0 };
 
+    // blocks being evacuated by the incremental compaction, and evacuated blocks
+    // waiting for the frame that copied out of them to finish
+    std::vector<vk::Buffer> compactionSources;
+    std::vector<lime::Buffer> retired;
+
+    // a block is compacted once less than this fraction of its used range is live
+    static constexpr float COMPACTION_LIVE_RATIO { .5f };
+
+    // scenes upload their geometry from a worker thread, the upload holds this for its whole
+    // duration and the per frame compaction is skipped while it is held
+    std::mutex mutex;
+
 public:
     explicit GeometryHandler(VCtx ctx)
         : ctx(ctx)
@@ -88,8 +106,32 @@ public:
         return geometries.add(geometry);
     }
 
+    struct VertexUpdate {
+        Geometry::ID id;
+        void const* vertexData { nullptr };
+        void const* normalData { nullptr };
+    };
+
+    // rewrites vertex positions and normals in place, the index buffer (topology) is kept,
+    // all updates share the staging submissions
+    void UpdateVertices(std::span<VertexUpdate const> updates)
+    {
+        std::vector<lime::Transfer::BufferUpload> uploads;
+        for (auto const& u : updates) {
+            auto const& g { geometries[u.id] };
+            uploads.push_back({ .src = u.vertexData, .size = g.vertexBuffer.size, .dst = g.vertexBuffer });
+            if (u.normalData)
+                uploads.push_back({ .src = u.normalData, .size = g.normalBuffer.size, .dst = g.normalBuffer });
+        }
+        ctx.transfer.ToDeviceSync(uploads);
+    }
+
     void remove(Geometry::ID id)
     {
+        forEachBuffer(geometries[id], [this](lime::Buffer::Detail& b) {
+            if (auto const block { blockOf(b) }; block < liveBytes.size())
+                liveBytes[block] -= b.size;
+        });
         geometries.remove(id);
     }
 
@@ -98,23 +140,125 @@ public:
         geometries.reset();
         buffer.clear();
         linearAllocator.clear();
+        liveBytes.clear();
+        compactionSources.clear();
+        retired.clear();
         allocateBuffer(1);
     }
 
+    // Moves live geometry out of fragmented blocks, copying at most budget bytes per call.
+    // The copies are submitted and finished before returning, geometry details point to the
+    // new locations, so the scene description has to be updated when true is returned.
+    // Evacuated blocks are kept until ReleaseRetiredBlocks().
+    bool Compact(vk::DeviceSize budget)
+    {
+        if (compactionSources.empty())
+            scheduleCompaction();
+        if (compactionSources.empty())
+            return false;
+
+        struct Move {
+            lime::Buffer::Detail src;
+            lime::Buffer::Detail dst;
+        };
+        std::vector<Move> moves;
+        vk::DeviceSize copied { 0 };
+        for (u32 i { 0 }; i < geometries.size() && copied < budget; ++i) {
+            forEachBuffer(geometries[Geometry::ID { i }], [&](lime::Buffer::Detail& b) {
+                if (copied >= budget || !isCompactionSource(b.resource))
+                    return;
+                liveBytes[blockOf(b)] -= b.size;
+                moves.push_back({ b, allocate(b.size) });
+                b = moves.back().dst;
+                copied += b.size;
+            });
+        }
+
+        if (!moves.empty())
+            ctx.transfer.SubmitSync([&moves](vk::CommandBuffer cmd) {
+                for (auto const& m : moves)
+                    m.dst.CopyBufferToMe(cmd, m.src, 0);
+            });
+
+        retireEvacuatedBlocks();
+        return !moves.empty();
+    }
+
+    // call once no command buffer recorded before the last Compact() uses the old locations
+    void ReleaseRetiredBlocks()
+    {
+        retired.clear();
+    }
+
     // private:
     lime::Buffer::Detail allocate(vk::DeviceSize size)
     {
-        for (auto& la : linearAllocator)
-            if (auto b { la.alloc(size, alignment) }; b.resource)
+        for (u32 i { 0 }; i < linearAllocator.size(); ++i) {
+            if (isCompactionSource(buffer[i].get()))
+                continue;
+            if (auto b { linearAllocator[i].alloc(size, alignment) }; b.resource) {
+                liveBytes[i] += b.size;
                 return b;
+            }
+        }
         allocateBuffer(size);
+        liveBytes.back() += size;
         return linearAllocator.back().alloc(size, alignment);
     }
 
+    template<typename F>
+    static void forEachBuffer(Geometry& g, F&& f)
+    {
+        for (auto* b : { &g.indexBuffer, &g.vertexBuffer, &g.uvBuffer, &g.normalBuffer })
+            if (b->resource)
+                f(*b);
+    }
+
+    [[nodiscard]] size_t blockOf(lime::Buffer::Detail const& b) const
+    {
+        return static_cast<size_t>(std::ranges::find(buffer, b.resource, &lime::Buffer::get) - buffer.begin());
+    }
+
+    [[nodiscard]] bool isCompactionSource(vk::Buffer b) const
+    {
+        return std::ranges::find(compactionSources, b) != compactionSources.end();
+    }
+
+    void scheduleCompaction()
+    {
+        for (u32 i { 0 }; i < buffer.size(); ++i) {
+            auto const used { linearAllocator[i].freeAddress - linearAllocator[i].buffer.offset };
+            if (used == 0)
+                continue;
+            if (liveBytes[i] == 0) {
+                // nothing to move, the block can be reused right away
+                linearAllocator[i].reset();
+                continue;
+            }
+            if (static_cast<float>(liveBytes[i]) < COMPACTION_LIVE_RATIO * static_cast<float>(used))
+                compactionSources.push_back(buffer[i].get());
+        }
+    }
+
+    void retireEvacuatedBlocks()
+    {
+        for (size_t i { buffer.size() }; i-- > 0;) {
+            if (!isCompactionSource(buffer[i].get()) || liveBytes[i] > 0)
+                continue;
+            std::erase(compactionSources, buffer[i].get());
+            retired.emplace_back(std::move(buffer[i]));
+            buffer.erase(buffer.begin() + static_cast<i64>(i));
+            linearAllocator.erase(linearAllocator.begin() + static_cast<i64>(i));
+            liveBytes.erase(liveBytes.begin() + static_cast<i64>(i));
+        }
+        if (buffer.empty())
+            allocateBuffer(1);
+    }
+
     void allocateBuffer(vk::DeviceSize size)
     {
         using Usage = vk::BufferUsageFlagBits;
-        auto usage { Usage::eVertexBuffer | Usage::eIndexBuffer | Usage::eTransferDst };
+        auto usage { Usage::eVertexBuffer | Usage::eIndexBuffer | Usage::eTransferSrc | Usage::eTransferDst };
         if (ctx.memory.features.bufferDeviceAddress)
             usage |= Usage::eShaderDeviceAddress;
         if (ctx.capabilities.isAvailable("Ray Tracing KHR"))
@@ -124,6 +268,7 @@ public:
         buffer.emplace_back(ctx.memory.alloc({ .memoryUsage = lime::DeviceMemoryUsage::eDeviceOptimal }, { .size = size, .usage = usage }, std::format("geometry_{}", buffer.size()).c_str()));
 
         linearAllocator.emplace_back(buffer.back());
+        liveBytes.emplace_back(0);
         alignment = buffer.back().getMemoryRequirements(ctx.memory.d).alignment;
     }
 };
@@ -27,7 +27,9 @@ lime::rg::id::Resource PathTracerCompute::ScheduleRgTasks(lime::rg::Graph& rg, d
     lime::rg::id::Commands ptTask;
 
     if (scene.changed.everything) {
-        builder.buildState = bvh::Builder::BuildState::ePLOC;
+        builder.InvalidateScene();
+    } else if (scene.changed.transformationMatrices) {
+        builder.RefitGeometry();
     }
     builder.BVHBuildPiecewise(rg, scene);
 
@@ -74,6 +76,7 @@ lime::rg::id::Resource PathTracerCompute::ScheduleRgTasks(lime::rg::Graph& rg, d
             return;
 
         traceRuntimeData.geometryDescriptorAddress = scene.data->sceneDescriptionBuffer.getDeviceAddress(ctx.d);
+        traceRuntimeData.sceneAabb = scene.aabb;
         traceRuntimeData.camera = scene.data->cameraBuffer;
         traceRuntimeData.x = rg.GetResource(ptImg).extent.width;
         traceRuntimeData.y = rg.GetResource(ptImg).extent.height;
@@ -54,7 +54,16 @@ public:
     }
 
     void SetPipelineConfiguration(config::BVHPipeline config);
+    void EnableBvhDiskCache(std::filesystem::path const& dir)
+    {
+        builder.EnableDiskCache(dir);
+    }
 
+    static void CollectPipelineKeys(vk::PhysicalDevice pd, config::BVHPipeline const& config, std::vector<bvh::PipelineKey>& keys)
+    {
+        bvh::Builder::CollectPipelineKeys(pd, config, keys);
+        bvh::Tracer::CollectPipelineKeys(config.tracer, keys);
+    }
 };
 
 }
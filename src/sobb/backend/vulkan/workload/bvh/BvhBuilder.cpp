@@ -1,8 +1,11 @@
 #include "BvhBuilder.h"
+#include "TraversalReference.h"
 
-#include "../../data/Scene.h"
+#include <berries/util/Hash.h>
 #include <vLime/CommandPool.h>
+#include <vLime/Reflection.h>
 #include <vLime/RenderGraph.h>
+#include <vLime/Transfer.h>
 
 namespace backend::vulkan::bvh {
 
@@ -14,52 +17,204 @@ Bvh Builder::GetBvhForTraversal() const
     if (buildConfig.tracer.bv == config::BV::eNone)
         return {};
 
-    return rearrangement.GetBVH();
+    if (instanced)
+        return tlas.HasOutput() ? tlas.GetBVH() : Bvh {};
+    return rearrangement.HasOutput() ? rearrangement.GetBVH() : Bvh {};
+}
+
+void Builder::CollectPipelineKeys(vk::PhysicalDevice pd, config::BVHPipeline const& config, std::vector<PipelineKey>& keys)
+{
+    PLOCpp::CollectPipelineKeys(pd, config.plocpp, keys);
+    if (config.plocpp.bv == config::BV::eAABB)
+        Restructuring::CollectPipelineKeys(pd, config.restructuring, keys);
+    Collapsing::CollectPipelineKeys(pd, config.collapsing, keys);
+    Transformation::CollectPipelineKeys(pd, config.transformation, keys);
+    Rearrangement::CollectPipelineKeys(pd, config.rearrangement, keys);
+    if (config.collapsing.bv == config::BV::eAABB || (config.collapsing.bv == config::BV::eNone && config.plocpp.bv == config::BV::eAABB))
+        Refit::CollectPipelineKeys(pd, keys);
+    Tlas::CollectPipelineKeys(pd, keys);
+
+    auto statsConfig { config.stats };
+    for (auto const bv : { config.plocpp.bv, config.collapsing.bv, config.transformation.bv }) {
+        statsConfig.bv = bv;
+        Stats::CollectPipelineKeys(pd, statsConfig, config::NodeLayout::eDefault, keys);
+    }
+    statsConfig.bv = config.rearrangement.bv;
+    Stats::CollectPipelineKeys(pd, statsConfig, config.rearrangement.layout, keys);
 }
 
 void Builder::Configure(config::BVHPipeline config)
 {
+    StageCache::Key const previousUpstream { buildConfig.plocpp, buildConfig.restructuring, buildConfig.collapsing };
+    auto const upstreamBuilt { buildState == BuildState::eDone && plocpp.HasOutput() && !upstreamRefitted };
+
     buildConfig = std::move(config);
 
-    [[maybe_unused]] auto t0 = rearrangement.NeedsRecompute(buildConfig.rearrangement);
-    [[maybe_unused]] auto t1 = transformation.NeedsRecompute(buildConfig.transformation);
-    [[maybe_unused]] auto t2 = collapsing.NeedsRecompute(buildConfig.collapsing);
-    [[maybe_unused]] auto t3 = plocpp.NeedsRecompute(buildConfig.plocpp);
+    auto const t0 = rearrangement.NeedsRecompute(buildConfig.rearrangement);
+    auto const t1 = transformation.NeedsRecompute(buildConfig.transformation);
+    auto const t2 = collapsing.NeedsRecompute(buildConfig.collapsing);
+    // the collapsed tree was built from the restructured one, switching restructuring off invalidates it too
+    auto const t3 = restructuring.NeedsRecompute(buildConfig.restructuring)
+        || (previousUpstream.restructuring.bv != config::BV::eNone && buildConfig.restructuring.bv == config::BV::eNone);
+    auto const t4 = plocpp.NeedsRecompute(buildConfig.plocpp);
 
-    if (t0 || t1 || t2 || t3) {
-        buildState = BuildState::ePLOC;
+    if (!(t0 || t1 || t2 || t3 || t4))
+        return;
 
-        rearrangement.freeAll();
-        transformation.freeAll();
-        collapsing.freeAll();
-        plocpp.freeAll();
+    rearrangement.freeAll();
+    transformation.freeAll();
+    tlas.freeAll();
+    statsBuild.transformation = {};
+    statsBuild.rearrangement = {};
+
+    // upstream config is unchanged, continue from the collapsed tree
+    if (!t2 && !t3 && !t4 && plocpp.HasOutput()) {
+        resumeFrom(BuildState::eTransformation);
+        return;
+    }
+
+    if (upstreamBuilt)
+        stageCache.Insert({
+            .key = previousUpstream,
+            .plocpp = plocpp.DetachOutput(),
+            .restructuring = restructuring.DetachOutput(),
+            .collapsing = collapsing.DetachOutput(),
+            .statsPlocpp = statsBuild.plocpp,
+            .statsRestructuring = statsBuild.restructuring,
+            .statsCollapsing = statsBuild.collapsing,
+        });
+    collapsing.freeAll();
+    restructuring.freeAll();
+    plocpp.freeAll();
+    upstreamRefitted = false;
+
+    if (auto cached { stageCache.Extract({ buildConfig.plocpp, buildConfig.restructuring, buildConfig.collapsing }) }) {
+        plocpp.AttachOutput(std::move(cached->plocpp));
+        restructuring.AttachOutput(std::move(cached->restructuring));
+        collapsing.AttachOutput(std::move(cached->collapsing));
+        statsBuild.plocpp = cached->statsPlocpp;
+        statsBuild.restructuring = cached->statsRestructuring;
+        statsBuild.collapsing = cached->statsCollapsing;
+        buildState = BuildState::eTransformation;
+        return;
+    }
+
+    statsBuild.clear();
+    buildState = BuildState::ePLOC;
+}
+
+void Builder::InvalidateScene()
+{
+    tlas.freeAll();
+    stageCache.Clear();
+    statsBuild.clear();
+    upstreamRefitted = false;
+    buildState = BuildState::ePLOC;
+}
+
+void Builder::RefitGeometry()
+{
+    // instanced geometry does not move, only the top level over the instances is rebuilt
+    if (tlas.HasOutput()) {
+        tlasOutdated = true;
+        return;
+    }
+
+    // trees built for the previous geometry are stale, same for the finished tree keyed by the scene file
+    stageCache.Clear();
+    if (diskCache.IsEnabled()) {
+        berry::log::info("BVH cache: disabled for animated scene");
+        diskCache.Disable();
+    }
+
+    if (getUpstreamBv() != config::BV::eAABB || !plocpp.HasOutput()) {
+        upstreamRefitted = false;
+        buildState = BuildState::ePLOC;
+        return;
     }
+    // with collapsing enabled, only the collapsed tree is refitted
+    upstreamRefitted = true;
+    resumeFrom(BuildState::eRefit);
+}
+
+void Builder::EnableDiskCache(std::filesystem::path const& dir)
+{
+    diskCache.Enable(dir);
 }
 
 void Builder::CheckForShaderHotReload()
 {
+    auto const stateBefore { buildState };
     if (rearrangement.CheckForShaderHotReload())
         buildState = BuildState::eRearrangement;
     if (transformation.CheckForShaderHotReload())
         buildState = BuildState::eTransformation;
-    if (collapsing.CheckForShaderHotReload())
+    if (refit.CheckForShaderHotReload() && upstreamRefitted)
+        resumeFrom(BuildState::eRefit);
+    if (collapsing.CheckForShaderHotReload()) {
         buildState = BuildState::eCollapsing;
-    if (plocpp.CheckForShaderHotReload())
+        stageCache.Clear();
+    }
+    if (restructuring.CheckForShaderHotReload()) {
+        buildState = BuildState::eRestructuring;
+        stageCache.Clear();
+    }
+    if (plocpp.CheckForShaderHotReload()) {
         buildState = BuildState::ePLOC;
+        stageCache.Clear();
+    }
+    if (tlas.CheckForShaderHotReload())
+        tlasOutdated = true;
+
+    // edited shaders are not part of the disk cache key
+    if (buildState != stateBefore && diskCache.IsEnabled()) {
+        berry::log::info("BVH cache: disabled after shader hot reload");
+        diskCache.Disable();
+    }
+}
+
+void Builder::resumeFrom(BuildState state)
+{
+    if (buildState == BuildState::eDone || state < buildState)
+        buildState = state;
+}
+
+// the hybrid layout addresses fewer nodes and triangles than the others, a larger tree is not built at all
+bool Builder::canAddress(u32 triangleCount) const
+{
+    if (Rearrangement::CanAddress(buildConfig.rearrangement, PLOCpp::MaxLeafCount(buildConfig.plocpp, triangleCount)))
+        return true;
+    berry::log::warn("{} triangles exceed the node and triangle ids of the rearranged layout, skipping BVH construction: {}", triangleCount, buildConfig.name);
+    return false;
 }
 
 void Builder::scheduleBuildSteps()
 {
     buildSteps.clear();
+    // a tree loaded from the disk cache has no intermediate outputs to resume from
+    if (buildState != BuildState::eDone && !plocpp.HasOutput())
+        buildState = BuildState::ePLOC;
+    if (buildState == BuildState::ePLOC)
+        upstreamRefitted = false;
     switch (buildState) {
     case BuildState::ePLOC:
         if (buildConfig.plocpp.bv != config::BV::eNone)
             buildSteps.emplace_back(BuildState::ePLOC);
         [[fallthrough]];
+    case BuildState::eRestructuring:
+        if (isRestructured())
+            buildSteps.emplace_back(BuildState::eRestructuring);
+        else if (buildConfig.restructuring.bv != config::BV::eNone)
+            berry::log::warn("Restructuring needs an AABB tree from PLOC++, skipping the stage: {}", buildConfig.name);
+        [[fallthrough]];
     case BuildState::eCollapsing:
         if (buildConfig.collapsing.bv != config::BV::eNone && buildConfig.collapsing.maxLeafSize > 1)
             buildSteps.emplace_back(BuildState::eCollapsing);
         [[fallthrough]];
+    case BuildState::eRefit:
+        if (buildState == BuildState::eRefit)
+            buildSteps.emplace_back(BuildState::eRefit);
+        [[fallthrough]];
     case BuildState::eTransformation:
         if (buildConfig.transformation.bv != config::BV::eNone)
             buildSteps.emplace_back(BuildState::eTransformation);
@@ -82,140 +237,619 @@ Bvh Builder::getIntermediateBvh(BuildState state) const
             return transformation.GetBVH();
         [[fallthrough]];
     case BuildState::eTransformation:
+    case BuildState::eRefit:
         if (buildConfig.collapsing.bv != config::BV::eNone && buildConfig.collapsing.maxLeafSize > 1)
             return collapsing.GetBVH();
         [[fallthrough]];
     case BuildState::eCollapsing:
+        if (isRestructured())
+            return restructuring.GetBVH();
+        [[fallthrough]];
+    case BuildState::eRestructuring:
         return plocpp.GetBVH();
     default:
         return {};
     }
 }
 
+bool Builder::isRestructured() const
+{
+    return buildConfig.restructuring.bv != config::BV::eNone && buildConfig.plocpp.bv == config::BV::eAABB;
+}
+
+config::BV Builder::getUpstreamBv() const
+{
+    if (buildConfig.collapsing.bv != config::BV::eNone && buildConfig.collapsing.maxLeafSize > 1)
+        return buildConfig.collapsing.bv;
+    return buildConfig.plocpp.bv;
+}
+
+std::pair<lime::Buffer::Detail, lime::Buffer::Detail> Builder::getTriangleBuffers() const
+{
+    if (buildConfig.collapsing.bv != config::BV::eNone && buildConfig.collapsing.maxLeafSize > 1)
+        return collapsing.GetTriangleBuffers();
+    return plocpp.GetTriangleBuffers();
+}
+
 void Builder::BVHBuildPiecewise(lime::rg::Graph& rg, data::Scene const& scene)
 {
+    instanced = scene.IsInstanced();
+    if (instanced) {
+        scheduleInstanced(rg, scene);
+        return;
+    }
+
     scheduleBuildSteps();
     if (buildSteps.empty())
         return;
+    if (!canAddress(scene.totalTriangleCount)) {
+        buildState = BuildState::eDone;
+        rearrangement.freeAll();
+        return;
+    }
 
     intermediateBvh = {};
     berry::log::debug("Scheduling BVH construction: {}", buildConfig.name);
-    statsBuild.clear();
     stats.SetSceneAabbSurfaceArea(scene.aabb.Area());
+    if (buildSteps.front() == BuildState::ePLOC && scheduleLoadFromDiskCache(rg, scene)) {
+        scheduleTreeDepthCheck(rg);
+        return;
+    }
+    scheduleStages(rg, scene);
+
+    if (buildSteps.back() == BuildState::eRearrangement && diskCache.IsEnabled() && scene.contentHash != 0) {
+        auto const asTask { rg.AddTask<lime::rg::CommandsSync>() };
+        rg.GetTask(asTask).RegisterExecutionCallback([this, &scene](vk::CommandBuffer commandBuffer) {
+            static_cast<void>(commandBuffer);
+            storeToDiskCache(scene);
+        });
+    }
+    if (buildSteps.back() == BuildState::eRearrangement && buildConfig.tracer.validateShortStack > 0) {
+        auto const asTask { rg.AddTask<lime::rg::CommandsSync>() };
+        rg.GetTask(asTask).RegisterExecutionCallback([this, &scene](vk::CommandBuffer commandBuffer) {
+            static_cast<void>(commandBuffer);
+            checkShortStackTraversal(scene);
+        });
+    }
+    if (buildSteps.back() == BuildState::eRearrangement)
+        scheduleTreeDepthCheck(rg);
+}
+
+void Builder::scheduleInstanced(lime::rg::Graph& rg, data::Scene const& scene)
+{
+    // bottom levels follow the pipeline config and the uploaded geometry, moved instances only rebuild the top level
+    auto const blasesOutdated { buildState != BuildState::eDone || !tlas.HasOutput() };
+    if (!blasesOutdated && !tlasOutdated)
+        return;
+    tlasOutdated = false;
+
+    if (buildConfig.rearrangement.bv == config::BV::eNone) {
+        buildState = BuildState::eDone;
+        berry::log::warn("Instanced scene needs a rearranged bottom level tree, skipping BVH construction: {}", buildConfig.name);
+        return;
+    }
+    if (buildConfig.collapsing.triangles == config::TriangleLayout::eIndexed) {
+        buildState = BuildState::eDone;
+        berry::log::warn("Instanced scene needs Woop triangles in the bottom level trees, skipping BVH construction: {}", buildConfig.name);
+        return;
+    }
+    u32 blasTriangleCountMax { 0 };
+    for (auto const g : scene.geometries)
+        blasTriangleCountMax = std::max(blasTriangleCountMax, scene.data->geometries[g].indexCount / 3);
+    if (!canAddress(blasTriangleCountMax)) {
+        buildState = BuildState::eDone;
+        return;
+    }
+
     lime::rg::id::CommandsSync asTask;
+    if (blasesOutdated) {
+        berry::log::debug("Scheduling instanced BVH construction: {}, {} bottom levels", buildConfig.name, scene.geometries.size());
 
-    for (auto const& step : buildSteps) {
-        switch (step) {
-        case BuildState::ePLOC:
+        blasScenes.clear();
+        for (u32 i = 0; i < scene.geometries.size(); ++i)
+            blasScenes.emplace_back(std::make_unique<data::Scene>(scene.data, scene.geometries[i], scene.geometryAabbs[i]));
+
+        // the bottom levels share one set of stages, each submission reads back and hands over the previous tree
+        // before it records all stages of the next one, the top level task finishes the last tree
+        buildState = BuildState::ePLOC;
+        scheduleBuildSteps();
+        for (u32 i = 0; i < blasScenes.size(); ++i) {
             asTask = rg.AddTask<lime::rg::CommandsSync>();
-            rg.GetTask(asTask).RegisterExecutionCallback([this, &scene](vk::CommandBuffer commandBuffer) {
-                berry::log::debug("BVH build stage: PLOCpp");
-                plocpp.Compute(commandBuffer, scene);
+            rg.GetTask(asTask).RegisterExecutionCallback([this, i, steps = buildSteps](vk::CommandBuffer commandBuffer) {
+                if (i > 0)
+                    finishBlas(steps);
+                else {
+                    tlas.freeAll();
+                    plocpp.freeAll();
+                    restructuring.freeAll();
+                    collapsing.freeAll();
+                    transformation.freeAll();
+                    rearrangement.freeAll();
+                    ctx.memory.cleanUp();
+                    statsBuild.clear();
+                }
+                auto const& blasScene { *blasScenes[i] };
+                intermediateBvh = {};
+                stats.SetSceneAabbSurfaceArea(blasScene.aabb.Area());
+                recordStages(commandBuffer, steps, blasScene);
             });
-            asTask = rg.AddTask<lime::rg::CommandsSync>();
-            rg.GetTask(asTask).RegisterExecutionCallback([this](vk::CommandBuffer commandBuffer) {
-                plocpp.ReadRuntimeData();
-                intermediateBvh = plocpp.GetBVH();
+        }
+    }
 
-                plocpp.freeIntermediate();
-                ctx.memory.cleanUp();
+    berry::log::debug("Scheduling top level BVH construction over {} instances", scene.instances.size());
+    asTask = rg.AddTask<lime::rg::CommandsSync>();
+    rg.GetTask(asTask).RegisterExecutionCallback([this, &scene, lastBlas = blasesOutdated && !blasScenes.empty(), steps = buildSteps](vk::CommandBuffer commandBuffer) {
+        if (lastBlas)
+            finishBlas(steps);
+        berry::log::debug("BVH build stage: top level PLOCpp");
+        tlas.Compute(commandBuffer, { .address = scene.instanceBuffer.getDeviceAddress(ctx.d), .count = csize<u32>(scene.instances), .aabb = scene.aabb });
+    });
+    asTask = rg.AddTask<lime::rg::CommandsSync>();
+    rg.GetTask(asTask).RegisterExecutionCallback([this](vk::CommandBuffer commandBuffer) {
+        berry::log::debug("BVH build stage: top level Rearrangement");
+        tlas.Rearrange(commandBuffer);
+    });
+    asTask = rg.AddTask<lime::rg::CommandsSync>();
+    rg.GetTask(asTask).RegisterExecutionCallback([this, &scene](vk::CommandBuffer commandBuffer) {
+        static_cast<void>(commandBuffer);
+        tlas.ReadRuntimeData();
 
-                berry::log::debug("BVH build stage: PLOCpp stats");
-                buildConfig.stats.bv = buildConfig.plocpp.bv;
-                stats.Compute(commandBuffer, buildConfig.stats, intermediateBvh);
-            });
-            asTask = rg.AddTask<lime::rg::CommandsSync>();
-            rg.GetTask(asTask).RegisterExecutionCallback([this](vk::CommandBuffer commandBuffer) {
-                static_cast<void>(commandBuffer);
-                statsBuild.plocpp = plocpp.GatherStats(*stats.data);
-            });
-            break;
-        case BuildState::eCollapsing:
-            asTask = rg.AddTask<lime::rg::CommandsSync>();
-            rg.GetTask(asTask).RegisterExecutionCallback([this, &scene](vk::CommandBuffer commandBuffer) {
-                berry::log::debug("BVH build stage: Collapsing");
-                if (!intermediateBvh.isValid())
-                    intermediateBvh = getIntermediateBvh(BuildState::eCollapsing);
-                auto const geometryDescriptorAddress { scene.data->sceneDescriptionBuffer.getDeviceAddress(ctx.d) };
-                collapsing.Compute(commandBuffer, intermediateBvh, geometryDescriptorAddress);
-            });
-            asTask = rg.AddTask<lime::rg::CommandsSync>();
-            rg.GetTask(asTask).RegisterExecutionCallback([this](vk::CommandBuffer commandBuffer) {
-                collapsing.ReadRuntimeData();
-                intermediateBvh = collapsing.GetBVH();
+        auto const timeBlas { statsBuild.instancing.timeBlas };
+        statsBuild.instancing = tlas.GatherStats();
+        statsBuild.instancing.timeBlas = timeBlas;
+        statsBuild.instancing.instanceCount = csize<u32>(scene.instances);
+        statsBuild.instancing.triangleCountUnique = scene.totalTriangleCount;
+        statsBuild.instancing.triangleCountInstanced = scene.instancedTriangleCount;
+    });
+}
 
-                collapsing.freeIntermediate();
-                ctx.memory.cleanUp();
+static std::string_view StageName(Builder::BuildState step)
+{
+    switch (step) {
+    case Builder::BuildState::ePLOC:
+        return "PLOCpp";
+    case Builder::BuildState::eRestructuring:
+        return "Restructuring";
+    case Builder::BuildState::eCollapsing:
+        return "Collapsing";
+    case Builder::BuildState::eRefit:
+        return "Refit";
+    case Builder::BuildState::eTransformation:
+        return "Transformation";
+    case Builder::BuildState::eRearrangement:
+        return "Rearrangement";
+    default:
+        return {};
+    }
+}
 
-                berry::log::debug("BVH build stage: Collapsing stats");
-                buildConfig.stats.bv = buildConfig.collapsing.bv;
-                stats.Compute(commandBuffer, buildConfig.stats, intermediateBvh);
-            });
-            asTask = rg.AddTask<lime::rg::CommandsSync>();
-            rg.GetTask(asTask).RegisterExecutionCallback([this](vk::CommandBuffer commandBuffer) {
-                static_cast<void>(commandBuffer);
-                statsBuild.collapsing = collapsing.GatherStats(*stats.data);
-            });
-            break;
-        case BuildState::eTransformation:
-            asTask = rg.AddTask<lime::rg::CommandsSync>();
-            rg.GetTask(asTask).RegisterExecutionCallback([this, &scene](vk::CommandBuffer commandBuffer) {
-                berry::log::debug("BVH build stage: Transformation");
-                if (!intermediateBvh.isValid())
-                    intermediateBvh = getIntermediateBvh(BuildState::eTransformation);
-                auto const geometryDescriptorAddress { scene.data->sceneDescriptionBuffer.getDeviceAddress(ctx.d) };
-                transformation.Compute(commandBuffer, intermediateBvh, geometryDescriptorAddress);
-            });
-            asTask = rg.AddTask<lime::rg::CommandsSync>();
-            rg.GetTask(asTask).RegisterExecutionCallback([this](vk::CommandBuffer commandBuffer) {
-                transformation.ReadRuntimeData();
-                intermediateBvh = transformation.GetBVH();
+// stages recorded back to back read what the previous one wrote, be it by a kernel or a copy
+static void BarrierStage(vk::CommandBuffer commandBuffer)
+{
+    vk::MemoryBarrier const stageBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eIndirectCommandRead,
+    };
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(), stageBarrier, nullptr, nullptr);
+}
 
-                collapsing.freeIntermediate();
-                transformation.freeIntermediate();
-                ctx.memory.cleanUp();
+void Builder::scheduleStages(lime::rg::Graph& rg, data::Scene const& scene)
+{
+    if (buildConfig.singleSubmission) {
+        scheduleStagesSingleSubmission(rg, scene);
+        return;
+    }
 
-                berry::log::debug("BVH build stage: Transformation stats");
-                buildConfig.stats.bv = buildConfig.transformation.bv;
-                stats.Compute(commandBuffer, buildConfig.stats, intermediateBvh);
-            });
-            asTask = rg.AddTask<lime::rg::CommandsSync>();
-            rg.GetTask(asTask).RegisterExecutionCallback([this](vk::CommandBuffer commandBuffer) {
-                static_cast<void>(commandBuffer);
-                statsBuild.transformation = transformation.GatherStats(*stats.data);
-            });
-            break;
-        case BuildState::eRearrangement:
-            asTask = rg.AddTask<lime::rg::CommandsSync>();
-            rg.GetTask(asTask).RegisterExecutionCallback([this](vk::CommandBuffer commandBuffer) {
-                berry::log::debug("BVH build stage: Rearrangement");
-                if (!intermediateBvh.isValid())
-                    intermediateBvh = getIntermediateBvh(BuildState::eRearrangement);
-                rearrangement.Compute(commandBuffer, intermediateBvh);
-            });
-            asTask = rg.AddTask<lime::rg::CommandsSync>();
-            rg.GetTask(asTask).RegisterExecutionCallback([this](vk::CommandBuffer commandBuffer) {
-                rearrangement.ReadRuntimeData();
-                intermediateBvh = rearrangement.GetBVH();
+    lime::rg::id::CommandsSync asTask;
 
-                rearrangement.freeIntermediate();
-                transformation.freeIntermediate();
-                ctx.memory.cleanUp();
+    for (auto const& step : buildSteps) {
+        asTask = rg.AddTask<lime::rg::CommandsSync>();
+        rg.GetTask(asTask).RegisterExecutionCallback([this, step, &scene](vk::CommandBuffer commandBuffer) {
+            computeStage(commandBuffer, step, scene);
+        });
+        asTask = rg.AddTask<lime::rg::CommandsSync>();
+        rg.GetTask(asTask).RegisterExecutionCallback([this, step](vk::CommandBuffer commandBuffer) {
+            intermediateBvh = readStage(step);
 
-                berry::log::debug("BVH build stage: Rearrangement stats");
-                buildConfig.stats.bv = buildConfig.rearrangement.bv;
-                stats.Compute(commandBuffer, buildConfig.stats, intermediateBvh);
-            });
-            asTask = rg.AddTask<lime::rg::CommandsSync>();
-            rg.GetTask(asTask).RegisterExecutionCallback([this](vk::CommandBuffer commandBuffer) {
-                static_cast<void>(commandBuffer);
-                statsBuild.rearrangement = rearrangement.GatherStats(*stats.data);
-            });
-            break;
-        case BuildState::eDone:
-            break;
+            freeStage(step);
+            ctx.memory.cleanUp();
+
+            berry::log::debug("BVH build stage: {} stats", StageName(step));
+            buildConfig.stats.bv = getStatsBv(step);
+            stats.Compute(commandBuffer, buildConfig.stats, intermediateBvh);
+        });
+        asTask = rg.AddTask<lime::rg::CommandsSync>();
+        rg.GetTask(asTask).RegisterExecutionCallback([this, step](vk::CommandBuffer commandBuffer) {
+            static_cast<void>(commandBuffer);
+            gatherStage(step, *stats.data);
+        });
+    }
+}
+
+void Builder::scheduleStagesSingleSubmission(lime::rg::Graph& rg, data::Scene const& scene)
+{
+    auto asTask { rg.AddTask<lime::rg::CommandsSync>() };
+    rg.GetTask(asTask).RegisterExecutionCallback([this, steps = buildSteps, &scene](vk::CommandBuffer commandBuffer) {
+        recordStages(commandBuffer, steps, scene);
+    });
+    asTask = rg.AddTask<lime::rg::CommandsSync>();
+    rg.GetTask(asTask).RegisterExecutionCallback([this, steps = buildSteps](vk::CommandBuffer commandBuffer) {
+        static_cast<void>(commandBuffer);
+        readStages(steps);
+    });
+}
+
+void Builder::recordStages(vk::CommandBuffer commandBuffer, std::vector<BuildState> const& steps, data::Scene const& scene)
+{
+    // stages are recorded against host node counts that are only an upper bound, the kernels take the exact ones
+    // from the device, intermediate buffers and staging copies stay alive until everything is read back
+    u32 slot { 0 };
+    for (auto const& step : steps) {
+        computeStage(commandBuffer, step, scene);
+        BarrierStage(commandBuffer);
+
+        intermediateBvh = getStageBvh(step);
+        berry::log::debug("BVH build stage: {} stats", StageName(step));
+        buildConfig.stats.bv = getStatsBv(step);
+        stats.Compute(commandBuffer, buildConfig.stats, intermediateBvh, slot++);
+        BarrierStage(commandBuffer);
+    }
+}
+
+void Builder::readStages(std::vector<BuildState> const& steps)
+{
+    // stages in build order, each one takes the exact counts of its input read just before
+    u32 slot { 0 };
+    for (auto const& step : steps) {
+        intermediateBvh = readStage(step);
+        gatherStage(step, stats.data[slot++]);
+    }
+
+    for (auto const& step : steps)
+        freeStage(step);
+    ctx.memory.cleanUp();
+}
+
+void Builder::finishBlas(std::vector<BuildState> const& steps)
+{
+    readStages(steps);
+    auto const bvh { rearrangement.GetBVH() };
+
+    // only the tree and the triangles it references are kept
+    auto const collapsed { buildConfig.collapsing.bv != config::BV::eNone && buildConfig.collapsing.maxLeafSize > 1 };
+    if (collapsed) {
+        plocpp.freeAll();
+        collapsing.freeAllButGeometry();
+    } else
+        plocpp.freeAllButGeometry();
+    restructuring.freeAll();
+    transformation.freeAll();
+
+    tlas.AddBlas({
+        .bvh = bvh,
+        .plocpp = plocpp.DetachOutput(),
+        .collapsing = collapsing.DetachOutput(),
+        .rearrangement = rearrangement.DetachOutput(),
+    });
+    ctx.memory.cleanUp();
+
+    statsBuild.instancing.timeBlas += statsBuild.plocpp.timeTotal + statsBuild.restructuring.timeTotal + statsBuild.collapsing.timeTotal + statsBuild.transformation.timeTotal + statsBuild.rearrangement.timeTotal;
+}
+
+config::BV Builder::getStatsBv(BuildState step) const
+{
+    switch (step) {
+    case BuildState::ePLOC:
+        return buildConfig.plocpp.bv;
+    case BuildState::eRestructuring:
+    case BuildState::eRefit:
+        return config::BV::eAABB;
+    case BuildState::eCollapsing:
+        return buildConfig.collapsing.bv;
+    case BuildState::eTransformation:
+        return buildConfig.transformation.bv;
+    case BuildState::eRearrangement:
+        return buildConfig.rearrangement.bv;
+    default:
+        return config::BV::eNone;
+    }
+}
+
+Bvh Builder::getStageBvh(BuildState step) const
+{
+    switch (step) {
+    case BuildState::ePLOC:
+        return plocpp.GetBVH();
+    case BuildState::eRestructuring:
+        return restructuring.GetBVH();
+    case BuildState::eCollapsing:
+        return collapsing.GetBVH();
+    case BuildState::eRefit:
+        return getIntermediateBvh(BuildState::eRefit);
+    case BuildState::eTransformation:
+        return transformation.GetBVH();
+    case BuildState::eRearrangement:
+        return rearrangement.GetBVH();
+    default:
+        return {};
+    }
+}
+
+void Builder::computeStage(vk::CommandBuffer commandBuffer, BuildState step, data::Scene const& scene)
+{
+    berry::log::debug("BVH build stage: {}", StageName(step));
+    // refit works in place on the tree it was given, the other stages continue from the last output
+    if (step == BuildState::eRefit || !intermediateBvh.isValid())
+        intermediateBvh = getIntermediateBvh(step);
+    auto const geometryDescriptorAddress { scene.data->sceneDescriptionBuffer.getDeviceAddress(ctx.d) };
+
+    switch (step) {
+    case BuildState::ePLOC:
+        plocpp.Compute(commandBuffer, scene);
+        break;
+    case BuildState::eRestructuring:
+        restructuring.Compute(commandBuffer, intermediateBvh, plocpp.GetNodeBuffer(), geometryDescriptorAddress);
+        break;
+    case BuildState::eCollapsing:
+        collapsing.Compute(commandBuffer, intermediateBvh, geometryDescriptorAddress);
+        break;
+    case BuildState::eRefit:
+        refit.Compute(commandBuffer, intermediateBvh, geometryDescriptorAddress);
+        break;
+    case BuildState::eTransformation:
+        transformation.Compute(commandBuffer, intermediateBvh, geometryDescriptorAddress);
+        break;
+    case BuildState::eRearrangement:
+        rearrangement.Compute(commandBuffer, intermediateBvh);
+        break;
+    case BuildState::eDone:
+        break;
+    }
+}
+
+Bvh Builder::readStage(BuildState step)
+{
+    switch (step) {
+    case BuildState::ePLOC:
+        plocpp.ReadRuntimeData();
+        break;
+    case BuildState::eRestructuring:
+        restructuring.ReadRuntimeData(getIntermediateBvh(step));
+        break;
+    case BuildState::eCollapsing:
+        collapsing.ReadRuntimeData();
+        break;
+    case BuildState::eTransformation:
+        transformation.ReadRuntimeData(getIntermediateBvh(step));
+        break;
+    case BuildState::eRearrangement:
+        rearrangement.ReadRuntimeData();
+        break;
+    default:
+        break;
+    }
+    return getStageBvh(step);
+}
+
+void Builder::freeStage(BuildState step)
+{
+    switch (step) {
+    case BuildState::ePLOC:
+        plocpp.freeIntermediate();
+        break;
+    case BuildState::eRestructuring:
+        restructuring.freeIntermediate();
+        break;
+    case BuildState::eCollapsing:
+        collapsing.freeIntermediate();
+        break;
+    case BuildState::eTransformation:
+        collapsing.freeIntermediate();
+        transformation.freeIntermediate();
+        break;
+    case BuildState::eRearrangement:
+        rearrangement.freeIntermediate();
+        transformation.freeIntermediate();
+        break;
+    default:
+        break;
+    }
+}
+
+void Builder::gatherStage(BuildState step, BvhStats const& bvhStats)
+{
+    switch (step) {
+    case BuildState::ePLOC:
+        statsBuild.plocpp = plocpp.GatherStats(bvhStats);
+        break;
+    case BuildState::eRestructuring:
+        statsBuild.restructuring = restructuring.GatherStats(bvhStats);
+        break;
+    case BuildState::eCollapsing:
+        statsBuild.collapsing = collapsing.GatherStats(bvhStats);
+        break;
+    case BuildState::eRefit: {
+        auto const collapsed { buildConfig.collapsing.bv != config::BV::eNone && buildConfig.collapsing.maxLeafSize > 1 };
+        auto const costUncollapsed { isRestructured() ? statsBuild.restructuring.costTotal : statsBuild.plocpp.costTotal };
+        auto const costReference { collapsed ? statsBuild.collapsing.costTotal : costUncollapsed };
+        statsBuild.refit = refit.GatherStats(bvhStats, costReference);
+        if (statsBuild.refit.sahDegradation > REFIT_MAX_SAH_DEGRADATION) {
+            berry::log::debug("BVH refit: SAH cost degraded {:.2f}x, scheduling rebuild", statsBuild.refit.sahDegradation);
+            statsBuild.refit.rebuildScheduled = true;
+            buildState = BuildState::ePLOC;
         }
+        break;
     }
+    case BuildState::eTransformation:
+        statsBuild.transformation = transformation.GatherStats(bvhStats);
+        break;
+    case BuildState::eRearrangement:
+        statsBuild.rearrangement = rearrangement.GatherStats(bvhStats);
+        break;
+    case BuildState::eDone:
+        break;
+    }
+}
+
+// edited shaders build other trees, the key covers the SPIR-V of every pipeline of the config
+u64 Builder::diskCacheKey() const
+{
+    std::vector<PipelineKey> keys;
+    CollectPipelineKeys(ctx.pd, buildConfig, keys);
+    berry::Fnv1a shaderHash;
+    for (auto const& key : keys)
+        shaderHash.Add(ctx.sCache.LoadShader(key.shader).spvHash);
+    return BvhCache::PipelineHash(buildConfig, shaderHash.Get());
+}
+
+bool Builder::scheduleLoadFromDiskCache(lime::rg::Graph& rg, data::Scene const& scene)
+{
+    diskCacheFile = diskCache.Open(scene.contentHash, diskCacheKey());
+    if (!diskCacheFile)
+        return false;
+
+    auto const asTask { rg.AddTask<lime::rg::CommandsSync>() };
+    rg.GetTask(asTask).RegisterExecutionCallback([this](vk::CommandBuffer commandBuffer) {
+        static_cast<void>(commandBuffer);
+        berry::log::debug("BVH build stage: loading from disk cache");
+
+        plocpp.freeAll();
+        restructuring.freeAll();
+        collapsing.freeAll();
+        transformation.freeAll();
+        rearrangement.AllocFromCache(diskCacheFile->GetHeader());
+
+        for (auto const section : { BvhCache::Section::eNodes, BvhCache::Section::eAux, BvhCache::Section::eTriangles, BvhCache::Section::eTriangleIDs }) {
+            auto const src { diskCacheFile->GetSection(section) };
+            auto dst { rearrangement.GetBuffer(section) };
+            if (!src.empty())
+                ctx.transfer.ToDeviceSync(src.data(), src.size(), dst);
+        }
+
+        statsBuild = diskCacheFile->GetStats();
+        diskCacheFile.reset();
+    });
+    return true;
+}
+
+void Builder::storeToDiskCache(data::Scene const& scene)
+{
+    auto const pipelineHash { diskCacheKey() };
+    if (diskCache.Contains(scene.contentHash, pipelineHash))
+        return;
+
+    auto const bvh { rearrangement.GetBVH() };
+    BvhCache::Header const header {
+        .sceneHash = scene.contentHash,
+        .pipelineHash = pipelineHash,
+        .bv = bvh.bv,
+        .layout = bvh.layout,
+        .nodeCountLeaf = bvh.nodeCountLeaf,
+        .nodeCountTotal = bvh.nodeCountTotal,
+    };
+
+    auto const [triangles, triangleIDs] { getTriangleBuffers() };
+    std::array<lime::Buffer::Detail, 4> const buffers {
+        rearrangement.GetBuffer(BvhCache::Section::eNodes),
+        rearrangement.GetBuffer(BvhCache::Section::eAux),
+        triangles,
+        triangleIDs,
+    };
+
+    std::array<std::vector<u8>, BvhCache::SECTION_COUNT> sections;
+    for (u32 i = 0; i < buffers.size(); ++i) {
+        sections[i].resize(buffers[i].getSizeInBytes());
+        if (!sections[i].empty())
+            ctx.transfer.FromDevice(buffers[i], sections[i]);
+    }
+    diskCache.Store(header, std::move(sections), statsBuild);
+}
+
+// the depth of a compact binary tree, leaves are one level below their parents
+template<typename Node>
+static u32 treeDepth(lime::Transfer& transfer, lime::Buffer::Detail const& bNodes)
+{
+    std::vector<Node> nodes(bNodes.getSizeInBytes() / sizeof(Node));
+    transfer.FromDevice(bNodes, nodes);
+
+    u32 depthMax { 0 };
+    std::vector<std::pair<i32, u32>> stack { { 0, 0 } };
+    while (!stack.empty()) {
+        auto const [nodeId, depth] { stack.back() };
+        stack.pop_back();
+        depthMax = std::max(depthMax, depth);
+        if (nodeId < 0)
+            continue;
+        stack.emplace_back(nodes[nodeId].c[0], depth + 1);
+        stack.emplace_back(nodes[nodeId].c[1], depth + 1);
+    }
+    return depthMax;
+}
+
+void Builder::scheduleTreeDepthCheck(lime::rg::Graph& rg)
+{
+    if (!buildConfig.tracer.shortStack)
+        return;
+    auto const asTask { rg.AddTask<lime::rg::CommandsSync>() };
+    rg.GetTask(asTask).RegisterExecutionCallback([this](vk::CommandBuffer commandBuffer) {
+        static_cast<void>(commandBuffer);
+        if (!fitsRestartTrail())
+            rearrangement.freeAll();
+    });
+}
+
+bool Builder::fitsRestartTrail() const
+{
+    auto const bvh { rearrangement.GetBVH() };
+    auto const bNodes { rearrangement.GetBuffer(BvhCache::Section::eNodes) };
+
+    u32 depth { 0 };
+    if (bvh.layout == config::NodeLayout::eBVH2 && bvh.bv == config::BV::eAABB)
+        depth = treeDepth<data_bvh::NodeBVH2_AABB_c>(ctx.transfer, bNodes);
+    else if (bvh.layout == config::NodeLayout::eBVH2 && (bvh.bv == config::BV::eSOBB_i32 || bvh.bv == config::BV::eSOBB_i48 || bvh.bv == config::BV::eSOBB_i64))
+        depth = treeDepth<data_bvh::NodeBVH2_SOBBi_c>(ctx.transfer, bNodes);
+    else {
+        berry::log::error("Short stack traversal needs a compact binary AABB or SOBB tree, not tracing: {}", buildConfig.name);
+        return false;
+    }
+
+    if (depth <= TraversalReference::TRAIL_DEPTH_MAX)
+        return true;
+    berry::log::error("Tree depth {} exceeds the short stack restart trail, {} levels at most, not tracing: {}", depth, TraversalReference::TRAIL_DEPTH_MAX, buildConfig.name);
+    return false;
+}
+
+void Builder::checkShortStackTraversal(data::Scene const& scene)
+{
+    auto const bvh { rearrangement.GetBVH() };
+    if (bvh.bv != config::BV::eAABB || bvh.layout != config::NodeLayout::eBVH2 || bvh.triangles == 0) {
+        berry::log::warn("Short stack traversal is checked on compact AABB trees with Woop triangles only, skipping: {}", buildConfig.name);
+        return;
+    }
+
+    auto const bNodes { rearrangement.GetBuffer(BvhCache::Section::eNodes) };
+    auto const bTriangles { getTriangleBuffers().first };
+    std::vector<data_bvh::NodeBVH2_AABB_c> nodes(bNodes.getSizeInBytes() / sizeof(data_bvh::NodeBVH2_AABB_c));
+    std::vector<data_bvh::BvhTriangle> triangles(bTriangles.getSizeInBytes() / sizeof(data_bvh::BvhTriangle));
+    ctx.transfer.FromDevice(bNodes, nodes);
+    ctx.transfer.FromDevice(bTriangles, triangles);
+
+    static constexpr u32 RAY_COUNT { 1 << 16 };
+    auto const shortStackSize { buildConfig.tracer.validateShortStack };
+    auto const result { TraversalReference(nodes, triangles).Compare(scene.aabb, RAY_COUNT, shortStackSize) };
+    if (result.treeDepth > TraversalReference::TRAIL_DEPTH_MAX) {
+        berry::log::error("Short stack traversal: tree depth {} exceeds the restart trail, {} levels at most", result.treeDepth, TraversalReference::TRAIL_DEPTH_MAX);
+        return;
+    }
+
+    auto const msg { std::format("Short stack traversal ({} entries): {} rays, {} hits, {} mismatches, {} ties, {:.2f} restarts per ray, tree depth {}",
+        shortStackSize, result.rayCount, result.hitCount, result.mismatchCount, result.tieCount, static_cast<f64>(result.restartCount) / result.rayCount, result.treeDepth) };
+    if (result.mismatchCount > 0)
+        berry::log::error("{}", msg);
+    else
+        berry::log::info("{}", msg);
 }
 
 }
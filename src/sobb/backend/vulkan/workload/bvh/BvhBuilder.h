@@ -1,9 +1,15 @@
 #pragma once
 
+#include "../../data/Scene.h"
+#include "BvhCache.h"
 #include "Collapsing.h"
 #include "PLOCpp.h"
 #include "Rearrangement.h"
+#include "Refit.h"
+#include "Restructuring.h"
+#include "StageCache.h"
 #include "Stats.h"
+#include "Tlas.h"
 #include "Transformation.h"
 
 namespace lime::rg {
@@ -20,18 +26,36 @@ class Builder {
     lime::Queue queue;
 
     PLOCpp plocpp;
+    Restructuring restructuring;
     Collapsing collapsing;
     Transformation transformation;
     Rearrangement rearrangement;
+    Refit refit;
     Stats stats;
 
+    static constexpr f32 REFIT_MAX_SAH_DEGRADATION { 1.25f };
+    bool upstreamRefitted { false };
+
+    static constexpr vk::DeviceSize STAGE_CACHE_BUDGET { 1024 * lime::MB };
+    StageCache stageCache { STAGE_CACHE_BUDGET };
+    BvhCache diskCache;
+    std::unique_ptr<BvhCache::File> diskCacheFile;
+
+    // two-level tree over instanced geometry
+    Tlas tlas;
+    std::vector<std::unique_ptr<data::Scene>> blasScenes;
+    bool instanced { false };
+    bool tlasOutdated { false };
+
     Bvh intermediateBvh;
 
 public:
     enum class BuildState {
         eDone,
         ePLOC,
+        eRestructuring,
         eCollapsing,
+        eRefit,
         eTransformation,
         eRearrangement,
     } buildState { BuildState::ePLOC };
@@ -45,12 +69,15 @@ public:
         : ctx(ctx)
         , queue(queue)
         , plocpp(ctx)
+        , restructuring(ctx)
         , collapsing(ctx)
         , transformation(ctx)
         , rearrangement(ctx)
+        , refit(ctx)
         , stats(ctx)
+        , tlas(ctx)
     {
-        buildSteps.reserve(4);
+        buildSteps.reserve(6);
     }
 
     stats::BVHPipeline const& GetStatsBuild() const
@@ -65,13 +92,42 @@ public:
 
     Bvh GetBvhForTraversal() const;
 
+    static void CollectPipelineKeys(vk::PhysicalDevice pd, config::BVHPipeline const& config, std::vector<PipelineKey>& keys);
+
     void Configure(config::BVHPipeline config);
+    void InvalidateScene();
+    void RefitGeometry();
+    void EnableDiskCache(std::filesystem::path const& dir);
     void CheckForShaderHotReload();
     void BVHBuildPiecewise(lime::rg::Graph& rg, data::Scene const& scene);
 
 private:
     void scheduleBuildSteps();
+    [[nodiscard]] bool canAddress(u32 triangleCount) const;
+    void scheduleStages(lime::rg::Graph& rg, data::Scene const& scene);
+    void scheduleStagesSingleSubmission(lime::rg::Graph& rg, data::Scene const& scene);
+    void recordStages(vk::CommandBuffer commandBuffer, std::vector<BuildState> const& steps, data::Scene const& scene);
+    void readStages(std::vector<BuildState> const& steps);
+    void computeStage(vk::CommandBuffer commandBuffer, BuildState step, data::Scene const& scene);
+    Bvh readStage(BuildState step);
+    void freeStage(BuildState step);
+    void gatherStage(BuildState step, BvhStats const& bvhStats);
+    Bvh getStageBvh(BuildState step) const;
+    config::BV getStatsBv(BuildState step) const;
+    void scheduleInstanced(lime::rg::Graph& rg, data::Scene const& scene);
+    void finishBlas(std::vector<BuildState> const& steps);
+    void resumeFrom(BuildState state);
     Bvh getIntermediateBvh(BuildState state) const;
+    bool isRestructured() const;
+    config::BV getUpstreamBv() const;
+    std::pair<lime::Buffer::Detail, lime::Buffer::Detail> getTriangleBuffers() const;
+
+    [[nodiscard]] u64 diskCacheKey() const;
+    bool scheduleLoadFromDiskCache(lime::rg::Graph& rg, data::Scene const& scene);
+    void storeToDiskCache(data::Scene const& scene);
+    void checkShortStackTraversal(data::Scene const& scene);
+    void scheduleTreeDepthCheck(lime::rg::Graph& rg);
+    [[nodiscard]] bool fitsRestartTrail() const;
 };
 
 }
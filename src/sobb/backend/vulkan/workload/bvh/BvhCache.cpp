@@ -0,0 +1,241 @@
+#include "BvhCache.h"
+
+#include <berries/lib_helper/spdlog.h>
+#include <berries/util/Hash.h>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <numeric>
+#include <type_traits>
+
+#ifdef __linux__
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+namespace backend::vulkan::bvh {
+
+template<typename T>
+static void append(std::vector<u8>& dst, T const& value)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    auto const* bytes { reinterpret_cast<u8 const*>(&value) };
+    dst.insert(dst.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T>
+static T consume(std::span<u8 const>& src)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value {};
+    if (src.size() < sizeof(T))
+        return value;
+    std::memcpy(&value, src.data(), sizeof(T));
+    src = src.subspan(sizeof(T));
+    return value;
+}
+
+static std::vector<u8> serializeStats(stats::BVHPipeline const& stats)
+{
+    std::vector<u8> result;
+
+    auto const& p { stats.plocpp };
+    append(result, static_cast<u32>(p.times.size()));
+    for (auto const t : p.times)
+        append(result, t);
+    append(result, p.timeTotal);
+    append(result, p.iterationCount);
+    append(result, p.splitCount);
+    append(result, p.saIntersect);
+    append(result, p.saTraverse);
+    append(result, p.costTotal);
+    append(result, p.nodeCountTotal);
+    append(result, p.leafSizeMin);
+    append(result, p.leafSizeMax);
+    append(result, p.leafSizeAvg);
+
+    append(result, stats.restructuring);
+    append(result, stats.collapsing);
+    append(result, stats.transformation);
+    append(result, stats.rearrangement);
+    return result;
+}
+
+static stats::BVHPipeline deserializeStats(std::span<u8 const> src)
+{
+    stats::BVHPipeline result;
+
+    auto& p { result.plocpp };
+    p.times.resize(consume<u32>(src));
+    for (auto& t : p.times)
+        t = consume<f32>(src);
+    p.timeTotal = consume<f32>(src);
+    p.iterationCount = consume<u32>(src);
+    p.splitCount = consume<u32>(src);
+    p.saIntersect = consume<f32>(src);
+    p.saTraverse = consume<f32>(src);
+    p.costTotal = consume<f32>(src);
+    p.nodeCountTotal = consume<u32>(src);
+    p.leafSizeMin = consume<u32>(src);
+    p.leafSizeMax = consume<u32>(src);
+    p.leafSizeAvg = consume<f32>(src);
+
+    result.restructuring = consume<stats::Restructuring>(src);
+    result.collapsing = consume<stats::Collapsing>(src);
+    result.transformation = consume<stats::Transformation>(src);
+    result.rearrangement = consume<stats::Rearrangement>(src);
+    return result;
+}
+
+BvhCache::File::File(std::filesystem::path const& path)
+{
+#ifdef __linux__
+    auto const fd { open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+    if (fd < 0)
+        return;
+
+    struct stat st { };
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        auto const size { static_cast<size_t>(st.st_size) };
+        if (auto* m { mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) }; m != MAP_FAILED) {
+            madvise(m, size, MADV_SEQUENTIAL);
+            mapping = m;
+            contents = { static_cast<u8 const*>(m), size };
+        }
+    }
+    close(fd);
+#else
+    std::ifstream file { path, std::ios::binary | std::ios::ate };
+    if (!file.is_open())
+        return;
+
+    buffer.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+    contents = buffer;
+#endif
+
+    if (contents.size() >= sizeof(Header))
+        std::memcpy(&header, contents.data(), sizeof(Header));
+    else
+        header.magic = 0;
+}
+
+BvhCache::File::~File()
+{
+#ifdef __linux__
+    if (mapping)
+        munmap(mapping, contents.size());
+#endif
+}
+
+std::span<u8 const> BvhCache::File::GetSection(Section section) const
+{
+    auto const id { static_cast<u32>(section) };
+    auto const offset { std::accumulate(header.sectionSize.begin(), header.sectionSize.begin() + id, static_cast<u64>(sizeof(Header))) };
+    return contents.subspan(offset, header.sectionSize[id]);
+}
+
+stats::BVHPipeline BvhCache::File::GetStats() const
+{
+    return deserializeStats(GetSection(Section::eStats));
+}
+
+void BvhCache::Enable(std::filesystem::path const& cacheDir)
+{
+    dir = cacheDir;
+}
+
+void BvhCache::Disable()
+{
+    dir.clear();
+}
+
+bool BvhCache::Contains(u64 sceneHash, u64 pipelineHash) const
+{
+    if (!IsEnabled() || sceneHash == 0)
+        return false;
+
+    std::error_code ec;
+    return std::filesystem::exists(filePath(sceneHash, pipelineHash), ec);
+}
+
+std::unique_ptr<BvhCache::File> BvhCache::Open(u64 sceneHash, u64 pipelineHash) const
+{
+    if (!Contains(sceneHash, pipelineHash))
+        return nullptr;
+
+    auto const path { filePath(sceneHash, pipelineHash) };
+    auto file { std::make_unique<File>(path) };
+
+    auto const& h { file->GetHeader() };
+    auto const expectedSize { std::accumulate(h.sectionSize.begin(), h.sectionSize.end(), static_cast<u64>(sizeof(Header))) };
+    if (h.magic != MAGIC || h.version != VERSION || h.sceneHash != sceneHash || h.pipelineHash != pipelineHash || expectedSize != file->contents.size()) {
+        berry::log::warn("BVH cache: ignoring invalid file {}", path.generic_string());
+        return nullptr;
+    }
+    return file;
+}
+
+void BvhCache::Store(Header header, std::array<std::vector<u8>, SECTION_COUNT>&& sections, stats::BVHPipeline const& statsBuild) const
+{
+    if (!IsEnabled())
+        return;
+
+    sections[static_cast<u32>(Section::eStats)] = serializeStats(statsBuild);
+    for (u32 i = 0; i < SECTION_COUNT; ++i)
+        header.sectionSize[i] = sections[i].size();
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+
+    auto const path { filePath(header.sceneHash, header.pipelineHash) };
+    auto tmp { path };
+    tmp += ".tmp";
+    {
+        std::ofstream file { tmp, std::ios::binary | std::ios::trunc };
+        file.write(reinterpret_cast<char const*>(&header), sizeof(Header));
+        for (auto const& s : sections)
+            file.write(reinterpret_cast<char const*>(s.data()), static_cast<std::streamsize>(s.size()));
+        if (!file) {
+            berry::log::error("BVH cache: failed to write {}", tmp.generic_string());
+            return;
+        }
+    }
+
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+        berry::log::error("BVH cache: failed to write {}: {}", path.generic_string(), ec.message());
+    else
+        berry::log::info("BVH cache: stored {}", path.filename().generic_string());
+}
+
+u64 BvhCache::PipelineHash(config::BVHPipeline const& config, u64 shaderHash)
+{
+    berry::Fnv1a hash;
+    hash.Add(VERSION).Add(shaderHash);
+
+    // only the settings that affect the finished tree (or its reported stats), disabled stages are skipped
+    if (auto const& c { config.plocpp }; c.bv != config::BV::eNone)
+        hash.Add(c.bv).Add(c.shader.initialClusters).Add(c.shader.copyClusters).Add(c.shader.iterations).Add(c.sfc).Add(c.ic).Add(c.radius).Add(c.radiusSchedule).Add(c.radiusMin).Add(c.radiusStep).Add(c.splitBudget).Add(c.workgroupSize);
+    if (auto const& c { config.restructuring }; c.bv != config::BV::eNone && config.plocpp.bv == config::BV::eAABB)
+        hash.Add(c.bv).Add(c.shader.restructure).Add(c.method).Add(c.treeletSize).Add(c.iterations).Add(c.c_t).Add(c.c_i).Add(c.minReinsertionRatio);
+    if (auto const& c { config.collapsing }; c.bv != config::BV::eNone && c.maxLeafSize > 1)
+        hash.Add(c.bv).Add(c.shader.collapse).Add(c.triangles).Add(c.maxLeafSize).Add(c.c_t).Add(c.c_i);
+    if (auto const& c { config.transformation }; c.bv != config::BV::eNone)
+        hash.Add(c.bv).Add(c.shader.transform).Add(c.sobbCostRatio).Add(c.sobbFit).Add(c.sobbCandidates);
+    if (auto const& c { config.rearrangement }; c.bv != config::BV::eNone)
+        hash.Add(c.bv).Add(c.shader.rearrange).Add(c.layout);
+    hash.Add(config.stats.c_t).Add(config.stats.c_i);
+
+    return hash.Get();
+}
+
+std::filesystem::path BvhCache::filePath(u64 sceneHash, u64 pipelineHash) const
+{
+    return dir / std::format("bvh_{:016x}_{:016x}.bin", sceneHash, pipelineHash);
+}
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "../../../Config.h"
+#include "../../../Stats.h"
+
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace backend::vulkan::bvh {
+
+// Finished (rearranged) BVHs stored on disk, addressed by the scene file contents, the normalized pipeline config and
+// the SPIR-V of the shaders building it.
+class BvhCache {
+public:
+    static constexpr u32 MAGIC { 0x4856424C }; // "LBVH"
+    static constexpr u32 VERSION { 5 };
+
+    enum class Section {
+        eNodes,
+        eAux,
+        eTriangles,
+        eTriangleIDs,
+        eStats,
+        eCount,
+    };
+    static constexpr u32 SECTION_COUNT { static_cast<u32>(Section::eCount) };
+
+    struct Header {
+        u32 magic { MAGIC };
+        u32 version { VERSION };
+        u64 sceneHash { 0 };
+        u64 pipelineHash { 0 };
+
+        config::BV bv { config::BV::eNone };
+        config::NodeLayout layout { config::NodeLayout::eDefault };
+        u32 nodeCountLeaf { 0 };
+        u32 nodeCountTotal { 0 };
+
+        std::array<u64, SECTION_COUNT> sectionSize {};
+    };
+
+    // read-only view of a cache file, memory mapped where the platform supports it
+    class File {
+    public:
+        explicit File(std::filesystem::path const& path);
+        ~File();
+        File(File const&) = delete;
+        File& operator=(File const&) = delete;
+
+        [[nodiscard]] Header const& GetHeader() const
+        {
+            return header;
+        }
+        [[nodiscard]] std::span<u8 const> GetSection(Section section) const;
+        [[nodiscard]] stats::BVHPipeline GetStats() const;
+
+    private:
+        friend class BvhCache;
+
+        Header header;
+        std::span<u8 const> contents;
+#ifdef __linux__
+        void* mapping { nullptr };
+#else
+        std::vector<u8> buffer;
+#endif
+    };
+
+    void Enable(std::filesystem::path const& cacheDir);
+    void Disable();
+    [[nodiscard]] bool IsEnabled() const
+    {
+        return !dir.empty();
+    }
+
+    [[nodiscard]] bool Contains(u64 sceneHash, u64 pipelineHash) const;
+    [[nodiscard]] std::unique_ptr<File> Open(u64 sceneHash, u64 pipelineHash) const;
+    void Store(Header header, std::array<std::vector<u8>, SECTION_COUNT>&& sections, stats::BVHPipeline const& statsBuild) const;
+
+    [[nodiscard]] static u64 PipelineHash(config::BVHPipeline const& config, u64 shaderHash);
+
+private:
+    std::filesystem::path dir;
+
+    [[nodiscard]] std::filesystem::path filePath(u64 sceneHash, u64 pipelineHash) const;
+};
+
+}
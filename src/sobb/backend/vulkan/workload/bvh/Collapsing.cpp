@@ -12,23 +12,30 @@ static u32 CreateSpecializationConstants(vk::PhysicalDevice pd)
     return prop2.properties.limits.maxComputeWorkGroupSize[0];
 }
 
+static std::array<vk::SpecializationMapEntry, 1> constexpr scEntries {
+    vk::SpecializationMapEntry { 0, 0, sizeof(u32) },
+};
+
 Collapsing::Collapsing(VCtx ctx)
     : ctx(ctx)
+    , deviceCounts(ctx)
     , timestamps(ctx.d, ctx.pd)
 {
 }
 
 bool Collapsing::CheckForShaderHotReload()
 {
-    return pCollapse.Update(ctx.d, ctx.sCache);
+    auto const updated { deviceCounts.CheckForShaderHotReload() };
+    return pCollapse.Update(ctx.d, ctx.sCache) || updated;
 }
 
 Bvh Collapsing::GetBVH() const
 {
     return {
         .bvh = buffersOut.at(Buffer::eBVH).getDeviceAddress(ctx.d),
-        .triangles = metadata.bvhTriangles != 0 ? metadata.bvhTriangles : buffersOut.at(Buffer::eBVHTriangles).getDeviceAddress(ctx.d),
+        .triangles = metadata.bvhTriangles != 0 || !buffersOut.contains(Buffer::eBVHTriangles) ? metadata.bvhTriangles : buffersOut.at(Buffer::eBVHTriangles).getDeviceAddress(ctx.d),
         .triangleIDs = metadata.bvhTriangleIDs != 0 ? metadata.bvhTriangleIDs : buffersOut.at(Buffer::eBVHTriangleIDs).getDeviceAddress(ctx.d),
+        .counts = metadata.counts,
         .nodeCountLeaf = metadata.nodeCountLeaf,
         .nodeCountTotal = metadata.nodeCountTotal,
         .bv = config.bv,
@@ -36,6 +43,16 @@ Bvh Collapsing::GetBVH() const
     };
 }
 
+std::pair<lime::Buffer::Detail, lime::Buffer::Detail> Collapsing::GetTriangleBuffers() const
+{
+    auto const get { [this](Buffer b) -> lime::Buffer::Detail {
+        if (!buffersOut.contains(b))
+            return {};
+        return buffersOut.at(b);
+    } };
+    return { get(Buffer::eBVHTriangles), get(Buffer::eBVHTriangleIDs) };
+}
+
 void Collapsing::Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, vk::DeviceAddress geometryDescriptor)
 {
     // allocate full size based on input bvh
@@ -54,6 +71,7 @@ void Collapsing::Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, v
 
     reloadPipelines();
     alloc();
+    metadata.counts = config.maxLeafSize > 1 ? buffersOut[Buffer::eCounts].getDeviceAddress(ctx.d) : inputBvh.counts;
 
     lime::compute::fillZeros(commandBuffer, buffersIntermediate[Buffer::eScheduler]);
     lime::compute::fillZeros(commandBuffer, buffersIntermediate[Buffer::eTraversalCounters]);
@@ -64,15 +82,19 @@ void Collapsing::Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, v
     collapse(commandBuffer, inputBvh, geometryDescriptor);
     timestamps.End(commandBuffer);
 
+    if (config.maxLeafSize == 1)
+        return;
+    deviceCounts.Write(commandBuffer, BVH_COUNTS_FROM_COLLAPSED, metadata.counts, buffersOut[Buffer::eCollapsedNodeCounts].getDeviceAddress(ctx.d));
     lime::compute::pBarrierTransferRead(commandBuffer);
-    commandBuffer.copyBuffer(buffersOut[Buffer::eCollapsedNodeCounts].get(), stagingBuffer.get(), vk::BufferCopy(0, 0, 8));
+    commandBuffer.copyBuffer(buffersOut[Buffer::eCounts].get(), stagingBuffer.get(), vk::BufferCopy(0, 0, sizeof(data_bvh::BvhCounts)));
 }
 
 void Collapsing::ReadRuntimeData()
 {
     if (config.maxLeafSize > 1) {
-        metadata.nodeCountLeaf = static_cast<u32*>(stagingBuffer.getMapping())[1];
-        metadata.nodeCountTotal = static_cast<u32*>(stagingBuffer.getMapping())[0] + metadata.nodeCountLeaf + 1;
+        auto const* counts { static_cast<data_bvh::BvhCounts*>(stagingBuffer.getMapping()) };
+        metadata.nodeCountLeaf = counts->nodeCountLeaf;
+        metadata.nodeCountTotal = counts->nodeCountTotal;
     }
 }
 
@@ -93,14 +115,18 @@ stats::Collapsing Collapsing::GatherStats(BvhStats const& bvhStats)
     return stats;
 }
 
+void Collapsing::CollectPipelineKeys(vk::PhysicalDevice pd, config::Collapsing const& config, std::vector<PipelineKey>& keys)
+{
+    if (config.bv == config::BV::eNone || config.shader.collapse.empty())
+        return;
+    keys.emplace_back(config.shader.collapse, scEntries, CreateSpecializationConstants(pd));
+    DeviceCounts::CollectPipelineKeys(keys);
+}
+
 void Collapsing::reloadPipelines()
 {
     metadata.workgroupSize = CreateSpecializationConstants(ctx.memory.pd);
-
-    static std::array<vk::SpecializationMapEntry, 1> constexpr entries {
-        vk::SpecializationMapEntry { 0, 0, sizeof(u32) },
-    };
-    vk::SpecializationInfo sInfo { 1, entries.data(), 4, &metadata.workgroupSize };
+    vk::SpecializationInfo sInfo { 1, scEntries.data(), 4, &metadata.workgroupSize };
 
     pCollapse = { ctx.d, ctx.sCache, config.shader.collapse, sInfo };
 }
@@ -110,12 +136,15 @@ void Collapsing::collapse(vk::CommandBuffer commandBuffer, Bvh const& inputBvh,
     vk::MemoryBarrier memoryBarrierCompute { .srcAccessMask = vk::AccessFlagBits::eShaderWrite, .dstAccessMask = vk::AccessFlagBits::eShaderRead };
     commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), memoryBarrierCompute, nullptr, nullptr);
 
+    auto const counts { deviceCounts.Prepare(commandBuffer, inputBvh, metadata.workgroupSize) };
+
     data_plocpp::PC_Collapse pc {
         .bvhAddress = inputBvh.bvh,
         .bvhTrianglesAddress = inputBvh.triangles,
         .bvhTriangleIndicesAddress = inputBvh.triangleIDs,
         .bvhCollapsedAddress = buffersOut[Buffer::eBVH].getDeviceAddress(ctx.d),
-        .bvhCollapsedTrianglesAddress = buffersOut[Buffer::eBVHTriangles].getDeviceAddress(ctx.d),
+        // indexed leaves keep only the reordered triangle ids
+        .bvhCollapsedTrianglesAddress = buffersOut.contains(Buffer::eBVHTriangles) ? buffersOut[Buffer::eBVHTriangles].getDeviceAddress(ctx.d) : 0,
         .bvhCollapsedTriangleIndicesAddress = buffersOut[Buffer::eBVHTriangleIDs].getDeviceAddress(ctx.d),
 
         .counterAddress = buffersIntermediate[Buffer::eTraversalCounters].getDeviceAddress(ctx.d),
@@ -131,8 +160,8 @@ void Collapsing::collapse(vk::CommandBuffer commandBuffer, Bvh const& inputBvh,
         .indirectDispatchBufferAddress = 0,
 
         .debugAddress = geometryDescriptor,
+        .countsAddress = counts,
 
-        .leafNodeCount = inputBvh.nodeCountLeaf,
         .maxLeafSize = config.maxLeafSize,
 
         .c_t = config.c_t,
@@ -141,7 +170,7 @@ void Collapsing::collapse(vk::CommandBuffer commandBuffer, Bvh const& inputBvh,
 
     commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pCollapse.get());
     commandBuffer.pushConstants(pCollapse.layout.pipeline.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
-    commandBuffer.dispatch(lime::divCeil(inputBvh.nodeCountLeaf, metadata.workgroupSize), 1, 1);
+    deviceCounts.DispatchLeaves(commandBuffer);
 }
 
 void Collapsing::freeIntermediate()
@@ -159,7 +188,31 @@ void Collapsing::freeAllButGeometry()
 void Collapsing::freeAll()
 {
     freeIntermediate();
+    deviceCounts.freeAll();
+    buffersOut.clear();
+}
+
+vk::DeviceSize Collapsing::Output::SizeInBytes() const
+{
+    vk::DeviceSize size { 0 };
+    for (auto const& [id, buffer] : buffers)
+        size += buffer.getSizeInBytes();
+    return size;
+}
+
+Collapsing::Output Collapsing::DetachOutput()
+{
+    freeIntermediate();
+    Output output { .buffers = std::move(buffersOut), .metadata = metadata };
     buffersOut.clear();
+    return output;
+}
+
+void Collapsing::AttachOutput(Output&& output)
+{
+    freeAll();
+    buffersOut = std::move(output.buffers);
+    metadata = output.metadata;
 }
 
 void Collapsing::alloc()
@@ -191,8 +244,10 @@ void Collapsing::alloc()
 
     cInfo.size = getNodeSize(config.bv) * metadata.nodeCountTotal;
     buffersOut[Buffer::eBVH] = ctx.memory.alloc(aReq, cInfo, "bvh_collapsed");
-    cInfo.size = sizeof(f32) * 12 * metadata.nodeCountLeaf;
-    buffersOut[Buffer::eBVHTriangles] = ctx.memory.alloc(aReq, cInfo, "bvh_collapsed_triangles");
+    if (config.triangles == config::TriangleLayout::eWoop) {
+        cInfo.size = sizeof(f32) * 12 * metadata.nodeCountLeaf;
+        buffersOut[Buffer::eBVHTriangles] = ctx.memory.alloc(aReq, cInfo, "bvh_collapsed_triangles");
+    }
     cInfo.size = sizeof(u32) * 2 * metadata.nodeCountLeaf;
     buffersOut[Buffer::eBVHTriangleIDs] = ctx.memory.alloc(aReq, cInfo, "bvh_collapsed_triangle_ids");
 
@@ -209,7 +264,9 @@ void Collapsing::alloc()
 
     cInfo.size = sizeof(u32) * 2;
     buffersOut[Buffer::eCollapsedNodeCounts] = ctx.memory.alloc(aReq, cInfo, "collapsed_node_counts");
+    cInfo.size = sizeof(data_bvh::BvhCounts);
+    buffersOut[Buffer::eCounts] = ctx.memory.alloc(aReq, cInfo, "bvh_collapsed_counts");
 
-    stagingBuffer = ctx.memory.alloc({ .memoryUsage = lime::DeviceMemoryUsage::eDeviceToHost }, { .size = 8, .usage = vk::BufferUsageFlagBits::eTransferDst }, "collapsing_staging");
+    stagingBuffer = ctx.memory.alloc({ .memoryUsage = lime::DeviceMemoryUsage::eDeviceToHost }, { .size = sizeof(data_bvh::BvhCounts), .usage = vk::BufferUsageFlagBits::eTransferDst }, "collapsing_staging");
 }
 }
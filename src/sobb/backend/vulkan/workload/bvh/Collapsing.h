@@ -3,6 +3,7 @@
 #include "../../../Config.h"
 #include "../../../Stats.h"
 #include "../../VCtx.h"
+#include "DeviceCounts.h"
 #include "Types.h"
 #include <vLime/Compute.h>
 #include <vLime/Memory.h>
@@ -15,6 +16,8 @@ struct Collapsing {
     explicit Collapsing(VCtx ctx);
 
     [[nodiscard]] Bvh GetBVH() const;
+    // triangles and triangle ids owned by this stage, empty if passed through from upstream
+    [[nodiscard]] std::pair<lime::Buffer::Detail, lime::Buffer::Detail> GetTriangleBuffers() const;
     [[nodiscard]] bool NeedsRecompute(config::Collapsing const& buildConfig)
     {
         auto const cfgChanged { config != buildConfig };
@@ -22,6 +25,7 @@ struct Collapsing {
         return cfgChanged && config.bv != config::BV::eNone;
     }
     [[nodiscard]] bool CheckForShaderHotReload();
+    static void CollectPipelineKeys(vk::PhysicalDevice pd, config::Collapsing const& config, std::vector<PipelineKey>& keys);
 
     void Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, vk::DeviceAddress geometryDescriptor);
     void ReadRuntimeData();
@@ -32,10 +36,12 @@ private:
     config::Collapsing config;
 
     lime::PipelineCompute pCollapse;
+    DeviceCounts deviceCounts;
 
     struct Metadata {
         vk::DeviceAddress bvhTriangles { 0 };
         vk::DeviceAddress bvhTriangleIDs { 0 };
+        vk::DeviceAddress counts { 0 };
         u32 nodeCountLeaf { 0 };
         u32 nodeCountTotal { 0 };
 
@@ -57,6 +63,7 @@ private:
         eNewTriId,
 
         eCollapsedNodeCounts,
+        eCounts,
 
         eStats,
         eDebug,
@@ -70,6 +77,20 @@ private:
     void alloc();
 
 public:
+    // built tree detached from the stage, parked in the stage cache until a pipeline with the same upstream config needs it
+    struct Output {
+        std::unordered_map<Buffer, lime::Buffer> buffers;
+        Metadata metadata;
+
+        [[nodiscard]] vk::DeviceSize SizeInBytes() const;
+    };
+    [[nodiscard]] bool HasOutput() const
+    {
+        return buffersOut.contains(Buffer::eBVH);
+    }
+    [[nodiscard]] Output DetachOutput();
+    void AttachOutput(Output&& output);
+
     void freeIntermediate();
     void freeAllButGeometry();
     void freeAll();
@@ -0,0 +1,112 @@
+#include "DeviceCounts.h"
+
+#include <vLime/ComputeHelpers.h>
+
+#include <final/shared/data_bvh.h>
+
+namespace backend::vulkan::bvh {
+
+DeviceCounts::DeviceCounts(VCtx ctx)
+    : ctx(ctx)
+{
+}
+
+bool DeviceCounts::CheckForShaderHotReload()
+{
+    return pCounts.Update(ctx.d, ctx.sCache);
+}
+
+void DeviceCounts::CollectPipelineKeys(std::vector<PipelineKey>& keys)
+{
+    keys.emplace_back(SHADER);
+}
+
+void DeviceCounts::Write(vk::CommandBuffer commandBuffer, u32 mode, vk::DeviceAddress counts, vk::DeviceAddress data, vk::DeviceAddress inputCounts)
+{
+    if (!pCounts.isValid())
+        reloadPipelines();
+
+    data_bvh::PC_BvhCounts pc {
+        .countsAddress = counts,
+        .dataAddress = data,
+        .inputCountsAddress = inputCounts,
+        .mode = mode,
+        .workgroupSize = 1,
+    };
+
+    lime::compute::pBarrierCompute(commandBuffer);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pCounts.get());
+    commandBuffer.pushConstants(pCounts.layout.pipeline.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
+    commandBuffer.dispatch(1, 1, 1);
+    lime::compute::pBarrierCompute(commandBuffer);
+}
+
+vk::DeviceAddress DeviceCounts::Prepare(vk::CommandBuffer commandBuffer, Bvh const& bvh, u32 workgroupSize)
+{
+    if (!pCounts.isValid())
+        reloadPipelines();
+    if (!bDispatch.isValid())
+        alloc();
+
+    // arguments of the previous dispatch over this buffer have to be consumed before they are overwritten
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), nullptr, nullptr, nullptr);
+
+    // trees loaded from the disk cache have only host counts, these are exact
+    auto counts { bvh.counts };
+    if (counts == 0) {
+        data_bvh::BvhCounts const hostCounts { bvh.nodeCountLeaf, bvh.nodeCountTotal, bvh.nodeCountTotal - 1 };
+        commandBuffer.updateBuffer(bDispatch.get(), sizeof(data_bvh::BvhDispatch), sizeof(hostCounts), &hostCounts);
+        lime::compute::pBarrierTransferWrite(commandBuffer);
+        counts = bDispatch.getDeviceAddress(ctx.d) + sizeof(data_bvh::BvhDispatch);
+    }
+
+    data_bvh::PC_BvhCounts pc {
+        .countsAddress = counts,
+        .dataAddress = bDispatch.getDeviceAddress(ctx.d),
+        .inputCountsAddress = 0,
+        .mode = BVH_COUNTS_DISPATCH,
+        .workgroupSize = workgroupSize,
+    };
+
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pCounts.get());
+    commandBuffer.pushConstants(pCounts.layout.pipeline.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
+    commandBuffer.dispatch(1, 1, 1);
+
+    vk::MemoryBarrier indirectDispatchBarrier { .srcAccessMask = vk::AccessFlagBits::eShaderWrite, .dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eShaderRead };
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), indirectDispatchBarrier, nullptr, nullptr);
+
+    return counts;
+}
+
+void DeviceCounts::DispatchLeaves(vk::CommandBuffer commandBuffer) const
+{
+    commandBuffer.dispatchIndirect(bDispatch.get(), offsetof(data_bvh::BvhDispatch, leaves));
+}
+
+void DeviceCounts::DispatchNodes(vk::CommandBuffer commandBuffer) const
+{
+    commandBuffer.dispatchIndirect(bDispatch.get(), offsetof(data_bvh::BvhDispatch, nodes));
+}
+
+void DeviceCounts::freeAll()
+{
+    bDispatch.reset();
+}
+
+void DeviceCounts::reloadPipelines()
+{
+    pCounts = { ctx.d, ctx.sCache, SHADER };
+}
+
+void DeviceCounts::alloc()
+{
+    using bfub = vk::BufferUsageFlagBits;
+    bDispatch = ctx.memory.alloc({ .memoryUsage = lime::DeviceMemoryUsage::eDeviceOptimal },
+        {
+            .size = sizeof(data_bvh::BvhDispatch) + sizeof(data_bvh::BvhCounts),
+            .usage = bfub::eStorageBuffer | bfub::eShaderDeviceAddress | bfub::eIndirectBuffer | bfub::eTransferDst,
+        },
+        "bvh_dispatch");
+}
+
+}
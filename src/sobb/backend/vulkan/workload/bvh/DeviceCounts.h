@@ -0,0 +1,42 @@
+#pragma once
+
+#include "../../VCtx.h"
+#include "Types.h"
+#include <vLime/Compute.h>
+#include <vLime/Memory.h>
+#include <vLime/vLime.h>
+
+namespace backend::vulkan::bvh {
+
+// Node counts of a tree kept on the device. The stage that builds a tree writes them from its runtime data, stages
+// that read the tree turn them into indirect dispatch arguments for their own workgroup size. Host counts are only
+// an upper bound used for allocation, no count has to be read back to record the next stage.
+struct DeviceCounts {
+    explicit DeviceCounts(VCtx ctx);
+
+    [[nodiscard]] bool CheckForShaderHotReload();
+    static void CollectPipelineKeys(std::vector<PipelineKey>& keys);
+
+    // writes the counts of a built tree, mode is one of BVH_COUNTS_FROM_*, the caller rebinds its pipeline afterwards
+    void Write(vk::CommandBuffer commandBuffer, u32 mode, vk::DeviceAddress counts, vk::DeviceAddress data, vk::DeviceAddress inputCounts = 0);
+    // dispatch arguments over the tree, returns the address of its counts for the push constants of the caller
+    [[nodiscard]] vk::DeviceAddress Prepare(vk::CommandBuffer commandBuffer, Bvh const& bvh, u32 workgroupSize);
+    void DispatchLeaves(vk::CommandBuffer commandBuffer) const;
+    void DispatchNodes(vk::CommandBuffer commandBuffer) const;
+
+    void freeAll();
+
+private:
+    static constexpr std::string_view SHADER { "final/bvh_Counts.comp.spv" };
+
+    VCtx ctx;
+
+    lime::PipelineCompute pCounts;
+    // dispatch arguments, followed by the counts of a tree that has none on the device
+    lime::Buffer bDispatch;
+
+    void reloadPipelines();
+    void alloc();
+};
+
+}
@@ -2,6 +2,7 @@
 
 #include "../../RadixSort.h"
 #include "../../data/Scene.h"
+#include <bit>
 #include <radix_sort/platforms/vk/radix_sort_vk.h>
 #include <vLime/ComputeHelpers.h>
 
@@ -10,6 +11,37 @@
 
 namespace backend::vulkan::bvh {
 
+static u32 SpaceFillingCurve(config::SpaceFilling sfc)
+{
+    switch (sfc) {
+    case config::SpaceFilling::eMorton32:
+        return SFC_MORTON32;
+    case config::SpaceFilling::eMorton64:
+        return SFC_MORTON64;
+    case config::SpaceFilling::eHilbert64:
+        return SFC_HILBERT64;
+    }
+    return SFC_MORTON32;
+}
+
+static u32 RadiusSchedule(config::RadiusSchedule schedule)
+{
+    switch (schedule) {
+    case config::RadiusSchedule::eFixed:
+        return PLOC_RADIUS_FIXED;
+    case config::RadiusSchedule::eLinear:
+        return PLOC_RADIUS_LINEAR;
+    case config::RadiusSchedule::eClusterCount:
+        return PLOC_RADIUS_CLUSTER_COUNT;
+    }
+    return PLOC_RADIUS_FIXED;
+}
+
+static bool SplitsTriangles(config::PLOC const& config)
+{
+    return config.ic == config::InitialClusters::eTriangleSplits && config.bv == config::BV::eAABB;
+}
+
 static u32 SpecConstants(vk::PhysicalDevice pd)
 {
     auto const prop2 { pd.getProperties2() };
@@ -43,12 +75,22 @@ static data_plocpp::SC SpecConstantsPLOC(vk::PhysicalDevice pd, config::PLOC con
         f = 14u;
     u32 const warpCount = totalSharedMemory / (sizeof(u32) * (1 + (f + 2) * result.sizeSubgroup));
     result.sizeWorkgroup = std::min(result.sizeWorkgroup, (warpCount << 5));
+    // a chunk has to outgrow the 4 * radius overlap by a warp at least
+    if (config.workgroupSize > 0)
+        result.sizeWorkgroup = std::min(result.sizeWorkgroup, std::max(config.workgroupSize, lime::divCeil(4 * config.radius + 32, 32) * 32));
 
     return result;
 }
 
+static std::array<vk::SpecializationMapEntry, 3> constexpr scEntries {
+    vk::SpecializationMapEntry { 0, static_cast<u32>(offsetof(data_plocpp::SC, sizeWorkgroup)), sizeof(u32) },
+    vk::SpecializationMapEntry { 1, static_cast<u32>(offsetof(data_plocpp::SC, sizeSubgroup)), sizeof(u32) },
+    vk::SpecializationMapEntry { 2, static_cast<u32>(offsetof(data_plocpp::SC, plocRadius)), sizeof(u32) },
+};
+
 PLOCpp::PLOCpp(VCtx ctx)
     : ctx(ctx)
+    , deviceCounts(ctx)
     , timestamps(ctx.d, ctx.pd)
 {
 }
@@ -61,6 +103,7 @@ Bvh PLOCpp::GetBVH() const
             ? buffersOut.at(Buffer::eBVHTriangles).getDeviceAddress(ctx.d)
             : 0,
         .triangleIDs = buffersOut.at(Buffer::eBVHTriangleIDs).getDeviceAddress(ctx.d),
+        .counts = buffersOut.at(Buffer::eCounts).getDeviceAddress(ctx.d),
         .nodeCountLeaf = metadata.nodeCountLeaf,
         .nodeCountTotal = metadata.nodeCountTotal,
         .bv = config.bv,
@@ -68,6 +111,21 @@ Bvh PLOCpp::GetBVH() const
     };
 }
 
+std::pair<lime::Buffer::Detail, lime::Buffer::Detail> PLOCpp::GetTriangleBuffers() const
+{
+    auto const get { [this](Buffer b) -> lime::Buffer::Detail {
+        if (!buffersOut.contains(b))
+            return {};
+        return buffersOut.at(b);
+    } };
+    return { get(Buffer::eBVHTriangles), get(Buffer::eBVHTriangleIDs) };
+}
+
+lime::Buffer::Detail PLOCpp::GetNodeBuffer() const
+{
+    return buffersOut.at(Buffer::eBVH);
+}
+
 bool PLOCpp::CheckForShaderHotReload()
 {
     if (config.bv == config::BV::eNone)
@@ -75,14 +133,43 @@ bool PLOCpp::CheckForShaderHotReload()
     bool updated = false;
     for (auto& p : pipelines)
         updated = p.Update(ctx.d, ctx.sCache) || updated;
-    return updated;
+    return deviceCounts.CheckForShaderHotReload() || updated;
+}
+
+u32 PLOCpp::MaxLeafCount(config::PLOC const& config, u32 triangleCount)
+{
+    return triangleCount + (SplitsTriangles(config) ? static_cast<u32>(config.splitBudget * static_cast<f32>(triangleCount)) : 0);
 }
 
 void PLOCpp::Compute(vk::CommandBuffer commandBuffer, data::Scene const& scene)
 {
-    metadata.nodeCountLeaf = scene.totalTriangleCount;
-    metadata.nodeCountTotal = scene.totalTriangleCount * 2 - 1;
     metadata.sceneMeshCount_TMP = csize<u32>(scene.geometries);
+    auto const splitBudget { MaxLeafCount(config, scene.totalTriangleCount) - scene.totalTriangleCount };
+    computeBegin(commandBuffer, scene.totalTriangleCount, splitBudget);
+    initialClusters(commandBuffer, scene);
+    if (splitBudget > 0)
+        splitClusters(commandBuffer, scene);
+    computeEnd(commandBuffer);
+}
+
+void PLOCpp::Compute(vk::CommandBuffer commandBuffer, Instances const& instances)
+{
+    metadata.sceneMeshCount_TMP = 0;
+    computeBegin(commandBuffer, instances.count);
+    initialClustersInstances(commandBuffer, instances);
+    computeEnd(commandBuffer);
+}
+
+void PLOCpp::computeBegin(vk::CommandBuffer commandBuffer, u32 leafCount, u32 splitBudget)
+{
+    // split references are appended after the triangles, buffers are sized for the whole budget,
+    // the actual leaf count is written to the device counts and read back with the runtime data
+    metadata.triangleCount = leafCount;
+    metadata.splitBudget = splitBudget;
+    metadata.nodeCountLeaf = leafCount + splitBudget;
+    metadata.nodeCountTotal = metadata.nodeCountLeaf * 2 - 1;
+    // 32-bit codes fill the upper half of the sort keyval, 64-bit ones leave just enough low bits for the cluster id
+    metadata.clusterIdBits = config.sfc == config::SpaceFilling::eMorton32 ? 32 : std::max(1u, static_cast<u32>(std::bit_width(metadata.nodeCountLeaf - 1)));
 
     reloadPipelines();
     alloc();
@@ -91,14 +178,16 @@ void PLOCpp::Compute(vk::CommandBuffer commandBuffer, data::Scene const& scene)
     lime::compute::fillZeros(commandBuffer, buffersOut[Buffer::eBVH]);
 
     // init input for indirect dispatch buffer fill kernel
-    commandBuffer.fillBuffer(buffersIntermediate[Buffer::eIndirectDispatchBuffer].get(), 0, 4, metadata.nodeCountLeaf);
-    commandBuffer.fillBuffer(buffersIntermediate[Buffer::eIndirectDispatchBuffer].get(), 4, 4, metadata.nodeCountLeaf);
+    commandBuffer.fillBuffer(buffersIntermediate[Buffer::eIndirectDispatchBuffer].get(), 0, 4, metadata.triangleCount);
+    commandBuffer.fillBuffer(buffersIntermediate[Buffer::eIndirectDispatchBuffer].get(), 4, 4, metadata.triangleCount);
     commandBuffer.fillBuffer(buffersIntermediate[Buffer::eIndirectDispatchBuffer].get(), 8, 20, 0);
 
     timestamps.Reset(commandBuffer);
     timestamps.WriteBeginStamp(commandBuffer);
+}
 
-    initialClusters(commandBuffer, scene);
+void PLOCpp::computeEnd(vk::CommandBuffer commandBuffer)
+{
     timestamps.Write(commandBuffer, Times::Stamp::eInitialClustersAndWoopify);
 
     // wait for init writes
@@ -119,23 +208,27 @@ void PLOCpp::Compute(vk::CommandBuffer commandBuffer, data::Scene const& scene)
 
     {
         lime::compute::pBarrierTransferRead(commandBuffer);
-        commandBuffer.fillBuffer(buffersIntermediate[Buffer::eRuntimeData].get(), 0, 40, 0);
+        commandBuffer.fillBuffer(buffersIntermediate[Buffer::eRuntimeData].get(), 0, 48, 0);
         lime::compute::pBarrierTransferWrite(commandBuffer);
         iterationsSingleKernel(commandBuffer);
     }
     timestamps.Write(commandBuffer, Times::Stamp::ePLOCppIterations);
 
+    deviceCounts.Write(commandBuffer, BVH_COUNTS_FROM_CLUSTERS, buffersOut[Buffer::eCounts].getDeviceAddress(ctx.d), idbAddr);
+
     lime::compute::pBarrierTransferRead(commandBuffer);
     commandBuffer.copyBuffer(buffersIntermediate[Buffer::eRuntimeData].get(), stagingBuffer.get(), vk::BufferCopy(36, 0, 4));
+    commandBuffer.copyBuffer(buffersOut[Buffer::eCounts].get(), stagingBuffer.get(), vk::BufferCopy(0, 4, sizeof(data_bvh::BvhCounts)));
 }
 
 void PLOCpp::ReadRuntimeData()
 {
-    metadata.iterationCount = *static_cast<u32*>(stagingBuffer.getMapping());
+    auto const* staging { static_cast<u32*>(stagingBuffer.getMapping()) };
+    metadata.iterationCount = staging[0];
 
-    // NOTE: works only with resizable bar, should rework whole pipeline to indirect dispatch
-    metadata.nodeCountLeaf = *static_cast<u32*>(buffersIntermediate[Buffer::eIndirectDispatchBuffer].getMapping());
-    metadata.nodeCountTotal = metadata.nodeCountLeaf * 2 - 1;
+    auto const* counts { reinterpret_cast<data_bvh::BvhCounts const*>(staging + 1) };
+    metadata.nodeCountLeaf = counts->nodeCountLeaf;
+    metadata.nodeCountTotal = counts->nodeCountTotal;
 }
 
 stats::PLOC PLOCpp::GatherStats(BvhStats const& bvhStats)
@@ -149,6 +242,7 @@ stats::PLOC PLOCpp::GatherStats(BvhStats const& bvhStats)
     }
 
     stats.iterationCount = metadata.iterationCount;
+    stats.splitCount = metadata.nodeCountLeaf - metadata.triangleCount;
 
     stats.saIntersect = bvhStats.saIntersect;
     stats.saTraverse = bvhStats.saTraverse;
@@ -162,24 +256,38 @@ stats::PLOC PLOCpp::GatherStats(BvhStats const& bvhStats)
     return stats;
 }
 
+void PLOCpp::CollectPipelineKeys(vk::PhysicalDevice pd, config::PLOC const& config, std::vector<PipelineKey>& keys)
+{
+    if (config.bv == config::BV::eNone)
+        return;
+    auto const sc = SpecConstantsPLOC(pd, config);
+    auto const workgroupSize = SpecConstants(pd);
+    auto const scWorkgroupSize { std::span { scEntries }.first(1) };
+
+    keys.emplace_back("final/plocpp_FillIndirect.comp.spv");
+    DeviceCounts::CollectPipelineKeys(keys);
+    keys.emplace_back("final/plocpp_CopyClusterIDs.comp.spv", scWorkgroupSize, workgroupSize);
+    keys.emplace_back(config.shader.initialClusters, scWorkgroupSize, workgroupSize);
+    keys.emplace_back(config.shader.iterations, scEntries, sc);
+    if (SplitsTriangles(config))
+        keys.emplace_back("final/plocpp_aabb_SplitClusters.comp.spv", scWorkgroupSize, workgroupSize);
+}
+
 void PLOCpp::reloadPipelines()
 {
     auto const sc = SpecConstantsPLOC(ctx.pd, config);
     metadata.workgroupSize = SpecConstants(ctx.pd);
     metadata.workgroupSizePLOCpp = sc.sizeWorkgroup;
 
-    static std::array<vk::SpecializationMapEntry, 3> constexpr entries {
-        vk::SpecializationMapEntry { 0, static_cast<u32>(offsetof(data_plocpp::SC, sizeWorkgroup)), sizeof(u32) },
-        vk::SpecializationMapEntry { 1, static_cast<u32>(offsetof(data_plocpp::SC, sizeSubgroup)), sizeof(u32) },
-        vk::SpecializationMapEntry { 2, static_cast<u32>(offsetof(data_plocpp::SC, plocRadius)), sizeof(u32) },
-    };
-    vk::SpecializationInfo sInfo { 1, entries.data(), 4, &metadata.workgroupSize };
-    vk::SpecializationInfo sInfoPLOC { 3, entries.data(), 12, &sc };
+    vk::SpecializationInfo sInfo { 1, scEntries.data(), 4, &metadata.workgroupSize };
+    vk::SpecializationInfo sInfoPLOC { 3, scEntries.data(), 12, &sc };
 
     pipelines[Pipeline::eFillIndirect] = { ctx.d, ctx.sCache, "final/plocpp_FillIndirect.comp.spv" };
     pipelines[Pipeline::eCopySortedClusterIDs] = { ctx.d, ctx.sCache, "final/plocpp_CopyClusterIDs.comp.spv", sInfo };
     pipelines[Pipeline::eInitialClusters] = { ctx.d, ctx.sCache, config.shader.initialClusters, sInfo };
     pipelines[Pipeline::ePLOCppIterations] = { ctx.d, ctx.sCache, config.shader.iterations, sInfoPLOC };
+    if (metadata.splitBudget > 0)
+        pipelines[Pipeline::eSplitClusters] = { ctx.d, ctx.sCache, "final/plocpp_aabb_SplitClusters.comp.spv", sInfo };
 }
 
 void PLOCpp::initialClusters(vk::CommandBuffer commandBuffer, data::Scene const& scene)
@@ -194,6 +302,8 @@ void PLOCpp::initialClusters(vk::CommandBuffer commandBuffer, data::Scene const&
         .bvhTrianglesAddress = buffersOut[Buffer::eBVHTriangles].getDeviceAddress(ctx.d),
         .bvhTriangleIndicesAddress = buffersOut[Buffer::eBVHTriangleIDs].getDeviceAddress(ctx.d),
         .auxBufferAddress = buffersIntermediate[Buffer::eIndirectDispatchBuffer].getDeviceAddress(ctx.d),
+        .spaceFilling = SpaceFillingCurve(config.sfc),
+        .clusterIdBits = metadata.clusterIdBits,
     };
 
     data_plocpp::PC_MortonPerGeometry pcPerGeometry {
@@ -228,6 +338,69 @@ void PLOCpp::initialClusters(vk::CommandBuffer commandBuffer, data::Scene const&
     }
 }
 
+void PLOCpp::initialClustersInstances(vk::CommandBuffer commandBuffer, Instances const& instances)
+{
+    auto const cubedAabb { instances.aabb.GetCubed() };
+    data_plocpp::PC_MortonGlobal pcGlobal {
+        .sceneAabbCubedMin = { cubedAabb.min.x, cubedAabb.min.y, cubedAabb.min.z },
+        .sceneAabbNormalizationScale = 1.f / (cubedAabb.max - cubedAabb.min).x,
+        .mortonAddress = buffersIntermediate[Buffer::eRadixEven].getDeviceAddress(ctx.d),
+        .bvhAddress = buffersOut[Buffer::eBVH].getDeviceAddress(ctx.d),
+
+        .bvhTrianglesAddress = 0,
+        .bvhTriangleIndicesAddress = buffersOut[Buffer::eBVHTriangleIDs].getDeviceAddress(ctx.d),
+        .auxBufferAddress = buffersIntermediate[Buffer::eIndirectDispatchBuffer].getDeviceAddress(ctx.d),
+        .spaceFilling = SpaceFillingCurve(config.sfc),
+        .clusterIdBits = metadata.clusterIdBits,
+    };
+    data_plocpp::PC_MortonInstances pcInstances {
+        .instancesAddress = instances.address,
+        .instanceCount = instances.count,
+    };
+
+    auto const layout { pipelines[Pipeline::eInitialClusters].layout.pipeline.get() };
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipelines[Pipeline::eInitialClusters].get());
+    commandBuffer.pushConstants(layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(pcGlobal), &pcGlobal);
+    commandBuffer.pushConstants(layout, vk::ShaderStageFlagBits::eCompute, sizeof(pcGlobal), sizeof(pcInstances), &pcInstances);
+    commandBuffer.dispatch(lime::divCeil(instances.count, metadata.workgroupSize), 1, 1);
+}
+
+void PLOCpp::splitClusters(vk::CommandBuffer commandBuffer, data::Scene const& scene)
+{
+    lime::compute::fillZeros(commandBuffer, buffersIntermediate[Buffer::eSplitPrioritySum]);
+    lime::compute::pBarrierTransferWrite(commandBuffer);
+    lime::compute::pBarrierCompute(commandBuffer);
+
+    auto const cubedAabb { scene.aabb.GetCubed() };
+    data_plocpp::PC_SplitClusters pc {
+        .sceneAabbCubedMin = { cubedAabb.min.x, cubedAabb.min.y, cubedAabb.min.z },
+        .sceneAabbNormalizationScale = 1.f / (cubedAabb.max - cubedAabb.min).x,
+        .mortonAddress = buffersIntermediate[Buffer::eRadixEven].getDeviceAddress(ctx.d),
+        .bvhAddress = buffersOut[Buffer::eBVH].getDeviceAddress(ctx.d),
+        .bvhTriangleIndicesAddress = buffersOut[Buffer::eBVHTriangleIDs].getDeviceAddress(ctx.d),
+        .geometryDescriptorAddress = scene.data->sceneDescriptionBuffer.getDeviceAddress(ctx.d),
+        .prioritiesAddress = buffersIntermediate[Buffer::eSplitPriorities].getDeviceAddress(ctx.d),
+        .prioritySumAddress = buffersIntermediate[Buffer::eSplitPrioritySum].getDeviceAddress(ctx.d),
+        .idbAddress = buffersIntermediate[Buffer::eIndirectDispatchBuffer].getDeviceAddress(ctx.d),
+        .spaceFilling = SpaceFillingCurve(config.sfc),
+        .clusterIdBits = metadata.clusterIdBits,
+        .triangleCount = metadata.triangleCount,
+        .splitBudget = metadata.splitBudget,
+        .phase = SPLIT_PHASE_PRIORITIES,
+    };
+
+    auto const layout { pipelines[Pipeline::eSplitClusters].layout.pipeline.get() };
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipelines[Pipeline::eSplitClusters].get());
+    commandBuffer.pushConstants(layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
+    commandBuffer.dispatch(lime::divCeil(metadata.triangleCount, metadata.workgroupSize), 1, 1);
+
+    // the split pass needs the sum of all priorities
+    lime::compute::pBarrierCompute(commandBuffer);
+    pc.phase = SPLIT_PHASE_SPLIT;
+    commandBuffer.pushConstants(layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
+    commandBuffer.dispatch(lime::divCeil(metadata.triangleCount, metadata.workgroupSize), 1, 1);
+}
+
 void PLOCpp::sortClusterIDs(vk::CommandBuffer commandBuffer)
 {
     vk::MemoryBarrier memoryBarrierCompute { .srcAccessMask = vk::AccessFlagBits::eShaderWrite, .dstAccessMask = vk::AccessFlagBits::eShaderRead };
@@ -239,7 +412,7 @@ void PLOCpp::sortClusterIDs(vk::CommandBuffer commandBuffer)
 
     radix_sort_vk_sort_indirect_info_t radixInfoIndirect;
     radixInfoIndirect.ext = nullptr;
-    radixInfoIndirect.key_bits = 32;
+    radixInfoIndirect.key_bits = 64 - metadata.clusterIdBits;
     radixInfoIndirect.count = { buffersIntermediate[Buffer::eIndirectDispatchBuffer].get(), 0, 4 };
     radixInfoIndirect.keyvals_even = { buffersIntermediate[Buffer::eRadixEven].get(), 0, radixSortMemory.keyvals_size };
     radixInfoIndirect.keyvals_odd = { buffersIntermediate[Buffer::eRadixOdd].get(), 0, radixSortMemory.keyvals_size };
@@ -262,6 +435,7 @@ void PLOCpp::copySortedClusterIDs(vk::CommandBuffer commandBuffer)
         .mortonAddress = nodeBuffer1Address,
         .nodeIdAddress = nodeBuffer0Address,
         .clusterCount = metadata.nodeCountLeaf,
+        .clusterIdMask = metadata.clusterIdBits == 32 ? ~0u : (1u << metadata.clusterIdBits) - 1,
     };
 
     commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipelines[Pipeline::eCopySortedClusterIDs].get());
@@ -287,6 +461,11 @@ void PLOCpp::iterationsSingleKernel(vk::CommandBuffer commandBuffer)
 
         .auxBufferAddress = buffersIntermediate[Buffer::eDebug].getDeviceAddress(ctx.d),
         .idbAddress = buffersIntermediate[Buffer::eIndirectDispatchBuffer].getDeviceAddress(ctx.d),
+
+        // config.radius is the specialization constant, the schedule never exceeds it
+        .radiusSchedule = RadiusSchedule(config.radiusSchedule),
+        .radiusMin = config.radiusMin,
+        .radiusStep = config.radiusStep,
     };
 
     commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipelines[Pipeline::ePLOCppIterations].get());
@@ -343,12 +522,41 @@ void PLOCpp::freeIntermediate()
     stagingBuffer.reset();
 }
 
+void PLOCpp::freeAllButGeometry()
+{
+    freeIntermediate();
+    buffersOut.erase(Buffer::eBVH);
+}
+
 void PLOCpp::freeAll()
 {
     freeIntermediate();
     buffersOut.clear();
 }
 
+vk::DeviceSize PLOCpp::Output::SizeInBytes() const
+{
+    vk::DeviceSize size { 0 };
+    for (auto const& [id, buffer] : buffers)
+        size += buffer.getSizeInBytes();
+    return size;
+}
+
+PLOCpp::Output PLOCpp::DetachOutput()
+{
+    freeIntermediate();
+    Output output { .buffers = std::move(buffersOut), .metadata = metadata };
+    buffersOut.clear();
+    return output;
+}
+
+void PLOCpp::AttachOutput(Output&& output)
+{
+    freeAll();
+    buffersOut = std::move(output.buffers);
+    metadata = output.metadata;
+}
+
 void PLOCpp::alloc()
 {
     freeAll();
@@ -380,6 +588,8 @@ void PLOCpp::alloc()
     buffersOut[Buffer::eBVH] = ctx.memory.alloc(aReq, cInfo, "bvh_plocpp");
     cInfo.size = sizeof(u32) * 2 * metadata.nodeCountLeaf;
     buffersOut[Buffer::eBVHTriangleIDs] = ctx.memory.alloc(aReq, cInfo, "bvh_plocpp_triangle_ids");
+    cInfo.size = sizeof(data_bvh::BvhCounts);
+    buffersOut[Buffer::eCounts] = ctx.memory.alloc(aReq, cInfo, "bvh_plocpp_counts");
 
     switch (config.bv) {
     case config::BV::eNone:
@@ -401,7 +611,7 @@ void PLOCpp::alloc()
     buffersIntermediate[Buffer::eRadixInternal] = ctx.memory.alloc(aReq, cInfo, "plocpp_radix_internal");
 
     aReq.additionalAlignment = 256;
-    cInfo.size = sizeof(u32) * 10;
+    cInfo.size = sizeof(u32) * 12;
     buffersIntermediate[Buffer::eRuntimeData] = ctx.memory.alloc(aReq, cInfo, "plocpp_runtime_data");
 
     cInfo.size = sizeof(u32) * 2 * lime::divCeil(metadata.nodeCountLeaf, metadata.workgroupSizePLOCpp - 4 * config.radius);
@@ -417,7 +627,15 @@ void PLOCpp::alloc()
     aReq.additionalAlignment = radixSortMemory.indirect_alignment;
     buffersIntermediate[Buffer::eRadixIndirect] = ctx.memory.alloc(aReq, cInfo, "plocpp_radix_idirect");
 
-    stagingBuffer = ctx.memory.alloc({ .memoryUsage = lime::DeviceMemoryUsage::eDeviceToHost }, { .size = 4, .usage = vk::BufferUsageFlagBits::eTransferDst }, "plocpp_staging");
+    if (metadata.splitBudget > 0) {
+        aReq.additionalAlignment = 256;
+        cInfo.size = sizeof(u32) * metadata.triangleCount;
+        buffersIntermediate[Buffer::eSplitPriorities] = ctx.memory.alloc(aReq, cInfo, "plocpp_split_priorities");
+        cInfo.size = sizeof(u64);
+        buffersIntermediate[Buffer::eSplitPrioritySum] = ctx.memory.alloc(aReq, cInfo, "plocpp_split_priority_sum");
+    }
+
+    stagingBuffer = ctx.memory.alloc({ .memoryUsage = lime::DeviceMemoryUsage::eDeviceToHost }, { .size = 4 + sizeof(data_bvh::BvhCounts), .usage = vk::BufferUsageFlagBits::eTransferDst }, "plocpp_staging");
 }
 
 }
@@ -3,6 +3,7 @@
 #include "../../../Config.h"
 #include "../../../Stats.h"
 #include "../../VCtx.h"
+#include "DeviceCounts.h"
 #include "Types.h"
 #include <berries/util/ConstexprEnumMap.h>
 #include <unordered_map>
@@ -20,6 +21,10 @@ struct PLOCpp {
     explicit PLOCpp(VCtx ctx);
 
     [[nodiscard]] Bvh GetBVH() const;
+    // triangles and triangle ids owned by this stage, empty if passed through from upstream
+    [[nodiscard]] std::pair<lime::Buffer::Detail, lime::Buffer::Detail> GetTriangleBuffers() const;
+    // node buffer, for downstream stages that work on a copy of the tree
+    [[nodiscard]] lime::Buffer::Detail GetNodeBuffer() const;
     [[nodiscard]] bool NeedsRecompute(config::PLOC const& buildConfig)
     {
         auto const cfgChanged { config != buildConfig };
@@ -27,8 +32,13 @@ struct PLOCpp {
         return cfgChanged && config.bv != config::BV::eNone;
     }
     [[nodiscard]] bool CheckForShaderHotReload();
+    static void CollectPipelineKeys(vk::PhysicalDevice pd, config::PLOC const& config, std::vector<PipelineKey>& keys);
+    // upper bound of the leaves, i.e. triangle references, of a tree over the triangles including the split ones
+    [[nodiscard]] static u32 MaxLeafCount(config::PLOC const& config, u32 triangleCount);
 
     void Compute(vk::CommandBuffer commandBuffer, data::Scene const& scene);
+    // leaves are instance bounds instead of triangles, used for the top level of instanced scenes
+    void Compute(vk::CommandBuffer commandBuffer, Instances const& instances);
     void ReadRuntimeData();
     [[nodiscard]] stats::PLOC GatherStats(BvhStats const& bvhStats);
 
@@ -42,15 +52,20 @@ private:
         ePLOCppIterations,
         eFillIndirect,
         ePairDiscovery,
+        eSplitClusters,
         eCount,
     };
     berry::ConstexprEnumMap<Pipeline, lime::PipelineCompute> pipelines;
+    DeviceCounts deviceCounts;
 
     struct Metadata {
         u32 nodeCountLeaf { 0 };
         u32 nodeCountTotal { 0 };
+        u32 triangleCount { 0 };
+        u32 splitBudget { 0 };
 
         u32 iterationCount { 0 };
+        u32 clusterIdBits { 0 };
         u32 workgroupSize { 0 };
         u32 workgroupSizePLOCpp { 0 };
 
@@ -61,6 +76,7 @@ private:
         eBVH,
         eBVHTriangles,
         eBVHTriangleIDs,
+        eCounts,
 
         eBV_SOBB4,
 
@@ -79,6 +95,9 @@ private:
         eScratchIds0,
         eScratchIds1,
         eScratchTriIds,
+
+        eSplitPriorities,
+        eSplitPrioritySum,
     };
     lime::Buffer stagingBuffer;
     std::unordered_map<Buffer, lime::Buffer> buffersOut;
@@ -90,11 +109,30 @@ private:
     void alloc();
 
 public:
+    // built tree detached from the stage, parked in the stage cache until a pipeline with the same upstream config needs it
+    struct Output {
+        std::unordered_map<Buffer, lime::Buffer> buffers;
+        Metadata metadata;
+
+        [[nodiscard]] vk::DeviceSize SizeInBytes() const;
+    };
+    [[nodiscard]] bool HasOutput() const
+    {
+        return buffersOut.contains(Buffer::eBVH);
+    }
+    [[nodiscard]] Output DetachOutput();
+    void AttachOutput(Output&& output);
+
     void freeIntermediate();
+    void freeAllButGeometry();
     void freeAll();
 
 private:
+    void computeBegin(vk::CommandBuffer commandBuffer, u32 leafCount, u32 splitBudget = 0);
+    void computeEnd(vk::CommandBuffer commandBuffer);
     void initialClusters(vk::CommandBuffer commandBuffer, data::Scene const& scene);
+    void initialClustersInstances(vk::CommandBuffer commandBuffer, Instances const& instances);
+    void splitClusters(vk::CommandBuffer commandBuffer, data::Scene const& scene);
     void sortClusterIDs(vk::CommandBuffer commandBuffer);
     void copySortedClusterIDs(vk::CommandBuffer commandBuffer);
     void iterationsSingleKernel(vk::CommandBuffer commandBuffer);
@@ -12,8 +12,13 @@ static u32 CreateSpecializationConstants(vk::PhysicalDevice pd)
     return prop2.properties.limits.maxComputeWorkGroupSize[0];
 }
 
+static std::array<vk::SpecializationMapEntry, 1> constexpr scEntries {
+    vk::SpecializationMapEntry { 0, 0, sizeof(u32) },
+};
+
 Rearrangement::Rearrangement(VCtx ctx)
     : ctx(ctx)
+    , deviceCounts(ctx)
     , timestamps(ctx.d, ctx.pd)
 {
 }
@@ -22,7 +27,8 @@ bool Rearrangement::CheckForShaderHotReload()
 {
     if (config.bv == config::BV::eNone)
         return false;
-    return pRearrange.Update(ctx.d, ctx.sCache);
+    auto const updated { deviceCounts.CheckForShaderHotReload() };
+    return pRearrange.Update(ctx.d, ctx.sCache) || updated;
 }
 
 Bvh Rearrangement::GetBVH() const
@@ -32,6 +38,7 @@ Bvh Rearrangement::GetBVH() const
         .triangles = metadata.bvhTriangles,
         .triangleIDs = metadata.bvhTriangleIDs,
         .bvhAux = buffersOut.contains(Buffer::eSplit) ? buffersOut.at(Buffer::eSplit).getDeviceAddress(ctx.d) : 0,
+        .counts = buffersOut.contains(Buffer::eCounts) ? buffersOut.at(Buffer::eCounts).getDeviceAddress(ctx.d) : 0,
         .nodeCountLeaf = metadata.nodeCountLeaf,
         .nodeCountTotal = metadata.nodeCountTotal,
         .bv = config.bv,
@@ -44,7 +51,11 @@ void Rearrangement::Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBvh
 {
     auto const estimateRearrangedNodeCount { [](u32 inTotal, config::NodeLayout layout) -> u32 {
         switch (layout) {
+        // every wide node consumes at least one binary interior node, the exact count is written to the device counts
         case config::NodeLayout::eBVH2:
+        case config::NodeLayout::eBVH2q:
+        case config::NodeLayout::eBVH4:
+        case config::NodeLayout::eBVH8:
             return inTotal >> 1;
         default:;
         }
@@ -53,6 +64,7 @@ void Rearrangement::Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBvh
 
     metadata.nodeCountLeaf = inputBvh.nodeCountLeaf;
     metadata.nodeCountTotal = estimateRearrangedNodeCount(inputBvh.nodeCountTotal, config.layout);
+    metadata.inputNodeCountTotal = inputBvh.nodeCountTotal;
     metadata.bvhTriangles = inputBvh.triangles;
     metadata.bvhTriangleIDs = inputBvh.triangleIDs;
 
@@ -61,20 +73,29 @@ void Rearrangement::Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBvh
 
     commandBuffer.fillBuffer(buffersIntermediate[Buffer::eRuntimeData].get(), 0, 4, 0);
     commandBuffer.fillBuffer(buffersIntermediate[Buffer::eRuntimeData].get(), 4, 8, 1);
-    commandBuffer.fillBuffer(buffersIntermediate[Buffer::eWorkBuffer].get(), 0, 4, inputBvh.nodeCountTotal - 1);
-    commandBuffer.fillBuffer(buffersIntermediate[Buffer::eWorkBuffer].get(), 4, 4, 0);
-    commandBuffer.fillBuffer(buffersIntermediate[Buffer::eWorkBuffer].get(), 8, buffersIntermediate[Buffer::eWorkBuffer].getSizeInBytes() - 8, INVALID_VALUE);
+    // the root work item is seeded by the kernel from the device counts of the input tree
+    commandBuffer.fillBuffer(buffersIntermediate[Buffer::eWorkBuffer].get(), 0, buffersIntermediate[Buffer::eWorkBuffer].getSizeInBytes(), INVALID_VALUE);
+    if (buffersIntermediate.contains(Buffer::eCollapseCost))
+        commandBuffer.fillBuffer(buffersIntermediate[Buffer::eCollapseCost].get(), 0, vk::WholeSize, 0);
     lime::compute::pBarrierTransferWrite(commandBuffer);
 
+    auto const inputCounts { deviceCounts.Prepare(commandBuffer, inputBvh, metadata.workgroupSize) };
+
     timestamps.Reset(commandBuffer);
     timestamps.Begin(commandBuffer);
-    rearrange(commandBuffer, inputBvh);
+    rearrange(commandBuffer, inputBvh, inputCounts);
     timestamps.End(commandBuffer);
+
+    deviceCounts.Write(commandBuffer, BVH_COUNTS_FROM_REARRANGED, buffersOut[Buffer::eCounts].getDeviceAddress(ctx.d), buffersIntermediate[Buffer::eRuntimeData].getDeviceAddress(ctx.d), inputCounts);
+    lime::compute::pBarrierTransferRead(commandBuffer);
+    commandBuffer.copyBuffer(buffersOut[Buffer::eCounts].get(), stagingBuffer.get(), vk::BufferCopy(0, 0, sizeof(data_bvh::BvhCounts)));
 }
 
 void Rearrangement::ReadRuntimeData()
 {
-    metadata.nodeCountTotal = static_cast<i32*>(buffersIntermediate[Buffer::eRuntimeData].getMapping())[2];
+    auto const* counts { static_cast<data_bvh::BvhCounts*>(stagingBuffer.getMapping()) };
+    metadata.nodeCountLeaf = counts->nodeCountLeaf;
+    metadata.nodeCountTotal = counts->nodeCountTotal;
 }
 
 stats::Rearrangement Rearrangement::GatherStats(BvhStats const& bvhStats)
@@ -91,52 +112,144 @@ stats::Rearrangement Rearrangement::GatherStats(BvhStats const& bvhStats)
     stats.leafSizeMin = bvhStats.leafSizeMin;
     stats.leafSizeMax = bvhStats.leafSizeMax;
     stats.leafSizeAvg = static_cast<f32>(bvhStats.leafSizeSum) / static_cast<f32>(metadata.nodeCountLeaf);
+    stats.childCountAABB = bvhStats.aabbChildCount;
 
     return stats;
 }
 
-void Rearrangement::reloadPipelines()
+lime::Buffer::Detail Rearrangement::GetBuffer(BvhCache::Section section) const
 {
-    metadata.workgroupSize = CreateSpecializationConstants(ctx.memory.pd);
+    auto const get { [this](Buffer b) -> lime::Buffer::Detail {
+        if (!buffersOut.contains(b))
+            return {};
+        return buffersOut.at(b);
+    } };
+
+    switch (section) {
+    case BvhCache::Section::eNodes:
+        return get(Buffer::eBVH);
+    case BvhCache::Section::eAux:
+        return get(Buffer::eSplit);
+    case BvhCache::Section::eTriangles:
+        return get(Buffer::eBVHTriangles);
+    case BvhCache::Section::eTriangleIDs:
+        return get(Buffer::eBVHTriangleIDs);
+    default:
+        return {};
+    }
+}
 
-    static std::array<vk::SpecializationMapEntry, 1> constexpr entries {
-        vk::SpecializationMapEntry { 0, 0, sizeof(u32) },
+void Rearrangement::AllocFromCache(BvhCache::Header const& header)
+{
+    freeAll();
+    ctx.memory.cleanUp();
+
+    using bfub = vk::BufferUsageFlagBits;
+    lime::AllocRequirements aReq {
+        .memoryUsage = lime::DeviceMemoryUsage::eDeviceOptimal,
+        .additionalAlignment = 256,
+    };
+    vk::BufferCreateInfo cInfo {
+        .size = 0,
+        .usage = bfub::eStorageBuffer | bfub::eShaderDeviceAddress | bfub::eTransferSrc | bfub::eTransferDst,
     };
-    vk::SpecializationInfo sInfo { 1, entries.data(), 4, &metadata.workgroupSize };
+
+    auto const alloc { [&](BvhCache::Section section, Buffer buffer, char const* name) {
+        cInfo.size = header.sectionSize[static_cast<u32>(section)];
+        if (cInfo.size > 0)
+            buffersOut[buffer] = ctx.memory.alloc(aReq, cInfo, name);
+    } };
+    alloc(BvhCache::Section::eNodes, Buffer::eBVH, "bvh_rearranged");
+    alloc(BvhCache::Section::eAux, Buffer::eSplit, "bvh_rearranged_split");
+    alloc(BvhCache::Section::eTriangles, Buffer::eBVHTriangles, "bvh_rearranged_triangles");
+    alloc(BvhCache::Section::eTriangleIDs, Buffer::eBVHTriangleIDs, "bvh_rearranged_triangle_ids");
+
+    metadata.nodeCountLeaf = header.nodeCountLeaf;
+    metadata.nodeCountTotal = header.nodeCountTotal;
+    metadata.bvhTriangles = GetBuffer(BvhCache::Section::eTriangles).getDeviceAddress(ctx.d);
+    metadata.bvhTriangleIDs = GetBuffer(BvhCache::Section::eTriangleIDs).getDeviceAddress(ctx.d);
+}
+
+void Rearrangement::CollectPipelineKeys(vk::PhysicalDevice pd, config::Rearrangement const& config, std::vector<PipelineKey>& keys)
+{
+    if (config.bv == config::BV::eNone || config.shader.rearrange.empty())
+        return;
+    keys.emplace_back(config.shader.rearrange, scEntries, CreateSpecializationConstants(pd));
+    DeviceCounts::CollectPipelineKeys(keys);
+}
+
+bool Rearrangement::CanAddress(config::Rearrangement const& config, u32 leafCount)
+{
+    // the hybrid layout tags AABB children by bit 26 of the child index, node ids and triangle offsets have to stay
+    // below it. A binary tree has 2n - 1 nodes, a leaf offset is below the reference count n.
+    if (config.bv != config::BV::eHybrid_i32)
+        return true;
+    return 2ull * leafCount <= MIXED_CHILD_AABB;
+}
+
+void Rearrangement::reloadPipelines()
+{
+    metadata.workgroupSize = CreateSpecializationConstants(ctx.memory.pd);
+    vk::SpecializationInfo sInfo { 1, scEntries.data(), 4, &metadata.workgroupSize };
 
     pRearrange = { ctx.d, ctx.sCache, config.shader.rearrange, sInfo };
 }
 
-void Rearrangement::rearrange(vk::CommandBuffer commandBuffer, Bvh const& inputBvh)
+void Rearrangement::rearrange(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, vk::DeviceAddress inputCounts)
 {
     vk::MemoryBarrier memoryBarrierCompute { .srcAccessMask = vk::AccessFlagBits::eShaderWrite, .dstAccessMask = vk::AccessFlagBits::eShaderRead };
     commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), memoryBarrierCompute, nullptr, nullptr);
 
+    // split planes of the binary layouts, collapse costs of the wide ones
+    vk::DeviceAddress auxBufferAddress { 0 };
+    if (buffersOut.contains(Buffer::eSplit))
+        auxBufferAddress = buffersOut.at(Buffer::eSplit).getDeviceAddress(ctx.d);
+    else if (buffersIntermediate.contains(Buffer::eCollapseCost))
+        auxBufferAddress = buffersIntermediate.at(Buffer::eCollapseCost).getDeviceAddress(ctx.d);
+
     data_plocpp::PC_Rearrange pc {
         .bvhAddress = inputBvh.bvh,
         .bvhWideAddress = buffersOut[Buffer::eBVH].getDeviceAddress(ctx.d),
         .workBufferAddress = buffersIntermediate[Buffer::eWorkBuffer].getDeviceAddress(ctx.d),
         .runtimeDataAddress = buffersIntermediate[Buffer::eRuntimeData].getDeviceAddress(ctx.d),
-        .auxBufferAddress = buffersOut.contains(Buffer::eSplit) ? buffersOut.at(Buffer::eSplit).getDeviceAddress(ctx.d) : 0,
-        .leafNodeCount = inputBvh.nodeCountLeaf,
+        .auxBufferAddress = auxBufferAddress,
+        .countsAddress = inputCounts,
     };
 
     commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pRearrange.get());
     commandBuffer.pushConstants(pRearrange.layout.pipeline.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
-    commandBuffer.dispatch(lime::divCeil(inputBvh.nodeCountLeaf, metadata.workgroupSize), 1, 1);
+    deviceCounts.DispatchLeaves(commandBuffer);
 }
 
 void Rearrangement::freeIntermediate()
 {
     buffersIntermediate.clear();
+    stagingBuffer.reset();
 }
 
 void Rearrangement::freeAll()
 {
     freeIntermediate();
+    deviceCounts.freeAll();
     buffersOut.clear();
 }
 
+vk::DeviceSize Rearrangement::Output::SizeInBytes() const
+{
+    vk::DeviceSize size { 0 };
+    for (auto const& [id, buffer] : buffers)
+        size += buffer.getSizeInBytes();
+    return size;
+}
+
+Rearrangement::Output Rearrangement::DetachOutput()
+{
+    freeIntermediate();
+    Output output { .buffers = std::move(buffersOut) };
+    buffersOut.clear();
+    return output;
+}
+
 void Rearrangement::alloc()
 {
     freeAll();
@@ -160,8 +273,48 @@ void Rearrangement::alloc()
             case config::BV::eSOBB_i48:
             case config::BV::eSOBB_i64:
                 return sizeof(data_bvh::NodeBVH2_SOBBi_c);
+            case config::BV::eHybrid_i32:
+                return sizeof(data_bvh::NodeBVH2_MIXED_c);
+            default:;
+            }
+            break;
+        case config::NodeLayout::eBVH2q:
+            switch (bv) {
+            case config::BV::eAABB:
+                return sizeof(data_bvh::NodeBVH2_AABB_q);
+            case config::BV::eSOBB_i32:
+            case config::BV::eSOBB_i48:
+            case config::BV::eSOBB_i64:
+                return sizeof(data_bvh::NodeBVH2_SOBBi_q);
             default:;
             }
+            break;
+        case config::NodeLayout::eBVH4:
+            switch (bv) {
+            case config::BV::eAABB:
+                return sizeof(data_bvh::NodeBVH4_AABB_c);
+            case config::BV::eSOBB_d:
+                return sizeof(data_bvh::NodeBVH4_SOBB_c);
+            case config::BV::eSOBB_i32:
+            case config::BV::eSOBB_i48:
+            case config::BV::eSOBB_i64:
+                return sizeof(data_bvh::NodeBVH4_SOBBi_c);
+            default:;
+            }
+            break;
+        case config::NodeLayout::eBVH8:
+            switch (bv) {
+            case config::BV::eAABB:
+                return sizeof(data_bvh::NodeBVH8_AABB_c);
+            case config::BV::eSOBB_d:
+                return sizeof(data_bvh::NodeBVH8_SOBB_c);
+            case config::BV::eSOBB_i32:
+            case config::BV::eSOBB_i48:
+            case config::BV::eSOBB_i64:
+                return sizeof(data_bvh::NodeBVH8_SOBBi_c);
+            default:;
+            }
+            break;
         default:;
         }
         berry::log::error("Rearrangement: unknown bvh node size.");
@@ -186,10 +339,22 @@ void Rearrangement::alloc()
         buffersOut[Buffer::eSplit] = ctx.memory.alloc(aReq, cInfo, "bvh_rearranged_split");
     }
 
+    cInfo.size = sizeof(data_bvh::BvhCounts);
+    buffersOut[Buffer::eCounts] = ctx.memory.alloc(aReq, cInfo, "bvh_rearranged_counts");
+
     cInfo.size = sizeof(u32) * 3;
     buffersIntermediate[Buffer::eRuntimeData] = ctx.memory.alloc(aReq, cInfo, "rearrangement_runtime");
 
     cInfo.size = sizeof(u32) * metadata.nodeCountLeaf * 2;
     buffersIntermediate[Buffer::eWorkBuffer] = ctx.memory.alloc(aReq, cInfo, "rearrangement_work_buffer");
+
+    // arrival counter and a cost per slot count for every binary node, see rearrange_bvhw.glsl
+    if (config.layout == config::NodeLayout::eBVH4 || config.layout == config::NodeLayout::eBVH8) {
+        auto const width { config.layout == config::NodeLayout::eBVH8 ? 8u : 4u };
+        cInfo.size = sizeof(u32) * metadata.inputNodeCountTotal * (width + 1);
+        buffersIntermediate[Buffer::eCollapseCost] = ctx.memory.alloc(aReq, cInfo, "rearrangement_collapse_cost");
+    }
+
+    stagingBuffer = ctx.memory.alloc({ .memoryUsage = lime::DeviceMemoryUsage::eDeviceToHost }, { .size = sizeof(data_bvh::BvhCounts), .usage = vk::BufferUsageFlagBits::eTransferDst }, "rearrangement_staging");
 }
 }
@@ -3,6 +3,8 @@
 #include "../../../Config.h"
 #include "../../../Stats.h"
 #include "../../VCtx.h"
+#include "BvhCache.h"
+#include "DeviceCounts.h"
 #include "Types.h"
 #include <vLime/Compute.h>
 #include <vLime/Memory.h>
@@ -22,20 +24,29 @@ struct Rearrangement {
         return cfgChanged && config.bv != config::BV::eNone;
     }
     [[nodiscard]] bool CheckForShaderHotReload();
+    static void CollectPipelineKeys(vk::PhysicalDevice pd, config::Rearrangement const& config, std::vector<PipelineKey>& keys);
+    // whether the layout can address every node and triangle reference of a tree over leafCount leaves
+    [[nodiscard]] static bool CanAddress(config::Rearrangement const& config, u32 leafCount);
 
     void Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBvh);
     void ReadRuntimeData();
     [[nodiscard]] stats::Rearrangement GatherStats(BvhStats const& bvhStats);
 
+    // final tree buffers, triangles are owned only by a tree loaded from the on-disk cache
+    [[nodiscard]] lime::Buffer::Detail GetBuffer(BvhCache::Section section) const;
+    void AllocFromCache(BvhCache::Header const& header);
+
 private:
     VCtx ctx;
     config::Rearrangement config;
 
     lime::PipelineCompute pRearrange;
+    DeviceCounts deviceCounts;
 
     struct Metadata {
         u32 nodeCountLeaf { 0 };
         u32 nodeCountTotal { 0 };
+        u32 inputNodeCountTotal { 0 };
         vk::DeviceAddress bvhTriangles { 0 };
         vk::DeviceAddress bvhTriangleIDs { 0 };
 
@@ -45,22 +56,38 @@ private:
     enum class Buffer {
         eBVH,
         eSplit,
+        eBVHTriangles,
+        eBVHTriangleIDs,
+        eCounts,
         eWorkBuffer,
         eRuntimeData,
+        eCollapseCost,
     };
 
-    // lime::Buffer stagingBuffer;
+    lime::Buffer stagingBuffer;
     std::unordered_map<Buffer, lime::Buffer> buffersOut;
     std::unordered_map<Buffer, lime::Buffer> buffersIntermediate;
 
     void reloadPipelines();
     void alloc();
 public:
+    // finished tree detached from the stage, kept by the two-level tree as one of its bottom levels
+    struct Output {
+        std::unordered_map<Buffer, lime::Buffer> buffers;
+
+        [[nodiscard]] vk::DeviceSize SizeInBytes() const;
+    };
+    [[nodiscard]] bool HasOutput() const
+    {
+        return buffersOut.contains(Buffer::eBVH);
+    }
+    [[nodiscard]] Output DetachOutput();
+
     void freeIntermediate();
     void freeAll();
 private:
 
-    void rearrange(vk::CommandBuffer commandBuffer, Bvh const& inputBvh);
+    void rearrange(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, vk::DeviceAddress inputCounts);
 
     lime::SingleTimer timestamps;
 };
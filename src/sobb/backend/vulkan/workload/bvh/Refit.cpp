@@ -0,0 +1,119 @@
+#include "Refit.h"
+
+#include <final/shared/data_plocpp.h>
+#include <vLime/ComputeHelpers.h>
+
+namespace backend::vulkan::bvh {
+
+static u32 CreateSpecializationConstants(vk::PhysicalDevice pd)
+{
+    auto const prop2 { pd.getProperties2() };
+    return std::min(512u, prop2.properties.limits.maxComputeWorkGroupSize[0]);
+}
+
+static std::array<vk::SpecializationMapEntry, 1> constexpr scEntries {
+    vk::SpecializationMapEntry { 0, 0, sizeof(u32) },
+};
+
+Refit::Refit(VCtx ctx)
+    : ctx(ctx)
+    , deviceCounts(ctx)
+    , timestamps(ctx.d, ctx.pd)
+{
+}
+
+bool Refit::CheckForShaderHotReload()
+{
+    auto const updated { deviceCounts.CheckForShaderHotReload() };
+    return pRefit.Update(ctx.d, ctx.sCache) || updated;
+}
+
+void Refit::Compute(vk::CommandBuffer commandBuffer, Bvh const& bvh, vk::DeviceAddress geometryDescriptor)
+{
+    if (!pRefit.isValid())
+        reloadPipelines();
+    if (metadata.nodeCountTotal != bvh.nodeCountTotal || buffersIntermediate.empty()) {
+        metadata.nodeCountTotal = bvh.nodeCountTotal;
+        alloc();
+    }
+
+    auto const counts { deviceCounts.Prepare(commandBuffer, bvh, metadata.workgroupSize) };
+    lime::compute::fillZeros(commandBuffer, buffersIntermediate[Buffer::eTraversalCounters]);
+
+    timestamps.Reset(commandBuffer);
+    vk::MemoryBarrier bufferWriteBarrier { .srcAccessMask = vk::AccessFlagBits::eTransferWrite, .dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite };
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), bufferWriteBarrier, nullptr, nullptr);
+    timestamps.Begin(commandBuffer);
+
+    data_plocpp::PC_Refit pc {
+        .bvhAddress = bvh.bvh,
+        .bvhTrianglesAddress = bvh.triangles,
+        .bvhTriangleIndicesAddress = bvh.triangleIDs,
+
+        .geometryDescriptorAddress = geometryDescriptor,
+        .countersAddress = buffersIntermediate[Buffer::eTraversalCounters].getDeviceAddress(ctx.d),
+        .countsAddress = counts,
+    };
+
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pRefit.get());
+    commandBuffer.pushConstants(pRefit.layout.pipeline.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
+    deviceCounts.DispatchLeaves(commandBuffer);
+
+    timestamps.End(commandBuffer);
+}
+
+stats::Refit Refit::GatherStats(BvhStats const& bvhStats, f32 costReference)
+{
+    stats::Refit stats;
+    stats.timeTotal = timestamps.ReadTimeNs() * 1e-6f;
+    stats.costTotal = bvhStats.costIntersect + bvhStats.costTraverse;
+    stats.costReference = costReference;
+    stats.sahDegradation = costReference > 0.f ? stats.costTotal / costReference : 1.f;
+
+    return stats;
+}
+
+void Refit::CollectPipelineKeys(vk::PhysicalDevice pd, std::vector<PipelineKey>& keys)
+{
+    keys.emplace_back(SHADER, scEntries, CreateSpecializationConstants(pd));
+    DeviceCounts::CollectPipelineKeys(keys);
+}
+
+void Refit::reloadPipelines()
+{
+    metadata.workgroupSize = CreateSpecializationConstants(ctx.pd);
+    vk::SpecializationInfo sInfo { 1, scEntries.data(), 4, &metadata.workgroupSize };
+
+    pRefit = { ctx.d, ctx.sCache, SHADER, sInfo };
+}
+
+void Refit::freeIntermediate()
+{
+    buffersIntermediate.clear();
+}
+
+void Refit::freeAll()
+{
+    freeIntermediate();
+    deviceCounts.freeAll();
+}
+
+void Refit::alloc()
+{
+    freeIntermediate();
+    ctx.memory.cleanUp();
+
+    using bfub = vk::BufferUsageFlagBits;
+    lime::AllocRequirements aReq {
+        .memoryUsage = lime::DeviceMemoryUsage::eDeviceOptimal,
+        .additionalAlignment = 256,
+    };
+    vk::BufferCreateInfo cInfo {
+        .size = sizeof(u32) * metadata.nodeCountTotal,
+        .usage = bfub::eStorageBuffer | bfub::eShaderDeviceAddress | bfub::eTransferSrc | bfub::eTransferDst,
+    };
+
+    buffersIntermediate[Buffer::eTraversalCounters] = ctx.memory.alloc(aReq, cInfo, "refit_traversal_counters");
+}
+
+}
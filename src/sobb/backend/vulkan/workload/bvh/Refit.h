@@ -0,0 +1,54 @@
+#pragma once
+
+#include "../../../Config.h"
+#include "../../../Stats.h"
+#include "../../VCtx.h"
+#include "DeviceCounts.h"
+#include "Types.h"
+#include <vLime/Compute.h>
+#include <vLime/Memory.h>
+#include <vLime/Timestamp.h>
+#include <vLime/vLime.h>
+
+namespace backend::vulkan::bvh {
+
+// Refits an AABB BVH2 in place after its geometry moved, the topology is kept.
+struct Refit {
+    explicit Refit(VCtx ctx);
+
+    [[nodiscard]] bool CheckForShaderHotReload();
+    static void CollectPipelineKeys(vk::PhysicalDevice pd, std::vector<PipelineKey>& keys);
+
+    void Compute(vk::CommandBuffer commandBuffer, Bvh const& bvh, vk::DeviceAddress geometryDescriptor);
+    [[nodiscard]] stats::Refit GatherStats(BvhStats const& bvhStats, f32 costReference);
+
+private:
+    static constexpr std::string_view SHADER { "final/refit_aabb.comp.spv" };
+
+    VCtx ctx;
+
+    lime::PipelineCompute pRefit;
+    DeviceCounts deviceCounts;
+
+    struct Metadata {
+        u32 nodeCountTotal { 0 };
+        u32 workgroupSize { 0 };
+    } metadata;
+
+    enum class Buffer {
+        eTraversalCounters,
+    };
+
+    std::unordered_map<Buffer, lime::Buffer> buffersIntermediate;
+
+    void reloadPipelines();
+    void alloc();
+public:
+    void freeIntermediate();
+    void freeAll();
+private:
+
+    lime::SingleTimer timestamps;
+};
+
+}
@@ -0,0 +1,326 @@
+#include "Restructuring.h"
+
+#include <final/shared/data_bvh.h>
+#include <final/shared/data_plocpp.h>
+#include <vLime/ComputeHelpers.h>
+
+namespace backend::vulkan::bvh {
+
+// every thread keeps the cost table of all subsets of its treelet leaves, workgroups are kept small
+static constexpr u32 MAX_WORKGROUP_SIZE { 64 };
+static constexpr u32 MIN_TREELET_SIZE { 3 };
+static constexpr u32 MAX_TREELET_SIZE { 9 };
+// the applied moves of every reinsertion iteration are counted separately, the stop check reads the previous one
+static constexpr u32 MAX_REINSERTION_ITERATIONS { 64 };
+
+static data_plocpp::SC_Restructure CreateSpecializationConstants(vk::PhysicalDevice pd, config::Restructuring const& config)
+{
+    auto const prop2 { pd.getProperties2() };
+    return {
+        .sizeWorkgroup = std::min(MAX_WORKGROUP_SIZE, prop2.properties.limits.maxComputeWorkGroupSize[0]),
+        .treeletSize = std::clamp(config.treeletSize, MIN_TREELET_SIZE, MAX_TREELET_SIZE),
+    };
+}
+
+// k-DOP the SOBB score volume is fitted to, 0 for the volumes kept as they are
+static u32 GetScoreDopSize(config::BV bv)
+{
+    switch (bv) {
+    case config::BV::eSOBB_d:
+    case config::BV::eSOBB_d32:
+    case config::BV::eSOBB_i32:
+        return 32;
+    case config::BV::eSOBB_d48:
+    case config::BV::eSOBB_i48:
+        return 48;
+    case config::BV::eSOBB_d64:
+    case config::BV::eSOBB_i64:
+        return 64;
+    default:
+        return 0;
+    }
+}
+
+static std::array<vk::SpecializationMapEntry, 2> constexpr scEntries {
+    vk::SpecializationMapEntry { 0, static_cast<u32>(offsetof(data_plocpp::SC_Restructure, sizeWorkgroup)), sizeof(u32) },
+    vk::SpecializationMapEntry { 1, static_cast<u32>(offsetof(data_plocpp::SC_Restructure, treeletSize)), sizeof(u32) },
+};
+
+Restructuring::Restructuring(VCtx ctx)
+    : ctx(ctx)
+    , deviceCounts(ctx)
+    , timestamps(ctx.d, ctx.pd)
+{
+}
+
+bool Restructuring::CheckForShaderHotReload()
+{
+    auto const updated { deviceCounts.CheckForShaderHotReload() };
+    return pRestructure.Update(ctx.d, ctx.sCache) || updated;
+}
+
+Bvh Restructuring::GetBVH() const
+{
+    return {
+        .bvh = buffersOut.at(Buffer::eBVH).getDeviceAddress(ctx.d),
+        .triangles = metadata.bvhTriangles,
+        .triangleIDs = metadata.bvhTriangleIDs,
+        .counts = metadata.counts,
+        .nodeCountLeaf = metadata.nodeCountLeaf,
+        .nodeCountTotal = metadata.nodeCountTotal,
+        .bv = config::BV::eAABB,
+        .layout = config::NodeLayout::eDefault,
+    };
+}
+
+void Restructuring::Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, lime::Buffer::Detail const& inputNodes, vk::DeviceAddress geometryDescriptor)
+{
+    metadata.bvhTriangles = inputBvh.triangles;
+    metadata.bvhTriangleIDs = inputBvh.triangleIDs;
+    // the topology changes, the node counts do not
+    metadata.counts = inputBvh.counts;
+    metadata.nodeCountLeaf = inputBvh.nodeCountLeaf;
+    metadata.nodeCountTotal = inputBvh.nodeCountTotal;
+
+    reloadPipelines();
+    alloc();
+
+    lime::compute::pBarrierTransferRead(commandBuffer);
+    commandBuffer.copyBuffer(inputNodes.get(), buffersOut[Buffer::eBVH].get(), vk::BufferCopy(inputNodes.offset, 0, buffersOut[Buffer::eBVH].getSizeInBytes()));
+
+    timestamps.Reset(commandBuffer);
+    timestamps.Begin(commandBuffer);
+    if (config.method == config::RestructuringMethod::eReinsertion)
+        reinsert(commandBuffer, inputBvh, geometryDescriptor);
+    else
+        restructure(commandBuffer, inputBvh, geometryDescriptor);
+    timestamps.End(commandBuffer);
+
+    if (config.method == config::RestructuringMethod::eReinsertion) {
+        lime::compute::pBarrierTransferRead(commandBuffer);
+        commandBuffer.copyBuffer(buffersIntermediate[Buffer::eRuntimeData].get(), stagingBuffer.get(), vk::BufferCopy(0, 0, stagingBuffer.getSizeInBytes()));
+    }
+}
+
+void Restructuring::ReadRuntimeData(Bvh const& inputBvh)
+{
+    metadata.nodeCountLeaf = inputBvh.nodeCountLeaf;
+    metadata.nodeCountTotal = inputBvh.nodeCountTotal;
+
+    metadata.iterationCount = config.iterations;
+    metadata.reinsertionCount = 0;
+    if (config.method != config::RestructuringMethod::eReinsertion)
+        return;
+
+    // iterations after the first one without enough moves have exited early
+    auto const* applied { static_cast<u32*>(stagingBuffer.getMapping()) };
+    auto const minReinsertions { getMinReinsertions(metadata.nodeCountTotal) };
+    metadata.iterationCount = 0;
+    for (u32 i = 0; i < std::min(config.iterations, MAX_REINSERTION_ITERATIONS); ++i) {
+        metadata.iterationCount++;
+        metadata.reinsertionCount += applied[i];
+        if (applied[i] < minReinsertions)
+            break;
+    }
+}
+
+stats::Restructuring Restructuring::GatherStats(BvhStats const& bvhStats)
+{
+    stats::Restructuring stats;
+    stats.timeTotal = timestamps.ReadTimeNs() * 1e-6f;
+    stats.iterationCount = metadata.iterationCount;
+    stats.reinsertionCount = metadata.reinsertionCount;
+
+    stats.saIntersect = bvhStats.saIntersect;
+    stats.saTraverse = bvhStats.saTraverse;
+    stats.costTotal = bvhStats.costIntersect + bvhStats.costTraverse;
+
+    stats.nodeCountTotal = metadata.nodeCountTotal;
+
+    return stats;
+}
+
+void Restructuring::CollectPipelineKeys(vk::PhysicalDevice pd, config::Restructuring const& config, std::vector<PipelineKey>& keys)
+{
+    if (config.bv == config::BV::eNone || config.shader.restructure.empty())
+        return;
+    keys.emplace_back(config.shader.restructure, scEntries, CreateSpecializationConstants(pd, config));
+    DeviceCounts::CollectPipelineKeys(keys);
+}
+
+void Restructuring::reloadPipelines()
+{
+    auto const sc { CreateSpecializationConstants(ctx.memory.pd, config) };
+    metadata.workgroupSize = sc.sizeWorkgroup;
+    vk::SpecializationInfo sInfo { csize<u32>(scEntries), scEntries.data(), sizeof(sc), &sc };
+
+    pRestructure = { ctx.d, ctx.sCache, config.shader.restructure, sInfo };
+}
+
+void Restructuring::restructure(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, vk::DeviceAddress geometryDescriptor)
+{
+    auto const counts { deviceCounts.Prepare(commandBuffer, inputBvh, metadata.workgroupSize) };
+
+    data_plocpp::PC_Restructure pc {
+        .bvhAddress = buffersOut[Buffer::eBVH].getDeviceAddress(ctx.d),
+        .bvhTriangleIndicesAddress = inputBvh.triangleIDs,
+        .bvhScoreAddress = buffersIntermediate.contains(Buffer::eNodeScoreBV) ? buffersIntermediate[Buffer::eNodeScoreBV].getDeviceAddress(ctx.d) : 0,
+
+        .geometryDescriptorAddress = geometryDescriptor,
+        .countersAddress = buffersIntermediate[Buffer::eTraversalCounters].getDeviceAddress(ctx.d),
+        .costAddress = buffersIntermediate[Buffer::eNodeCost].getDeviceAddress(ctx.d),
+        .countsAddress = counts,
+
+        .c_t = config.c_t,
+        .c_i = config.c_i,
+    };
+
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pRestructure.get());
+    commandBuffer.pushConstants(pRestructure.layout.pipeline.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
+
+    // each pass starts from the leaves again, treelets restructured by one pass are regrouped by the next one
+    for (u32 i = 0; i < config.iterations; ++i) {
+        if (i > 0) {
+            lime::compute::pBarrierCompute(commandBuffer);
+            lime::compute::pBarrierTransferRead(commandBuffer);
+        }
+        lime::compute::fillZeros(commandBuffer, buffersIntermediate[Buffer::eTraversalCounters]);
+        lime::compute::pBarrierTransferWrite(commandBuffer);
+        deviceCounts.DispatchLeaves(commandBuffer);
+    }
+}
+
+void Restructuring::reinsert(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, vk::DeviceAddress geometryDescriptor)
+{
+    auto const counts { deviceCounts.Prepare(commandBuffer, inputBvh, metadata.workgroupSize) };
+
+    data_plocpp::PC_Reinsert pc {
+        .bvhAddress = buffersOut[Buffer::eBVH].getDeviceAddress(ctx.d),
+        .bvhTriangleIndicesAddress = inputBvh.triangleIDs,
+        .bvhScoreAddress = buffersIntermediate.contains(Buffer::eNodeScoreBV) ? buffersIntermediate[Buffer::eNodeScoreBV].getDeviceAddress(ctx.d) : 0,
+
+        .geometryDescriptorAddress = geometryDescriptor,
+        .countersAddress = buffersIntermediate[Buffer::eTraversalCounters].getDeviceAddress(ctx.d),
+        .candidatesAddress = buffersIntermediate[Buffer::eReinsertionCandidates].getDeviceAddress(ctx.d),
+        .locksAddress = buffersIntermediate[Buffer::eReinsertionLocks].getDeviceAddress(ctx.d),
+        .runtimeDataAddress = buffersIntermediate[Buffer::eRuntimeData].getDeviceAddress(ctx.d),
+        .countsAddress = counts,
+
+        .phase = REINSERT_PHASE_INIT,
+        .iteration = 0,
+        .minReinsertionRatio = config.minReinsertionRatio,
+    };
+
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pRestructure.get());
+    auto const dispatch = [&](u32 phase, u32 iteration) {
+        pc.phase = phase;
+        pc.iteration = iteration;
+        commandBuffer.pushConstants(pRestructure.layout.pipeline.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
+        deviceCounts.DispatchNodes(commandBuffer);
+        lime::compute::pBarrierCompute(commandBuffer);
+    };
+
+    lime::compute::fillZeros(commandBuffer, buffersIntermediate[Buffer::eRuntimeData]);
+    // the AABBs of the tree are scored directly, other volumes are fitted to it first
+    if (config.bv != config::BV::eAABB) {
+        lime::compute::fillZeros(commandBuffer, buffersIntermediate[Buffer::eTraversalCounters]);
+        lime::compute::pBarrierTransferWrite(commandBuffer);
+        dispatch(REINSERT_PHASE_INIT, 0);
+    }
+
+    // the dispatches are recorded for the whole budget, the ones after the improvement stalls exit early on the device
+    for (u32 i = 0; i < std::min(config.iterations, MAX_REINSERTION_ITERATIONS); ++i) {
+        lime::compute::pBarrierTransferRead(commandBuffer);
+        lime::compute::fillZeros(commandBuffer, buffersIntermediate[Buffer::eReinsertionLocks]);
+        lime::compute::fillZeros(commandBuffer, buffersIntermediate[Buffer::eTraversalCounters]);
+        lime::compute::pBarrierTransferWrite(commandBuffer);
+
+        dispatch(REINSERT_PHASE_SEARCH, i);
+        dispatch(REINSERT_PHASE_APPLY, i);
+        dispatch(REINSERT_PHASE_REFIT, i);
+    }
+}
+
+u32 Restructuring::getMinReinsertions(u32 nodeCount) const
+{
+    return std::max(1u, static_cast<u32>(config.minReinsertionRatio * static_cast<f32>(nodeCount)));
+}
+
+void Restructuring::freeIntermediate()
+{
+    buffersIntermediate.clear();
+    stagingBuffer.reset();
+}
+
+void Restructuring::freeAll()
+{
+    freeIntermediate();
+    deviceCounts.freeAll();
+    buffersOut.clear();
+}
+
+vk::DeviceSize Restructuring::Output::SizeInBytes() const
+{
+    vk::DeviceSize size { 0 };
+    for (auto const& [id, buffer] : buffers)
+        size += buffer.getSizeInBytes();
+    return size;
+}
+
+Restructuring::Output Restructuring::DetachOutput()
+{
+    freeIntermediate();
+    Output output { .buffers = std::move(buffersOut), .metadata = metadata };
+    buffersOut.clear();
+    return output;
+}
+
+void Restructuring::AttachOutput(Output&& output)
+{
+    freeAll();
+    buffersOut = std::move(output.buffers);
+    metadata = output.metadata;
+}
+
+void Restructuring::alloc()
+{
+    freeAll();
+    ctx.memory.cleanUp();
+
+    using bfub = vk::BufferUsageFlagBits;
+    lime::AllocRequirements aReq {
+        .memoryUsage = lime::DeviceMemoryUsage::eDeviceOptimal,
+        .additionalAlignment = 256,
+    };
+    vk::BufferCreateInfo cInfo {
+        .size = 0,
+        .usage = bfub::eStorageBuffer | bfub::eShaderDeviceAddress | bfub::eTransferSrc | bfub::eTransferDst,
+    };
+
+    cInfo.size = sizeof(data_bvh::NodeBVH2_AABB) * metadata.nodeCountTotal;
+    buffersOut[Buffer::eBVH] = ctx.memory.alloc(aReq, cInfo, "bvh_restructured");
+
+    cInfo.size = sizeof(u32) * metadata.nodeCountTotal;
+    buffersIntermediate[Buffer::eTraversalCounters] = ctx.memory.alloc(aReq, cInfo, "restructuring_traversal_counters");
+
+    if (config.method == config::RestructuringMethod::eReinsertion) {
+        cInfo.size = sizeof(data_plocpp::ReinsertionCandidate) * metadata.nodeCountTotal;
+        buffersIntermediate[Buffer::eReinsertionCandidates] = ctx.memory.alloc(aReq, cInfo, "restructuring_reinsertion_candidates");
+        cInfo.size = sizeof(u64) * metadata.nodeCountTotal;
+        buffersIntermediate[Buffer::eReinsertionLocks] = ctx.memory.alloc(aReq, cInfo, "restructuring_reinsertion_locks");
+        cInfo.size = sizeof(u32) * MAX_REINSERTION_ITERATIONS;
+        buffersIntermediate[Buffer::eRuntimeData] = ctx.memory.alloc(aReq, cInfo, "restructuring_runtime_data");
+        stagingBuffer = ctx.memory.alloc({ .memoryUsage = lime::DeviceMemoryUsage::eDeviceToHost }, { .size = cInfo.size, .usage = vk::BufferUsageFlagBits::eTransferDst }, "restructuring_staging");
+    } else
+        buffersIntermediate[Buffer::eNodeCost] = ctx.memory.alloc(aReq, cInfo, "restructuring_node_cost");
+
+    // only the bounds of the nodes are used, the node layout keeps the shader side simple
+    if (config.bv == config::BV::eDOP14) {
+        cInfo.size = sizeof(data_bvh::NodeBVH2_DOP14) * metadata.nodeCountTotal;
+        buffersIntermediate[Buffer::eNodeScoreBV] = ctx.memory.alloc(aReq, cInfo, "restructuring_node_score_bv");
+    } else if (auto const dopSize { GetScoreDopSize(config.bv) }; dopSize > 0) {
+        cInfo.size = sizeof(f32) * dopSize * metadata.nodeCountTotal;
+        buffersIntermediate[Buffer::eNodeScoreBV] = ctx.memory.alloc(aReq, cInfo, "restructuring_node_score_bv");
+    }
+}
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "../../../Config.h"
+#include "../../../Stats.h"
+#include "../../VCtx.h"
+#include "DeviceCounts.h"
+#include "Types.h"
+#include <vLime/Compute.h>
+#include <vLime/Memory.h>
+#include <vLime/Timestamp.h>
+#include <vLime/vLime.h>
+
+namespace backend::vulkan::bvh {
+
+// Optimizes the topology of the PLOC++ tree by treelet restructuring or parallel reinsertion, works on a copy so
+// the PLOC++ output stays valid for other pipelines. Triangles are passed through from upstream.
+struct Restructuring {
+    explicit Restructuring(VCtx ctx);
+
+    [[nodiscard]] Bvh GetBVH() const;
+    [[nodiscard]] bool NeedsRecompute(config::Restructuring const& buildConfig)
+    {
+        auto const cfgChanged { config != buildConfig };
+        config = buildConfig;
+        return cfgChanged && config.bv != config::BV::eNone;
+    }
+    [[nodiscard]] bool CheckForShaderHotReload();
+    static void CollectPipelineKeys(vk::PhysicalDevice pd, config::Restructuring const& config, std::vector<PipelineKey>& keys);
+
+    void Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, lime::Buffer::Detail const& inputNodes, vk::DeviceAddress geometryDescriptor);
+    // node counts of the input tree are final only once its own runtime data was read back
+    void ReadRuntimeData(Bvh const& inputBvh);
+    [[nodiscard]] stats::Restructuring GatherStats(BvhStats const& bvhStats);
+
+private:
+    VCtx ctx;
+    config::Restructuring config;
+
+    lime::PipelineCompute pRestructure;
+    DeviceCounts deviceCounts;
+
+    struct Metadata {
+        vk::DeviceAddress bvhTriangles { 0 };
+        vk::DeviceAddress bvhTriangleIDs { 0 };
+        vk::DeviceAddress counts { 0 };
+        u32 nodeCountLeaf { 0 };
+        u32 nodeCountTotal { 0 };
+
+        u32 workgroupSize { 0 };
+        u32 iterationCount { 0 };
+        u32 reinsertionCount { 0 };
+    } metadata;
+
+    enum class Buffer {
+        eBVH,
+
+        eTraversalCounters,
+        eNodeCost,
+        eNodeScoreBV,
+
+        eReinsertionCandidates,
+        eReinsertionLocks,
+        eRuntimeData,
+    };
+
+    std::unordered_map<Buffer, lime::Buffer> buffersOut;
+    std::unordered_map<Buffer, lime::Buffer> buffersIntermediate;
+    lime::Buffer stagingBuffer;
+
+    void reloadPipelines();
+    void alloc();
+    [[nodiscard]] u32 getMinReinsertions(u32 nodeCount) const;
+
+public:
+    // built tree detached from the stage, parked in the stage cache until a pipeline with the same upstream config needs it
+    struct Output {
+        std::unordered_map<Buffer, lime::Buffer> buffers;
+        Metadata metadata;
+
+        [[nodiscard]] vk::DeviceSize SizeInBytes() const;
+    };
+    [[nodiscard]] bool HasOutput() const
+    {
+        return buffersOut.contains(Buffer::eBVH);
+    }
+    [[nodiscard]] Output DetachOutput();
+    void AttachOutput(Output&& output);
+
+    void freeIntermediate();
+    void freeAll();
+
+private:
+    void restructure(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, vk::DeviceAddress geometryDescriptor);
+    void reinsert(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, vk::DeviceAddress geometryDescriptor);
+
+    lime::SingleTimer timestamps;
+};
+
+}
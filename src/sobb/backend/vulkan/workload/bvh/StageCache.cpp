@@ -0,0 +1,57 @@
+#include "StageCache.h"
+
+#include <algorithm>
+#include <berries/lib_helper/spdlog.h>
+
+namespace backend::vulkan::bvh {
+
+void StageCache::Insert(Entry&& entry)
+{
+    auto const size { entry.SizeInBytes() };
+    if (size == 0 || size > budget)
+        return;
+
+    std::erase_if(slots, [&](Slot const& s) {
+        if (s.entry.key != entry.key)
+            return false;
+        sizeInBytes -= s.sizeInBytes;
+        return true;
+    });
+
+    slots.push_back({ .entry = std::move(entry), .sizeInBytes = size, .lastUse = ++useCounter });
+    sizeInBytes += size;
+    evict();
+
+    berry::log::debug("Stage cache: stored upstream tree ({:.1f} MB), {} entries, {:.1f} MB total", 1e-6f * static_cast<f32>(size), slots.size(), 1e-6f * static_cast<f32>(sizeInBytes));
+}
+
+std::optional<StageCache::Entry> StageCache::Extract(Key const& key)
+{
+    auto const it { std::ranges::find_if(slots, [&](Slot const& s) { return s.entry.key == key; }) };
+    if (it == slots.end())
+        return std::nullopt;
+
+    std::optional<Entry> result { std::move(it->entry) };
+    sizeInBytes -= it->sizeInBytes;
+    slots.erase(it);
+
+    berry::log::debug("Stage cache: reusing upstream tree, {} entries left", slots.size());
+    return result;
+}
+
+void StageCache::Clear()
+{
+    slots.clear();
+    sizeInBytes = 0;
+}
+
+void StageCache::evict()
+{
+    while (sizeInBytes > budget && !slots.empty()) {
+        auto const lru { std::ranges::min_element(slots, {}, &Slot::lastUse) };
+        sizeInBytes -= lru->sizeInBytes;
+        slots.erase(lru);
+    }
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "../../../Config.h"
+#include "../../../Stats.h"
+#include "Collapsing.h"
+#include "PLOCpp.h"
+#include "Restructuring.h"
+
+#include <optional>
+#include <vector>
+
+namespace backend::vulkan::bvh {
+
+// Built upstream trees (PLOC++, restructuring and collapsing outputs) shared between pipelines.
+// Entries are addressed by the config chain that produced them and evicted in LRU order over the VRAM budget.
+class StageCache {
+public:
+    struct Key {
+        config::PLOC plocpp;
+        config::Restructuring restructuring;
+        config::Collapsing collapsing;
+
+        bool operator==(Key const& rhs) const = default;
+    };
+
+    struct Entry {
+        Key key;
+        PLOCpp::Output plocpp;
+        Restructuring::Output restructuring;
+        Collapsing::Output collapsing;
+
+        stats::PLOC statsPlocpp;
+        stats::Restructuring statsRestructuring;
+        stats::Collapsing statsCollapsing;
+
+        [[nodiscard]] vk::DeviceSize SizeInBytes() const
+        {
+            return plocpp.SizeInBytes() + restructuring.SizeInBytes() + collapsing.SizeInBytes();
+        }
+    };
+
+    explicit StageCache(vk::DeviceSize budget)
+        : budget(budget)
+    {
+    }
+
+    void Insert(Entry&& entry);
+    [[nodiscard]] std::optional<Entry> Extract(Key const& key);
+    void Clear();
+
+    [[nodiscard]] vk::DeviceSize SizeInBytes() const
+    {
+        return sizeInBytes;
+    }
+
+private:
+    struct Slot {
+        Entry entry;
+        vk::DeviceSize sizeInBytes { 0 };
+        u64 lastUse { 0 };
+    };
+    std::vector<Slot> slots;
+
+    vk::DeviceSize budget;
+    vk::DeviceSize sizeInBytes { 0 };
+    u64 useCounter { 0 };
+
+    void evict();
+};
+
+}
@@ -12,56 +12,51 @@ static u32 CreateSpecializationConstants(vk::PhysicalDevice pd)
 
 Stats::Stats(VCtx ctx)
     : ctx(ctx)
+    , deviceCounts(ctx)
 {
     alloc();
 }
 
-void Stats::Compute(vk::CommandBuffer commandBuffer, config::Stats const& buildCfg, Bvh const& bvh)
+void Stats::Compute(vk::CommandBuffer commandBuffer, config::Stats const& buildCfg, Bvh const& bvh, u32 slot)
 {
     config = buildCfg;
-    reloadPipelines(bvh.layout);
-    stats(commandBuffer, bvh);
+    reloadPipelines(bvh.layout, slot);
+    stats(commandBuffer, bvh, slot);
 }
 
-void Stats::reloadPipelines(config::NodeLayout layout)
+static std::string_view ShaderName(config::BV bv, config::NodeLayout layout)
 {
-    workgroupSize = CreateSpecializationConstants(ctx.pd);
-
-    static std::array<vk::SpecializationMapEntry, 1> constexpr entries {
-        vk::SpecializationMapEntry { 0, 0, sizeof(u32) },
-    };
-    vk::SpecializationInfo sInfo { 1, entries.data(), 4, &workgroupSize };
-
-    switch (config.bv) {
+    switch (bv) {
     case config::BV::eAABB:
         switch (layout) {
         case config::NodeLayout::eDefault:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_aabb.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_aabb.comp.spv";
         case config::NodeLayout::eBVH2:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_aabb_c.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_aabb_c.comp.spv";
+        case config::NodeLayout::eBVH2q:
+            return "final/stats_bvh2q_aabb_c.comp.spv";
+        case config::NodeLayout::eBVH4:
+            return "final/stats_bvh4_aabb_c.comp.spv";
+        case config::NodeLayout::eBVH8:
+            return "final/stats_bvh8_aabb_c.comp.spv";
+        default:;
         }
         break;
     case config::BV::eDOP14:
         switch (layout) {
         case config::NodeLayout::eDefault:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_dop14.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_dop14.comp.spv";
         case config::NodeLayout::eBVH2:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_dop14_c.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_dop14_c.comp.spv";
         default:;
         }
         break;
     case config::BV::eOBB:
         switch (layout) {
         case config::NodeLayout::eDefault:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_obb.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_obb.comp.spv";
         case config::NodeLayout::eBVH2:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_obb_c.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_obb_c.comp.spv";
         default:;
         }
         break;
@@ -71,50 +66,95 @@ void Stats::reloadPipelines(config::NodeLayout layout)
     case config::BV::eSOBB_d64:
         switch (layout) {
         case config::NodeLayout::eDefault:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_sobb_d.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_sobb_d.comp.spv";
         case config::NodeLayout::eBVH2:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_sobb_d_c.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_sobb_d_c.comp.spv";
+        case config::NodeLayout::eBVH4:
+            return "final/stats_bvh4_sobb_d_c.comp.spv";
+        case config::NodeLayout::eBVH8:
+            return "final/stats_bvh8_sobb_d_c.comp.spv";
         default:;
         }
         break;
     case config::BV::eSOBB_i32:
         switch (layout) {
         case config::NodeLayout::eDefault:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_sobb_i32.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_sobb_i32.comp.spv";
         case config::NodeLayout::eBVH2:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_sobb_i32_c.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_sobb_i32_c.comp.spv";
+        case config::NodeLayout::eBVH2q:
+            return "final/stats_bvh2q_sobb_i32_c.comp.spv";
+        case config::NodeLayout::eBVH4:
+            return "final/stats_bvh4_sobb_i32_c.comp.spv";
+        case config::NodeLayout::eBVH8:
+            return "final/stats_bvh8_sobb_i32_c.comp.spv";
         default:;
         }
         break;
     case config::BV::eSOBB_i48:
         switch (layout) {
         case config::NodeLayout::eDefault:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_sobb_i48.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_sobb_i48.comp.spv";
         case config::NodeLayout::eBVH2:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_sobb_i48_c.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_sobb_i48_c.comp.spv";
+        case config::NodeLayout::eBVH2q:
+            return "final/stats_bvh2q_sobb_i48_c.comp.spv";
+        case config::NodeLayout::eBVH4:
+            return "final/stats_bvh4_sobb_i48_c.comp.spv";
+        case config::NodeLayout::eBVH8:
+            return "final/stats_bvh8_sobb_i48_c.comp.spv";
         default:;
         }
         break;
     case config::BV::eSOBB_i64:
         switch (layout) {
         case config::NodeLayout::eDefault:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_sobb_i64.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_sobb_i64.comp.spv";
+        case config::NodeLayout::eBVH2:
+            return "final/stats_bvh2_sobb_i64_c.comp.spv";
+        case config::NodeLayout::eBVH2q:
+            return "final/stats_bvh2q_sobb_i64_c.comp.spv";
+        case config::NodeLayout::eBVH4:
+            return "final/stats_bvh4_sobb_i64_c.comp.spv";
+        case config::NodeLayout::eBVH8:
+            return "final/stats_bvh8_sobb_i64_c.comp.spv";
+        default:;
+        }
+        break;
+    case config::BV::eHybrid_i32:
+        switch (layout) {
+        case config::NodeLayout::eDefault:
+            return "final/stats_bvh2_sobb_i32.comp.spv";
         case config::NodeLayout::eBVH2:
-            pStats = { ctx.d, ctx.sCache, "final/stats_bvh2_sobb_i64_c.comp.spv", sInfo };
-            break;
+            return "final/stats_bvh2_hybrid_i32_c.comp.spv";
         default:;
         }
         break;
-    default:
-        pStats = {};
+    default:;
     }
+    return {};
+}
+
+static std::array<vk::SpecializationMapEntry, 1> constexpr scEntries {
+    vk::SpecializationMapEntry { 0, 0, sizeof(u32) },
+};
+
+void Stats::CollectPipelineKeys(vk::PhysicalDevice pd, config::Stats const& config, config::NodeLayout layout, std::vector<PipelineKey>& keys)
+{
+    if (auto const name { ShaderName(config.bv, layout) }; !name.empty())
+        keys.emplace_back(name, scEntries, CreateSpecializationConstants(pd));
+    DeviceCounts::CollectPipelineKeys(keys);
+}
+
+void Stats::reloadPipelines(config::NodeLayout layout, u32 slot)
+{
+    workgroupSize = CreateSpecializationConstants(ctx.pd);
+    vk::SpecializationInfo sInfo { 1, scEntries.data(), 4, &workgroupSize };
+
+    if (auto const name { ShaderName(config.bv, layout) }; !name.empty())
+        pStats[slot] = { ctx.d, ctx.sCache, name, sInfo };
+    else
+        pStats[slot] = {};
 }
 
 void Stats::alloc()
@@ -127,7 +167,7 @@ void Stats::alloc()
         .memoryUsage = lime::DeviceMemoryUsage::eDeviceToHost,
     };
     vk::BufferCreateInfo cInfo {
-        .size = sizeof(BvhStats),
+        .size = sizeof(BvhStats) * SLOT_COUNT,
         .usage = bfub::eStorageBuffer | bfub::eShaderDeviceAddress | bfub::eTransferSrc | bfub::eTransferDst,
     };
 
@@ -138,27 +178,30 @@ void Stats::alloc()
 void Stats::freeAll()
 {
     bStats.reset();
+    deviceCounts.freeAll();
 }
 
-void Stats::stats(vk::CommandBuffer commandBuffer, Bvh const& bvh)
+void Stats::stats(vk::CommandBuffer commandBuffer, Bvh const& bvh, u32 slot)
 {
-    *data = BvhStats {};
+    data[slot] = BvhStats {};
 
-    if (!pStats.get())
+    if (!pStats[slot].get())
         return;
 
+    auto const counts { deviceCounts.Prepare(commandBuffer, bvh, workgroupSize) };
+
     data_bvh::PC_BvhStats pc {
         .bvhAddress = bvh.bvh,
         .bvhAuxAddress = bvh.bvhAux,
-        .resultBufferAddress = bStats.getDeviceAddress(ctx.d),
-        .nodeCount = bvh.nodeCountTotal,
+        .resultBufferAddress = bStats.getDeviceAddress(ctx.d) + sizeof(BvhStats) * slot,
+        .countsAddress = counts,
         .c_t = config.c_t,
         .c_i = config.c_i,
         .sceneAABBSurfaceArea = metadata.sceneAabbSurfaceArea,
     };
-    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pStats.get());
-    commandBuffer.pushConstants(pStats.layout.pipeline.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
-    commandBuffer.dispatch(lime::divCeil(pc.nodeCount, workgroupSize), 1, 1);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pStats[slot].get());
+    commandBuffer.pushConstants(pStats[slot].layout.pipeline.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
+    deviceCounts.DispatchNodes(commandBuffer);
 }
 
 }
@@ -2,6 +2,7 @@
 
 #include "../../../Config.h"
 #include "../../VCtx.h"
+#include "DeviceCounts.h"
 #include "Types.h"
 #include <vLime/Compute.h>
 #include <vLime/vLime.h>
@@ -11,18 +12,23 @@ namespace backend::vulkan::bvh {
 struct Stats {
     config::Stats config;
 
+    // one result per build stage, a build recorded into a single submission reads all of them back at its end
+    static constexpr u32 SLOT_COUNT { 6 };
     BvhStats* data { nullptr };
 
     explicit Stats(VCtx ctx);
 
-    void Compute(vk::CommandBuffer commandBuffer, config::Stats const& buildCfg, Bvh const& bvh);
+    void Compute(vk::CommandBuffer commandBuffer, config::Stats const& buildCfg, Bvh const& bvh, u32 slot = 0);
+    static void CollectPipelineKeys(vk::PhysicalDevice pd, config::Stats const& config, config::NodeLayout layout, std::vector<PipelineKey>& keys);
 
     void SetSceneAabbSurfaceArea(f32 sa) { metadata.sceneAabbSurfaceArea = sa; }
 
 private:
     VCtx ctx;
 
-    lime::PipelineCompute pStats;
+    // pipelines bound by a pending submission must outlive it, each slot keeps its own
+    std::array<lime::PipelineCompute, SLOT_COUNT> pStats;
+    DeviceCounts deviceCounts;
 
     struct Metadata {
         f32 sceneAabbSurfaceArea { std::numeric_limits<f32>::infinity() };
@@ -32,11 +38,11 @@ private:
 
     u32 workgroupSize { 0 };
 
-    void reloadPipelines(config::NodeLayout layout);
+    void reloadPipelines(config::NodeLayout layout, u32 slot);
     void alloc();
     void freeAll();
 
-    void stats(vk::CommandBuffer commandBuffer, Bvh const& bvh);
+    void stats(vk::CommandBuffer commandBuffer, Bvh const& bvh, u32 slot);
 };
 
 }
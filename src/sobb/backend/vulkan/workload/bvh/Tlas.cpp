@@ -0,0 +1,151 @@
+#include "Tlas.h"
+
+#include <vLime/ComputeHelpers.h>
+#include <vLime/Transfer.h>
+
+#include <final/shared/data_bvh.h>
+
+namespace backend::vulkan::bvh {
+
+vk::DeviceSize Tlas::Blas::SizeInBytes() const
+{
+    return plocpp.SizeInBytes() + collapsing.SizeInBytes() + rearrangement.SizeInBytes();
+}
+
+config::PLOC Tlas::configPlocpp()
+{
+    config::PLOC result {
+        .bv = config::BV::eAABB,
+        .ic = config::InitialClusters::eTriangles,
+    };
+    result.shader.initialClusters = SHADER_INITIAL_CLUSTERS;
+    result.shader.iterations = SHADER_ITERATIONS;
+    return result;
+}
+
+config::Rearrangement Tlas::configRearrangement()
+{
+    config::Rearrangement result {
+        .bv = config::BV::eAABB,
+        .layout = config::NodeLayout::eBVH2,
+    };
+    result.shader.rearrange = SHADER_REARRANGE;
+    return result;
+}
+
+Tlas::Tlas(VCtx ctx)
+    : ctx(ctx)
+    , plocpp(ctx)
+    , rearrangement(ctx)
+{
+    static_cast<void>(plocpp.NeedsRecompute(configPlocpp()));
+    static_cast<void>(rearrangement.NeedsRecompute(configRearrangement()));
+}
+
+Bvh Tlas::GetBVH() const
+{
+    auto result { rearrangement.GetBVH() };
+    result.instances = instancesAddress;
+    result.blasDescriptors = blasDescriptors.getDeviceAddress(ctx.d);
+    // traversal shader is picked by the bottom level layout, the top level is always compact AABB
+    if (!blases.empty()) {
+        result.bv = blases.front().bvh.bv;
+        result.layout = blases.front().bvh.layout;
+    }
+    return result;
+}
+
+bool Tlas::CheckForShaderHotReload()
+{
+    auto const updated { plocpp.CheckForShaderHotReload() };
+    return rearrangement.CheckForShaderHotReload() || updated;
+}
+
+void Tlas::CollectPipelineKeys(vk::PhysicalDevice pd, std::vector<PipelineKey>& keys)
+{
+    PLOCpp::CollectPipelineKeys(pd, configPlocpp(), keys);
+    Rearrangement::CollectPipelineKeys(pd, configRearrangement(), keys);
+}
+
+void Tlas::AddBlas(Blas&& blas)
+{
+    blases.emplace_back(std::move(blas));
+    blasDescriptors.reset();
+}
+
+void Tlas::Compute(vk::CommandBuffer commandBuffer, Instances const& instances)
+{
+    if (!blasDescriptors.isValid())
+        uploadBlasDescriptors();
+
+    instancesAddress = 0;
+    rearrangement.freeAll();
+    plocpp.Compute(commandBuffer, instances);
+    instancesAddress = instances.address;
+}
+
+void Tlas::Rearrange(vk::CommandBuffer commandBuffer)
+{
+    plocpp.ReadRuntimeData();
+    plocpp.freeIntermediate();
+    ctx.memory.cleanUp();
+
+    lime::compute::pBarrierCompute(commandBuffer);
+    rearrangement.Compute(commandBuffer, plocpp.GetBVH());
+}
+
+void Tlas::ReadRuntimeData()
+{
+    rearrangement.ReadRuntimeData();
+    rearrangement.freeIntermediate();
+    ctx.memory.cleanUp();
+}
+
+stats::Instancing Tlas::GatherStats()
+{
+    stats::Instancing stats;
+    stats.blasCount = csize<u32>(blases);
+    for (auto const& b : blases)
+        stats.memoryBlas += b.SizeInBytes();
+    stats.timeTlas = plocpp.GatherStats({}).timeTotal + rearrangement.GatherStats({}).timeTotal;
+    return stats;
+}
+
+void Tlas::uploadBlasDescriptors()
+{
+    std::vector<data_bvh::BlasDescriptor> data;
+    data.reserve(blases.size());
+    for (auto const& b : blases) {
+        data.push_back({
+            .bvhAddress = b.bvh.bvh,
+            .bvhTrianglesAddress = b.bvh.triangles,
+            .bvhTriangleIndicesAddress = b.bvh.triangleIDs,
+            .bvhAuxAddress = b.bvh.bvhAux,
+        });
+    }
+
+    blasDescriptors = ctx.memory.alloc({ .memoryUsage = lime::DeviceMemoryUsage::eDeviceOptimal },
+        {
+            .size = std::max<vk::DeviceSize>(data.size(), 1) * sizeof(data_bvh::BlasDescriptor),
+            .usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eTransferDst,
+        },
+        "tlas_blas_descriptors");
+    ctx.transfer.ToDeviceSync(data, blasDescriptors);
+}
+
+void Tlas::freeIntermediate()
+{
+    plocpp.freeIntermediate();
+    rearrangement.freeIntermediate();
+}
+
+void Tlas::freeAll()
+{
+    plocpp.freeAll();
+    rearrangement.freeAll();
+    blases.clear();
+    blasDescriptors.reset();
+    instancesAddress = 0;
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "../../../Config.h"
+#include "../../../Stats.h"
+#include "../../VCtx.h"
+#include "Collapsing.h"
+#include "PLOCpp.h"
+#include "Rearrangement.h"
+#include "Types.h"
+#include <vLime/Memory.h>
+#include <vLime/vLime.h>
+
+namespace backend::vulkan::bvh {
+
+// Top level of a two-level tree: PLOC++ over world space instance bounds, rearranged to the compact AABB layout.
+// Bottom levels are built per geometry by the regular pipeline and handed over together with the buffers they reference.
+struct Tlas {
+    struct Blas {
+        Bvh bvh;
+        PLOCpp::Output plocpp;
+        Collapsing::Output collapsing;
+        Rearrangement::Output rearrangement;
+
+        [[nodiscard]] vk::DeviceSize SizeInBytes() const;
+    };
+
+    explicit Tlas(VCtx ctx);
+
+    [[nodiscard]] Bvh GetBVH() const;
+    [[nodiscard]] bool HasOutput() const
+    {
+        return instancesAddress != 0;
+    }
+    [[nodiscard]] u32 GetBlasCount() const
+    {
+        return csize<u32>(blases);
+    }
+    [[nodiscard]] bool CheckForShaderHotReload();
+    static void CollectPipelineKeys(vk::PhysicalDevice pd, std::vector<PipelineKey>& keys);
+
+    // blases are indexed by the host geometry id, instances refer to them through blasId
+    void AddBlas(Blas&& blas);
+
+    void Compute(vk::CommandBuffer commandBuffer, Instances const& instances);
+    void Rearrange(vk::CommandBuffer commandBuffer);
+    void ReadRuntimeData();
+    [[nodiscard]] stats::Instancing GatherStats();
+
+    void freeIntermediate();
+    void freeAll();
+
+private:
+    static constexpr std::string_view SHADER_INITIAL_CLUSTERS { "final/plocpp_aabb_InitialClustersInstances.comp.spv" };
+    static constexpr std::string_view SHADER_ITERATIONS { "final/plocpp_aabb_PLOCpp.comp.spv" };
+    static constexpr std::string_view SHADER_REARRANGE { "final/rearrange_bvh2_aabb.comp.spv" };
+
+    static config::PLOC configPlocpp();
+    static config::Rearrangement configRearrangement();
+
+    VCtx ctx;
+    PLOCpp plocpp;
+    Rearrangement rearrangement;
+
+    std::vector<Blas> blases;
+    lime::Buffer blasDescriptors;
+    vk::DeviceAddress instancesAddress { 0 };
+
+    void uploadBlasDescriptors();
+};
+
+}
@@ -1,7 +1,9 @@
 #include "Tracer.h"
+#include "../../RadixSort.h"
 #include "vLime/ComputeHelpers.h"
 
 #include <final/shared/data_ptrace.h>
+#include <radix_sort/platforms/vk/radix_sort_vk.h>
 
 namespace backend::vulkan::bvh {
 using bfub = vk::BufferUsageFlagBits;
@@ -32,6 +34,8 @@ Tracer::Tracer(VCtx ctx)
 void Tracer::Trace(vk::CommandBuffer commandBuffer, config::Tracer const& traceCfg, TraceRuntime const& trt, Bvh const& inputBvh)
 {
     if (traceCfg != config) {
+        if (traceCfg.reordering.enabled != config.reordering.enabled || traceCfg.shadowRays != config.shadowRays)
+            metadata.reallocRayBuffers = true;
         config = traceCfg;
         metadata.reloadPipelines = true;
     }
@@ -42,6 +46,26 @@ void Tracer::Trace(vk::CommandBuffer commandBuffer, config::Tracer const& traceC
     if (config.bv == config::BV::eNone)
         return;
 
+    // only the path tracing kernels sharing ptrace_bvh2.glsl traverse two-level trees
+    if (inputBvh.blasDescriptors != 0 && (metadata.visMode != State::VisMode::ePathTracing || config.bv == config::BV::eDOP14split || inputBvh.layout != config::NodeLayout::eBVH2)) {
+        if (!metadata.instancedUnsupportedReported)
+            berry::log::warn("Tracer: instanced scenes are traced only in path tracing mode with the binary layout, not with dop14split");
+        metadata.instancedUnsupportedReported = true;
+        return;
+    }
+    metadata.instancedUnsupportedReported = false;
+
+    // wide and quantized layouts and indexed leaves have path tracing kernels only
+    auto const indexedLeaves { inputBvh.triangles == 0 };
+    auto const pathTracingOnly { indexedLeaves || inputBvh.layout == config::NodeLayout::eBVH2q || inputBvh.layout == config::NodeLayout::eBVH4 || inputBvh.layout == config::NodeLayout::eBVH8 };
+    if (pathTracingOnly && metadata.visMode != State::VisMode::ePathTracing) {
+        if (!metadata.layoutUnsupportedReported)
+            berry::log::warn("Tracer: wide and quantized bvh layouts and indexed leaves are traced only in path tracing mode");
+        metadata.layoutUnsupportedReported = true;
+        return;
+    }
+    metadata.layoutUnsupportedReported = false;
+
     if (metadata.reloadPipelines) {
         reloadPipelines();
         metadata.reloadPipelines = false;
@@ -95,6 +119,11 @@ void Tracer::trace_separate(vk::CommandBuffer commandBuffer, TraceRuntime const&
 
         .traceTimeAddress = bTimes.getDeviceAddress(ctx.d),
         .traceStatsAddress = bStats.getDeviceAddress(ctx.d),
+
+        .instancesAddress = inputBvh.instances,
+        .blasDescriptorsAddress = inputBvh.blasDescriptors,
+        .instanceHitAddress = inputBvh.blasDescriptors != 0 ? bInstanceHit.getDeviceAddress(ctx.d) : 0,
+        .geometryDescriptorAddress = trt.geometryDescriptorAddress,
     };
 
     data_ptrace::PC_ShadeCast pcShadeCast {
@@ -111,6 +140,13 @@ void Tracer::trace_separate(vk::CommandBuffer commandBuffer, TraceRuntime const&
         .rayTraceResultAddress = bTraceResult.getDeviceAddress(ctx.d),
         .geometryDescriptorAddress = trt.geometryDescriptorAddress,
         .bvhTriangleIndicesAddress = inputBvh.triangleIDs,
+        .instancesAddress = inputBvh.instances,
+        .instanceHitAddress = pcTrace.instanceHitAddress,
+
+        .shadow_rayBufferMetadataAddress = castsShadowRays() ? bShadowRayMetadata.getDeviceAddress(ctx.d) : 0,
+        .shadow_rayBufferAddress = castsShadowRays() ? bShadowRay.getDeviceAddress(ctx.d) : 0,
+        .shadow_rayPayloadAddress = castsShadowRays() ? bShadowRayPayload.getDeviceAddress(ctx.d) : 0,
+        .pathRadianceAddress = castsShadowRays() ? bPathRadiance.getDeviceAddress(ctx.d) : 0,
 
         .depth = 0,
         .depthMax = trt.ptDepth,
@@ -148,6 +184,15 @@ void Tracer::trace_separate(vk::CommandBuffer commandBuffer, TraceRuntime const&
         commandBuffer.fillBuffer(bTimes.get(), 0 + 16 * depth, 8, uint32_t(-1));
         commandBuffer.fillBuffer(bTimes.get(), 8 + 16 * depth, 8, 0);
     }
+    // no shadow rays are cast at the last depth, nor with shadow rays disabled
+    auto const shadowTimesOffset { offsetof(data_ptrace::TraceTimes, shadowTimes) };
+    commandBuffer.fillBuffer(bTimes.get(), shadowTimesOffset, sizeof(data_ptrace::TraceTimes::shadowTimes), 0);
+    if (castsShadowRays()) {
+        for (u32 depth = 0; depth < trt.ptDepth; depth++)
+            commandBuffer.fillBuffer(bTimes.get(), shadowTimesOffset + 16 * depth, 8, uint32_t(-1));
+        lime::compute::fillZeros(commandBuffer, bShadowRayMetadata);
+        lime::compute::fillZeros(commandBuffer, bPathRadiance);
+    }
     lime::compute::pBarrierTransferWrite(commandBuffer);
 
     timestamp.Reset(commandBuffer);
@@ -170,6 +215,10 @@ void Tracer::trace_separate(vk::CommandBuffer commandBuffer, TraceRuntime const&
         }
         // secondary rays
         else {
+            if (reordersRays()) {
+                pcTrace.rayOrderAddress = sortRays(commandBuffer, trt, pcTrace.rayBufferMetadataAddress, pcTrace.rayBufferAddress);
+                pcTrace.rayOrderCountAddress = bSortCount.getDeviceAddress(ctx.d);
+            }
             commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipelines[Pipeline::eTraceSecondary].get());
             commandBuffer.pushConstants(pipelines[Pipeline::eTraceSecondary].getLayout(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pcTrace), &pcTrace);
             traceWorkgroupCount = config.rSecondary.workgroupCount;
@@ -188,6 +237,10 @@ void Tracer::trace_separate(vk::CommandBuffer commandBuffer, TraceRuntime const&
         // wait for metadata clear
         lime::compute::pBarrierTransferWrite(commandBuffer);
         commandBuffer.dispatch(lime::divCeil(metadata.rayCount, 1024u), 1, 1);
+
+        // the last depth only terminates the paths
+        if (castsShadowRays() && depth < trt.ptDepth)
+            traceShadowRays(commandBuffer, trt, inputBvh, depth);
     }
 
     timestamp.End(commandBuffer);
@@ -196,6 +249,90 @@ void Tracer::trace_separate(vk::CommandBuffer commandBuffer, TraceRuntime const&
     commandBuffer.copyBuffer(bTimes.get(), bStaging.get(), vk::BufferCopy(0, 0, bTimes.getSizeInBytes()));
 }
 
+void Tracer::traceShadowRays(vk::CommandBuffer commandBuffer, TraceRuntime const& trt, Bvh const& inputBvh, u32 depth)
+{
+    // the closest hits in bTraceResult are consumed by ShadeAndCast at this point, the shadow rays reuse the buffer
+    data_ptrace::PC_Trace pcTrace {
+        .rayBufferMetadataAddress = bShadowRayMetadata.getDeviceAddress(ctx.d),
+        .rayBufferAddress = bShadowRay.getDeviceAddress(ctx.d),
+        .rayTraceResultAddress = bTraceResult.getDeviceAddress(ctx.d),
+
+        .bvhAddress = inputBvh.bvh,
+        .bvhTrianglesAddress = inputBvh.triangles,
+        .bvhTriangleIndicesAddress = inputBvh.triangleIDs,
+        .bvhAuxAddress = inputBvh.bvhAux,
+
+        .traceTimeAddress = bTimes.getDeviceAddress(ctx.d) + offsetof(data_ptrace::TraceTimes, shadowTimes) + 16 * depth,
+        .traceStatsAddress = bStats.getDeviceAddress(ctx.d),
+
+        .instancesAddress = inputBvh.instances,
+        .blasDescriptorsAddress = inputBvh.blasDescriptors,
+        .instanceHitAddress = inputBvh.blasDescriptors != 0 ? bInstanceHit.getDeviceAddress(ctx.d) : 0,
+        .geometryDescriptorAddress = trt.geometryDescriptorAddress,
+    };
+    data_ptrace::PC_ResolveShadows pcResolve {
+        .rayBufferMetadataAddress = bShadowRayMetadata.getDeviceAddress(ctx.d),
+        .rayPayloadAddress = bShadowRayPayload.getDeviceAddress(ctx.d),
+        .rayTraceResultAddress = bTraceResult.getDeviceAddress(ctx.d),
+        .pathRadianceAddress = bPathRadiance.getDeviceAddress(ctx.d),
+        .imageWidth = trt.x,
+    };
+
+    // wait for the shadow rays of ShadeAndCast
+    lime::compute::pBarrierCompute(commandBuffer);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipelines[Pipeline::eTraceShadow].get());
+    commandBuffer.pushConstants(pipelines[Pipeline::eTraceShadow].getLayout(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pcTrace), &pcTrace);
+    commandBuffer.dispatch(config.rSecondary.workgroupCount, 1, 1);
+
+    lime::compute::pBarrierCompute(commandBuffer);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipelines[Pipeline::eResolveShadows].get());
+    commandBuffer.pushConstants(pipelines[Pipeline::eResolveShadows].getLayout(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pcResolve), &pcResolve);
+    commandBuffer.dispatch(lime::divCeil(metadata.rayCount, 1024u), 1, 1);
+
+    // the queue is refilled by ShadeAndCast of the next depth
+    lime::compute::pBarrierTransferRead(commandBuffer);
+    commandBuffer.fillBuffer(bShadowRayMetadata.get(), 0, bShadowRayMetadata.getSizeInBytes(), 0);
+    lime::compute::pBarrierTransferWrite(commandBuffer);
+}
+
+vk::DeviceAddress Tracer::sortRays(vk::CommandBuffer commandBuffer, TraceRuntime const& trt, vk::DeviceAddress rayBufferMetadataAddress, vk::DeviceAddress rayBufferAddress)
+{
+    auto const cubedAabb { trt.sceneAabb.GetCubed() };
+    data_ptrace::PC_SortRays pc {
+        .rayBufferMetadataAddress = rayBufferMetadataAddress,
+        .rayBufferAddress = rayBufferAddress,
+        .keyvalsAddress = bSortKeyvals[0].getDeviceAddress(ctx.d),
+        .sortCountAddress = bSortCount.getDeviceAddress(ctx.d),
+        .sceneAabbCubedMin = { cubedAabb.min.x, cubedAabb.min.y, cubedAabb.min.z },
+        .sceneAabbNormalizationScale = 1.f / (cubedAabb.max - cubedAabb.min).x,
+        .minRayCount = config.reordering.minRayCount,
+    };
+
+    // wait for the rays of the previous bounce
+    lime::compute::pBarrierCompute(commandBuffer);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipelines[Pipeline::eSortRays].get());
+    commandBuffer.pushConstants(pipelines[Pipeline::eSortRays].getLayout(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
+    commandBuffer.dispatch(lime::divCeil(metadata.rayCount, 1024u), 1, 1);
+    lime::compute::pBarrierCompute(commandBuffer);
+
+    // the ray count is known on the device only, it is 0 when the rays are left unsorted
+    radix_sort_vk_memory_requirements_t radixSortMemory;
+    radix_sort_vk_get_memory_requirements(FuchsiaRadixSort::radixSort, metadata.rayCount, &radixSortMemory);
+    VkDescriptorBufferInfo results;
+
+    radix_sort_vk_sort_indirect_info_t radixInfoIndirect;
+    radixInfoIndirect.ext = nullptr;
+    radixInfoIndirect.key_bits = 32;
+    radixInfoIndirect.count = { bSortCount.get(), 0, 4 };
+    radixInfoIndirect.keyvals_even = { bSortKeyvals[0].get(), 0, radixSortMemory.keyvals_size };
+    radixInfoIndirect.keyvals_odd = { bSortKeyvals[1].get(), 0, radixSortMemory.keyvals_size };
+    radixInfoIndirect.internal = { bSortInternal.get(), 0, radixSortMemory.internal_size };
+    radixInfoIndirect.indirect = { bSortIndirect.get(), 0, radixSortMemory.indirect_size };
+    radix_sort_vk_sort_indirect(FuchsiaRadixSort::radixSort, &radixInfoIndirect, ctx.d, commandBuffer, &results);
+
+    return (vk::Buffer(results.buffer) == bSortKeyvals[0].get() ? bSortKeyvals[0] : bSortKeyvals[1]).getDeviceAddress(ctx.d);
+}
+
 void Tracer::trace_separate_bv(vk::CommandBuffer commandBuffer, TraceRuntime const& trt, Bvh const& inputBvh)
 {
     data_ptrace::PC_GenPrimary pcGenPrimary {
@@ -218,6 +355,8 @@ void Tracer::trace_separate_bv(vk::CommandBuffer commandBuffer, TraceRuntime con
 
         .traceTimeAddress = bTimes.getDeviceAddress(ctx.d),
         .traceStatsAddress = bStats.getDeviceAddress(ctx.d),
+
+        .geometryDescriptorAddress = trt.geometryDescriptorAddress,
     };
 
     data_ptrace::PC_ShadeCast pcShadeCast {
@@ -347,6 +486,8 @@ stats::Trace Tracer::GetStats() const
     for (int i = 0; i < 8; i++) {
         result.data[i].rayCount = data.times[i].rayCount;
         result.data[i].traceTimeMs = timestampToMs(data.times[i].timer);
+        result.shadow[i].rayCount = data.shadowTimes[i].rayCount;
+        result.shadow[i].traceTimeMs = timestampToMs(data.shadowTimes[i].timer);
     }
 
     result.testedNodes = stats.testedNodes;
@@ -409,6 +550,31 @@ void Tracer::checkForShaderHotReload()
     }
 }
 
+void Tracer::CollectPipelineKeys(config::Tracer const& config, std::vector<PipelineKey>& keys)
+{
+    if (config.bv == config::BV::eNone)
+        return;
+
+    static std::array constexpr smePrimaryRays {
+        vk::SpecializationMapEntry { 0, 0, sizeof(uint32_t) },
+        vk::SpecializationMapEntry { 1, 4, sizeof(uint32_t) },
+    };
+    static std::array constexpr smeTrace {
+        vk::SpecializationMapEntry { 0, 0, sizeof(uint32_t) },
+    };
+    // path tracing mode only, visualization pipelines are compiled on demand
+    keys.emplace_back(config.shader.genPrimary, smePrimaryRays, std::array<u32, 2> { 32, 32 });
+    keys.emplace_back(config.shader.traceRays, smeTrace, config.rPrimary.warpsPerWorkgroup);
+    keys.emplace_back(config.shader.traceRays, smeTrace, config.rSecondary.warpsPerWorkgroup);
+    keys.emplace_back(config.shader.shadeAndCast);
+    if (config.reordering.enabled)
+        keys.emplace_back(config.shader.sortRays);
+    if (config.shadowRays) {
+        keys.emplace_back(config.shader.traceShadow, smeTrace, config.rSecondary.warpsPerWorkgroup);
+        keys.emplace_back(config.shader.resolveShadows);
+    }
+}
+
 void Tracer::reloadPipelines()
 {
     metadata.workgroupSize = CreateSpecializationConstants(ctx.pd);
@@ -438,6 +604,12 @@ void Tracer::reloadPipelines()
         pipelines[Pipeline::eTracePrimary] = { ctx.d, ctx.sCache, config.shader.traceRays, siTracePrimary };
         pipelines[Pipeline::eTraceSecondary] = { ctx.d, ctx.sCache, config.shader.traceRays, siTraceSecondary };
         pipelines[Pipeline::eShadeAndCast] = { ctx.d, ctx.sCache, config.shader.shadeAndCast };
+        if (reordersRays())
+            pipelines[Pipeline::eSortRays] = { ctx.d, ctx.sCache, config.shader.sortRays };
+        if (castsShadowRays()) {
+            pipelines[Pipeline::eTraceShadow] = { ctx.d, ctx.sCache, config.shader.traceShadow, siTraceSecondary };
+            pipelines[Pipeline::eResolveShadows] = { ctx.d, ctx.sCache, config.shader.resolveShadows };
+        }
         break;
     case State::VisMode::eBVVisualization:
         pipelines[Pipeline::eTracePrimary] = { ctx.d, ctx.sCache, config.shader.traceRays_bv, siTracePrimary };
@@ -523,6 +695,55 @@ void Tracer::allocRayBuffers(uint32_t rayCount)
     }
 
     bTraceResult = ctx.memory.alloc(aReq, cInfo, "tracer_result");
+
+    cInfo.size = metadata.rayCount * sizeof(u32);
+    bInstanceHit = ctx.memory.alloc(aReq, cInfo, "tracer_instance_hit");
+
+    if (castsShadowRays()) {
+        // one shadow ray per path at most
+        cInfo.size = metadata.rayCount * sizeof(data_ptrace::Ray);
+        bShadowRay = ctx.memory.alloc(aReq, cInfo, "tracer_shadow_ray_buffer");
+        cInfo.size = metadata.rayCount * sizeof(data_ptrace::RayPayload);
+        bShadowRayPayload = ctx.memory.alloc(aReq, cInfo, "tracer_shadow_ray_payload");
+
+        cInfo.usage |= bfub::eTransferDst;
+        cInfo.size = sizeof(data_ptrace::RayBufferMetadata);
+        bShadowRayMetadata = ctx.memory.alloc(aReq, cInfo, "tracer_shadow_ray_metadata");
+        cInfo.size = metadata.rayCount * sizeof(f32) * 3;
+        bPathRadiance = ctx.memory.alloc(aReq, cInfo, "tracer_path_radiance");
+    }
+
+    if (!reordersRays())
+        return;
+
+    cInfo.usage |= bfub::eTransferSrc | bfub::eTransferDst;
+    radix_sort_vk_memory_requirements_t radixSortMemory;
+    radix_sort_vk_get_memory_requirements(FuchsiaRadixSort::radixSort, metadata.rayCount, &radixSortMemory);
+    cInfo.size = radixSortMemory.keyvals_size;
+    aReq.additionalAlignment = radixSortMemory.keyvals_alignment;
+    bSortKeyvals[0] = ctx.memory.alloc(aReq, cInfo, "tracer_sort_even");
+    bSortKeyvals[1] = ctx.memory.alloc(aReq, cInfo, "tracer_sort_odd");
+    cInfo.size = radixSortMemory.internal_size;
+    aReq.additionalAlignment = radixSortMemory.internal_alignment;
+    bSortInternal = ctx.memory.alloc(aReq, cInfo, "tracer_sort_internal");
+
+    cInfo.usage |= bfub::eIndirectBuffer;
+    cInfo.size = radixSortMemory.indirect_size;
+    aReq.additionalAlignment = radixSortMemory.indirect_alignment;
+    bSortIndirect = ctx.memory.alloc(aReq, cInfo, "tracer_sort_indirect");
+    cInfo.size = sizeof(u32);
+    aReq.additionalAlignment = 256;
+    bSortCount = ctx.memory.alloc(aReq, cInfo, "tracer_sort_count");
+}
+
+bool Tracer::reordersRays() const
+{
+    return config.reordering.enabled && metadata.visMode == State::VisMode::ePathTracing;
+}
+
+bool Tracer::castsShadowRays() const
+{
+    return config.shadowRays && metadata.visMode == State::VisMode::ePathTracing;
 }
 
 void Tracer::allocStatic()
@@ -561,6 +782,16 @@ void Tracer::freeRayBuffers()
         buf.reset();
     }
     bTraceResult.reset();
+    bInstanceHit.reset();
+    for (auto& buf : bSortKeyvals)
+        buf.reset();
+    bSortInternal.reset();
+    bSortIndirect.reset();
+    bSortCount.reset();
+    bShadowRayMetadata.reset();
+    bShadowRay.reset();
+    bShadowRayPayload.reset();
+    bPathRadiance.reset();
 }
 
 void Tracer::freeAll()
@@ -24,6 +24,7 @@ struct Tracer {
     void Trace(vk::CommandBuffer commandBuffer, config::Tracer const& traceCfg, TraceRuntime const& trt, Bvh const& inputBvh);
     [[nodiscard]] stats::Trace GetStats() const;
     void SetVisualizationMode(State::VisMode mode);
+    static void CollectPipelineKeys(config::Tracer const& config, std::vector<PipelineKey>& keys);
 
 public:
     std::array<f32, 4> dirLight;
@@ -38,6 +39,9 @@ private:
         eTraceSecondary,
         eGenPrimary,
         eShadeAndCast,
+        eSortRays,
+        eTraceShadow,
+        eResolveShadows,
         eDebug,
         eCount,
     };
@@ -57,6 +61,8 @@ private:
 
         bool reloadPipelines { true };
         bool reallocRayBuffers { false };
+        bool instancedUnsupportedReported { false };
+        bool layoutUnsupportedReported { false };
     } metadata;
 
     enum class Buffer {
@@ -71,6 +77,18 @@ private:
     lime::Buffer bRay[2];
     lime::Buffer bRayPayload[2];
     lime::Buffer bTraceResult;
+    // instance hit by each ray, written only when tracing a two-level tree
+    lime::Buffer bInstanceHit;
+    // radix sort of the secondary rays, allocated only with ray reordering enabled
+    lime::Buffer bSortKeyvals[2];
+    lime::Buffer bSortInternal;
+    lime::Buffer bSortIndirect;
+    lime::Buffer bSortCount;
+    // shadow ray queue and the per pixel light it gathers, allocated only with shadow rays enabled
+    lime::Buffer bShadowRayMetadata;
+    lime::Buffer bShadowRay;
+    lime::Buffer bShadowRayPayload;
+    lime::Buffer bPathRadiance;
 
     vk::UniqueDescriptorPool dPool;
     vk::DescriptorSet dSet;
@@ -80,10 +98,14 @@ private:
     void dSetUpdate(vk::ImageView targetImageView, lime::Buffer::Detail const& camera) const;
     void allocRayBuffers(uint32_t rayCount);
     void allocStatic();
+    [[nodiscard]] bool reordersRays() const;
+    [[nodiscard]] bool castsShadowRays() const;
 
     void trace_separate(vk::CommandBuffer commandBuffer, TraceRuntime const& trt, Bvh const& inputBvh);
     void trace_separate_bv(vk::CommandBuffer commandBuffer, TraceRuntime const& trt, Bvh const& inputBvh);
     void debugTrace(vk::CommandBuffer commandBuffer, TraceRuntime const& trt, Bvh const& inputBvh);
+    [[nodiscard]] vk::DeviceAddress sortRays(vk::CommandBuffer commandBuffer, TraceRuntime const& trt, vk::DeviceAddress rayBufferMetadataAddress, vk::DeviceAddress rayBufferAddress);
+    void traceShadowRays(vk::CommandBuffer commandBuffer, TraceRuntime const& trt, Bvh const& inputBvh, u32 depth);
 
     void freeRayBuffers();
     void freeAll();
@@ -12,8 +12,28 @@ static u32 CreateSpecializationConstants(vk::PhysicalDevice pd)
     return std::min(512u, prop2.properties.limits.maxComputeWorkGroupSize[0]);
 }
 
+static std::array<vk::SpecializationMapEntry, 1> constexpr scEntries {
+    vk::SpecializationMapEntry { 0, 0, sizeof(u32) },
+};
+
+static u32 SOBBFitMethod(config::SOBBFit fit)
+{
+    switch (fit) {
+    case config::SOBBFit::eGreedy:
+        return SOBB_FIT_GREEDY;
+    case config::SOBBFit::eAnchored:
+        return SOBB_FIT_ANCHORED;
+    case config::SOBBFit::ePruned:
+        return SOBB_FIT_PRUNED;
+    case config::SOBBFit::eExhaustive:
+        return SOBB_FIT_EXHAUSTIVE;
+    }
+    return SOBB_FIT_ANCHORED;
+}
+
 Transformation::Transformation(VCtx ctx)
     : ctx(ctx)
+    , deviceCounts(ctx)
     , timestamps(ctx.d, ctx.pd)
 {
 }
@@ -22,7 +42,8 @@ bool Transformation::CheckForShaderHotReload()
 {
     if (config.bv == config::BV::eNone)
         return false;
-    return pTransform.Update(ctx.d, ctx.sCache);
+    auto const updated { deviceCounts.CheckForShaderHotReload() };
+    return pTransform.Update(ctx.d, ctx.sCache) || updated;
 }
 
 Bvh Transformation::GetBVH() const
@@ -31,6 +52,7 @@ Bvh Transformation::GetBVH() const
         .bvh = buffersOut.at(Buffer::eBVH).getDeviceAddress(ctx.d),
         .triangles = metadata.bvhTriangles,
         .triangleIDs = metadata.bvhTriangleIDs,
+        .counts = metadata.counts,
         .nodeCountLeaf = metadata.nodeCountLeaf,
         .nodeCountTotal = metadata.nodeCountTotal,
         .bv = config.bv,
@@ -43,6 +65,8 @@ void Transformation::Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBv
     metadata.nodeCountTotal = inputBvh.nodeCountTotal;
     metadata.bvhTriangles = inputBvh.triangles;
     metadata.bvhTriangleIDs = inputBvh.triangleIDs;
+    // only the bounding volumes change, the topology and node counts are kept
+    metadata.counts = inputBvh.counts;
 
     reloadPipelines();
     alloc();
@@ -70,6 +94,7 @@ void Transformation::Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBv
     case config::BV::eSOBB_i32:
     case config::BV::eSOBB_i48:
     case config::BV::eSOBB_i64:
+    case config::BV::eHybrid_i32:
         transform_sobb(commandBuffer, inputBvh, geometryDescriptor);
         break;
     default:
@@ -78,8 +103,10 @@ void Transformation::Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBv
     timestamps.End(commandBuffer);
 }
 
-void Transformation::ReadRuntimeData()
+void Transformation::ReadRuntimeData(Bvh const& inputBvh)
 {
+    metadata.nodeCountLeaf = inputBvh.nodeCountLeaf;
+    metadata.nodeCountTotal = inputBvh.nodeCountTotal;
 }
 
 stats::Transformation Transformation::GatherStats(BvhStats const& bvhStats)
@@ -99,14 +126,18 @@ stats::Transformation Transformation::GatherStats(BvhStats const& bvhStats)
     return stats;
 }
 
+void Transformation::CollectPipelineKeys(vk::PhysicalDevice pd, config::Transformation const& config, std::vector<PipelineKey>& keys)
+{
+    if (config.bv == config::BV::eNone || config.shader.transform.empty())
+        return;
+    keys.emplace_back(config.shader.transform, scEntries, CreateSpecializationConstants(pd));
+    DeviceCounts::CollectPipelineKeys(keys);
+}
+
 void Transformation::reloadPipelines()
 {
     metadata.workgroupSize = CreateSpecializationConstants(ctx.pd);
-
-    static std::array<vk::SpecializationMapEntry, 1> constexpr entries {
-        vk::SpecializationMapEntry { 0, 0, sizeof(u32) },
-    };
-    vk::SpecializationInfo sInfo { 1, entries.data(), 4, &metadata.workgroupSize };
+    vk::SpecializationInfo sInfo { 1, scEntries.data(), 4, &metadata.workgroupSize };
 
     pTransform = { ctx.d, ctx.sCache, config.shader.transform, sInfo };
 }
@@ -116,6 +147,8 @@ void Transformation::transform_dop14(vk::CommandBuffer commandBuffer, Bvh const&
     vk::MemoryBarrier memoryBarrierCompute { .srcAccessMask = vk::AccessFlagBits::eShaderWrite, .dstAccessMask = vk::AccessFlagBits::eShaderRead };
     commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), memoryBarrierCompute, nullptr, nullptr);
 
+    auto const counts { deviceCounts.Prepare(commandBuffer, inputBvh, metadata.workgroupSize) };
+
     data_plocpp::PC_TransformToDOP pc {
         .bvhAddress = inputBvh.bvh,
         .bvhTriangleIndicesAddress = inputBvh.triangleIDs,
@@ -125,13 +158,12 @@ void Transformation::transform_dop14(vk::CommandBuffer commandBuffer, Bvh const&
 
         .geometryDescriptorAddress = geometryDescriptor,
         .countersAddress = buffersIntermediate[Buffer::eTraversalCounters].getDeviceAddress(ctx.d),
-
-        .leafNodeCount = inputBvh.nodeCountLeaf,
+        .countsAddress = counts,
     };
 
     commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pTransform.get());
     commandBuffer.pushConstants(pTransform.layout.pipeline.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
-    commandBuffer.dispatch(lime::divCeil(inputBvh.nodeCountLeaf, metadata.workgroupSize), 1, 1);
+    deviceCounts.DispatchLeaves(commandBuffer);
 }
 
 void Transformation::transform_obb(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, vk::DeviceAddress geometryDescriptor)
@@ -139,6 +171,8 @@ void Transformation::transform_obb(vk::CommandBuffer commandBuffer, Bvh const& i
     vk::MemoryBarrier memoryBarrierCompute { .srcAccessMask = vk::AccessFlagBits::eShaderWrite, .dstAccessMask = vk::AccessFlagBits::eShaderRead };
     commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), memoryBarrierCompute, nullptr, nullptr);
 
+    auto const counts { deviceCounts.Prepare(commandBuffer, inputBvh, metadata.workgroupSize) };
+
     data_plocpp::PC_TransformToOBB pc {
         .bvhInAddress = inputBvh.bvh,
         .bvhInTriangleIndicesAddress = inputBvh.triangleIDs,
@@ -151,12 +185,12 @@ void Transformation::transform_obb(vk::CommandBuffer commandBuffer, Bvh const& i
         .traversalCounterAddress = buffersIntermediate[Buffer::eTraversalCounters].getDeviceAddress(ctx.d),
         .schedulerDataAddress = buffersIntermediate[Buffer::eScheduler].getDeviceAddress(ctx.d),
         .timesAddress_TMP = buffersIntermediate[Buffer::eTimes_TMP].getDeviceAddress(ctx.d),
-
-        .leafNodeCount = inputBvh.nodeCountLeaf,
+        .countsAddress = counts,
     };
 
     commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pTransform.get());
     commandBuffer.pushConstants(pTransform.layout.pipeline.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
+    // persistent threads take their tasks from the device counts, the host count only bounds the grid from above
     commandBuffer.dispatch(std::max(2048u, lime::divCeil(inputBvh.nodeCountLeaf, metadata.workgroupSize)), 1, 1);
 }
 
@@ -165,6 +199,8 @@ void Transformation::transform_sobb(vk::CommandBuffer commandBuffer, Bvh const&
     vk::MemoryBarrier memoryBarrierCompute { .srcAccessMask = vk::AccessFlagBits::eShaderWrite, .dstAccessMask = vk::AccessFlagBits::eShaderRead };
     commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), memoryBarrierCompute, nullptr, nullptr);
 
+    auto const counts { deviceCounts.Prepare(commandBuffer, inputBvh, metadata.workgroupSize) };
+
     data_plocpp::PC_TransformToSOBB pc {
         .bvhAddress = inputBvh.bvh,
         .bvhTriangleIndicesAddress = inputBvh.triangleIDs,
@@ -176,13 +212,15 @@ void Transformation::transform_sobb(vk::CommandBuffer commandBuffer, Bvh const&
         .dopBaseAddress = buffersIntermediate[Buffer::eBaseDOP].getDeviceAddress(ctx.d),
         .dopRefAddress = buffersIntermediate[Buffer::eDOPRef].getDeviceAddress(ctx.d),
         .statsAddress = buffersOut[Buffer::eStats_TMP].getDeviceAddress(ctx.d),
-
-        .leafNodeCount = inputBvh.nodeCountLeaf,
+        .countsAddress = counts,
+        .sobbCostRatio = config.sobbCostRatio,
+        .sobbFit = SOBBFitMethod(config.sobbFit),
+        .sobbCandidates = config.sobbCandidates,
     };
 
     commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pTransform.get());
     commandBuffer.pushConstants(pTransform.layout.pipeline.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pc), &pc);
-    commandBuffer.dispatch(lime::divCeil(inputBvh.nodeCountLeaf, metadata.workgroupSize), 1, 1);
+    deviceCounts.DispatchLeaves(commandBuffer);
 }
 
 void Transformation::freeIntermediate()
@@ -193,6 +231,7 @@ void Transformation::freeIntermediate()
 void Transformation::freeAll()
 {
     freeIntermediate();
+    deviceCounts.freeAll();
     buffersOut.clear();
 }
 
@@ -214,6 +253,7 @@ void Transformation::alloc()
         case config::BV::eSOBB_i32:
         case config::BV::eSOBB_i48:
         case config::BV::eSOBB_i64:
+        case config::BV::eHybrid_i32:
             return sizeof(data_bvh::NodeBVH2_SOBBi);
         default:
             break;
@@ -255,6 +295,7 @@ void Transformation::alloc()
         switch (bv) {
         case config::BV::eSOBB_i32:
         case config::BV::eSOBB_d32:
+        case config::BV::eHybrid_i32:
             return 32;
         case config::BV::eSOBB_i48:
         case config::BV::eSOBB_d48:
@@ -3,6 +3,7 @@
 #include "../../../Config.h"
 #include "../../../Stats.h"
 #include "../../VCtx.h"
+#include "DeviceCounts.h"
 #include "Types.h"
 #include <vLime/Compute.h>
 #include <vLime/Memory.h>
@@ -22,9 +23,11 @@ struct Transformation {
         return cfgChanged && config.bv != config::BV::eNone;
     }
     [[nodiscard]] bool CheckForShaderHotReload();
+    static void CollectPipelineKeys(vk::PhysicalDevice pd, config::Transformation const& config, std::vector<PipelineKey>& keys);
 
     void Compute(vk::CommandBuffer commandBuffer, Bvh const& inputBvh, vk::DeviceAddress geometryDescriptor);
-    void ReadRuntimeData();
+    // node counts of the input tree are final only once its own runtime data was read back
+    void ReadRuntimeData(Bvh const& inputBvh);
     [[nodiscard]] stats::Transformation GatherStats(BvhStats const& bvhStats);
 
 private:
@@ -32,12 +35,14 @@ private:
     config::Transformation config;
 
     lime::PipelineCompute pTransform;
+    DeviceCounts deviceCounts;
 
     struct Metadata {
         u32 nodeCountLeaf { 0 };
         u32 nodeCountTotal { 0 };
         vk::DeviceAddress bvhTriangles { 0 };
         vk::DeviceAddress bvhTriangleIDs { 0 };
+        vk::DeviceAddress counts { 0 };
 
         u32 workgroupSize { 0 };
     } metadata;
@@ -0,0 +1,243 @@
+#include "TraversalReference.h"
+
+#include <cmath>
+#include <numbers>
+#include <random>
+#include <vector>
+
+namespace backend::vulkan::bvh {
+
+namespace {
+constexpr f32 EPS_BV_INTERSECT { 1e-5f };
+constexpr u64 TRAIL_ROOT { u64 { 1 } << TraversalReference::TRAIL_DEPTH_MAX };
+
+// glsl sign(), 0 stays 0
+f32 sign(f32 x)
+{
+    return static_cast<f32>((x > 0.f) - (x < 0.f));
+}
+
+f32 dot(vec4 const& v, glm::vec3 const& x)
+{
+    return v[0] * x.x + v[1] * x.y + v[2] * x.z;
+}
+}
+
+TraversalReference::TraversalReference(std::span<data_bvh::NodeBVH2_AABB_c const> nodes, std::span<data_bvh::BvhTriangle const> triangles)
+    : nodes(nodes)
+    , triangles(triangles)
+{
+}
+
+TraversalReference::RayDetail TraversalReference::initRayDetail(Ray const& ray)
+{
+    glm::vec3 idir;
+    for (i32 i = 0; i < 3; ++i)
+        idir[i] = 1.f / (std::abs(ray.dir[i]) > EPS_BV_INTERSECT ? ray.dir[i] : EPS_BV_INTERSECT * sign(ray.dir[i]));
+    return {
+        .origin = ray.origin,
+        .dir = ray.dir,
+        .idir = idir,
+        .ood = ray.origin * idir,
+        .tmin = ray.tmin,
+    };
+}
+
+glm::vec2 TraversalReference::intersect(::AABB const& bv, RayDetail const& rd, f32 tmax)
+{
+    glm::vec2 const t0 { bv[0] * rd.idir.x - rd.ood.x, bv[3] * rd.idir.x - rd.ood.x };
+    glm::vec2 const t1 { bv[1] * rd.idir.y - rd.ood.y, bv[4] * rd.idir.y - rd.ood.y };
+    glm::vec2 const t2 { bv[2] * rd.idir.z - rd.ood.z, bv[5] * rd.idir.z - rd.ood.z };
+    return {
+        std::max(std::max(std::min(t0.x, t0.y), std::min(t1.x, t1.y)), std::max(std::min(t2.x, t2.y), rd.tmin)),
+        std::min(std::min(std::max(t0.x, t0.y), std::max(t1.x, t1.y)), std::min(std::max(t2.x, t2.y), tmax)),
+    };
+}
+
+void TraversalReference::intersectLeaf(i32 leafId, RayDetail const& rd, Hit& hit) const
+{
+    auto const triStartId { leafId & 0x07FFFFFF };
+    auto const triCount { ((leafId >> 27) & 0xF) + 1 };
+
+    for (i32 triId = triStartId; triId < triStartId + triCount; ++triId) {
+        auto const& tri { triangles[triId] };
+
+        auto const t { (tri.v0[3] - dot(tri.v0, rd.origin)) / dot(tri.v0, rd.dir) };
+        if (!(t > rd.tmin && t < hit.t))
+            continue;
+        auto const u { tri.v1[3] + dot(tri.v1, rd.origin) + t * dot(tri.v1, rd.dir) };
+        if (u < 0.f)
+            continue;
+        auto const v { tri.v2[3] + dot(tri.v2, rd.origin) + t * dot(tri.v2, rd.dir) };
+        if (v >= 0.f && u + v <= 1.f) {
+            hit.tId = triId;
+            hit.t = t;
+        }
+    }
+}
+
+TraversalReference::Hit TraversalReference::TraceFullStack(Ray const& ray) const
+{
+    auto const rd { initRayDetail(ray) };
+    Hit hit { .t = ray.tmax };
+
+    std::vector<i32> stack;
+    i32 nodeId { 0 };
+    while (true) {
+        if (nodeId >= 0) {
+            auto const& node { nodes[nodeId] };
+            auto const c0minmax { intersect(node.bv[0], rd, hit.t) };
+            auto const c1minmax { intersect(node.bv[1], rd, hit.t) };
+
+            auto const swp { c1minmax[0] < c0minmax[0] };
+            auto const traverseC0 { c0minmax[1] >= c0minmax[0] };
+            auto const traverseC1 { c1minmax[1] >= c1minmax[0] };
+
+            if (traverseC0 && traverseC1) {
+                nodeId = node.c[swp ? 1 : 0];
+                stack.push_back(node.c[swp ? 0 : 1]);
+                continue;
+            }
+            if (traverseC0 || traverseC1) {
+                nodeId = node.c[traverseC0 ? 0 : 1];
+                continue;
+            }
+        }
+        else
+            intersectLeaf(nodeId, rd, hit);
+
+        if (stack.empty())
+            break;
+        nodeId = stack.back();
+        stack.pop_back();
+    }
+    return hit;
+}
+
+// same control flow as traceShortStack() in ptrace_bvh2_short_stack.glsl
+TraversalReference::Hit TraversalReference::TraceShortStack(Ray const& ray, u32 shortStackSize, u64& restartCount) const
+{
+    auto const rd { initRayDetail(ray) };
+    Hit hit { .t = ray.tmax };
+
+    std::vector<i32> shortStack(shortStackSize);
+    u32 stackTop { 0 };
+    u32 stackCount { 0 };
+
+    u64 trail { 0 };
+    u64 level { TRAIL_ROOT };
+    i32 nodeId { 0 };
+    while (true) {
+        if (nodeId >= 0) {
+            auto const& node { nodes[nodeId] };
+            auto const c0minmax { intersect(node.bv[0], rd, hit.t) };
+            auto const c1minmax { intersect(node.bv[1], rd, hit.t) };
+
+            auto const swp { c1minmax[0] < c0minmax[0] };
+            auto const nearId { node.c[swp ? 1 : 0] };
+            auto const farId { node.c[swp ? 0 : 1] };
+            auto const traverseC0 { c0minmax[1] >= c0minmax[0] };
+            auto const traverseC1 { c1minmax[1] >= c1minmax[0] };
+            auto const traverseNear { swp ? traverseC1 : traverseC0 };
+            auto const traverseFar { swp ? traverseC0 : traverseC1 };
+
+            if (traverseNear || traverseFar) {
+                level >>= 1;
+                if ((trail & level) == 0) {
+                    if (traverseNear && traverseFar) {
+                        if (shortStackSize > 0) {
+                            shortStack[stackTop] = farId;
+                            stackTop = (stackTop + 1) % shortStackSize;
+                            stackCount = std::min(stackCount + 1, shortStackSize);
+                        }
+                        nodeId = nearId;
+                        continue;
+                    }
+                    if (!traverseNear)
+                        trail &= ~(level - 1);
+                    trail |= level;
+                    nodeId = traverseNear ? nearId : farId;
+                    continue;
+                }
+                auto const postponedFar { (trail & (level - 1)) == 0 };
+                if (traverseFar || !postponedFar) {
+                    nodeId = traverseFar ? farId : nearId;
+                    continue;
+                }
+            }
+        }
+        else
+            intersectLeaf(nodeId, rd, hit);
+
+        trail &= ~(level - 1);
+        trail += level;
+        if ((trail & TRAIL_ROOT) != 0)
+            break;
+        level = trail & (~trail + 1);
+
+        if (stackCount > 0) {
+            stackTop = (stackTop + shortStackSize - 1) % shortStackSize;
+            --stackCount;
+            nodeId = shortStack[stackTop];
+            continue;
+        }
+        nodeId = 0;
+        level = TRAIL_ROOT;
+        ++restartCount;
+    }
+    return hit;
+}
+
+u32 TraversalReference::Depth() const
+{
+    u32 depthMax { 0 };
+    std::vector<std::pair<i32, u32>> stack { { 0, 0 } };
+    while (!stack.empty()) {
+        auto const [nodeId, depth] { stack.back() };
+        stack.pop_back();
+        depthMax = std::max(depthMax, depth);
+        if (nodeId < 0)
+            continue;
+        stack.emplace_back(nodes[nodeId].c[0], depth + 1);
+        stack.emplace_back(nodes[nodeId].c[1], depth + 1);
+    }
+    return depthMax;
+}
+
+TraversalReference::Result TraversalReference::Compare(scene::AABB const& sceneAabb, u32 rayCount, u32 shortStackSize) const
+{
+    Result result {
+        .rayCount = rayCount,
+        .treeDepth = Depth(),
+    };
+    if (result.treeDepth > TRAIL_DEPTH_MAX)
+        return result;
+
+    std::mt19937 gen { 0x50BB };
+    std::uniform_real_distribution<f32> unit { 0.f, 1.f };
+
+    for (u32 i = 0; i < rayCount; ++i) {
+        Ray ray;
+        for (i32 a = 0; a < 3; ++a)
+            ray.origin[a] = sceneAabb.min[a] + unit(gen) * (sceneAabb.max[a] - sceneAabb.min[a]);
+        auto const z { 2.f * unit(gen) - 1.f };
+        auto const phi { 2.f * std::numbers::pi_v<f32> * unit(gen) };
+        auto const r { std::sqrt(std::max(0.f, 1.f - z * z)) };
+        ray.dir = { r * std::cos(phi), r * std::sin(phi), z };
+
+        auto const reference { TraceFullStack(ray) };
+        auto const hit { TraceShortStack(ray, shortStackSize, result.restartCount) };
+
+        if (reference.tId >= 0)
+            ++result.hitCount;
+        if (hit.tId == reference.tId)
+            continue;
+        if (hit.tId >= 0 && reference.tId >= 0 && hit.t == reference.t)
+            ++result.tieCount;
+        else
+            ++result.mismatchCount;
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "../../../scene/AABB.h"
+#include <berries/util/types.h>
+#include <final/shared/data_bvh.h>
+#include <glm/vec2.hpp>
+
+#include <limits>
+#include <span>
+
+namespace backend::vulkan::bvh {
+
+// Host mirror of the binary traversal kernels over compact AABB nodes and Woop triangles. Traces the same rays with the
+// full stack traversal of ptrace_bvh2.glsl and the restart trail one of ptrace_bvh2_short_stack.glsl, both must report
+// the same closest hits.
+class TraversalReference {
+public:
+    struct Ray {
+        glm::vec3 origin { 0.f };
+        glm::vec3 dir { 0.f, 0.f, 1.f };
+        f32 tmin { 0.f };
+        f32 tmax { std::numeric_limits<f32>::max() };
+    };
+
+    struct Hit {
+        i32 tId { -1 };
+        f32 t { 0.f };
+    };
+
+    struct Result {
+        u32 rayCount { 0 };
+        u32 hitCount { 0 };
+        // different closest distance, or a hit on one side only
+        u32 mismatchCount { 0 };
+        // same closest distance, another triangle, e.g. on a shared edge
+        u32 tieCount { 0 };
+        u64 restartCount { 0 };
+        u32 treeDepth { 0 };
+    };
+
+    // the restart trail holds one bit per level, see TRAIL_DEPTH_MAX in ptrace_bvh2_short_stack.glsl
+    static constexpr u32 TRAIL_DEPTH_MAX { 62 };
+
+    TraversalReference(std::span<data_bvh::NodeBVH2_AABB_c const> nodes, std::span<data_bvh::BvhTriangle const> triangles);
+
+    [[nodiscard]] Hit TraceFullStack(Ray const& ray) const;
+    // shortStackSize 0 is the stackless traversal, it restarts from the root on every pop
+    [[nodiscard]] Hit TraceShortStack(Ray const& ray, u32 shortStackSize, u64& restartCount) const;
+    [[nodiscard]] u32 Depth() const;
+
+    // rays of uniformly distributed origins within the scene bounds and directions, generated from a fixed seed
+    [[nodiscard]] Result Compare(scene::AABB const& sceneAabb, u32 rayCount, u32 shortStackSize) const;
+
+private:
+    std::span<data_bvh::NodeBVH2_AABB_c const> nodes;
+    std::span<data_bvh::BvhTriangle const> triangles;
+
+    struct RayDetail {
+        glm::vec3 origin;
+        glm::vec3 dir;
+        glm::vec3 idir;
+        glm::vec3 ood;
+        f32 tmin;
+    };
+
+    [[nodiscard]] static RayDetail initRayDetail(Ray const& ray);
+    [[nodiscard]] static glm::vec2 intersect(::AABB const& bv, RayDetail const& rd, f32 tmax);
+    void intersectLeaf(i32 leafId, RayDetail const& rd, Hit& hit) const;
+};
+
+}
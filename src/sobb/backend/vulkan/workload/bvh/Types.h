@@ -1,18 +1,59 @@
 #pragma once
 
 #include "../../../Config.h"
+#include "../../../scene/AABB.h"
 #include <vLime/Memory.h>
 #include <vLime/types.h>
 #include <vLime/vLime.h>
 
+#include <cstring>
+#include <span>
+#include <string>
+#include <vector>
+
 namespace backend::vulkan::bvh {
 
+// compute pipeline variant (shader + specialization constants), used to compile pipelines ahead of their first use
+struct PipelineKey {
+    std::string shader;
+    std::vector<vk::SpecializationMapEntry> entries;
+    std::vector<u8> data;
+
+    template<typename T>
+    PipelineKey(std::string_view shader, std::span<vk::SpecializationMapEntry const> entries, T const& sc)
+        : shader(shader)
+        , entries(entries.begin(), entries.end())
+        , data(sizeof(T))
+    {
+        std::memcpy(data.data(), &sc, sizeof(T));
+    }
+
+    explicit PipelineKey(std::string_view shader)
+        : shader(shader)
+    {
+    }
+
+    [[nodiscard]] vk::SpecializationInfo GetSpecializationInfo() const
+    {
+        return { static_cast<u32>(entries.size()), entries.data(), data.size(), data.data() };
+    }
+
+    bool operator==(PipelineKey const& rhs) const = default;
+};
+
 struct Bvh {
     vk::DeviceAddress bvh { 0 };
     vk::DeviceAddress triangles { 0 };
     vk::DeviceAddress triangleIDs { 0 };
     vk::DeviceAddress bvhAux { 0 };
 
+    // two level trees only: bvh is the top level over instances, triangleIDs map its leaves to instances
+    vk::DeviceAddress instances { 0 };
+    vk::DeviceAddress blasDescriptors { 0 };
+
+    // device side BvhCounts written by the stage that built the tree, 0 for a tree loaded from the disk cache;
+    // host counts are exact once the stage read its runtime data back, an upper bound before that
+    vk::DeviceAddress counts { 0 };
     u32 nodeCountLeaf { 0 };
     u32 nodeCountTotal { 0 };
 
@@ -27,6 +68,13 @@ struct Bvh {
     bool operator==(Bvh const& rhs) const = default;
 };
 
+// top level input, one leaf per scene instance
+struct Instances {
+    vk::DeviceAddress address { 0 };
+    u32 count { 0 };
+    scene::AABB aabb;
+};
+
 struct BvhStats {
     f32 saTraverse { 0.f };
     f32 saIntersect { 0.f };
@@ -35,6 +83,7 @@ struct BvhStats {
     u32 leafSizeSum { 0 };
     u32 leafSizeMin { 0xFFFFFFFF };
     u32 leafSizeMax { 0 };
+    u32 aabbChildCount { 0 };
 };
 
 struct TraceRuntime {
@@ -48,6 +97,8 @@ struct TraceRuntime {
     u32 ptDepth { 7 };
 
     vk::DeviceAddress geometryDescriptorAddress { 0 };
+    // quantizes the ray origins for ray reordering
+    scene::AABB sceneAabb;
 
     vk::ImageView targetImageView;
     lime::Buffer::Detail camera;
@@ -1,7 +1,10 @@
 #include "ConfigFiles.h"
 
+#include <algorithm>
 #include <berries/lib_helper/spdlog.h>
+#include <cctype>
 #include <cstdlib>
+#include <fstream>
 
 #define TOML_IMPLEMENTATION
 #define TOML_HEADER_ONLY 0
@@ -11,6 +14,8 @@ namespace fs = std::filesystem;
 
 backend::config::BVHPipeline getPipeline(toml::table const& tPipeline, toml::table const& tShaders);
 void getPipeline(toml::table const& tPipeline, toml::table const& tShaders, backend::config::BVHPipeline& pipeline);
+backend::config::BV getBoundingVolume(std::string_view bv);
+backend::config::NodeLayout getNodeLayout(std::string_view layout);
 
 ConfigFiles::ConfigFiles(fs::path const& res, fs::path const& pScenes, fs::path const& pPipelines)
 {
@@ -19,6 +24,7 @@ ConfigFiles::ConfigFiles(fs::path const& res, fs::path const& pScenes, fs::path
 
 void ConfigFiles::Read(fs::path const& res, fs::path const& pScenes, fs::path const& pPipelines)
 {
+    tuningDirectory = res / "tuning";
     parseScenes(res, pScenes);
     parsePipelines(pPipelines);
 }
@@ -126,6 +132,187 @@ std::vector<ConfigFiles::Scene> const& ConfigFiles::GetScenes() const
     return scenes;
 }
 
+static fs::path tuningFile(fs::path const& dir, std::string_view deviceName)
+{
+    std::string name;
+    name.reserve(deviceName.size());
+    for (auto const c : deviceName)
+        name += std::isalnum(static_cast<unsigned char>(c)) ? static_cast<char>(std::tolower(static_cast<unsigned char>(c))) : '_';
+    return dir / (name + ".toml");
+}
+
+static std::string_view getBoundingVolumeKey(backend::config::BV bv)
+{
+    switch (bv) {
+    case backend::config::BV::eNone:
+        return "none";
+    case backend::config::BV::eAABB:
+        return "aabb";
+    case backend::config::BV::eOBB:
+        return "obb";
+    case backend::config::BV::eDOP14:
+        return "dop14";
+    case backend::config::BV::eDOP14split:
+        return "dop14split";
+    case backend::config::BV::eSOBB_d:
+        return "sobb_d";
+    case backend::config::BV::eSOBB_d32:
+        return "sobb_d32";
+    case backend::config::BV::eSOBB_d48:
+        return "sobb_d48";
+    case backend::config::BV::eSOBB_d64:
+        return "sobb_d64";
+    case backend::config::BV::eSOBB_i32:
+        return "sobb_i32";
+    case backend::config::BV::eSOBB_i48:
+        return "sobb_i48";
+    case backend::config::BV::eSOBB_i64:
+        return "sobb_i64";
+    case backend::config::BV::eHybrid_i32:
+        return "hybrid_i32";
+    }
+    return "none";
+}
+
+static std::string_view getNodeLayoutKey(backend::config::NodeLayout layout)
+{
+    switch (layout) {
+    case backend::config::NodeLayout::eDefault:
+        return "default";
+    case backend::config::NodeLayout::eBVH2:
+        return "bvh2";
+    case backend::config::NodeLayout::eBVH2q:
+        return "bvh2q";
+    case backend::config::NodeLayout::eBVH4:
+        return "bvh4";
+    case backend::config::NodeLayout::eBVH8:
+        return "bvh8";
+    }
+    return "default";
+}
+
+void ConfigFiles::ReadTuning(std::string_view deviceName)
+{
+    tuning = {};
+    auto const path { tuningFile(tuningDirectory, deviceName) };
+    if (!fs::exists(path))
+        return;
+
+    toml::table toml;
+    try {
+        toml = toml::parse_file(path.c_str());
+    } catch (toml::parse_error const& err) {
+        berry::log::error("Parsing of '{}' failed:", path.generic_string());
+        berry::log::error("  {}", err.description());
+        return;
+    }
+
+    auto const getThreads = [](toml::table const& t, std::string_view key, backend::config::Tracer::PersistentThreads& threads) {
+        if (auto const value { t.at_path(std::string(key) + ".workgroup_count").value<u32>() }; value)
+            threads.workgroupCount = value.value();
+        if (auto const value { t.at_path(std::string(key) + ".warps_per_workgroup").value<u32>() }; value)
+            threads.warpsPerWorkgroup = value.value();
+    };
+
+    if (auto const* entries { toml["tracer"].as_array() })
+        for (auto const& e : *entries) {
+            auto const* t { e.as_table() };
+            if (!t)
+                continue;
+            Tuning::Tracer entry;
+            entry.bv = getBoundingVolume(t->at_path("bv").value_or<std::string_view>(""));
+            entry.layout = getNodeLayout(t->at_path("layout").value_or<std::string_view>(""));
+            getThreads(*t, "rays_primary", entry.rPrimary);
+            getThreads(*t, "rays_secondary", entry.rSecondary);
+            if (entry.bv != backend::config::BV::eNone)
+                tuning.tracer.push_back(entry);
+        }
+    if (auto const* entries { toml["plocpp"].as_array() })
+        for (auto const& e : *entries) {
+            auto const* t { e.as_table() };
+            if (!t)
+                continue;
+            Tuning::PLOC const entry {
+                .bv = getBoundingVolume(t->at_path("bv").value_or<std::string_view>("")),
+                .workgroupSize = t->at_path("workgroup_size").value_or<u32>(0),
+            };
+            if (entry.bv != backend::config::BV::eNone)
+                tuning.plocpp.push_back(entry);
+        }
+
+    applyTuning();
+    berry::log::info("Tuning: applied {}", path.filename().generic_string());
+}
+
+void ConfigFiles::WriteTuning(std::string_view deviceName, Tuning const& tuned)
+{
+    for (auto const& t : tuned.tracer) {
+        auto const it { std::ranges::find_if(tuning.tracer, [&t](auto const& e) { return e.bv == t.bv && e.layout == t.layout; }) };
+        if (it != tuning.tracer.end())
+            *it = t;
+        else
+            tuning.tracer.push_back(t);
+    }
+    for (auto const& t : tuned.plocpp) {
+        auto const it { std::ranges::find_if(tuning.plocpp, [&t](auto const& e) { return e.bv == t.bv; }) };
+        if (it != tuning.plocpp.end())
+            *it = t;
+        else
+            tuning.plocpp.push_back(t);
+    }
+    applyTuning();
+
+    auto const threads = [](backend::config::Tracer::PersistentThreads const& threads) {
+        return toml::table {
+            { "workgroup_count", threads.workgroupCount },
+            { "warps_per_workgroup", threads.warpsPerWorkgroup },
+        };
+    };
+    toml::array tTracer;
+    for (auto const& t : tuning.tracer)
+        tTracer.push_back(toml::table {
+            { "bv", getBoundingVolumeKey(t.bv) },
+            { "layout", getNodeLayoutKey(t.layout) },
+            { "rays_primary", threads(t.rPrimary) },
+            { "rays_secondary", threads(t.rSecondary) },
+        });
+    toml::array tPlocpp;
+    for (auto const& t : tuning.plocpp)
+        tPlocpp.push_back(toml::table {
+            { "bv", getBoundingVolumeKey(t.bv) },
+            { "workgroup_size", t.workgroupSize },
+        });
+
+    std::error_code ec;
+    fs::create_directories(tuningDirectory, ec);
+    auto const path { tuningFile(tuningDirectory, deviceName) };
+    std::ofstream file { path };
+    if (ec || !file) {
+        berry::log::error("Tuning: failed to write {}", path.generic_string());
+        return;
+    }
+    file << toml::table {
+        { "device", deviceName },
+        { "tracer", std::move(tTracer) },
+        { "plocpp", std::move(tPlocpp) },
+    } << '\n';
+    berry::log::info("Tuning: stored {}", path.filename().generic_string());
+}
+
+void ConfigFiles::applyTuning()
+{
+    for (auto& p : bvhPipelines) {
+        for (auto const& t : tuning.tracer)
+            if (p.tracer.bv == t.bv && p.rearrangement.layout == t.layout) {
+                p.tracer.rPrimary = t.rPrimary;
+                p.tracer.rSecondary = t.rSecondary;
+            }
+        for (auto const& t : tuning.plocpp)
+            if (p.plocpp.bv == t.bv)
+                p.plocpp.workgroupSize = t.workgroupSize;
+    }
+}
+
 ConfigFiles::Scene ConfigFiles::GetScene(std::string_view sceneName)
 {
     Scene result;
@@ -166,6 +353,8 @@ backend::config::BV getBoundingVolume(std::string_view bv)
         return backend::config::BV::eSOBB_i48;
     if (bv == "sobb_i64")
         return backend::config::BV::eSOBB_i64;
+    if (bv == "hybrid_i32")
+        return backend::config::BV::eHybrid_i32;
     return backend::config::BV::eNone;
 }
 
@@ -173,6 +362,12 @@ backend::config::NodeLayout getNodeLayout(std::string_view layout)
 {
     if (layout == "bvh2")
         return backend::config::NodeLayout::eBVH2;
+    if (layout == "bvh2q")
+        return backend::config::NodeLayout::eBVH2q;
+    if (layout == "bvh4")
+        return backend::config::NodeLayout::eBVH4;
+    if (layout == "bvh8")
+        return backend::config::NodeLayout::eBVH8;
     return backend::config::NodeLayout::eDefault;
 }
 
@@ -180,12 +375,51 @@ backend::config::SpaceFilling getSFC(std::string_view sfc)
 {
     if (sfc == "morton32")
         return backend::config::SpaceFilling::eMorton32;
+    if (sfc == "morton64")
+        return backend::config::SpaceFilling::eMorton64;
+    if (sfc == "hilbert64")
+        return backend::config::SpaceFilling::eHilbert64;
     return backend::config::SpaceFilling::eMorton32;
 }
 
+backend::config::TriangleLayout getTriangleLayout(std::string_view layout)
+{
+    if (layout == "indexed")
+        return backend::config::TriangleLayout::eIndexed;
+    return backend::config::TriangleLayout::eWoop;
+}
+
+backend::config::SOBBFit getSOBBFit(std::string_view fit)
+{
+    if (fit == "greedy")
+        return backend::config::SOBBFit::eGreedy;
+    if (fit == "pruned")
+        return backend::config::SOBBFit::ePruned;
+    if (fit == "exhaustive")
+        return backend::config::SOBBFit::eExhaustive;
+    return backend::config::SOBBFit::eAnchored;
+}
+
+backend::config::RestructuringMethod getRestructuringMethod(std::string_view method)
+{
+    if (method == "reinsertion")
+        return backend::config::RestructuringMethod::eReinsertion;
+    return backend::config::RestructuringMethod::eTreelet;
+}
+
+backend::config::RadiusSchedule getRadiusSchedule(std::string_view schedule)
+{
+    if (schedule == "linear")
+        return backend::config::RadiusSchedule::eLinear;
+    if (schedule == "cluster_count")
+        return backend::config::RadiusSchedule::eClusterCount;
+    return backend::config::RadiusSchedule::eFixed;
+}
+
 backend::config::InitialClusters getInitialClusters(std::string_view ic)
 {
-    static_cast<void>(ic);
+    if (ic == "triangle_splits")
+        return backend::config::InitialClusters::eTriangleSplits;
     return backend::config::InitialClusters::eTriangles;
 }
 
@@ -211,11 +445,44 @@ void getPipeline(toml::table const& tPipeline, toml::table const& tShaders, back
         pipeline.plocpp.ic = getInitialClusters(value.value());
     if (auto const value { tPipeline.at_path("plocpp.radius").value<u32>() }; value)
         pipeline.plocpp.radius = value.value();
+    if (auto const value { tPipeline.at_path("plocpp.radius_schedule").value<std::string_view>() }; value)
+        pipeline.plocpp.radiusSchedule = getRadiusSchedule(value.value());
+    if (auto const value { tPipeline.at_path("plocpp.radius_min").value<u32>() }; value)
+        pipeline.plocpp.radiusMin = value.value();
+    if (auto const value { tPipeline.at_path("plocpp.radius_step").value<u32>() }; value)
+        pipeline.plocpp.radiusStep = value.value();
+    if (auto const value { tPipeline.at_path("plocpp.split_budget").value<f32>() }; value)
+        pipeline.plocpp.splitBudget = value.value();
+    if (auto const value { tPipeline.at_path("plocpp.workgroup_size").value<u32>() }; value) {
+        // the iterations run whole warps
+        pipeline.plocpp.workgroupSize = (value.value() + 31) / 32 * 32;
+        if (pipeline.plocpp.workgroupSize != value.value())
+            berry::log::warn("plocpp.workgroup_size {} is not a multiple of 32, using {}", value.value(), pipeline.plocpp.workgroupSize);
+    }
+
+    if (auto const value { tPipeline.at_path("restructuring.bv").value<std::string_view>() }; value)
+        pipeline.restructuring.bv = getBoundingVolume(value.value());
+    getShader("restructuring.shader.restructure", pipeline.restructuring.shader.restructure);
+    if (auto const value { tPipeline.at_path("restructuring.method").value<std::string_view>() }; value)
+        pipeline.restructuring.method = getRestructuringMethod(value.value());
+
+    if (auto const value { tPipeline.at_path("restructuring.treelet_size").value<u32>() }; value)
+        pipeline.restructuring.treeletSize = value.value();
+    if (auto const value { tPipeline.at_path("restructuring.iterations").value<u32>() }; value)
+        pipeline.restructuring.iterations = value.value();
+    if (auto const value { tPipeline.at_path("restructuring.c_t").value<f32>() }; value)
+        pipeline.restructuring.c_t = value.value();
+    if (auto const value { tPipeline.at_path("restructuring.c_i").value<f32>() }; value)
+        pipeline.restructuring.c_i = value.value();
+    if (auto const value { tPipeline.at_path("restructuring.min_reinsertion_ratio").value<f32>() }; value)
+        pipeline.restructuring.minReinsertionRatio = value.value();
 
     if (auto const value { tPipeline.at_path("collapsing.bv").value<std::string_view>() }; value)
         pipeline.collapsing.bv = getBoundingVolume(value.value());
     getShader("collapsing.shader.collapse", pipeline.collapsing.shader.collapse);
 
+    if (auto const value { tPipeline.at_path("collapsing.triangles").value<std::string_view>() }; value)
+        pipeline.collapsing.triangles = getTriangleLayout(value.value());
     if (auto const value { tPipeline.at_path("collapsing.max_leaf_size").value<u32>() }; value)
         pipeline.collapsing.maxLeafSize = value.value();
     if (auto const value { tPipeline.at_path("collapsing.c_t").value<f32>() }; value)
@@ -226,6 +493,12 @@ void getPipeline(toml::table const& tPipeline, toml::table const& tShaders, back
     if (auto const value { tPipeline.at_path("transformation.bv").value<std::string_view>() }; value)
         pipeline.transformation.bv = getBoundingVolume(value.value());
     getShader("transformation.shader.transform", pipeline.transformation.shader.transform);
+    if (auto const value { tPipeline.at_path("transformation.sobb_cost_ratio").value<f32>() }; value)
+        pipeline.transformation.sobbCostRatio = value.value();
+    if (auto const value { tPipeline.at_path("transformation.sobb_fit").value<std::string_view>() }; value)
+        pipeline.transformation.sobbFit = getSOBBFit(value.value());
+    if (auto const value { tPipeline.at_path("transformation.sobb_candidates").value<u32>() }; value)
+        pipeline.transformation.sobbCandidates = value.value();
 
     if (auto const value { tPipeline.at_path("rearrangement.bv").value<std::string_view>() }; value)
         pipeline.rearrangement.bv = getBoundingVolume(value.value());
@@ -239,6 +512,9 @@ void getPipeline(toml::table const& tPipeline, toml::table const& tShaders, back
     if (auto const value { tPipeline.at_path("stats.c_i").value<f32>() }; value)
         pipeline.stats.c_i = value.value();
 
+    if (auto const value { tPipeline.at_path("single_submission").value<bool>() }; value)
+        pipeline.singleSubmission = value.value();
+
     if (auto const value { tPipeline.at_path("tracer.bv").value<std::string_view>() }; value)
         pipeline.tracer.bv = getBoundingVolume(value.value());
     getShader("tracer.shader.gen_primary", pipeline.tracer.shader.genPrimary);
@@ -248,6 +524,9 @@ void getPipeline(toml::table const& tPipeline, toml::table const& tShaders, back
     getShader("tracer.shader.shade_and_cast_bv", pipeline.tracer.shader.shadeAndCast_bv);
     getShader("tracer.shader.trace_int", pipeline.tracer.shader.traceRays_int);
     getShader("tracer.shader.shade_and_cast_int", pipeline.tracer.shader.shadeAndCast_int);
+    getShader("tracer.shader.sort_rays", pipeline.tracer.shader.sortRays);
+    getShader("tracer.shader.trace_shadow", pipeline.tracer.shader.traceShadow);
+    getShader("tracer.shader.resolve_shadows", pipeline.tracer.shader.resolveShadows);
 
     if (auto const value { tPipeline.at_path("tracer.rays_primary.workgroup_count").value<u32>() }; value)
         pipeline.tracer.rPrimary.workgroupCount = value.value();
@@ -257,4 +536,14 @@ void getPipeline(toml::table const& tPipeline, toml::table const& tShaders, back
         pipeline.tracer.rSecondary.workgroupCount = value.value();
     if (auto const value { tPipeline.at_path("tracer.rays_secondary.warps_per_workgroup").value<u32>() }; value)
         pipeline.tracer.rSecondary.warpsPerWorkgroup = value.value();
+    if (auto const value { tPipeline.at_path("tracer.reordering.enabled").value<bool>() }; value)
+        pipeline.tracer.reordering.enabled = value.value();
+    if (auto const value { tPipeline.at_path("tracer.reordering.min_ray_count").value<u32>() }; value)
+        pipeline.tracer.reordering.minRayCount = value.value();
+    if (auto const value { tPipeline.at_path("tracer.shadow_rays").value<bool>() }; value)
+        pipeline.tracer.shadowRays = value.value();
+    if (auto const value { tPipeline.at_path("tracer.validate_short_stack").value<u32>() }; value)
+        pipeline.tracer.validateShortStack = value.value();
+    if (auto const value { tPipeline.at_path("tracer.short_stack").value<bool>() }; value)
+        pipeline.tracer.shortStack = value.value();
 }
@@ -20,13 +20,39 @@ public:
     std::vector<std::string> benchmarkScenes;
     std::vector<std::string> benchmarkPipelines;
 
+    // launch parameters found by the benchmark autotune run on one device, they replace the ones of benchmark.toml
+    // in every pipeline of the same tracer bv and node layout, resp. the same PLOC++ bv
+    struct Tuning {
+        struct Tracer {
+            backend::config::BV bv { backend::config::BV::eNone };
+            backend::config::NodeLayout layout { backend::config::NodeLayout::eDefault };
+            backend::config::Tracer::PersistentThreads rPrimary;
+            backend::config::Tracer::PersistentThreads rSecondary;
+        };
+        struct PLOC {
+            backend::config::BV bv { backend::config::BV::eNone };
+            u32 workgroupSize { 0 };
+        };
+        std::vector<Tracer> tracer;
+        std::vector<PLOC> plocpp;
+    };
+
     ConfigFiles(std::filesystem::path const& res, std::filesystem::path const& pScenes, std::filesystem::path const& pPipelines);
     void Read(std::filesystem::path const& res, std::filesystem::path const& pScenes, std::filesystem::path const& pPipelines);
     Scene GetScene(std::string_view = {});
     std::vector<ConfigFiles::Scene> const& GetScenes() const;
 
+    // per device file in res/tuning, missing file keeps the pipelines as they are
+    void ReadTuning(std::string_view deviceName);
+    // merges the tuned entries into the ones read before, then applies and stores them
+    void WriteTuning(std::string_view deviceName, Tuning const& tuned);
+
 private:
     std::string startupScene;
+    std::filesystem::path tuningDirectory;
+    Tuning tuning;
+
+    void applyTuning();
     void parseScenes(std::filesystem::path const& res, std::filesystem::path const& pScenes);
     void parsePipelines(std::filesystem::path const& pPipelines);
 };
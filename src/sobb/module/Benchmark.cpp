@@ -2,8 +2,13 @@
 
 #include "../Application.h"
 #include "../core/ConfigFiles.h"
+#include <berries/lib_helper/spdlog.h>
 #include <final/shared/data_bvh.h>
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
 #define FRAMES_WAIT 2
 #define FRAMES_MEASURE 3
 
@@ -13,6 +18,7 @@ Benchmark::Benchmark(Application& app)
     : app(app)
     , backend(app.backend)
 {
+    app.configFiles.ReadTuning(backend.GetDeviceName());
     LoadConfig();
     backend.SetPipelineConfiguration(bPipelines[0]);
 }
@@ -55,6 +61,7 @@ void Benchmark::SetupBenchmarkRun(State& state)
     backend.state.selectedRenderer = backend::vulkan::State::Renderer::ePathTracingCompute;
     backend.OnRenderModeChange();
     backend.ResetAccumulation();
+    warmUpPipelines();
 
     statExporter.PrintHeader();
     rt.bRunning = true;
@@ -62,6 +69,10 @@ void Benchmark::SetupBenchmarkRun(State& state)
 }
 void Benchmark::Run()
 {
+    if (tune.step != Autotune::Step::eIdle) {
+        runAutotune();
+        return;
+    }
     switch (bState) {
     case BenchmarkState::eIdle:
         return;
@@ -157,6 +168,171 @@ void Benchmark::SetDefaultAsActive()
     rt.currentPipeline = 0;
 }
 
+void Benchmark::warmUpPipelines()
+{
+    std::vector<backend::config::BVHPipeline> pipelines;
+    pipelines.reserve(rt.pipelines.size());
+    for (auto const i : rt.pipelines)
+        pipelines.push_back(bPipelines[i]);
+
+    auto jobs { backend.PipelineWarmUpJobs(pipelines) };
+    auto const t0 { std::chrono::steady_clock::now() };
+
+    Taskflow warmUp;
+    warmUp.for_each(jobs.begin(), jobs.end(), [](auto& job) { job(); });
+    app.mainExecutor.run(warmUp).wait();
+
+    auto const t1 { std::chrono::steady_clock::now() };
+    berry::log::info("Compiled {} pipelines in {:.2f} ms.", jobs.size(), std::chrono::duration<f32, std::milli>(t1 - t0).count());
+}
+
+void Benchmark::SetupAutotuneRun(State& state)
+{
+    tune = {};
+
+    // the persistent threads launch is swept for primary and secondary rays at once, both keep their own best
+    std::vector<backend::config::Tracer::PersistentThreads> threads;
+    for (u32 const workgroupCount : { 256u, 512u, 1024u, 2048u })
+        for (u32 const warpsPerWorkgroup : { 2u, 4u, 6u, 8u, 12u, 16u })
+            threads.push_back({ .workgroupCount = workgroupCount, .warpsPerWorkgroup = warpsPerWorkgroup });
+
+    for (auto const& name : method) {
+        auto const p { std::ranges::find(bPipelines, name, &backend::config::BVHPipeline::name) };
+        if (p == bPipelines.end())
+            continue;
+
+        auto& tracer { tune.tuned.tracer };
+        auto const tracerKnown { std::ranges::any_of(tracer, [&p](auto const& t) { return t.bv == p->tracer.bv && t.layout == p->rearrangement.layout; }) };
+        if (p->tracer.bv != backend::config::BV::eNone && !tracerKnown) {
+            auto const target { csize<i32>(tracer) };
+            tracer.push_back({ .bv = p->tracer.bv, .layout = p->rearrangement.layout, .rPrimary = p->tracer.rPrimary, .rSecondary = p->tracer.rSecondary });
+            tune.tracerNames.push_back(p->name);
+            tune.bestTracer.emplace_back(0.f, 0.f);
+
+            // the current setting competes too
+            auto candidates { threads };
+            for (auto const& t : { p->tracer.rPrimary, p->tracer.rSecondary })
+                if (std::ranges::find(candidates, t) == candidates.end())
+                    candidates.push_back(t);
+            for (auto const& t : candidates) {
+                auto& c { tune.candidates.emplace_back(*p, target, false) };
+                c.pipeline.tracer.rPrimary = t;
+                c.pipeline.tracer.rSecondary = t;
+            }
+        }
+
+        auto& plocpp { tune.tuned.plocpp };
+        auto const plocppKnown { std::ranges::any_of(plocpp, [&p](auto const& t) { return t.bv == p->plocpp.bv; }) };
+        if (p->plocpp.bv != backend::config::BV::eNone && !plocppKnown) {
+            auto const target { csize<i32>(plocpp) };
+            plocpp.push_back({ .bv = p->plocpp.bv, .workgroupSize = p->plocpp.workgroupSize });
+            tune.plocppNames.push_back(p->name);
+            tune.bestPlocpp.push_back(std::numeric_limits<f32>::max());
+
+            // 0 is the largest workgroup the device allows, a chunk has to outgrow the 4 * radius overlap by a warp
+            for (u32 const workgroupSize : { 0u, 256u, 384u, 512u, 768u, 1024u }) {
+                if (workgroupSize != 0 && workgroupSize < 4 * p->plocpp.radius + 32)
+                    continue;
+                auto& c { tune.candidates.emplace_back(*p, target, true) };
+                c.pipeline.plocpp.workgroupSize = workgroupSize;
+            }
+        }
+    }
+    if (tune.candidates.empty()) {
+        berry::log::warn("Autotune: no benchmark pipeline to tune");
+        return;
+    }
+    berry::log::info("Autotune: {} candidates for {} tracer and {} PLOC++ settings", tune.candidates.size(), tune.tuned.tracer.size(), tune.tuned.plocpp.size());
+
+    state.shaderHotReload = false;
+    backend.state.samplesPerPixel = 64;
+    backend.state.selectedRenderer = backend::vulkan::State::Renderer::ePathTracingCompute;
+    backend.OnRenderModeChange();
+    backend.ResetAccumulation();
+
+    rt.bRunning = true;
+    tune.step = Autotune::Step::eCandidateSet;
+}
+
+void Benchmark::runAutotune()
+{
+    switch (tune.step) {
+    case Autotune::Step::eIdle:
+        return;
+    case Autotune::Step::eCandidateSet: {
+        if (tune.current >= tune.candidates.size()) {
+            finishAutotune();
+            return;
+        }
+        backend.SetPipelineConfiguration(tune.candidates[tune.current].pipeline);
+        tune.pRayCount = 0;
+        tune.pTraceTimeMs = 0.f;
+        tune.sRayCount = 0;
+        tune.sTraceTimeMs = 0.f;
+        tune.step = Autotune::Step::eWaitFrames;
+    } break;
+    case Autotune::Step::eWaitFrames: {
+        if (tune.frames++ >= FRAMES_WAIT) {
+            tune.frames = 0;
+            tune.step = Autotune::Step::eMeasure;
+        }
+    } break;
+    case Autotune::Step::eMeasure: {
+        auto const t { backend.GetStatsTrace() };
+        tune.pRayCount += t.data[0].rayCount;
+        tune.pTraceTimeMs += t.data[0].traceTimeMs;
+        for (int i = 1; i < 8; i++) {
+            tune.sRayCount += t.data[i].rayCount;
+            tune.sTraceTimeMs += t.data[i].traceTimeMs;
+        }
+        if (++tune.frames < FRAMES_MEASURE)
+            break;
+        tune.frames = 0;
+
+        auto const& c { tune.candidates[tune.current++] };
+        if (c.plocpp) {
+            auto const timeMs { backend.GetStatsBuild().plocpp.timeTotal };
+            if (timeMs > 0.f && timeMs < tune.bestPlocpp[c.target]) {
+                tune.bestPlocpp[c.target] = timeMs;
+                tune.tuned.plocpp[c.target].workgroupSize = c.pipeline.plocpp.workgroupSize;
+            }
+        } else {
+            auto const pRate { tune.pTraceTimeMs > 0.f ? static_cast<f32>(tune.pRayCount) / tune.pTraceTimeMs : 0.f };
+            auto const sRate { tune.sTraceTimeMs > 0.f ? static_cast<f32>(tune.sRayCount) / tune.sTraceTimeMs : 0.f };
+            auto& [pBest, sBest] { tune.bestTracer[c.target] };
+            if (pRate > pBest) {
+                pBest = pRate;
+                tune.tuned.tracer[c.target].rPrimary = c.pipeline.tracer.rPrimary;
+            }
+            if (sRate > sBest) {
+                sBest = sRate;
+                tune.tuned.tracer[c.target].rSecondary = c.pipeline.tracer.rSecondary;
+            }
+        }
+        tune.step = Autotune::Step::eCandidateSet;
+    } break;
+    }
+}
+
+void Benchmark::finishAutotune()
+{
+    for (size_t i = 0; i < tune.tuned.tracer.size(); i++) {
+        auto const& t { tune.tuned.tracer[i] };
+        berry::log::info("Autotune: '{}' primary {}x{} ({:.1f} MRps), secondary {}x{} ({:.1f} MRps)", tune.tracerNames[i],
+            t.rPrimary.workgroupCount, t.rPrimary.warpsPerWorkgroup, tune.bestTracer[i].first * 1e-3f,
+            t.rSecondary.workgroupCount, t.rSecondary.warpsPerWorkgroup, tune.bestTracer[i].second * 1e-3f);
+    }
+    for (size_t i = 0; i < tune.tuned.plocpp.size(); i++)
+        berry::log::info("Autotune: '{}' PLOC++ workgroup size {} ({:.2f} ms)", tune.plocppNames[i], tune.tuned.plocpp[i].workgroupSize, tune.bestPlocpp[i]);
+
+    app.configFiles.WriteTuning(backend.GetDeviceName(), tune.tuned);
+    LoadConfig();
+    backend.SetPipelineConfiguration(bPipelines[rt.currentPipeline]);
+
+    tune.step = Autotune::Step::eIdle;
+    rt.bRunning = false;
+}
+
 void Benchmark::ExportPipeline(BPipeline& p, BPipeline const& pRel)
 {
     u64 pRayCount { 0 };
@@ -189,8 +365,8 @@ void Benchmark::ExportPipeline(BPipeline& p, BPipeline const& pRel)
     f32 pMRps_r { pMRps / pRel.pMRps };
     f32 sMRps { p.sMRps };
     f32 sMRps_r { sMRps / pRel.sMRps };
-    f32 buildTime { p.statsBuild.plocpp.timeTotal + p.statsBuild.collapsing.timeTotal + p.statsBuild.transformation.timeTotal + p.statsBuild.rearrangement.timeTotal };
-    f32 buildTime_ref { pRel.statsBuild.plocpp.timeTotal + pRel.statsBuild.collapsing.timeTotal + pRel.statsBuild.transformation.timeTotal + pRel.statsBuild.rearrangement.timeTotal };
+    f32 buildTime { p.statsBuild.plocpp.timeTotal + p.statsBuild.restructuring.timeTotal + p.statsBuild.collapsing.timeTotal + p.statsBuild.transformation.timeTotal + p.statsBuild.rearrangement.timeTotal };
+    f32 buildTime_ref { pRel.statsBuild.plocpp.timeTotal + pRel.statsBuild.restructuring.timeTotal + pRel.statsBuild.collapsing.timeTotal + pRel.statsBuild.transformation.timeTotal + pRel.statsBuild.rearrangement.timeTotal };
     f32 buildTime_r { buildTime / buildTime_ref };
     // empty & BV & SA leaves & rel & SA internal & rel & SA total & rel & avg. leaf size & pMRpS & rel & sMRpS & rel & build time
     fmt::print(" & {} & {:.1f} & ({:.2f}) & {:.1f} & ({:.2f}) & {:.1f} & {:.1f} & ({:.2f}) & {:.1f} & ({:.2f}) & {:.1f} & ({:.2f}) & {:.1f} & ({:.2f}) \\\\\n",
@@ -201,14 +377,18 @@ Benchmark::StatsExport::StatsExport()
 {
     stats = {
         { Stat::eAverageLeafSize, false },
+        { Stat::ePLOCIterations, false },
+        { Stat::eSAHCost, true },
         { Stat::eBuildTimeTotal, true },
         { Stat::eMemoryConsumption, true },
+        { Stat::eNodeBytesPerRay, true },
         { Stat::eAvgTestedBVs, true },
         { Stat::eAvgTestedTriangles, true },
         { Stat::eTraceTimeTotal, true },
         { Stat::eTraceTimeSecondary, false },
         { Stat::ePMRps, true },
         { Stat::eSMRps, true },
+        { Stat::eShMRps, false },
     };
 }
 void Benchmark::StatsExport::PrintHeader()
@@ -268,6 +448,8 @@ void Benchmark::StatsExport::PrintPipeline(backend::config::BVHPipeline& bConfig
     f32 pTraceTimeMs { 0.f };
     u64 sRayCount { 0 };
     f32 sTraceTimeMs { 0.f };
+    u64 shRayCount { 0 };
+    f32 shTraceTimeMs { 0.f };
     u64 totalTestedNodes { 0 };
     u64 totalTestedTris { 0 };
     u64 totalTestedBVs { 0 };
@@ -278,18 +460,25 @@ void Benchmark::StatsExport::PrintPipeline(backend::config::BVHPipeline& bConfig
             sRayCount += t.data[i].rayCount;
             sTraceTimeMs += t.data[i].traceTimeMs;
         }
+        for (auto const& sh : t.shadow) {
+            shRayCount += sh.rayCount;
+            shTraceTimeMs += sh.traceTimeMs;
+        }
         totalTestedNodes += t.testedNodes;
         totalTestedTris += t.testedTriangles;
         totalTestedBVs += t.testedBVolumes;
     }
     p.pMRps = (static_cast<f32>(pRayCount) * 1e-6f) / (pTraceTimeMs * 1e-3f);
     p.sMRps = (static_cast<f32>(sRayCount) * 1e-6f) / (sTraceTimeMs * 1e-3f);
+    p.shMRps = shRayCount > 0 ? (static_cast<f32>(shRayCount) * 1e-6f) / (shTraceTimeMs * 1e-3f) : 0.f;
     p.pTimeRel = pTraceTimeMs / (pTraceTimeMs + sTraceTimeMs);
     p.sTimeRel = sTraceTimeMs / (pTraceTimeMs + sTraceTimeMs);
-    p.timeTotal = pTraceTimeMs + sTraceTimeMs;
-    p.avgNodesPerRay = (static_cast<f32>(totalTestedNodes) / static_cast<f32>(pRayCount + sRayCount));
-    p.avgTrisPerRay = (static_cast<f32>(totalTestedTris) / static_cast<f32>(pRayCount + sRayCount));
-    p.avgBVsPerRay = (static_cast<f32>(totalTestedBVs) / static_cast<f32>(pRayCount + sRayCount));
+    p.timeTotal = pTraceTimeMs + sTraceTimeMs + shTraceTimeMs;
+    // the tested node, BV and triangle counters include the shadow rays
+    auto const rayCount { static_cast<f32>(pRayCount + sRayCount + shRayCount) };
+    p.avgNodesPerRay = static_cast<f32>(totalTestedNodes) / rayCount;
+    p.avgTrisPerRay = static_cast<f32>(totalTestedTris) / rayCount;
+    p.avgBVsPerRay = static_cast<f32>(totalTestedBVs) / rayCount;
 
     auto const getNodeSize { [](backend::config::NodeLayout layout, backend::config::BV bv) -> u64 {
         switch (layout) {
@@ -309,20 +498,63 @@ void Benchmark::StatsExport::PrintPipeline(backend::config::BVHPipeline& bConfig
             case backend::config::BV::eSOBB_i48:
             case backend::config::BV::eSOBB_i64:
                 return sizeof(data_bvh::NodeBVH2_SOBBi_c);
+            case backend::config::BV::eHybrid_i32:
+                return sizeof(data_bvh::NodeBVH2_MIXED_c);
+            default:;
+            }
+            break;
+        case backend::config::NodeLayout::eBVH2q:
+            switch (bv) {
+            case backend::config::BV::eAABB:
+                return sizeof(data_bvh::NodeBVH2_AABB_q);
+            case backend::config::BV::eSOBB_i32:
+            case backend::config::BV::eSOBB_i48:
+            case backend::config::BV::eSOBB_i64:
+                return sizeof(data_bvh::NodeBVH2_SOBBi_q);
+            default:;
+            }
+            break;
+        case backend::config::NodeLayout::eBVH4:
+            switch (bv) {
+            case backend::config::BV::eAABB:
+                return sizeof(data_bvh::NodeBVH4_AABB_c);
+            case backend::config::BV::eSOBB_d:
+                return sizeof(data_bvh::NodeBVH4_SOBB_c);
+            case backend::config::BV::eSOBB_i32:
+            case backend::config::BV::eSOBB_i48:
+            case backend::config::BV::eSOBB_i64:
+                return sizeof(data_bvh::NodeBVH4_SOBBi_c);
+            default:;
+            }
+            break;
+        case backend::config::NodeLayout::eBVH8:
+            switch (bv) {
+            case backend::config::BV::eAABB:
+                return sizeof(data_bvh::NodeBVH8_AABB_c);
+            case backend::config::BV::eSOBB_d:
+                return sizeof(data_bvh::NodeBVH8_SOBB_c);
+            case backend::config::BV::eSOBB_i32:
+            case backend::config::BV::eSOBB_i48:
+            case backend::config::BV::eSOBB_i64:
+                return sizeof(data_bvh::NodeBVH8_SOBBi_c);
             default:;
             }
+            break;
         default:;
         }
         return 0;
     } };
-    auto const tSize { [](auto leafType) {
-        static_cast<void>(leafType);
-        return 48;
+    // both layouts keep the triangle ids for shading, Woop leaves add the precomputed triangles
+    auto const tSize { [](backend::config::TriangleLayout leafType) {
+        return leafType == backend::config::TriangleLayout::eIndexed ? 8 : 48 + 8;
     } };
+    auto const collapsed { bConfig.collapsing.bv != backend::config::BV::eNone && bConfig.collapsing.maxLeafSize > 1 };
 
     p.memory = 0.f;
     p.memory += 1e-6f * p.statsBuild.rearrangement.nodeCountTotal * getNodeSize(bConfig.rearrangement.layout, bConfig.rearrangement.bv);
-    p.memory += 1e-6f * .5f * (p.statsBuild.plocpp.nodeCountTotal + 1) * tSize(bConfig.rearrangement.bv);
+    p.memory += 1e-6f * .5f * (p.statsBuild.plocpp.nodeCountTotal + 1) * tSize(collapsed ? bConfig.collapsing.triangles : backend::config::TriangleLayout::eWoop);
+    // node traffic of traversal, quantized layouts trade it for the decoding cost visible in the trace times
+    p.nodeBytesPerRay = p.avgNodesPerRay * getNodeSize(bConfig.rearrangement.layout, bConfig.rearrangement.bv);
 
     std::cout << " & " << p.name << " & ";
     for (size_t i = 0; i < stats.size(); i++) {
@@ -337,6 +569,18 @@ void Benchmark::StatsExport::PrintPipeline(backend::config::BVHPipeline& bConfig
             if (stats[i].includeRelativeCol)
                 std::cout << std::format(" & ({:.2f})", (p.sMRps / pRel.sMRps));
             break;
+        case Stat::eShMRps:
+            if (p.shMRps > 0.f)
+                std::cout << std::format("{:.1f}", p.shMRps);
+            else
+                std::cout << "--";
+            if (stats[i].includeRelativeCol) {
+                if (p.shMRps > 0.f && pRel.shMRps > 0.f)
+                    std::cout << std::format(" & ({:.2f})", (p.shMRps / pRel.shMRps));
+                else
+                    std::cout << " & --";
+            }
+            break;
         case Stat::eTraceTimePrimary:
             std::cout << std::format("{:.2f}", p.pTimeRel);
             if (stats[i].includeRelativeCol)
@@ -357,6 +601,11 @@ void Benchmark::StatsExport::PrintPipeline(backend::config::BVHPipeline& bConfig
             if (stats[i].includeRelativeCol)
                 std::cout << std::format(" & ({:.2f})", (p.memory / pRel.memory));
             break;
+        case Stat::eNodeBytesPerRay:
+            std::cout << std::format("{:.0f}", p.nodeBytesPerRay);
+            if (stats[i].includeRelativeCol)
+                std::cout << std::format(" & ({:.2f})", (p.nodeBytesPerRay / pRel.nodeBytesPerRay));
+            break;
         case Stat::eAvgTestedNodes:
             std::cout << std::format("{:.1f}", p.avgNodesPerRay);
             if (stats[i].includeRelativeCol)
@@ -375,12 +624,14 @@ void Benchmark::StatsExport::PrintPipeline(backend::config::BVHPipeline& bConfig
         case Stat::eBuildTimeTotal: {
             auto const t {
                 p.statsBuild.plocpp.timeTotal
+                + p.statsBuild.restructuring.timeTotal
                 + p.statsBuild.collapsing.timeTotal
                 + p.statsBuild.transformation.timeTotal
                 + p.statsBuild.rearrangement.timeTotal
             };
             auto const tRel {
                 pRel.statsBuild.plocpp.timeTotal
+                + pRel.statsBuild.restructuring.timeTotal
                 + pRel.statsBuild.collapsing.timeTotal
                 + pRel.statsBuild.transformation.timeTotal
                 + pRel.statsBuild.rearrangement.timeTotal
@@ -433,6 +684,16 @@ void Benchmark::StatsExport::PrintPipeline(backend::config::BVHPipeline& bConfig
                 }
             }
             break;
+        case Stat::ePLOCIterations:
+            std::cout << p.statsBuild.plocpp.iterationCount;
+            if (stats[i].includeRelativeCol)
+                std::cout << std::format(" & ({:.2f})", (static_cast<f32>(p.statsBuild.plocpp.iterationCount) / static_cast<f32>(pRel.statsBuild.plocpp.iterationCount)));
+            break;
+        case Stat::eSAHCost:
+            std::cout << std::format("{:.1f}", p.statsBuild.rearrangement.costTotal);
+            if (stats[i].includeRelativeCol)
+                std::cout << std::format(" & ({:.2f})", (p.statsBuild.rearrangement.costTotal / pRel.statsBuild.rearrangement.costTotal));
+            break;
         case Stat::eSA_leaf:
             std::cout << std::format("{:.1f}", p.statsBuild.rearrangement.saIntersect);
             if (stats[i].includeRelativeCol)
@@ -462,6 +723,8 @@ void Benchmark::StatsExport::headerL1(ToPrint const& tp)
         case Stat::eSMRps:
         case Stat::eTraceTimeSecondary:
             return "Secondary";
+        case Stat::eShMRps:
+            return "Shadow";
         case Stat::eAvgTestedNodes:
             return "Avg. nodes";
         case Stat::eAvgTestedTriangles:
@@ -479,6 +742,10 @@ void Benchmark::StatsExport::headerL1(ToPrint const& tp)
             return "Transform";
         case Stat::eBuildTimeCompress:
             return "Compress";
+        case Stat::ePLOCIterations:
+            return "PLOC++";
+        case Stat::eSAHCost:
+            return "SAH";
         case Stat::eAverageLeafSize:
             return "Avg. leaf";
         case Stat::eSA_leaf:
@@ -486,6 +753,8 @@ void Benchmark::StatsExport::headerL1(ToPrint const& tp)
             return "Area";
         case Stat::eMemoryConsumption:
             return "Memory req.";
+        case Stat::eNodeBytesPerRay:
+            return "Node traffic";
         default:
             return "n/a";
         }
@@ -501,6 +770,7 @@ void Benchmark::StatsExport::headerL2(ToPrint const& tp)
         switch (s) {
         case Stat::ePMRps:
         case Stat::eSMRps:
+        case Stat::eShMRps:
             return "(MRps)";
         case Stat::eTraceTimePrimary:
         case Stat::eTraceTimeSecondary:
@@ -518,12 +788,18 @@ void Benchmark::StatsExport::headerL2(ToPrint const& tp)
             return "(ms)";
         case Stat::eAverageLeafSize:
             return "size";
+        case Stat::ePLOCIterations:
+            return "iterations";
+        case Stat::eSAHCost:
+            return "cost";
         case Stat::eSA_leaf:
             return "leaf";
         case Stat::eSA_inner:
             return "inner";
         case Stat::eMemoryConsumption:
             return "(MB)";
+        case Stat::eNodeBytesPerRay:
+            return "(B/ray)";
         default:
             return "n/a";
         }
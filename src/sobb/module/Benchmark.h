@@ -5,6 +5,7 @@
 #include "../backend/Config.h"
 #include "../backend/Stats.h"
 #include "../backend/vulkan/Vulkan.h"
+#include "../core/ConfigFiles.h"
 
 #include <queue>
 
@@ -18,6 +19,9 @@ public:
 
     void LoadConfig();
     void SetupBenchmarkRun(State& state);
+    // sweeps the tracer and PLOC++ launch parameters of the benchmark pipelines on the loaded scene and active view,
+    // the fastest ones go to the tuning file of the device
+    void SetupAutotuneRun(State& state);
     void Run();
     void ExportTexTableRows();
 
@@ -60,6 +64,7 @@ private:
 
         f32 pMRps { 0.0f };
         f32 sMRps { 0.0f };
+        f32 shMRps { 0.0f };
         f32 pTimeRel { 0.0f };
         f32 sTimeRel { 0.0f };
         f32 timeTotal { 0.0f };
@@ -67,6 +72,7 @@ private:
         f32 avgTrisPerRay { 0.f };
         f32 avgBVsPerRay { 0.f };
         f32 memory { 0.0f };
+        f32 nodeBytesPerRay { 0.f };
     };
 
     struct SceneBenchmark {
@@ -81,16 +87,19 @@ private:
             eSAHCost,
             eAverageLeafSize,
             eMemoryConsumption,
+            eNodeBytesPerRay,
             eBuildTimeTotal,
             eBuildTimeBuild,
             eBuildTimeCollapse,
             eBuildTimeTransform,
             eBuildTimeCompress,
+            ePLOCIterations,
             eAvgTestedNodes,
             eAvgTestedTriangles,
             eAvgTestedBVs,
             ePMRps,
             eSMRps,
+            eShMRps,
             eTraceTimePrimary,
             eTraceTimeSecondary,
             eTraceTimeTotal,
@@ -118,6 +127,40 @@ private:
 
     std::vector<SceneBenchmark> sceneBenchmarks;
     void ExportPipeline(BPipeline& p, BPipeline const& pRel);
+    void warmUpPipelines();
+
+    struct Autotune {
+        enum class Step {
+            eIdle,
+            eCandidateSet,
+            eWaitFrames,
+            eMeasure,
+        } step { Step::eIdle };
+
+        struct Candidate {
+            backend::config::BVHPipeline pipeline;
+            // index into tuned.plocpp for the PLOC++ workgroup size, into tuned.tracer otherwise
+            i32 target { 0 };
+            bool plocpp { false };
+        };
+        std::vector<Candidate> candidates;
+        size_t current { 0 };
+        i32 frames { 0 };
+
+        ConfigFiles::Tuning tuned;
+        std::vector<std::string> tracerNames;
+        std::vector<std::string> plocppNames;
+        // rays per ms of the primary and the secondary rays, PLOC++ time in ms
+        std::vector<std::pair<f32, f32>> bestTracer;
+        std::vector<f32> bestPlocpp;
+
+        u64 pRayCount { 0 };
+        f32 pTraceTimeMs { 0.f };
+        u64 sRayCount { 0 };
+        f32 sTraceTimeMs { 0.f };
+    } tune;
+    void runAutotune();
+    void finishAutotune();
 };
 
 }
@@ -30,6 +30,58 @@ static std::string to_string(backend::config::BV bv)
         return "sobb i48";
     case backend::config::BV::eSOBB_i64:
         return "sobb i64";
+    case backend::config::BV::eHybrid_i32:
+        return "hybrid i32";
+    }
+    return "unknown";
+}
+
+static std::string to_string(backend::config::SpaceFilling sfc)
+{
+    switch (sfc) {
+    case backend::config::SpaceFilling::eMorton32:
+        return "morton32";
+    case backend::config::SpaceFilling::eMorton64:
+        return "morton64";
+    case backend::config::SpaceFilling::eHilbert64:
+        return "hilbert64";
+    }
+    return "unknown";
+}
+
+static std::string to_string(backend::config::TriangleLayout layout)
+{
+    switch (layout) {
+    case backend::config::TriangleLayout::eWoop:
+        return "woop";
+    case backend::config::TriangleLayout::eIndexed:
+        return "indexed";
+    }
+    return "unknown";
+}
+
+static std::string to_string(backend::config::SOBBFit fit)
+{
+    switch (fit) {
+    case backend::config::SOBBFit::eGreedy:
+        return "greedy";
+    case backend::config::SOBBFit::eAnchored:
+        return "anchored";
+    case backend::config::SOBBFit::ePruned:
+        return "pruned";
+    case backend::config::SOBBFit::eExhaustive:
+        return "exhaustive";
+    }
+    return "unknown";
+}
+
+static std::string to_string(backend::config::RestructuringMethod method)
+{
+    switch (method) {
+    case backend::config::RestructuringMethod::eTreelet:
+        return "treelet";
+    case backend::config::RestructuringMethod::eReinsertion:
+        return "reinsertion";
     }
     return "unknown";
 }
@@ -41,6 +93,25 @@ static std::string to_string(backend::config::NodeLayout layout)
         return "bvh2 default";
     case backend::config::NodeLayout::eBVH2:
         return "bvh2";
+    case backend::config::NodeLayout::eBVH2q:
+        return "bvh2 quantized";
+    case backend::config::NodeLayout::eBVH4:
+        return "bvh4";
+    case backend::config::NodeLayout::eBVH8:
+        return "bvh8";
+    }
+    return "unknown";
+}
+
+static std::string to_string(backend::config::RadiusSchedule schedule)
+{
+    switch (schedule) {
+    case backend::config::RadiusSchedule::eFixed:
+        return "fixed";
+    case backend::config::RadiusSchedule::eLinear:
+        return "linear";
+    case backend::config::RadiusSchedule::eClusterCount:
+        return "cluster count";
     }
     return "unknown";
 }
@@ -50,6 +121,8 @@ static std::string to_string(backend::config::InitialClusters ic)
     switch (ic) {
     case backend::config::InitialClusters::eTriangles:
         return "triangles";
+    case backend::config::InitialClusters::eTriangleSplits:
+        return "triangle splits";
     }
     return "unknown";
 }
@@ -68,6 +141,12 @@ void Benchmark::ProcessGUI(State& state)
     if (ImGui::Button("Run"))
         SetupBenchmarkRun(state);
 
+    ImGui::SameLine();
+    ImGui::BeginDisabled(!backend.HaveScene());
+    if (ImGui::Button("Autotune"))
+        SetupAutotuneRun(state);
+    ImGui::EndDisabled();
+
     ImGui::BeginChild("b. list", ImVec2(120, ImGui::GetContentRegionAvail().y), true, ImGuiWindowFlags_HorizontalScrollbar);
     static int bShowPreview { 0 };
     for (int i { 0 }; i < csize<int>(bPipelines); ++i) {
@@ -111,9 +190,35 @@ void Benchmark::ProcessGUI(State& state)
         ImGui::TableHeadersRow();
 
         printConfigValue("b. volume", "%s", to_string(bPipelines[bShowPreview].plocpp.bv).c_str());
-        printConfigValue("s. filling", "%s", "morton32");
+        printConfigValue("s. filling", "%s", to_string(bPipelines[bShowPreview].plocpp.sfc).c_str());
         printConfigValue("i. clusts", "%s", to_string(bPipelines[bShowPreview].plocpp.ic).c_str());
         printConfigValue("radius", "%u", bPipelines[bShowPreview].plocpp.radius);
+        if (bPipelines[bShowPreview].plocpp.radiusSchedule != backend::config::RadiusSchedule::eFixed) {
+            printConfigValue("radius schedule", "%s", to_string(bPipelines[bShowPreview].plocpp.radiusSchedule).c_str());
+            printConfigValue("radius min", "%u", bPipelines[bShowPreview].plocpp.radiusMin);
+            if (bPipelines[bShowPreview].plocpp.radiusSchedule == backend::config::RadiusSchedule::eLinear)
+                printConfigValue("radius step", "%u", bPipelines[bShowPreview].plocpp.radiusStep);
+        }
+        if (bPipelines[bShowPreview].plocpp.ic == backend::config::InitialClusters::eTriangleSplits)
+            printConfigValue("split budget", "%.2f", bPipelines[bShowPreview].plocpp.splitBudget);
+        if (bPipelines[bShowPreview].plocpp.workgroupSize > 0)
+            printConfigValue("wg size", "%u", bPipelines[bShowPreview].plocpp.workgroupSize);
+
+        ImGui::EndTable();
+    }
+    if (bPipelines[bShowPreview].restructuring.bv != backend::config::BV::eNone && ImGui::BeginTable("##preview restructuring", 1, tableFlags)) {
+        ImGui::TableSetupColumn("Restructuring", ImGuiTableColumnFlags_NoHide);
+        ImGui::TableHeadersRow();
+
+        printConfigValue("method", "%s", to_string(bPipelines[bShowPreview].restructuring.method).c_str());
+        printConfigValue("score volume", "%s", to_string(bPipelines[bShowPreview].restructuring.bv).c_str());
+        printConfigValue("iterations", "%u", bPipelines[bShowPreview].restructuring.iterations);
+        if (bPipelines[bShowPreview].restructuring.method == backend::config::RestructuringMethod::eTreelet) {
+            printConfigValue("treelet size", "%u", bPipelines[bShowPreview].restructuring.treeletSize);
+            printConfigValue("c_t", "%.1f", bPipelines[bShowPreview].restructuring.c_t);
+            printConfigValue("c_i", "%.1f", bPipelines[bShowPreview].restructuring.c_i);
+        } else
+            printConfigValue("min ratio", "%.4f", bPipelines[bShowPreview].restructuring.minReinsertionRatio);
 
         ImGui::EndTable();
     }
@@ -123,6 +228,7 @@ void Benchmark::ProcessGUI(State& state)
 
         printConfigValue("b. volume", "%s", to_string(bPipelines[bShowPreview].collapsing.bv).c_str());
         printConfigValue("max leaf size", "%u", bPipelines[bShowPreview].collapsing.maxLeafSize);
+        printConfigValue("triangles", "%s", to_string(bPipelines[bShowPreview].collapsing.triangles).c_str());
         printConfigValue("c_t", "%.1f", bPipelines[bShowPreview].collapsing.c_t);
         printConfigValue("c_i", "%.1f", bPipelines[bShowPreview].collapsing.c_i);
 
@@ -133,6 +239,13 @@ void Benchmark::ProcessGUI(State& state)
         ImGui::TableHeadersRow();
 
         printConfigValue("b. volume", "%s", to_string(bPipelines[bShowPreview].transformation.bv).c_str());
+        if (bPipelines[bShowPreview].transformation.bv == backend::config::BV::eHybrid_i32)
+            printConfigValue("sobb cost", "%.2f", bPipelines[bShowPreview].transformation.sobbCostRatio);
+        if (bPipelines[bShowPreview].transformation.bv >= backend::config::BV::eSOBB_d32) {
+            printConfigValue("sobb fit", "%s", to_string(bPipelines[bShowPreview].transformation.sobbFit).c_str());
+            if (bPipelines[bShowPreview].transformation.sobbFit == backend::config::SOBBFit::ePruned)
+                printConfigValue("candidates", "%u", bPipelines[bShowPreview].transformation.sobbCandidates);
+        }
 
         ImGui::EndTable();
     }
@@ -154,6 +267,15 @@ void Benchmark::ProcessGUI(State& state)
         printConfigValue("#p warps per wg", "%u", bPipelines[bShowPreview].tracer.rPrimary.warpsPerWorkgroup);
         printConfigValue("#s wg", "%u", bPipelines[bShowPreview].tracer.rSecondary.workgroupCount);
         printConfigValue("#s warps per wg", "%u", bPipelines[bShowPreview].tracer.rSecondary.warpsPerWorkgroup);
+        if (bPipelines[bShowPreview].tracer.reordering.enabled)
+            printConfigValue("#s reordered from", "%u", bPipelines[bShowPreview].tracer.reordering.minRayCount);
+        else
+            printConfigValue("#s reordered", "%s", "no");
+        printConfigValue("shadow rays", "%s", bPipelines[bShowPreview].tracer.shadowRays ? "yes" : "no");
+        if (bPipelines[bShowPreview].tracer.validateShortStack > 0)
+            printConfigValue("short stack validated", "%u", bPipelines[bShowPreview].tracer.validateShortStack);
+        if (bPipelines[bShowPreview].tracer.shortStack)
+            printConfigValue("short stack", "%s", "yes");
 
         ImGui::EndTable();
     }
@@ -164,6 +286,7 @@ void Benchmark::ProcessGUI(State& state)
         // printConfigValue("b. volume", "%s", to_string(bPipelines[bShowPreview].stats.bv).c_str());
         printConfigValue("c_t", "%.1f", bPipelines[bShowPreview].stats.c_t);
         printConfigValue("c_i", "%.1f", bPipelines[bShowPreview].stats.c_i);
+        printConfigValue("submission", "%s", bPipelines[bShowPreview].singleSubmission ? "single" : "per stage");
 
         ImGui::EndTable();
     }
@@ -293,12 +293,15 @@ void SceneRenderer::guiPathTracerCompute()
     if (ImGui::TreeNodeEx("BVH stats", ImGuiTreeNodeFlags_DefaultOpen)) {
         static f32 pMRps { 0.f };
         static f32 sMRps { 0.f };
+        static f32 shMRps { 0.f };
         static f32 buildTime { 0.f };
 
         static u64 pRayCount { 0 };
         static f32 pTraceTimeMs { 0.f };
         static u64 sRayCount { 0 };
         static f32 sTraceTimeMs { 0.f };
+        static u64 shRayCount { 0 };
+        static f32 shTraceTimeMs { 0.f };
 
         static std::array<f32, 7> sMRps_perLevel {};
         static std::array<u64, 7> sRayCount_perLevel {};
@@ -315,6 +318,10 @@ void SceneRenderer::guiPathTracerCompute()
             sRayCount_perLevel[i - 1] += tStats.data[i].rayCount;
             sTraceTimeMs_perLevel[i - 1] += tStats.data[i].traceTimeMs;
         }
+        for (auto const& sh : tStats.shadow) {
+            shRayCount += sh.rayCount;
+            shTraceTimeMs += sh.traceTimeMs;
+        }
         if (backend.state.oncePer250ms) {
             pMRps = (static_cast<f32>(pRayCount) * 1e-6f) / (pTraceTimeMs * 1e-3f);
             sMRps = (static_cast<f32>(sRayCount) * 1e-6f) / (sTraceTimeMs * 1e-3f);
@@ -322,6 +329,9 @@ void SceneRenderer::guiPathTracerCompute()
             pTraceTimeMs = 0.f;
             sRayCount = 0;
             sTraceTimeMs = 0.f;
+            shMRps = shRayCount > 0 ? (static_cast<f32>(shRayCount) * 1e-6f) / (shTraceTimeMs * 1e-3f) : 0.f;
+            shRayCount = 0;
+            shTraceTimeMs = 0.f;
 
             for (int i = 0; i < 7; i++) {
                 sMRps_perLevel[i] = (static_cast<f32>(sRayCount_perLevel[i]) * 1e-6f) / (sTraceTimeMs_perLevel[i] * 1e-3f);
@@ -329,7 +339,7 @@ void SceneRenderer::guiPathTracerCompute()
                 sTraceTimeMs_perLevel[i] = 0.f;
             }
         }
-        buildTime = bStats.plocpp.timeTotal + bStats.collapsing.timeTotal + bStats.transformation.timeTotal + bStats.rearrangement.timeTotal;
+        buildTime = bStats.plocpp.timeTotal + bStats.restructuring.timeTotal + bStats.collapsing.timeTotal + bStats.transformation.timeTotal + bStats.rearrangement.timeTotal;
 
         ImGui::Text("    Primary:  ~%s Mrps", fmt::format("{:>8.2f}", pMRps).c_str());
         ImGui::Text("  Secondary:  ~%s Mrps", fmt::format("{:>8.2f}", sMRps).c_str());
@@ -338,11 +348,15 @@ void SceneRenderer::guiPathTracerCompute()
                 ImGui::Text("     Sec. %d:  ~%s Mrps", i, fmt::format("{:>8.2f}", sMRps_perLevel[i]).c_str());
             ImGui::TreePop();
         }
+        if (shMRps > 0.f)
+            ImGui::Text("     Shadow:  ~%s Mrps", fmt::format("{:>8.2f}", shMRps).c_str());
         ImGui::Separator();
         ImGui::Text("  Full #Nodes:    %s", fmt::format("{:14L}", bStats.plocpp.nodeCountTotal).c_str());
         ImGui::Text("  Full area rel. i:      %s", fmt::format("{:>8.2f}", bStats.plocpp.saIntersect).c_str());
         ImGui::Text("  Full area rel. t:      %s", fmt::format("{:>8.2f}", bStats.plocpp.saTraverse).c_str());
         ImGui::Text("  Full SAH cost:        %s", fmt::format("{:>8.2f}", bStats.plocpp.costTotal).c_str());
+        if (bStats.restructuring.timeTotal > 0.f)
+            ImGui::Text("  Restructured SAH cost: %s", fmt::format("{:>7.2f}", bStats.restructuring.costTotal).c_str());
         ImGui::Separator();
         ImGui::Text("  Collapsed #N:   %s", fmt::format("{:14L}", bStats.collapsing.nodeCountTotal).c_str());
         ImGui::Text("  Collapsed area rel. i: %s", fmt::format("{:>8.2f}", bStats.collapsing.saIntersect).c_str());
@@ -360,6 +374,8 @@ void SceneRenderer::guiPathTracerCompute()
         ImGui::Text("  Arranged area rel. i: %s", fmt::format("{:>8.2f}", bStats.rearrangement.saIntersect).c_str());
         ImGui::Text("  Arranged area rel. t: %s", fmt::format("{:>8.2f}", bStats.rearrangement.saTraverse).c_str());
         ImGui::Text("  Arranged SAH cost:   %s", fmt::format("{:>8.2f}", bStats.rearrangement.costTotal).c_str());
+        if (bStats.rearrangement.childCountAABB > 0)
+            ImGui::Text("  Arranged #AABB:  %s", fmt::format("{:13L}", bStats.rearrangement.childCountAABB).c_str());
         ImGui::Separator();
         ImGui::Text("  Construction GPU: %s ms", fmt::format("{:>8.2f}", buildTime).c_str());
 
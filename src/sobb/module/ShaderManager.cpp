@@ -1,6 +1,7 @@
 #include "ShaderManager.h"
 
 #include <berries/lib_helper/spdlog.h>
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
@@ -8,6 +9,12 @@
 #include <ranges>
 #include <shared_mutex>
 #include <string_view>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 namespace module {
 namespace fs = std::filesystem;
@@ -15,22 +22,68 @@ namespace fs = std::filesystem;
 struct ShaderManager::Impl {
 private:
     std::filesystem::path shaders;
+    std::filesystem::path cache;
     struct TrackedFile {
         std::string name;
         fs::path path;
         fs::file_time_type timestamp;
+        // changes of files in directories that could not be watched are found by polling
+        bool watched { false };
         std::function<void(std::string_view, std::vector<u32>)> onChangeCallback;
     };
     std::vector<TrackedFile> trackedFiles;
-    std::shared_mutex trackedFilesMutex;
+    mutable std::shared_mutex trackedFilesMutex;
+
+#ifdef __linux__
+    // directories are watched instead of files, shader compilers often replace the file by a rename
+    int inotifyFd { -1 };
+    std::unordered_map<int, fs::path> watchedDirs;
+
+    [[nodiscard]] bool watchDirectory(fs::path const& dir)
+    {
+        if (inotifyFd < 0)
+            return false;
+        for (auto const& [wd, path] : watchedDirs)
+            if (path == dir)
+                return true;
+        if (auto const wd { inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) }; wd >= 0) {
+            watchedDirs[wd] = dir;
+            return true;
+        }
+        berry::log::warn("Failed to watch '{}', its files are polled.", dir.generic_string());
+        return false;
+    }
+
+    // returns false when events are not available and all files have to be polled
+    [[nodiscard]] bool readChangedFiles(std::vector<fs::path>& changed)
+    {
+        if (inotifyFd < 0)
+            return false;
+
+        alignas(inotify_event) char buffer[4096];
+        while (true) {
+            auto const len { read(inotifyFd, buffer, sizeof(buffer)) };
+            if (len <= 0)
+                break;
+            for (char* ptr { buffer }; ptr < buffer + len;) {
+                auto const* event { reinterpret_cast<inotify_event const*>(ptr) };
+                if (event->mask & IN_Q_OVERFLOW)
+                    return false;
+                if (auto const dir { watchedDirs.find(event->wd) }; dir != watchedDirs.end() && event->len > 0)
+                    changed.push_back(dir->second / event->name);
+                ptr += sizeof(inotify_event) + event->len;
+            }
+        }
+        return true;
+    }
+#endif
 
     void fastRemove(fs::path const& path)
     {
+        std::unique_lock lock { trackedFilesMutex };
         if (trackedFiles.empty())
             return;
 
-        std::unique_lock lock { trackedFilesMutex };
-
         auto it = std::ranges::find_if(trackedFiles, [&path](auto const& file) {
             return path == file.path;
         });
@@ -78,7 +131,36 @@ private:
 public:
     Impl(std::filesystem::path const& pRes)
         : shaders(pRes / "shaders")
+        , cache(pRes / "cache")
+    {
+#ifdef __linux__
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd < 0)
+            berry::log::warn("inotify not available, shader hot reload falls back to polling.");
+#endif
+    }
+
+    ~Impl()
     {
+#ifdef __linux__
+        if (inotifyFd >= 0)
+            close(inotifyFd);
+#endif
+    }
+
+    [[nodiscard]] bool IsEventDriven() const
+    {
+#ifdef __linux__
+        std::shared_lock lock { trackedFilesMutex };
+        return inotifyFd >= 0 && std::ranges::all_of(trackedFiles, &TrackedFile::watched);
+#else
+        return false;
+#endif
+    }
+
+    [[nodiscard]] fs::path const& CacheDirectory() const
+    {
+        return cache;
     }
 
     void Load(std::string_view name, std::vector<u32>& data, std::function<void(std::string_view, std::vector<u32>)> onChangeCallback)
@@ -93,35 +175,59 @@ public:
         data = readSpv(path);
 
         std::unique_lock lock { trackedFilesMutex };
+#ifdef __linux__
+        auto const watched { watchDirectory(path.parent_path()) };
+#else
+        auto const watched { false };
+#endif
         trackedFiles.push_back({
             .name = std::string(name),
             .path = path,
             .timestamp = fs::last_write_time(path),
+            .watched = watched,
             .onChangeCallback = std::move(onChangeCallback),
         });
         berry::log::debug("Now tracking '{}'.", path.generic_string());
     }
 
-    void Unload(fs::path const& path)
+    void Unload(std::string_view name)
     {
+        fs::path path { name };
+        if (path.is_relative())
+            path = shaders / path;
+
         fastRemove(path);
         berry::log::debug("Stopped tracking '{}'.", path.generic_string());
     }
 
     void CheckForHotReload()
     {
-        std::shared_lock lock { trackedFilesMutex };
-        for (auto& f : trackedFiles) {
-            if (!validate(f.path))
-                continue;
+        // reload() updates the timestamps of the tracked files
+        std::unique_lock lock { trackedFilesMutex };
+#ifdef __linux__
+        if (std::vector<fs::path> changed; readChangedFiles(changed)) {
+            for (auto& f : trackedFiles)
+                if (!f.watched || std::ranges::find(changed, f.path) != changed.end())
+                    reload(f);
+            return;
+        }
+#endif
+        for (auto& f : trackedFiles)
+            reload(f);
+    }
 
-            if (auto const tsNow = fs::last_write_time(f.path); tsNow > f.timestamp) {
-                berry::log::debug("File '{}' changed at {}.", f.path.generic_string(), std::format("{}", std::chrono::floor<std::chrono::seconds>(tsNow)));
+private:
+    void reload(TrackedFile& f)
+    {
+        if (!validate(f.path))
+            return;
 
-                if (f.onChangeCallback)
-                    f.onChangeCallback(f.name, readSpv(f.path));
-                f.timestamp = tsNow;
-            }
+        if (auto const tsNow = fs::last_write_time(f.path); tsNow > f.timestamp) {
+            berry::log::debug("File '{}' changed at {}.", f.path.generic_string(), std::format("{}", std::chrono::floor<std::chrono::seconds>(tsNow)));
+
+            if (f.onChangeCallback)
+                f.onChangeCallback(f.name, readSpv(f.path));
+            f.timestamp = tsNow;
         }
     }
 };
@@ -135,5 +241,7 @@ ShaderManager::~ShaderManager() = default;
 void ShaderManager::Load(std::string_view name, std::vector<u32>& data, std::function<void(std::string_view, std::vector<u32>)> onChangeCallback) { impl->Load(name, data, onChangeCallback); }
 void ShaderManager::Unload(std::string_view name) { impl->Unload(name); }
 void ShaderManager::CheckForHotReload() { impl->CheckForHotReload(); }
+bool ShaderManager::IsEventDriven() const { return impl->IsEventDriven(); }
+std::filesystem::path ShaderManager::CacheDirectory() const { return impl->CacheDirectory(); }
 
 }
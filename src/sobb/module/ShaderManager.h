@@ -17,6 +17,11 @@ public:
     void Load(std::string_view name, std::vector<u32>& data, std::function<void(std::string_view, std::vector<u32>)> onChangeCallback);
     void Unload(std::string_view name);
     void CheckForHotReload();
+    // changes are reported by the OS, checking is cheap enough to run every frame
+    [[nodiscard]] bool IsEventDriven() const;
+
+    // location of persistent pipeline and reflection caches
+    [[nodiscard]] std::filesystem::path CacheDirectory() const;
 };
 
 }
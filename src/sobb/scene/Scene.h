@@ -85,6 +85,8 @@ struct HostScene {
     std::vector<Geometry> geometries;
     std::vector<Node> nodes;
     u32 triangleCount { 0 };
+    // hash of the serialized scene, 0 for scenes imported from other formats
+    u64 contentHash { 0 };
 
     struct {
         bool transformation { true };
@@ -2,8 +2,10 @@
 
 #include <fstream>
 
+#include <berries/util/Hash.h>
 #include <berries/util/types.h>
 #include <berries/lib_helper/spdlog.h>
+#include <vector>
 
 template<typename T>
 inline static void write(std::ofstream& file, T const& data)
@@ -157,4 +159,19 @@ HostScene deserialize(std::filesystem::path const& path)
     return result;
 }
 
+u64 contentHash(std::filesystem::path const& path)
+{
+    std::ifstream file { path, std::ios::binary };
+    if (!file.is_open())
+        return 0;
+
+    berry::Fnv1a hash;
+    std::vector<u8> chunk(1 << 20);
+    while (file) {
+        file.read(reinterpret_cast<char*>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+        hash.Add(std::span<u8 const> { chunk.data(), static_cast<size_t>(file.gcount()) });
+    }
+    return hash.Get();
+}
+
 }
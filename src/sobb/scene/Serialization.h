@@ -7,5 +7,7 @@ namespace scene {
 
 void serialize(HostScene const& scene, std::filesystem::path const& dir);
 HostScene deserialize(std::filesystem::path const& path);
+// hash of the serialized scene file contents, 0 if the file cannot be read
+u64 contentHash(std::filesystem::path const& path);
 
 }
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "types.h"
+
+#include <span>
+#include <string_view>
+#include <type_traits>
+
+namespace berry {
+
+// incremental 64-bit FNV-1a, used to address on-disk caches by content
+class Fnv1a {
+    static constexpr u64 OFFSET_BASIS { 14695981039346656037ull };
+    static constexpr u64 PRIME { 1099511628211ull };
+
+    u64 value { OFFSET_BASIS };
+
+public:
+    constexpr Fnv1a& Add(std::span<u8 const> bytes)
+    {
+        for (auto const b : bytes) {
+            value ^= b;
+            value *= PRIME;
+        }
+        return *this;
+    }
+
+    Fnv1a& Add(std::string_view str)
+    {
+        Add(static_cast<u64>(str.size()));
+        return Add({ reinterpret_cast<u8 const*>(str.data()), str.size() });
+    }
+
+    template<typename T>
+        requires std::is_trivially_copyable_v<T>
+    Fnv1a& Add(T const& data)
+    {
+        return Add({ reinterpret_cast<u8 const*>(&data), sizeof(T) });
+    }
+
+    [[nodiscard]] constexpr u64 Get() const
+    {
+        return value;
+    }
+};
+
+}
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <format>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <ranges>
+#include <shared_mutex>
 #include <utility>
 #include <vLime/DebugUtils.h>
 #include <vLime/Flags.h>
@@ -204,6 +207,108 @@ public:
     }
 };
 
+// allocator guarded by a mutex, bindings may be freed from any thread
+template<typename A>
+class Synchronized final : public Allocator {
+    mutable std::mutex mutex;
+    A allocator;
+
+public:
+    template<typename... Args>
+    explicit Synchronized(Args&&... args)
+        : allocator(std::forward<Args>(args)...)
+    {
+    }
+
+    using Allocator::alloc;
+    std::optional<Chunk> alloc(vk::DeviceSize const _size, vk::DeviceSize const alignment = 1, bool const isLinear = true) override
+    {
+        std::scoped_lock lock { mutex };
+        return allocator.alloc(_size, alignment, isLinear);
+    }
+
+    void free(vk::DeviceSize chunkAddress) override
+    {
+        std::scoped_lock lock { mutex };
+        allocator.free(chunkAddress);
+    }
+
+    [[nodiscard]] bool canHold(vk::DeviceSize allocSize) const override
+    {
+        std::scoped_lock lock { mutex };
+        return allocator.canHold(allocSize);
+    }
+
+    void coalesce() override
+    {
+        std::scoped_lock lock { mutex };
+        allocator.coalesce();
+    }
+
+    void reset() override
+    {
+        std::scoped_lock lock { mutex };
+        allocator.reset();
+    }
+
+    [[nodiscard]] Dump dumpInternalState() const override
+    {
+        std::scoped_lock lock { mutex };
+        return allocator.dumpInternalState();
+    }
+};
+
+// first fit over the range [base, base + size), chunk addresses are absolute
+// base has to be aligned to every alignment requested from the suballocator
+class Suballocator final : public Allocator {
+    vk::DeviceSize base;
+    Synchronized<FirstFit> allocator;
+
+public:
+    Suballocator(vk::DeviceSize base, vk::DeviceSize size, vk::DeviceSize bufferImageGranularity = 1)
+        : base(base)
+        , allocator(size, bufferImageGranularity)
+    {
+    }
+
+    using Allocator::alloc;
+    std::optional<Chunk> alloc(vk::DeviceSize const _size, vk::DeviceSize const alignment = 1, bool const isLinear = true) override
+    {
+        auto chunk { allocator.alloc(_size, alignment, isLinear) };
+        if (chunk)
+            chunk->address += base;
+        return chunk;
+    }
+
+    void free(vk::DeviceSize chunkAddress) override
+    {
+        allocator.free(chunkAddress - base);
+    }
+
+    [[nodiscard]] bool canHold(vk::DeviceSize allocSize) const override
+    {
+        return allocator.canHold(allocSize);
+    }
+
+    void coalesce() override
+    {
+        allocator.coalesce();
+    }
+
+    void reset() override
+    {
+        allocator.reset();
+    }
+
+    [[nodiscard]] Dump dumpInternalState() const override
+    {
+        auto dump { allocator.dumpInternalState() };
+        for (auto& chunk : dump.chunks)
+            chunk.first.address += base;
+        return dump;
+    }
+};
+
 struct Binding {
     vk::DeviceMemory memory;
     vk::DeviceSize offset { 0 };
@@ -730,6 +835,57 @@ private:
 
     std::vector<std::vector<std::unique_ptr<DeviceMemory>>> deviceMemoryPerType;
 
+    // small allocations are served from per-thread slabs, so concurrent allocating threads
+    // do not contend on the shared device memory allocators
+    static constexpr vk::DeviceSize SMALL_ALLOCATION_LIMIT { 256 * 1024 };
+    static constexpr vk::DeviceSize SLAB_SIZE { 4 * MB };
+    static constexpr vk::DeviceSize SLAB_ALIGNMENT { 64 * 1024 };
+
+    struct Slab {
+        memory::Binding backing;
+        std::unique_ptr<memory::Suballocator> allocator;
+
+        Slab(memory::Binding const& backing, vk::DeviceSize bufferImageGranularity)
+            : backing(backing)
+            , allocator(std::make_unique<memory::Suballocator>(backing.offset, backing.size, bufferImageGranularity))
+        {
+        }
+
+        memory::Binding alloc(vk::MemoryRequirements const& req, vk::DeviceSize additionalAlignment)
+        {
+            memory::Binding binding;
+            if (auto const chunk { allocator->alloc(req, additionalAlignment) }) {
+                binding.memory = backing.memory;
+                binding.offset = chunk->address;
+                binding.size = chunk->size;
+                binding.mapping = backing.mapping ? static_cast<char*>(backing.mapping) + (chunk->address - backing.offset) : nullptr;
+                binding.allocator = allocator.get();
+            }
+            return binding;
+        }
+
+        [[nodiscard]] bool empty() const
+        {
+            return allocator->canHold(backing.size);
+        }
+    };
+
+    struct ThreadCache {
+        // locked by the owning thread on allocation and by cleanUp()
+        std::mutex mutex;
+        std::array<std::vector<Slab>, VK_MAX_MEMORY_TYPES> slabs;
+    };
+
+    struct Synchronization {
+        std::array<std::shared_mutex, VK_MAX_MEMORY_TYPES> perType;
+        std::mutex threadCaches;
+    };
+
+    inline static std::atomic<u64> instanceCounter { 0 };
+    u64 instanceId { instanceCounter++ };
+    std::unique_ptr<Synchronization> sync { std::make_unique<Synchronization>() };
+    std::vector<std::unique_ptr<ThreadCache>> threadCaches;
+
     class MemoryTypeIdCache {
     public:
         static constexpr u32 INVALID_MEMORY_ID { std::numeric_limits<u32>::max() };
@@ -830,7 +986,7 @@ public:
         , bufferImageGranularity(pd.getProperties().limits.bufferImageGranularity)
         , memoryTypeIdCache(*this)
     {
-        deviceMemoryPerType.reserve(properties.memoryTypeCount);
+        deviceMemoryPerType.resize(properties.memoryTypeCount);
     }
 
     [[nodiscard]] Buffer alloc(AllocRequirements const& allocRequirements, vk::BufferCreateInfo const& cInfo, char const* debugName = nullptr)
@@ -869,15 +1025,34 @@ public:
 
     [[nodiscard]] bool empty() const
     {
-        for (auto const& heap : deviceMemoryPerType)
-            if (!heap.empty())
+        for (u32 t { 0 }; t < deviceMemoryPerType.size(); t++) {
+            std::shared_lock lock { sync->perType[t] };
+            if (!deviceMemoryPerType[t].empty())
                 return false;
+        }
         return true;
     }
 
     void cleanUp()
     {
-        for (auto& heaps : deviceMemoryPerType) {
+        {
+            std::scoped_lock lock { sync->threadCaches };
+            for (auto& cache : threadCaches) {
+                std::scoped_lock cacheLock { cache->mutex };
+                for (auto& slabs : cache->slabs)
+                    std::erase_if(slabs, [](Slab& slab) {
+                        slab.allocator->coalesce();
+                        if (!slab.empty())
+                            return false;
+                        slab.backing.reset();
+                        return true;
+                    });
+            }
+        }
+
+        for (u32 t { 0 }; t < deviceMemoryPerType.size(); t++) {
+            std::unique_lock lock { sync->perType[t] };
+            auto& heaps { deviceMemoryPerType[t] };
             std::vector<u32> emptyAllocations;
             for (u32 i { 0 }; i < heaps.size(); i++) {
                 heaps[i]->CleanUp();
@@ -906,16 +1081,81 @@ private:
     memory::Binding getBackingMemory(AllocRequirements const& allocRequirements, vk::MemoryRequirements const& memoryRequirements)
     {
         auto const memoryTypeId { memoryTypeIdCache.GetMemoryTypes(allocRequirements.memoryUsage, memoryRequirements.memoryTypeBits)[0] };
-
-        if (deviceMemoryPerType.size() <= memoryTypeId)
-            deviceMemoryPerType.resize(memoryTypeId + 1);
+        if (memoryTypeId >= deviceMemoryPerType.size()) {
+            log::error(std::format("No suitable memory type for allocation of size {0}.", memoryRequirements.size));
+            return {};
+        }
 
         auto const dedicated { allocRequirements.allocFlags.checkFlags(AllocationFlagBits::eDedicated) };
-        // bind resource to one of existing allocations
-        if (!dedicated)
-            for (auto const& deviceMemory : deviceMemoryPerType[memoryTypeId])
-                if (auto binding { deviceMemory->alloc(memoryRequirements, allocRequirements.additionalAlignment) }; binding.isValid())
+        // alloc more memory if feasible
+        auto const pooled { !dedicated && (memoryTypeIdCache.haveResizableBar() || allocRequirements.memoryUsage != DeviceMemoryUsage::eHostToDeviceOptimal) };
+
+        if (pooled && isSmallAllocation(memoryRequirements, allocRequirements.additionalAlignment))
+            if (auto binding { allocSmall(memoryTypeId, memoryRequirements, allocRequirements.additionalAlignment) }; binding.isValid())
+                return binding;
+
+        return allocShared(memoryTypeId, memoryRequirements, allocRequirements.additionalAlignment, dedicated, pooled);
+    }
+
+    [[nodiscard]] static bool isSmallAllocation(vk::MemoryRequirements const& req, vk::DeviceSize additionalAlignment)
+    {
+        auto const alignment { additionalAlignment ? std::lcm(req.alignment, additionalAlignment) : req.alignment };
+        return req.size <= SMALL_ALLOCATION_LIMIT && SLAB_ALIGNMENT % alignment == 0;
+    }
+
+    ThreadCache& threadCache()
+    {
+        // keyed by instance id, so stale entries of destroyed managers are never matched
+        thread_local std::vector<std::pair<u64, ThreadCache*>> caches;
+        for (auto const& [id, cache] : caches)
+            if (id == instanceId)
+                return *cache;
+
+        std::scoped_lock lock { sync->threadCaches };
+        auto* cache { threadCaches.emplace_back(std::make_unique<ThreadCache>()).get() };
+        caches.emplace_back(instanceId, cache);
+        return *cache;
+    }
+
+    memory::Binding allocSmall(u32 memoryTypeId, vk::MemoryRequirements const& memoryRequirements, vk::DeviceSize additionalAlignment)
+    {
+        auto& cache { threadCache() };
+        std::scoped_lock lock { cache.mutex };
+
+        auto& slabs { cache.slabs[memoryTypeId] };
+        for (auto& slab : std::ranges::views::reverse(slabs))
+            if (auto binding { slab.alloc(memoryRequirements, additionalAlignment) }; binding.isValid())
+                return binding;
+
+        vk::MemoryRequirements const slabRequirements {
+            .size = SLAB_SIZE,
+            .alignment = SLAB_ALIGNMENT,
+            .memoryTypeBits = 1u << memoryTypeId,
+        };
+        auto const backing { allocShared(memoryTypeId, slabRequirements, 0, false, true) };
+        if (!backing.isValid())
+            return {};
+        return slabs.emplace_back(backing, bufferImageGranularity).alloc(memoryRequirements, additionalAlignment);
+    }
+
+    memory::Binding allocShared(u32 memoryTypeId, vk::MemoryRequirements const& memoryRequirements, vk::DeviceSize additionalAlignment, bool dedicated, bool pooled)
+    {
+        auto& heaps { deviceMemoryPerType[memoryTypeId] };
+        auto& mutex { sync->perType[memoryTypeId] };
+
+        auto const bindExisting = [&]() -> memory::Binding {
+            for (auto const& deviceMemory : heaps)
+                if (auto binding { deviceMemory->alloc(memoryRequirements, additionalAlignment) }; binding.isValid())
                     return binding;
+            return {};
+        };
+
+        // bind resource to one of existing allocations
+        if (!dedicated) {
+            std::shared_lock lock { mutex };
+            if (auto binding { bindExisting() }; binding.isValid())
+                return binding;
+        }
 
         vk::MemoryAllocateFlagsInfo allocFlags;
         if (features.bufferDeviceAddress)
@@ -926,12 +1166,17 @@ private:
             .allocationSize = memoryRequirements.size,
             .memoryTypeIndex = memoryTypeId,
         };
-        // alloc more memory if feasible
-        if (!dedicated && (memoryTypeIdCache.haveResizableBar() || allocRequirements.memoryUsage != DeviceMemoryUsage::eHostToDeviceOptimal))
+        if (pooled)
             allocInfo.allocationSize = std::max(memoryRequirements.size, 256 * MB);
 
-        auto& deviceMemory { deviceMemoryPerType[memoryTypeId].emplace_back(std::make_unique<DeviceMemory>(*this, allocInfo, bufferImageGranularity)) };
-        if (auto binding { deviceMemory->alloc(memoryRequirements, allocRequirements.additionalAlignment) }; binding.isValid())
+        std::unique_lock lock { mutex };
+        // another thread might have added an allocation in the meantime
+        if (!dedicated)
+            if (auto binding { bindExisting() }; binding.isValid())
+                return binding;
+
+        auto& deviceMemory { heaps.emplace_back(std::make_unique<DeviceMemory>(*this, allocInfo, bufferImageGranularity)) };
+        if (auto binding { deviceMemory->alloc(memoryRequirements, additionalAlignment) }; binding.isValid())
             return binding;
 
         log::error(std::format("Failed to allocate memory of size {0} for memory type {1}.", memoryRequirements.size, memoryTypeId));
@@ -952,7 +1197,7 @@ private:
         DeviceMemory(MemoryManager const& memMan, vk::MemoryAllocateInfo const allocInfo, vk::DeviceSize bufferImageGranularity)
             : d(memMan.d)
             , size(allocInfo.allocationSize)
-            , allocator(std::make_unique<memory::FirstFit>(size, bufferImageGranularity))
+            , allocator(std::make_unique<memory::Synchronized<memory::FirstFit>>(size, bufferImageGranularity))
         {
             memory = check(d.allocateMemoryUnique(allocInfo));
             if (memMan.checkHostVisibility(allocInfo.memoryTypeIndex))
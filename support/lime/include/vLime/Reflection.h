@@ -1,6 +1,8 @@
 #pragma once
 
+#include <filesystem>
 #include <functional>
+#include <mutex>
 #include <string_view>
 #include <unordered_map>
 #include <vLime/PipelineBuilder.h>
@@ -12,6 +14,8 @@
 
 namespace lime {
 
+class ReflectionCache;
+
 struct Shader {
     struct LayoutReflection {
         std::vector<std::pair<u32, vk::DescriptorSetLayoutBinding>> bindings;
@@ -22,11 +26,13 @@ struct Shader {
     vk::UniqueShaderModule module;
     LayoutReflection layoutReflection;
     u32 version { 0 };
+    // hash of the SPIR-V the module was created from
+    u64 spvHash { 0 };
 
-    Shader(vk::Device d, vk::ShaderStageFlagBits stage, std::vector<u32> const& spv)
+    Shader(vk::Device d, vk::ShaderStageFlagBits stage, std::vector<u32> const& spv, ReflectionCache* reflectionCache = nullptr)
         : stage(stage)
     {
-        Update(d, spv);
+        Update(d, spv, reflectionCache);
     }
 
     [[nodiscard]] vk::PipelineShaderStageCreateInfo GetStageCreateInfo(char const* entryPoint = "main") const
@@ -38,25 +44,47 @@ struct Shader {
         };
     }
 
-    void Update(vk::Device d, std::vector<u32> const& spv)
-    {
-        layoutReflection = reflect(spv, stage);
-        vk::ShaderModuleCreateInfo cInfo {
-            .codeSize = spv.size() * sizeof(u32),
-            .pCode = spv.data()
-        };
-        module = check(d.createShaderModuleUnique(cInfo));
-        version++;
-    }
+    void Update(vk::Device d, std::vector<u32> const& spv, ReflectionCache* reflectionCache = nullptr);
 
 private:
     Shader::LayoutReflection reflect(std::vector<u32> spv, vk::ShaderStageFlagBits shaderStage);
 };
 
+// reflected layouts keyed by hash of SPIR-V and shader stage, skips spirv-cross for unchanged shaders
+class ReflectionCache {
+    std::unordered_map<u64, Shader::LayoutReflection> cache;
+    bool changed { false };
+
+public:
+    [[nodiscard]] static u64 Key(std::vector<u32> const& spv, vk::ShaderStageFlagBits stage);
+
+    [[nodiscard]] Shader::LayoutReflection const* Find(u64 key) const
+    {
+        auto const it { cache.find(key) };
+        return it != cache.cend() ? &it->second : nullptr;
+    }
+
+    void Insert(u64 key, Shader::LayoutReflection const& layoutReflection)
+    {
+        cache.insert_or_assign(key, layoutReflection);
+        changed = true;
+    }
+
+    bool Load(std::filesystem::path const& path);
+    void Save(std::filesystem::path const& path);
+};
+
 class ShaderCache {
     vk::Device d;
     vk::UniquePipelineCache pCache;
     std::unordered_map<std::string, Shader> cache;
+    // pipelines may be created from multiple threads, the vk::PipelineCache itself is internally synchronized
+    mutable std::mutex cacheMutex;
+
+    // pipeline and reflection caches persist between runs once a cache directory is set
+    std::filesystem::path persistentCacheDir;
+    vk::PhysicalDeviceProperties pdProperties;
+    ReflectionCache reflectionCache;
 
     std::function<void(std::string_view, std::vector<u32>&, std::function<void(std::string_view, std::vector<u32>)>)> spvLoadFunc;
     std::function<void(std::string_view)> spvUnloadFunc;
@@ -72,9 +100,18 @@ public:
         , spvUnloadFunc(std::move(spvUnloadFunc))
     {
     }
+    ~ShaderCache();
+    ShaderCache(ShaderCache const&) = delete;
+    ShaderCache& operator=(ShaderCache const&) = delete;
+
+    // Loads the pipeline cache of the device and the reflection cache from dir. Must be
+    // called before the first pipeline is created, both caches are saved on destruction.
+    void EnablePersistentCache(vk::PhysicalDevice pd, std::filesystem::path const& dir);
+    void SavePersistentCache();
 
     [[nodiscard]] vk::PipelineShaderStageCreateInfo getShaderCreateInfo(std::string_view shaderName, char const* entryPoint = "main") const
     {
+        std::scoped_lock lock { cacheMutex };
         std::string key { shaderName };
         if (auto const m { cache.find(key) }; m != cache.cend())
             return m->second.GetStageCreateInfo(entryPoint);
@@ -89,32 +126,54 @@ public:
     Shader const& LoadShader(std::string_view shaderName)
     {
         std::string key { shaderName };
-        if (auto const it { cache.find(key) }; it != cache.cend())
-            return it->second;
-
+        {
+            std::scoped_lock lock { cacheMutex };
+            if (auto const it { cache.find(key) }; it != cache.cend())
+                return it->second;
+        }
+
+        // The loader takes its own lock and calls the change callback under it, the callback then takes
+        // cacheMutex. Loading with cacheMutex held would take the two locks in the opposite order.
         std::vector<u32> spv;
         spvLoadFunc(shaderName, spv, [this](auto name, auto spv) {
+            std::scoped_lock lock { cacheMutex };
             std::string key { name };
             spvUpdate[key] = std::move(spv);
         });
-        auto const c = cache.insert_or_assign(key, Shader { d, stageFlagFromFileName(shaderName), spv });
-        return c.first->second;
+
+        {
+            std::scoped_lock lock { cacheMutex };
+            if (auto const it { cache.find(key) }; it == cache.cend()) {
+                auto const c = cache.insert_or_assign(key, Shader { d, stageFlagFromFileName(shaderName), spv, &reflectionCache });
+                return c.first->second;
+            }
+        }
+        // loaded by another thread meanwhile, keep a single tracked copy
+        spvUnloadFunc(shaderName);
+        std::scoped_lock lock { cacheMutex };
+        return cache.at(key);
     }
 
     bool CheckForHotReload()
     {
+        std::scoped_lock lock { cacheMutex };
         bool result { !spvUpdate.empty() };
         for (auto& [name, spv] : spvUpdate)
-            cache.at(name).Update(d, spv);
+            if (auto const it { cache.find(name) }; it != cache.end())
+                it->second.Update(d, spv, &reflectionCache);
         spvUpdate.clear();
         return result;
     }
 
 private:
-    [[nodiscard]] vk::UniquePipelineCache createPipelineCache() const
+    [[nodiscard]] vk::UniquePipelineCache createPipelineCache(std::vector<u8> const& initialData = {}) const
     {
-        return check(d.createPipelineCacheUnique({}));
+        return check(d.createPipelineCacheUnique({
+            .initialDataSize = initialData.size(),
+            .pInitialData = initialData.data(),
+        }));
     }
+    [[nodiscard]] std::filesystem::path pipelineCachePath() const;
     [[nodiscard]] vk::ShaderStageFlagBits stageFlagFromFileName(std::string_view name);
 };
 
@@ -3,6 +3,9 @@
 #include <vLime/Memory.h>
 #include <vLime/Queues.h>
 
+#include <span>
+#include <vector>
+
 namespace type_utils {
 
 template<typename Test>
@@ -58,6 +61,27 @@ public:
             stageToDeviceSync(srcPtr, dst, size);
     }
 
+    struct BufferUpload {
+        void const* src { nullptr };
+        size_t size { 0 };
+        Buffer::Detail dst;
+    };
+
+    // uploads are packed to the staging buffer and copied with one submission per filled staging buffer
+    void ToDeviceSync(std::span<BufferUpload const> uploads)
+    {
+        std::vector<BufferUpload> staged;
+        for (auto const& u : uploads) {
+            assert(u.size <= u.dst.getSizeInBytes());
+            if (auto const mapping = u.dst.getMapping(); mapping != nullptr)
+                memcpy(static_cast<char*>(mapping), u.src, u.size);
+            else if (u.size > 0)
+                staged.push_back(u);
+        }
+        if (!staged.empty())
+            stagingBuffer->stageToDeviceSync(staged);
+    }
+
     template<typename Resource>
     void StageToDeviceSync(void const* srcPtr, size_t size, Resource& dst)
     {
@@ -65,6 +89,13 @@ public:
         stageToDeviceSync(srcPtr, dst, size);
     }
 
+    // records device side work, e.g. buffer to buffer copies, submits it and waits for it to finish
+    template<typename Record>
+    void SubmitSync(Record&& record)
+    {
+        stagingBuffer->submitSync(std::forward<Record>(record));
+    }
+
     // inlining to explicit cmdBuffer works only when the data fits to staging buffer
     // returns true if staging occured, consumer should sync explicitely
     template<typename HostData, typename Resource>
@@ -188,6 +219,26 @@ private:
             fence = FenceFactory(d, vk::FenceCreateFlagBits::eSignaled);
         }
 
+        template<typename Record>
+        void submitSync(Record&& record)
+        {
+            commandBuffer.reset(vk::CommandBufferResetFlags());
+
+            vk::CommandBufferBeginInfo beginInfo;
+            beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+            check(commandBuffer.begin(&beginInfo));
+            record(commandBuffer);
+            check(commandBuffer.end());
+
+            vk::SubmitInfo submitInfo;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &commandBuffer;
+
+            check(d.resetFences(1, &fence.get()));
+            check(queue.submit(1, &submitInfo, fence.get()));
+            check(d.waitForFences(1, &fence.get(), vk::True, std::numeric_limits<u64>::max()));
+        }
+
         template<typename Resource>
         void stageToDeviceSync(void const* src, Resource& dst, std::size_t size)
         {
@@ -241,6 +292,52 @@ private:
             }
         }
 
+        void stageToDeviceSync(std::span<BufferUpload const> uploads)
+        {
+            vk::DeviceSize stagingOffset = 0;
+            bool recording = false;
+
+            auto const submit = [&]() {
+                check(commandBuffer.end());
+
+                vk::SubmitInfo submitInfo;
+                submitInfo.commandBufferCount = 1;
+                submitInfo.pCommandBuffers = &commandBuffer;
+
+                check(d.resetFences(1, &fence.get()));
+                check(queue.submit(1, &submitInfo, fence.get()));
+                check(d.waitForFences(1, &fence.get(), vk::True, std::numeric_limits<u64>::max()));
+
+                stagingOffset = 0;
+                recording = false;
+            };
+
+            for (auto const& u : uploads) {
+                vk::DeviceSize dataOffset = 0;
+                while (dataOffset < u.size) {
+                    if (stagingOffset == STAGING_BUFFER_SIZE)
+                        submit();
+                    if (!recording) {
+                        commandBuffer.reset(vk::CommandBufferResetFlags());
+
+                        vk::CommandBufferBeginInfo beginInfo;
+                        beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+                        check(commandBuffer.begin(&beginInfo));
+                        recording = true;
+                    }
+
+                    auto const sizeToTransfer = std::min(STAGING_BUFFER_SIZE - stagingOffset, u.size - dataOffset);
+                    memcpy(static_cast<char*>(stagingBuffer.getMapping()) + stagingOffset, static_cast<char const*>(u.src) + dataOffset, sizeToTransfer);
+                    u.dst.CopyBufferToMe(commandBuffer, { stagingBuffer.get(), stagingOffset, sizeToTransfer, nullptr }, dataOffset);
+
+                    stagingOffset = std::min(memory::align(stagingOffset + sizeToTransfer, 16), STAGING_BUFFER_SIZE);
+                    dataOffset += sizeToTransfer;
+                }
+            }
+            if (recording)
+                submit();
+        }
+
         template<typename Resource>
         void stageToDevice(void const* src, Resource& dst, std::size_t size, vk::CommandBuffer commandBuffer)
         {
@@ -1,11 +1,164 @@
 #include "../include/vLime/Reflection.h"
 
+#include <berries/util/Hash.h>
 #include <spirv_common.hpp>
 #include <spirv_reflect.hpp>
 #include <vLime/Util.h>
 
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <span>
+
 namespace lime {
 
+namespace {
+
+u64 hashBytes(std::span<u8 const> bytes)
+{
+    return berry::Fnv1a {}.Add(bytes).Get();
+}
+
+template<typename T>
+void write(std::ofstream& file, T const& value)
+{
+    file.write(reinterpret_cast<char const*>(&value), sizeof(T));
+}
+
+template<typename T>
+T read(std::ifstream& file)
+{
+    T value {};
+    file.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return value;
+}
+
+// reflection cache entries are serialized to memory first, the header hashes the whole payload
+template<typename T>
+void append(std::vector<u8>& data, T const& value)
+{
+    auto const* bytes { reinterpret_cast<u8 const*>(&value) };
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+class PayloadReader {
+    std::span<u8 const> data;
+    size_t offset { 0 };
+    bool valid { true };
+
+public:
+    explicit PayloadReader(std::span<u8 const> data)
+        : data(data)
+    {
+    }
+
+    template<typename T>
+    T read()
+    {
+        T value {};
+        if (!valid || data.size() - offset < sizeof(T)) {
+            valid = false;
+            return value;
+        }
+        std::memcpy(&value, data.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return value;
+    }
+
+    // guards the element counts read from the payload before anything is allocated for them
+    [[nodiscard]] bool canHold(u64 count, size_t elementSize)
+    {
+        valid = valid && count <= (data.size() - offset) / elementSize;
+        return valid;
+    }
+
+    [[nodiscard]] bool isValid() const
+    {
+        return valid;
+    }
+
+    [[nodiscard]] bool atEnd() const
+    {
+        return offset == data.size();
+    }
+};
+
+struct ReflectionCacheHeader {
+    static constexpr std::array<char, 4> MAGIC { 'L', 'R', 'C', 'H' };
+    static constexpr u32 VERSION { 1 };
+
+    std::array<char, 4> magic { MAGIC };
+    u32 version { VERSION };
+    u64 dataSize { 0 };
+    u64 dataHash { 0 };
+
+    [[nodiscard]] bool matches(ReflectionCacheHeader const& rhs) const
+    {
+        return magic == rhs.magic && version == rhs.version;
+    }
+};
+
+struct PipelineCacheHeader {
+    static constexpr std::array<char, 4> MAGIC { 'L', 'P', 'C', 'H' };
+    static constexpr u32 VERSION { 1 };
+
+    std::array<char, 4> magic { MAGIC };
+    u32 version { VERSION };
+    u32 vendorID { 0 };
+    u32 deviceID { 0 };
+    u32 driverVersion { 0 };
+    std::array<u8, VK_UUID_SIZE> pipelineCacheUUID {};
+    u64 dataSize { 0 };
+    u64 dataHash { 0 };
+
+    explicit PipelineCacheHeader(vk::PhysicalDeviceProperties const& p = {})
+        : vendorID(p.vendorID)
+        , deviceID(p.deviceID)
+        , driverVersion(p.driverVersion)
+    {
+        std::memcpy(pipelineCacheUUID.data(), p.pipelineCacheUUID.data(), VK_UUID_SIZE);
+    }
+
+    [[nodiscard]] bool matches(PipelineCacheHeader const& rhs) const
+    {
+        return magic == rhs.magic && version == rhs.version && vendorID == rhs.vendorID && deviceID == rhs.deviceID
+            && driverVersion == rhs.driverVersion && pipelineCacheUUID == rhs.pipelineCacheUUID;
+    }
+};
+
+void replaceFile(std::filesystem::path const& tmp, std::filesystem::path const& path)
+{
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+        log::error(std::format("Failed to write '{}': {}", path.generic_string(), ec.message()));
+}
+
+}
+
+void Shader::Update(vk::Device d, std::vector<u32> const& spv, ReflectionCache* reflectionCache)
+{
+    if (!reflectionCache)
+        layoutReflection = reflect(spv, stage);
+    else {
+        auto const key { ReflectionCache::Key(spv, stage) };
+        if (auto const* cached { reflectionCache->Find(key) })
+            layoutReflection = *cached;
+        else {
+            layoutReflection = reflect(spv, stage);
+            reflectionCache->Insert(key, layoutReflection);
+        }
+    }
+
+    vk::ShaderModuleCreateInfo cInfo {
+        .codeSize = spv.size() * sizeof(u32),
+        .pCode = spv.data()
+    };
+    module = check(d.createShaderModuleUnique(cInfo));
+    spvHash = hashBytes({ reinterpret_cast<u8 const*>(spv.data()), spv.size() * sizeof(u32) });
+    version++;
+}
+
 Shader::LayoutReflection Shader::reflect(std::vector<uint32_t> spv, vk::ShaderStageFlagBits shaderStage)
 {
     Shader::LayoutReflection result;
@@ -66,6 +219,204 @@ Shader::LayoutReflection Shader::reflect(std::vector<uint32_t> spv, vk::ShaderSt
     return result;
 }
 
+u64 ReflectionCache::Key(std::vector<u32> const& spv, vk::ShaderStageFlagBits stage)
+{
+    return berry::Fnv1a {}
+        .Add(std::to_underlying(stage))
+        .Add(std::span<u8 const> { reinterpret_cast<u8 const*>(spv.data()), spv.size() * sizeof(u32) })
+        .Get();
+}
+
+bool ReflectionCache::Load(std::filesystem::path const& path)
+{
+    std::ifstream file { path, std::ios::binary | std::ios::ate };
+    if (!file.is_open())
+        return false;
+
+    auto const discard = [&path, &file](std::string_view reason) {
+        log::info(std::format("Reflection cache '{}' {}, discarding it.", path.generic_string(), reason));
+        file.close();
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        return false;
+    };
+
+    auto const fileSize { static_cast<u64>(file.tellg()) };
+    file.seekg(0);
+    auto const header { read<ReflectionCacheHeader>(file) };
+    if (!file || !header.matches(ReflectionCacheHeader {}))
+        return discard("has an unknown format");
+    if (header.dataSize != fileSize - sizeof(ReflectionCacheHeader))
+        return discard("is truncated");
+
+    std::vector<u8> data(header.dataSize);
+    file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    if (!file || hashBytes(data) != header.dataHash)
+        return discard("is corrupted");
+
+    // sizes of the serialized entries
+    auto constexpr keySize { sizeof(u64) + 2 * sizeof(u32) };
+    auto constexpr bindingSize { 5 * sizeof(u32) };
+    auto constexpr pcRangeSize { 3 * sizeof(u32) };
+
+    std::unordered_map<u64, Shader::LayoutReflection> loaded;
+    PayloadReader payload { data };
+    auto const count { payload.read<u64>() };
+    for (u64 i { 0 }; i < count && payload.canHold(1, keySize); i++) {
+        auto const key { payload.read<u64>() };
+        auto& lr { loaded[key] };
+
+        if (auto const n { payload.read<u32>() }; payload.canHold(n, bindingSize))
+            lr.bindings.resize(n);
+        for (auto& [set, b] : lr.bindings) {
+            set = payload.read<u32>();
+            b.binding = payload.read<u32>();
+            b.descriptorType = static_cast<vk::DescriptorType>(payload.read<u32>());
+            b.descriptorCount = payload.read<u32>();
+            b.stageFlags = static_cast<vk::ShaderStageFlags>(payload.read<u32>());
+        }
+        if (auto const n { payload.read<u32>() }; payload.canHold(n, pcRangeSize))
+            lr.pcRanges.resize(n);
+        for (auto& pc : lr.pcRanges) {
+            pc.stageFlags = static_cast<vk::ShaderStageFlags>(payload.read<u32>());
+            pc.offset = payload.read<u32>();
+            pc.size = payload.read<u32>();
+        }
+    }
+    if (!payload.isValid() || !payload.atEnd() || loaded.size() != count)
+        return discard("is corrupted");
+
+    cache = std::move(loaded);
+    changed = false;
+    return true;
+}
+
+void ReflectionCache::Save(std::filesystem::path const& path)
+{
+    if (!changed)
+        return;
+
+    std::vector<u8> data;
+    append<u64>(data, cache.size());
+    for (auto const& [key, lr] : cache) {
+        append<u64>(data, key);
+        append<u32>(data, static_cast<u32>(lr.bindings.size()));
+        for (auto const& [set, b] : lr.bindings) {
+            append<u32>(data, set);
+            append<u32>(data, b.binding);
+            append<u32>(data, std::to_underlying(b.descriptorType));
+            append<u32>(data, static_cast<u32>(b.descriptorCount));
+            append<u32>(data, static_cast<VkShaderStageFlags>(b.stageFlags));
+        }
+        append<u32>(data, static_cast<u32>(lr.pcRanges.size()));
+        for (auto const& pc : lr.pcRanges) {
+            append<u32>(data, static_cast<VkShaderStageFlags>(pc.stageFlags));
+            append<u32>(data, pc.offset);
+            append<u32>(data, pc.size);
+        }
+    }
+
+    ReflectionCacheHeader header;
+    header.dataSize = data.size();
+    header.dataHash = hashBytes(data);
+
+    auto tmp { path };
+    tmp += ".tmp";
+    {
+        std::ofstream file { tmp, std::ios::binary | std::ios::trunc };
+        if (!file.is_open()) {
+            log::error(std::format("Failed to open '{}' for writing.", tmp.generic_string()));
+            return;
+        }
+        write(file, header);
+        file.write(reinterpret_cast<char const*>(data.data()), static_cast<std::streamsize>(data.size()));
+    }
+    replaceFile(tmp, path);
+    changed = false;
+}
+
+ShaderCache::~ShaderCache()
+{
+    SavePersistentCache();
+}
+
+std::filesystem::path ShaderCache::pipelineCachePath() const
+{
+    std::string uuid;
+    for (auto const byte : pdProperties.pipelineCacheUUID)
+        uuid += std::format("{:02x}", byte);
+    return persistentCacheDir / std::format("pipeline_{}_{:08x}.bin", uuid, pdProperties.driverVersion);
+}
+
+void ShaderCache::EnablePersistentCache(vk::PhysicalDevice pd, std::filesystem::path const& dir)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec) {
+        log::error(std::format("Failed to create cache directory '{}': {}", dir.generic_string(), ec.message()));
+        return;
+    }
+    persistentCacheDir = dir;
+    pdProperties = pd.getProperties();
+
+    reflectionCache.Load(persistentCacheDir / "reflection.bin");
+
+    auto const path { pipelineCachePath() };
+    std::ifstream file { path, std::ios::binary | std::ios::ate };
+    if (!file.is_open())
+        return;
+
+    auto const fileSize { static_cast<u64>(file.tellg()) };
+    file.seekg(0);
+    PipelineCacheHeader const expected { pdProperties };
+    auto const header { read<PipelineCacheHeader>(file) };
+    if (!file || !header.matches(expected)) {
+        log::info(std::format("Pipeline cache '{}' does not match the device, ignoring it.", path.generic_string()));
+        return;
+    }
+    if (header.dataSize != fileSize - sizeof(PipelineCacheHeader)) {
+        log::error(std::format("Pipeline cache '{}' is truncated, ignoring it.", path.generic_string()));
+        return;
+    }
+
+    std::vector<u8> data(header.dataSize);
+    file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    if (!file || hashBytes(data) != header.dataHash) {
+        log::error(std::format("Pipeline cache '{}' is corrupted, ignoring it.", path.generic_string()));
+        return;
+    }
+
+    pCache = createPipelineCache(data);
+    log::debug(std::format("Loaded pipeline cache '{}' ({} B).", path.generic_string(), data.size()));
+}
+
+void ShaderCache::SavePersistentCache()
+{
+    if (persistentCacheDir.empty())
+        return;
+
+    reflectionCache.Save(persistentCacheDir / "reflection.bin");
+
+    auto const data { check(d.getPipelineCacheData(pCache.get())) };
+    PipelineCacheHeader header { pdProperties };
+    header.dataSize = data.size();
+    header.dataHash = hashBytes(data);
+
+    auto const path { pipelineCachePath() };
+    auto tmp { path };
+    tmp += ".tmp";
+    {
+        std::ofstream file { tmp, std::ios::binary | std::ios::trunc };
+        if (!file.is_open()) {
+            log::error(std::format("Failed to open '{}' for writing.", tmp.generic_string()));
+            return;
+        }
+        write(file, header);
+        file.write(reinterpret_cast<char const*>(data.data()), static_cast<std::streamsize>(data.size()));
+    }
+    replaceFile(tmp, path);
+}
+
 vk::ShaderStageFlagBits ShaderCache::stageFlagFromFileName(std::string_view name)
 {
     if (name.find(".vert") != std::string_view::npos)
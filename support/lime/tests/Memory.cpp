@@ -3,6 +3,9 @@
 #include <vLime/Memory.h>
 #include <vLime/Transfer.h>
 
+#include <atomic>
+#include <thread>
+
 TEST_CASE("First fit allocator basic usage", "[allocator]")
 {
     lime::memory::FirstFit allocator { 1024 };
@@ -360,6 +363,85 @@ TEST_CASE("First fit allocator, custom granularity, re-allocation", "[allocator]
     }
 }
 
+TEST_CASE("Suballocator addresses", "[allocator]")
+{
+    lime::memory::Suballocator allocator { 4096, 1024 };
+
+    auto const chunk1 { allocator.alloc(100, 64).value() };
+    auto const chunk2 { allocator.alloc(100, 64).value() };
+    REQUIRE(chunk1.address == 4096);
+    REQUIRE(chunk2.address == 4096 + 128);
+
+    allocator.free(chunk1.address);
+    allocator.free(chunk2.address);
+    allocator.coalesce();
+    REQUIRE(allocator.canHold(1024));
+}
+
+TEST_CASE("Linear allocator, alloc and rewind", "[allocator]")
+{
+    lime::LinearAllocator allocator { lime::Buffer::Detail { .size = 1024 } };
+
+    SECTION("aligned allocation")
+    {
+        auto const b0 { allocator.alloc(100, 64) };
+        auto const b1 { allocator.alloc(100, 64) };
+        REQUIRE(b0.offset == 0);
+        REQUIRE(b0.size == 100);
+        REQUIRE(b1.offset == 128);
+        REQUIRE(allocator.freeAddress == 228);
+    }
+
+    SECTION("exhaustion leaves the allocator unchanged")
+    {
+        auto const b0 { allocator.alloc(1000, 64) };
+        REQUIRE(b0.size == 1000);
+
+        auto const b1 { allocator.alloc(100, 64) };
+        REQUIRE(b1.size == 0);
+        REQUIRE(allocator.freeAddress == 1000);
+
+        auto const b2 { allocator.alloc(24) };
+        REQUIRE(b2.offset == 1000);
+        REQUIRE(allocator.freeAddress == 1024);
+    }
+
+    SECTION("reset rewinds to the start of the block")
+    {
+        allocator.alloc(512);
+        allocator.alloc(512);
+        REQUIRE(allocator.alloc(1).size == 0);
+
+        allocator.reset();
+        REQUIRE(allocator.freeAddress == 0);
+        auto const b { allocator.alloc(1024) };
+        REQUIRE(b.offset == 0);
+        REQUIRE(b.size == 1024);
+    }
+}
+
+TEST_CASE("Synchronized allocator, concurrent alloc and free", "[allocator]")
+{
+    auto constexpr threadCount { 8u };
+    auto constexpr allocCount { 64u };
+    lime::memory::Synchronized<lime::memory::FirstFit> allocator { threadCount * allocCount * 64 };
+
+    std::vector<std::thread> threads;
+    for (u32 t { 0 }; t < threadCount; t++)
+        threads.emplace_back([&allocator] {
+            std::vector<vk::DeviceSize> addresses;
+            for (u32 i { 0 }; i < allocCount; i++)
+                addresses.push_back(allocator.alloc(64, 64).value().address);
+            for (auto const address : addresses)
+                allocator.free(address);
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    allocator.coalesce();
+    REQUIRE(allocator.canHold(threadCount * allocCount * 64));
+}
+
 TEST_CASE("Basic global memory allocator opreations")
 {
     lime::LoadVulkan();
@@ -397,6 +479,28 @@ TEST_CASE("Basic global memory allocator opreations")
         REQUIRE(memory.empty());
     }
 
+    SECTION("concurrent buffer alloc and free")
+    {
+        std::atomic<u32> validCount { 0 };
+        std::vector<std::thread> threads;
+        for (u32 t { 0 }; t < 4; t++)
+            threads.emplace_back([&memory, &validCount] {
+                std::vector<lime::Buffer> buffers;
+                for (u32 i { 0 }; i < 32; i++)
+                    buffers.emplace_back(memory.alloc({ .memoryUsage = lime::DeviceMemoryUsage::eHostToDevice }, { .size = 1024 * (i + 1), .usage = vk::BufferUsageFlagBits::eStorageBuffer }));
+                for (auto const& b : buffers)
+                    if (b.isValid())
+                        validCount++;
+            });
+        for (auto& thread : threads)
+            thread.join();
+        REQUIRE(validCount == 4 * 32);
+
+        REQUIRE_FALSE(memory.empty());
+        memory.cleanUp();
+        REQUIRE(memory.empty());
+    }
+
     SECTION("host memory buffer data")
     {
         buffer = memory.alloc({ .memoryUsage = lime::DeviceMemoryUsage::eHostToDevice }, { .size = sizeof(i32), .usage = vk::BufferUsageFlagBits::eStorageBuffer });